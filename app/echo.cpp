@@ -24,7 +24,10 @@
 #include <cstdio>
 #include <cstdlib>
 
-#include "driver/mpipe.hpp"     // mpipe_t
+#include <netinet/in.h>         // in_addr_t, INADDR_LOOPBACK
+
+#include "driver/platform.hpp"  // platform_driver_t
+#include "driver/stats_server.hpp" // stats_server_t
 #include "util/macros.hpp"      // RUSTY_DEBUG, COLOR_GRN
 
 using namespace std;
@@ -36,11 +39,23 @@ using namespace rusty::net;
 #define ECHO_DEBUG(MSG, ...)                                                   \
     RUSTY_DEBUG("ECHO", ECHO_COLOR, MSG, ##__VA_ARGS__)
 
+// The mPIPE driver on the TILE-Gx, the host driver on other architectures.
+typedef platform_driver_t driver_t;
+
+// Address (in host byte order) and UDP port on which the counters of the
+// network stack are exported (see 'stats_server_t'). The server only answers
+// local requests by default.
+static const in_addr_t STATS_UDP_ADDR = INADDR_LOOPBACK;
+static const uint16_t STATS_UDP_PORT = 9090;
+
+// Directory in which the stats server writes the trace dumps.
+static const char *const TRACE_DUMP_DIR = "/tmp";
+
 // Parsed CLI arguments.
 struct args_t {
     char                    *link_name;
     net_t<ipv4_addr_t>      ipv4_addr;
-    mpipe_t::tcp_t::port_t  tcp_port;
+    driver_t::tcp_t::port_t tcp_port;
     size_t                  n_workers;
 };
 
@@ -60,30 +75,31 @@ int main(int argc, char **argv)
     if (!_parse_args(argc, argv, &args))
         return EXIT_FAILURE;
 
-    mpipe_t mpipe(args.link_name, args.ipv4_addr, args.n_workers);
+    driver_t driver(args.link_name, args.ipv4_addr, args.n_workers);
 
     ECHO_DEBUG(
         "Starts the echo server on interface %s (%s) with %s as IPv4 address "
         "on port %d",
-        args.link_name, mpipe_t::ethernet_t::addr_t::to_alpha(mpipe.ether_addr),
-        mpipe_t::ipv4_t::addr_t::to_alpha(args.ipv4_addr), args.tcp_port
+        args.link_name,
+        driver_t::ethernet_t::addr_t::to_alpha(driver.ether_addr),
+        driver_t::ipv4_t::addr_t::to_alpha(args.ipv4_addr), args.tcp_port
     );
 
-    mpipe.tcp_listen(
+    driver.tcp_listen(
         // On new connection handler.
         args.tcp_port,
-        [](mpipe_t::tcp_t::conn_t conn)
+        [](driver_t::tcp_t::conn_t conn)
         {
             ECHO_DEBUG(
                 "New connection from %s:%" PRIu16 " on port %" PRIu16,
-                mpipe_t::ipv4_t::addr_t::to_alpha(conn.tcb_id.raddr),
+                driver_t::ipv4_t::addr_t::to_alpha(conn.tcb_id.raddr),
                 conn.tcb_id.rport.host(), conn.tcb_id.lport.host()
             );
 
-            mpipe_t::tcp_t::conn_handlers_t handlers;
+            driver_t::tcp_t::conn_handlers_t handlers;
 
             handlers.new_data =
-                [conn](mpipe_t::cursor_t in) mutable
+                [conn](driver_t::cursor_t in) mutable
                 {
                     size_t size = in.size();
 
@@ -97,20 +113,34 @@ int main(int argc, char **argv)
                         }, size
                     );
 
-                    conn.send(
-                        size,
-                        [in](size_t offset, mpipe_t::cursor_t out)
+                    // Sums the data while copying it into the transmission
+                    // buffers.
+                    driver_t::tcp_t::writer_sum_t writer =
+                        [in](size_t offset, driver_t::cursor_t out)
                         {
+                            partial_sum_t partial_sum = partial_sum_t::ZERO;
+
                             in.drop(offset)
                               .take(out.size())
                               .for_each(
-                                [&out](const char * buffer, size_t buffer_size)
+                                [&out, &partial_sum]
+                                (const char * buffer, size_t buffer_size)
                                 {
-                                    out = out.write(buffer, buffer_size);
+                                    partial_sum_t buffer_sum;
+                                    out = out.write_and_sum(
+                                        buffer, buffer_size, &buffer_sum
+                                    );
+                                    partial_sum = partial_sum.append(
+                                        buffer_sum
+                                    );
                                 }
                             );
-                        },
 
+                            return partial_sum;
+                        };
+
+                    conn.send(
+                        size, writer,
                         _do_nothing // Does nothing on acknowledgment
                     );
                 };
@@ -131,10 +161,14 @@ int main(int argc, char **argv)
     );
 
     // Runs the application.
-    mpipe.run();
+    driver.run();
+
+    stats_server_t stats_server(
+        { &driver }, STATS_UDP_ADDR, STATS_UDP_PORT, TRACE_DUMP_DIR
+    );
 
     // Wait for the instance to finish (will not happen).
-    mpipe.join();
+    driver.join();
 
     return EXIT_SUCCESS;
 }
@@ -1,5 +1,6 @@
 //
-// Very simple HTTP server. Preload files from the given directory.
+// Very simple HTTP server. Serves the files of the given directory and of its
+// sub-directories. Reloads the directory on SIGHUP.
 //
 // Usage: ./app/httpd <link> <ipv4> <TCP port> <root dir> <n workers>
 //
@@ -20,24 +21,35 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 //
 
-#include <algorithm>            // min()
+#include <algorithm>            // max(), min()
+#include <atomic>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
-#include <unordered_map>
+#include <memory>               // make_shared(), shared_ptr
+#include <string>
 #include <vector>
 
-#include <alloca.h>             // alloca()
 #include <dirent.h>             // struct dirent, opendir(), readdir()
-#include <sys/stat.h>           // struct stat, stat()
+#include <fcntl.h>              // open()
+#include <netinet/in.h>         // in_addr_t, INADDR_LOOPBACK
+#include <pthread.h>            // pthread_create()
+#include <signal.h>             // pthread_sigmask(), sigwait()
+#include <strings.h>            // strncasecmp()
+#include <sys/mman.h>           // mmap(), munmap()
+#include <sys/stat.h>           // struct stat, stat(), lstat()
+#include <unistd.h>             // close(), usleep()
 
 #include <tmc/mem.h>            // tmc_mem_prefetch()
 
 #include "driver/cpu.hpp"
 #include "driver/mpipe.hpp"
+#include "driver/stats_server.hpp" // stats_server_t
 #include "net/checksum.hpp"     // partial_sum_t, precomputed_sums_t
 #include "net/endian.hpp"       // net_t
 #include "util/macros.hpp"      // LIKELY(), UNLIKELY, RUSTY_*
+#include "util/mpsc_ring.hpp"   // mpsc_ring_t
 
 using namespace std;
 
@@ -61,6 +73,15 @@ static vector<mpipe_t::arp_ipv4_t::static_entry_t> static_arp_entries {
     _static_arp_entry("10.0.5.1", "90:e2:ba:46:f2:e1")
 };
 
+// Address (in host byte order) and UDP port on which the counters of the
+// network stack are exported (see 'stats_server_t'). The server only answers
+// local requests by default.
+static const in_addr_t STATS_UDP_ADDR = INADDR_LOOPBACK;
+static const uint16_t STATS_UDP_PORT = 9090;
+
+// Directory in which the stats server writes the trace dumps.
+static const char *const TRACE_DUMP_DIR = "/tmp";
+
 #define HTTPD_COLOR     COLOR_GRN
 #define HTTPD_DEBUG(MSG, ...)                                                  \
     RUSTY_DEBUG("HTTPD", HTTPD_COLOR, MSG, ##__VA_ARGS__)
@@ -82,53 +103,268 @@ struct args_t {
     vector<interface_t>             interfaces;
 };
 
-// Type used to index file by their filename. Different from 'std::string', so
-// we can initialize it without having to reallocate and copy the string.
-struct filename_t {
-    const char                      *value;
+// Served file.
+//
+// The HTTP header of the 200 OK response is formatted when the file is loaded.
+// The content follows the header in the response.
+struct file_t {
+    const char                      *header;
+    size_t                          header_len;
+
+    const char                      *content;
+    size_t                          content_len;
+
+    #ifdef USE_PRECOMPUTED_CHECKSUMS
+        // Where the precomputed checksums of the content are saved, and the
+        // version of the file they are computed for (see '_file_version()').
+        const char                      *sums_path;
+        uint64_t                        version;
+
+        // Precomputed checksums of the content. 'nullptr' until they have been
+        // loaded or computed by the checksums thread (see '_file_sums()'), in
+        // which case segments are summed when they are sent.
+        mutable atomic<const precomputed_sums_t *>  sums { nullptr };
+
+        // Set once the checksums have been requested to the checksums thread.
+        mutable atomic<bool>            sums_requested { false };
+
+        // The checksums are released with the store, once no connection
+        // references the file anymore.
+        ~file_t(void)
+        {
+            delete sums.load(memory_order_acquire);
+        }
+    #endif /* USE_PRECOMPUTED_CHECKSUMS */
 };
 
-namespace std {
+// Served files, indexed by their paths relative to the root directory.
+//
+// Open addressing hash table with linear probing, kept at most half full.
+// Lookups directly hash the path in the received request, and only compare
+// the names of the entries with the same hash.
+//
+// The number of files is fixed when the table is created, as files are not
+// movable.
+struct files_t {
+    struct entry_t {
+        uint64_t                    hash;
+
+        // 'nullptr' if the entry is free.
+        const char                  *name;
+        size_t                      name_len;
+
+        // Index of the file in 'files'.
+        size_t                      file;
+    };
+
+    vector<file_t>                  files;
+
+    // Number of files which have been inserted.
+    size_t                          n_files;
 
-// 'std::hash<>' and 'std::equal_to<>' instances are required to index
-// files by their filenames.
+    // The number of entries is a power of two.
+    vector<entry_t>                 entries;
 
-template <>
-struct hash<filename_t> {
-    inline size_t operator()(filename_t filename) const
+    // Creates a table which can hold 'capacity' files.
+    files_t(size_t capacity) : files(capacity), n_files(0)
     {
-        const char *str = filename.value;
+        _resize(max((size_t) 16, _next_pow2(2 * capacity)));
+    }
+
+    // Indexes a new file with the given name, and returns the file so that
+    // the caller can initialize it.
+    file_t *insert(const char *name, size_t name_len)
+    {
+        assert(n_files < files.size());
+
+        _insert({ _hash(name, name_len), name, name_len, n_files });
+        return &files[n_files++];
+    }
+
+    // Returns the file with the given name, or 'nullptr' if there is no such
+    // file.
+    inline const file_t *find(const char *name, size_t name_len) const
+    {
+        if (UNLIKELY(entries.empty()))
+            return nullptr;
+
+        uint64_t hash   = _hash(name, name_len);
+        size_t   mask   = entries.size() - 1;
 
-        size_t sum = 0;
-        while (*str != '\0') {
-            sum += hash<char>()(*str);
-            str++;
+        for (size_t i = hash & mask;; i = (i + 1) & mask) {
+            const entry_t &entry = entries[i];
+
+            if (entry.name == nullptr)
+                return nullptr;
+
+            if (
+                   entry.hash == hash && entry.name_len == name_len
+                && memcmp(entry.name, name, name_len) == 0
+            )
+                return &files[entry.file];
         }
+    }
+
+    inline size_t size(void) const
+    {
+        return n_files;
+    }
 
-        return sum;
+private:
+
+    static size_t _next_pow2(size_t n)
+    {
+        size_t pow2 = 1;
+        while (pow2 < n)
+            pow2 *= 2;
+        return pow2;
+    }
+
+    // FNV-1a, followed by the finalizer of MurmurHash3 so that the low bits
+    // which index the table depend on every byte of the name.
+    static inline uint64_t _hash(const char *name, size_t name_len)
+    {
+        uint64_t h = 0xCBF29CE484222325ULL;
+
+        for (size_t i = 0; i < name_len; i++) {
+            h ^= (uint8_t) name[i];
+            h *= 0x100000001B3ULL;
+        }
+
+        h ^= h >> 33;
+        h *= 0xFF51AFD7ED558CCDULL;
+        h ^= h >> 33;
+        h *= 0xC4CEB9FE1A85EC53ULL;
+        h ^= h >> 33;
+
+        return h;
+    }
+
+    void _insert(entry_t new_entry)
+    {
+        size_t mask = entries.size() - 1;
+
+        for (size_t i = new_entry.hash & mask;; i = (i + 1) & mask) {
+            if (entries[i].name == nullptr) {
+                entries[i] = new_entry;
+                return;
+            }
+        }
+    }
+
+    void _resize(size_t n_entries)
+    {
+        vector<entry_t> old_entries(n_entries, { 0, nullptr, 0, 0 });
+        entries.swap(old_entries);
+
+        for (const entry_t &entry : old_entries) {
+            if (entry.name != nullptr)
+                _insert(entry);
+        }
     }
 };
 
-template <>
-struct equal_to<filename_t> {
-    inline bool operator()(filename_t a, filename_t b) const
+// Served files and the memory which holds them.
+//
+// The store is replaced as a whole when the root directory is reloaded. Each
+// connection holds a reference to the store which was current when it was
+// opened, so that its queued responses remain valid until it is closed.
+struct store_t {
+    files_t                         files;
+
+    // Names and formatted headers of the files. Never resized once filled, so
+    // that the files can reference their characters.
+    vector<string>                  strings;
+
+    // Memory mappings of the file contents, unmapped with the store.
+    vector<pair<void *, size_t>>    mappings;
+
+    store_t(size_t n_files) : files(n_files)
+    {
+        // A name, a header and a sums path for each file.
+        strings.reserve(3 * n_files);
+    }
+
+    store_t(const store_t &other) = delete;
+
+    ~store_t(void)
+    {
+        for (const pair<void *, size_t> &mapping : mappings)
+            munmap(mapping.first, mapping.second);
+    }
+
+    // Copies the string into the store, and returns the copy.
+    const char *save_string(string str)
     {
-        return strcmp(a.value, b.value) == 0;
+        assert(strings.size() < strings.capacity());
+
+        strings.push_back(move(str));
+        return strings.back().c_str();
     }
 };
 
-} /* namespace std */
+// Store used by the worker which executes the current thread.
+//
+// Set by '_publish_store()', through the message queue of each worker.
+static thread_local shared_ptr<const store_t> worker_store;
+
+#ifdef USE_PRECOMPUTED_CHECKSUMS
+    // File whose checksums must be loaded or computed. Holds its store, which
+    // could otherwise be released by a reload before the request is handled.
+    struct sums_request_t {
+        shared_ptr<const store_t>       store;
+        const file_t                    *file;
+    };
 
-// Served file and its content.
-struct file_t {
-    const char                      *content;
-    size_t                          content_len;
+    // Requests sent by the workers to the checksums thread. A file is only
+    // requested once, unless the queue is full.
+    static const size_t SUMS_REQUESTS_SIZE = 1024;
 
-    #ifdef USE_PRECOMPUTED_CHECKSUMS
-        precomputed_sums_t              precomputed_sums;
-    #endif /* USE_PRECOMPUTED_CHECKSUMS */
+    static rusty::util::mpsc_ring_t<sums_request_t, SUMS_REQUESTS_SIZE>
+        sums_requests;
+
+    // Delay during which the checksums thread sleeps when there is no request,
+    // in microseconds.
+    static const useconds_t SUMS_POLL_DELAY = 1000;
+#endif /* USE_PRECOMPUTED_CHECKSUMS */
+
+// State of an HTTP connection, shared by its event handlers.
+struct http_conn_t {
+    // Store which was current when the connection was opened.
+    shared_ptr<const store_t>       store;
+
+    // Beginning of a request which has not been entirely received yet.
+    string                          pending;
+
+    // 'true' once the server closed the connection. Following requests, if
+    // any, are ignored.
+    bool                            closed = false;
 };
 
+// Requests with a larger header are rejected.
+static constexpr size_t MAX_REQUEST_SIZE = 8192;
+
+// Header of the 200 OK responses. Formatted with the size of the file.
+static const char HEADER_200[] = "HTTP/1.1 200 OK\r\n"
+                                 "Content-Type: text/html\r\n"
+                                 "Content-Length: %zu\r\n"
+                                 "\r\n";
+
+#ifdef USE_PRECOMPUTED_CHECKSUMS
+    // The precomputed checksums of a file are saved next to it, in a file with
+    // the same name followed by this suffix. They are not served.
+    static const char SUMS_SUFFIX[] = ".sums";
+#endif /* USE_PRECOMPUTED_CHECKSUMS */
+
+#ifdef MPIPE_ZERO_COPY
+    // Static memory which holds the content of every loaded file, so that
+    // file contents are transmitted without being copied.
+    //
+    // As static memory can't be registered while the workers are running, the
+    // directory can't be reloaded in this mode.
+    static mpipe_t::static_mem_t files_mem;
+#endif /* MPIPE_ZERO_COPY */
+
 static void _print_usage(char **argv);
 
 // Parses CLI arguments.
@@ -136,22 +372,102 @@ static void _print_usage(char **argv);
 // Fails on a malformed command.
 static bool _parse_args(int argc, char **argv, args_t *args);
 
-// Loads all the file contents from the directory in the hash-table.
-static void _preload_files(
-    unordered_map<filename_t, file_t> *files, const char *dir
+// File found in the root directory, which will be loaded in the store.
+struct to_load_t {
+    // Path relative to the root directory.
+    string      name;
+    size_t      size;
+
+    // Identifies the version of the file which has been listed (see
+    // '_file_version()').
+    uint64_t    version;
+};
+
+// Creates a store with the files of the directory and of its sub-directories.
+//
+// Without zero-copy, file contents are memory-mapped and only read when they
+// are first served. Loading a directory is thus proportional to the number of
+// files, not to their size. Precomputed checksums are loaded or computed once
+// files are first served (see '_file_sums()').
+static shared_ptr<const store_t> _load_store(const char *root_dir);
+
+// Appends the files of the 'rel_dir' sub-directory of 'root_dir' (the root
+// directory itself if 'rel_dir' is empty) and of its sub-directories.
+//
+// Symbolic links to directories are not followed, so that a cycle can't be
+// walked forever.
+static void _list_files(
+    const string &root_dir, const string &rel_dir, vector<to_load_t> *to_load
+);
+
+// Replaces the store of every worker of the mPIPE instances.
+static void _publish_store(
+    vector<mpipe_t> *instances, shared_ptr<const store_t> store
 );
 
+#ifdef USE_PRECOMPUTED_CHECKSUMS
+    // Returns 'true' if 'str' ends with 'suffix'.
+    static bool _has_suffix(const char *str, const char *suffix);
+
+    // Returns the precomputed checksums of the file, or 'nullptr' if they are
+    // not available yet.
+    //
+    // The first call requests them to the checksums thread, so that workers
+    // never load nor compute them.
+    static const precomputed_sums_t *_file_sums(
+        const shared_ptr<const store_t> &store, const file_t *file
+    );
+
+    // Loads or computes the checksums requested by the workers, and publishes
+    // them in their files (never returns).
+    static void *_sums_thread_runner(void *);
+#endif /* USE_PRECOMPUTED_CHECKSUMS */
+
+// Hashes the modification time (with its nanoseconds), the inode and the
+// device of a file, so that the saved checksums of a file are not reused once
+// it is rewritten or replaced, even within the same second.
+static uint64_t _file_version(const struct stat &stat_buffer);
+
 // Used to define empty event handlers.
 static void _do_nothing(void);
 
-// Interprets an HTTP request and serves the requested content.
+// Interprets the HTTP requests in the received data and serves the requested
+// contents.
+//
+// Requests can be split over several calls, and several requests can be
+// received at once (pipelining). Responses are sent in the order of the
+// requests.
 static void _on_received_data(
-    unordered_map<filename_t, file_t> *files, mpipe_t::tcp_t::conn_t conn,
-    mpipe_t::cursor_t in
+    mpipe_t::tcp_t::conn_t conn, http_conn_t *http_conn, mpipe_t::cursor_t in
+);
+
+// Serves the complete requests at the beginning of the buffer.
+//
+// Returns the number of bytes of the served requests. Stops on the first
+// incomplete request or once the connection has been closed.
+//
+// Connections are closed after their current response once their store has
+// been replaced, so that clients reconnect to get the new files.
+static size_t _handle_requests(
+    mpipe_t::tcp_t::conn_t conn, http_conn_t *http_conn, const char *buffer,
+    size_t size
 );
 
-// Responds to the client with a 200 OK HTTP response containing the given file.
-void _respond_with_200(mpipe_t::tcp_t::conn_t conn, const file_t *file);
+// Returns the first byte after the empty line which ends the HTTP header
+// starting at 'begin', or 'nullptr' if the header is not complete.
+static const char *_find_header_end(const char *begin, const char *end);
+
+// Responds with a 400 Bad Request HTTP response and closes the connection.
+static void _bad_request(
+    mpipe_t::tcp_t::conn_t conn, http_conn_t *http_conn, const char *why
+);
+
+// Responds to the client with a 200 OK HTTP response containing the given file
+// of the store.
+void _respond_with_200(
+    mpipe_t::tcp_t::conn_t conn, const shared_ptr<const store_t> &store,
+    const file_t *file
+);
 
 // Responds to the client with a 400 Bad Request HTTP response.
 void _respond_with_400(mpipe_t::tcp_t::conn_t conn);
@@ -165,15 +481,31 @@ int main(int argc, char **argv)
     if (!_parse_args(argc, argv, &args))
         return EXIT_FAILURE;
 
-    unordered_map<filename_t, file_t> files { };
-    _preload_files(&files, args.root_dir);
+    // SIGHUP is handled by the main thread (see below). Blocks it before
+    // starting the workers, which inherit the signal mask.
+    sigset_t reload_signals;
+    sigemptyset(&reload_signals);
+    sigaddset(&reload_signals, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &reload_signals, nullptr);
+
+    shared_ptr<const store_t> store = _load_store(args.root_dir);
+
+    #ifdef USE_PRECOMPUTED_CHECKSUMS
+        // Loads or computes the checksums of the files once they are first
+        // served, off the workers.
+        pthread_t sums_thread;
+        int result = pthread_create(
+            &sums_thread, nullptr, _sums_thread_runner, nullptr
+        );
+        VERIFY_PTHREAD(result, "pthread_create()");
+    #endif /* USE_PRECOMPUTED_CHECKSUMS */
 
     //
     // Handler executed on new connections.
     //
 
     auto on_new_connection =
-        [&files](mpipe_t::tcp_t::conn_t conn)
+        [](mpipe_t::tcp_t::conn_t conn)
         {
             HTTPD_DEBUG(
                 "New connection from %s:%" PRIu16 " on port %" PRIu16,
@@ -183,11 +515,17 @@ int main(int argc, char **argv)
 
             mpipe_t::tcp_t::conn_handlers_t handlers;
 
+            // Released with the handlers, once the connection is closed.
+            shared_ptr<http_conn_t> http_conn = make_shared<http_conn_t>();
+
+            assert(worker_store != nullptr);
+            http_conn->store = worker_store;
+
             handlers.new_data =
-                [&files, conn](mpipe_t::cursor_t in) mutable
+                [conn, http_conn](mpipe_t::cursor_t in) mutable
                 {
                     if (conn.can_send())
-                        _on_received_data(&files, conn, in);
+                        _on_received_data(conn, http_conn.get(), in);
                 };
 
             handlers.remote_close =
@@ -220,6 +558,10 @@ int main(int argc, char **argv)
 
         mpipe_t &mpipe = instances.back();
 
+        #ifdef MPIPE_ZERO_COPY
+            mpipe.register_static_mem(files_mem);
+        #endif /* MPIPE_ZERO_COPY */
+
         HTTPD_DEBUG(
             "Starts the HTTP server on interface %s (%s) with %s as IPv4 "
             "address on port %d serving %s",
@@ -229,18 +571,45 @@ int main(int argc, char **argv)
             args.tcp_port, args.root_dir
         );
 
-        mpipe.tcp_listen(args.tcp_port, on_new_connection);
-
         mpipe.run();
 
         first_dataplane_cpu += interface.n_workers;
     }
 
+    // Messages are executed in order by each worker. Workers thus get their
+    // store before accepting any connection.
+    _publish_store(&instances, store);
+
+    for (mpipe_t &mpipe : instances)
+        mpipe.tcp_listen(args.tcp_port, on_new_connection);
+
+    vector<const mpipe_t *> stats_instances;
+    for (const mpipe_t &mpipe : instances)
+        stats_instances.push_back(&mpipe);
+
+    stats_server_t stats_server(
+        stats_instances, STATS_UDP_ADDR, STATS_UDP_PORT, TRACE_DUMP_DIR
+    );
+
     printf("HTTPD started\n");
 
-    // Wait for all instances to finish (will not happen).
-    for (mpipe_t &mpipe_instance : instances)
-        mpipe_instance.join();
+    // Reloads the root directory on SIGHUP (will never return).
+    for (;;) {
+        int sig;
+        if (sigwait(&reload_signals, &sig) != 0)
+            HTTPD_DIE("sigwait()");
+
+        #ifdef MPIPE_ZERO_COPY
+            HTTPD_ERROR("The directory can't be reloaded with zero-copy");
+        #else
+            HTTPD_DEBUG("Reloads %s", args.root_dir);
+
+            // The previous store is released once the last connection which
+            // references it is closed.
+            store = _load_store(args.root_dir);
+            _publish_store(&instances, store);
+        #endif /* MPIPE_ZERO_COPY */
+    }
 
     return EXIT_SUCCESS;
 }
@@ -313,68 +682,248 @@ static bool _parse_args(int argc, char **argv, args_t *args)
     return true;
 }
 
-static void _preload_files(
-    unordered_map<filename_t, file_t> *files, const char *root_dir
+static shared_ptr<const store_t> _load_store(const char *root_dir)
+{
+    // Lists the files first, so their number and their total size are known.
+
+    vector<to_load_t> to_load;
+    _list_files(root_dir, "", &to_load);
+
+    shared_ptr<store_t> store = make_shared<store_t>(to_load.size());
+
+    #ifdef MPIPE_ZERO_COPY
+        // Contents are copied in the static memory. They are followed by a
+        // '\0'.
+
+        size_t total_size = 0;
+        for (const to_load_t &file_info : to_load)
+            total_size += file_info.size + 1;
+
+        files_mem = mpipe_t::alloc_static_mem(total_size);
+        char *next_content = files_mem.mem;
+    #endif /* MPIPE_ZERO_COPY */
+
+    for (const to_load_t &file_info : to_load) {
+        string filepath = string(root_dir) + '/' + file_info.name;
+
+        int fd = open(filepath.c_str(), O_RDONLY);
+        if (fd < 0)
+            HTTPD_DIE("Unable to open a file (%s)", filepath.c_str());
+
+        size_t content_size = file_info.size;
+
+        #ifdef MPIPE_ZERO_COPY
+            char *content = next_content;
+            next_content += content_size + 1;
+
+            for (size_t read_size = 0; read_size < content_size;) {
+                ssize_t n = read(
+                    fd, content + read_size, content_size - read_size
+                );
+
+                if (n <= 0)
+                    HTTPD_DIE("Unable to read a file (%s)", filepath.c_str());
+
+                read_size += n;
+            }
+
+            content[content_size] = '\0';
+        #else
+            // Maps the file instead of reading it, so that pages are only
+            // loaded once served. The file must not be truncated while it is
+            // mapped.
+            const char *content = "";
+
+            if (content_size > 0) {
+                void *mem = mmap(
+                    nullptr, content_size, PROT_READ, MAP_PRIVATE, fd, 0
+                );
+
+                if (mem == MAP_FAILED)
+                    HTTPD_DIE("Unable to map a file (%s)", filepath.c_str());
+
+                store->mappings.emplace_back(mem, content_size);
+                content = (const char *) mem;
+            }
+        #endif /* MPIPE_ZERO_COPY */
+
+        close(fd);
+
+        // Formats the header.
+
+        size_t header_len = snprintf(nullptr, 0, HEADER_200, content_size);
+        string header(header_len + 1, '\0');
+        snprintf(&header[0], header_len + 1, HEADER_200, content_size);
+        header.resize(header_len);
+
+        const char *name = store->save_string(file_info.name);
+
+        file_t *file = store->files.insert(name, file_info.name.size());
+
+        file->header        = store->save_string(move(header));
+        file->header_len    = header_len;
+        file->content       = content;
+        file->content_len   = content_size;
+
+        #ifdef USE_PRECOMPUTED_CHECKSUMS
+            // The checksums saved during a previous run are mapped when the
+            // file is first served, if the file didn't change.
+            file->sums_path = store->save_string(filepath + SUMS_SUFFIX);
+            file->version   = file_info.version;
+        #endif /* USE_PRECOMPUTED_CHECKSUMS */
+    }
+
+    HTTPD_DEBUG("%zu file(s) loaded", store->files.size());
+
+    return store;
+}
+
+static void _list_files(
+    const string &root_dir, const string &rel_dir, vector<to_load_t> *to_load
 )
 {
+    string dir_path = rel_dir.empty() ? root_dir : root_dir + '/' + rel_dir;
+
     DIR *dir;
 
-    if (!(dir = opendir(root_dir)))
-        HTTPD_DIE("Unable to open the directory");
+    if (!(dir = opendir(dir_path.c_str())))
+        HTTPD_DIE("Unable to open the directory (%s)", dir_path.c_str());
 
     struct dirent *entry;
 
-    size_t root_dir_len = strlen(root_dir);
-
     while ((entry = readdir(dir))) {
-        filename_t filename = { strdup(entry->d_name) };
+        const char *filename = entry->d_name;
+
+        if (strcmp(filename, ".") == 0 || strcmp(filename, "..") == 0)
+            continue;
+
+        // Path relative to the root directory, as requested by the clients.
+        string name = rel_dir.empty() ? filename : rel_dir + '/' + filename;
 
-        // Filename with the directory path.
-        char *filepath = new char[root_dir_len + strlen(filename.value) + 2];
-        strcpy(filepath, root_dir);
-        filepath[root_dir_len] = '/';
-        strcpy(filepath + root_dir_len + 1, filename.value);
+        string filepath = root_dir + '/' + name;
 
-        // Skips directories.
         struct stat stat_buffer;
-        if (stat(filepath, &stat_buffer) != 0)
-            HTTPD_DIE("Unable to get info on a file (%s)", filename.value);
-        if (S_ISDIR(stat_buffer.st_mode))
+        if (lstat(filepath.c_str(), &stat_buffer) != 0)
+            HTTPD_DIE("Unable to get info on a file (%s)", filepath.c_str());
+
+        if (S_ISDIR(stat_buffer.st_mode)) {
+            _list_files(root_dir, name, to_load);
             continue;
+        }
 
-        FILE *file;
-        if (!(file = fopen(filepath, "r")))
-            HTTPD_DIE("Unable to open a file");
+        // Follows symbolic links to files.
+        if (
+               S_ISLNK(stat_buffer.st_mode)
+            && (   stat(filepath.c_str(), &stat_buffer) != 0
+                || S_ISDIR(stat_buffer.st_mode))
+        )
+            continue;
 
-        // Obtains the size of the file
-        fseek(file, 0, SEEK_END);
-        size_t content_size = ftell(file);
-        fseek(file, 0, SEEK_SET);
+        if (!S_ISREG(stat_buffer.st_mode))
+            continue;
 
-        // Reads the file content
+        #ifdef USE_PRECOMPUTED_CHECKSUMS
+            // Skips saved checksums (and the temporary files in which they are
+            // written).
+            if (
+                   _has_suffix(filename, SUMS_SUFFIX)
+                || _has_suffix(filename, ".sums.tmp")
+            )
+                continue;
+        #endif /* USE_PRECOMPUTED_CHECKSUMS */
 
-        char *content = new char[content_size + 1];
-        size_t read = fread(content, 1, content_size, file);
+        to_load->push_back({
+            move(name), (size_t) stat_buffer.st_size,
+            _file_version(stat_buffer)
+        });
+    }
 
-        if (read != content_size)
-            HTTPD_DIE("Unable to read a file %zu %zu", read, content_size);
+    closedir(dir);
+}
 
-        content[content_size] = '\0';
+static void _publish_store(
+    vector<mpipe_t> *instances, shared_ptr<const store_t> store
+)
+{
+    for (mpipe_t &mpipe : *instances) {
+        mpipe.broadcast([store](mpipe_t::instance_t *instance) {
+            worker_store = store;
+        });
+    }
+}
 
-        fclose(file);
+#ifdef USE_PRECOMPUTED_CHECKSUMS
+    static bool _has_suffix(const char *str, const char *suffix)
+    {
+        size_t str_len      = strlen(str),
+               suffix_len   = strlen(suffix);
 
-        #ifdef USE_PRECOMPUTED_CHECKSUMS
-            file_t entry = {
-                content, content_size, precomputed_sums_t(content, content_size)
-            };
-        #else
-            file_t entry = { content, content_size };
-        #endif /* USE_PRECOMPUTED_CHECKSUMS */
+        return    str_len >= suffix_len
+               && strcmp(str + str_len - suffix_len, suffix) == 0;
+    }
+
+    static const precomputed_sums_t *_file_sums(
+        const shared_ptr<const store_t> &store, const file_t *file
+    )
+    {
+        const precomputed_sums_t *sums = file->sums.load(memory_order_acquire);
+
+        if (
+               UNLIKELY(sums == nullptr)
+            && !file->sums_requested.exchange(true, memory_order_relaxed)
+        ) {
+            if (!sums_requests.emplace(sums_request_t { store, file })) {
+                // Retried by the next request for the file.
+                file->sums_requested.store(false, memory_order_relaxed);
+            }
+        }
+
+        return sums;
+    }
+
+    static void *_sums_thread_runner(void *)
+    {
+        for (;;) {
+            size_t n = sums_requests.drain([](sums_request_t request) {
+                const file_t *file = request.file;
+
+                // Maps the checksums saved during a previous run if the file
+                // didn't change. Otherwise, computes and saves them.
+                const precomputed_sums_t *sums = new precomputed_sums_t(
+                    file->content, file->content_len, file->sums_path,
+                    file->version
+                );
+
+                file->sums.store(sums, memory_order_release);
+            });
+
+            if (n == 0)
+                usleep(SUMS_POLL_DELAY);
+        }
+
+        return nullptr;
+    }
+#endif /* USE_PRECOMPUTED_CHECKSUMS */
 
-        files->emplace(filename, entry);
+static uint64_t _file_version(const struct stat &stat_buffer)
+{
+    const uint64_t fields[] = {
+        (uint64_t) stat_buffer.st_mtim.tv_sec,
+        (uint64_t) stat_buffer.st_mtim.tv_nsec,
+        (uint64_t) stat_buffer.st_ino,
+        (uint64_t) stat_buffer.st_dev
+    };
+
+    // Multiplicative mixing of each field (the constant is 2^64 divided by
+    // the golden ratio).
+    uint64_t h = 0;
+
+    for (uint64_t field : fields) {
+        h = (h ^ field) * 0x9E3779B97F4A7C15ULL;
+        h ^= h >> 32;
     }
 
-    HTTPD_DEBUG("%zu file(s) preloaded", files->size());
+    return h;
 }
 
 static void _do_nothing(void)
@@ -382,152 +931,257 @@ static void _do_nothing(void)
 }
 
 static void _on_received_data(
-    unordered_map<filename_t, file_t> *files, mpipe_t::tcp_t::conn_t conn,
-    mpipe_t::cursor_t in
+    mpipe_t::tcp_t::conn_t conn, http_conn_t *http_conn, mpipe_t::cursor_t in
 )
 {
-    // Expects that the first received segment contains the entire request.
+    in.for_each([conn, http_conn](const char *buffer, size_t size) {
+        if (http_conn->closed)
+            return;
 
-    size_t size = in.size();
+        string *pending = &http_conn->pending;
 
-    #define BAD_REQUEST(WHY, ...)                                              \
-        do {                                                                   \
-            HTTPD_ERROR("400 Bad Request (" WHY ")", ##__VA_ARGS__);           \
-            _respond_with_400(conn);                                           \
-            conn.close();                                                      \
-            return;                                                            \
-        } while (0)
+        if (LIKELY(pending->empty())) {
+            // Parses the requests in the received buffer, and only copies the
+            // last one if it is incomplete.
+            size_t served = _handle_requests(conn, http_conn, buffer, size);
 
-    if (UNLIKELY(size < sizeof ("XXX / HTTP/X.X\n")))
-        BAD_REQUEST("Not enough received data for the HTTP header");
+            if (!http_conn->closed && served < size)
+                pending->assign(buffer + served, size - served);
+        } else {
+            pending->append(buffer, size);
 
-    in.read_with(
-        [files, conn](const char *buffer) mutable
-        {
-            //
-            // Extracts the filename from the HTTP header
-            //
+            size_t served = _handle_requests(
+                conn, http_conn, pending->data(), pending->size()
+            );
+
+            pending->erase(0, served);
+        }
 
-            size_t      get_len         = sizeof ("GET /") - sizeof ('\0');
+        if (UNLIKELY(!http_conn->closed && pending->size() > MAX_REQUEST_SIZE))
+            _bad_request(conn, http_conn, "Request too large");
+    });
+}
+
+static size_t _handle_requests(
+    mpipe_t::tcp_t::conn_t conn, http_conn_t *http_conn, const char *buffer,
+    size_t size
+)
+{
+    static constexpr char   GET[]       = "GET /";
+    static constexpr size_t GET_LEN     = sizeof (GET) - sizeof ('\0');
 
-            if (UNLIKELY(strncmp(buffer, "GET /", get_len) != 0))
-                BAD_REQUEST("Not a GET request");
+    static constexpr char   HTTP[]      = "HTTP/1.";
+    static constexpr size_t HTTP_LEN    = sizeof (HTTP) - sizeof ('\0');
 
-            const char  *path_begin     = buffer + get_len;
-            const char  *path_end       = strchr(path_begin, ' ');
+    static constexpr char   CONNECTION[]    = "Connection:";
+    static constexpr size_t CONNECTION_LEN  = sizeof (CONNECTION)
+                                            - sizeof ('\0');
 
-            const char  *http11_begin   = path_end + 1;
-            size_t      http11_len      = sizeof ("HTTP/1.1") - sizeof ('\0');
-            const char  *http11_end     = http11_begin + http11_len;
+    const char *begin   = buffer,
+               *end     = buffer + size;
 
+    while (begin < end) {
+        const char *header_end = _find_header_end(begin, end);
 
-            if (UNLIKELY(strncmp(http11_begin, "HTTP/1.1", http11_len) != 0))
-                BAD_REQUEST("Not HTTP 1.1");
+        if (header_end == nullptr)
+            break; // Waits for the end of the request.
 
-            if (UNLIKELY(http11_end[0] != '\n' && http11_end[0] != '\r'))
-                BAD_REQUEST("Invalid header");
+        //
+        // Parses the request line.
+        //
 
-            size_t  path_len    = (intptr_t) path_end - (intptr_t) path_begin;
-            char    *path       = (char *) alloca(path_len);
+        const char *line_end = (const char *) memchr(begin, '\n', end - begin);
+
+        if (UNLIKELY(
+               line_end - begin < (ptrdiff_t) GET_LEN
+            || strncmp(begin, GET, GET_LEN) != 0
+        )) {
+            _bad_request(conn, http_conn, "Not a GET request");
+            break;
+        }
+
+        const char *path_begin  = begin + GET_LEN;
+        const char *path_end    = (const char *) memchr(
+            path_begin, ' ', line_end - path_begin
+        );
 
-            strncpy(path, path_begin, path_len);
-            path[path_len] = '\0';
+        if (UNLIKELY(path_end == nullptr)) {
+            _bad_request(conn, http_conn, "Invalid request line");
+            break;
+        }
 
-            //
-            // Responds to the request.
-            //
+        const char *version = path_end + 1;
 
-            auto file_it = files->find({ path });
+        if (UNLIKELY(
+               line_end - version < (ptrdiff_t) HTTP_LEN + 1
+            || strncmp(version, HTTP, HTTP_LEN) != 0
+            || (version[HTTP_LEN] != '0' && version[HTTP_LEN] != '1')
+        )) {
+            _bad_request(conn, http_conn, "Not HTTP 1.0 or 1.1");
+            break;
+        }
 
-            if (LIKELY(file_it != files->end())) {
-                HTTPD_DEBUG("200 OK - \"%s\"", path);
-                _respond_with_200(conn, &file_it->second);
-            } else {
-                HTTPD_ERROR("404 Not Found - \"%s\"", path);
-                _respond_with_404(conn);
+        // HTTP 1.1 connections are persistent unless the client asks to close
+        // them. HTTP 1.0 connections are always closed after the response,
+        // as the prebuilt responses can't announce a persistent connection.
+        bool keep_alive = version[HTTP_LEN] == '1';
+
+        //
+        // Looks for a 'Connection: close' header.
+        //
+
+        for (
+            const char *line = line_end + 1;
+            keep_alive && line < header_end;
+            line = line_end + 1
+        ) {
+            line_end = (const char *) memchr(line, '\n', header_end - line);
+
+            if (
+                   line_end - line >= (ptrdiff_t) CONNECTION_LEN
+                && strncasecmp(line, CONNECTION, CONNECTION_LEN) == 0
+            ) {
+                const char *value = line + CONNECTION_LEN;
+
+                while (value < line_end && *value == ' ')
+                    value++;
+
+                if (
+                       line_end - value >= (ptrdiff_t) sizeof ("close") - 1
+                    && strncasecmp(value, "close", sizeof ("close") - 1) == 0
+                )
+                    keep_alive = false;
             }
+        }
+
+        //
+        // Responds to the request.
+        //
+
+        size_t path_len = path_end - path_begin;
+
+        // Looks up the path in the received buffer.
+        const file_t *file = http_conn->store->files.find(path_begin, path_len);
+
+        if (LIKELY(file != nullptr)) {
+            HTTPD_DEBUG("200 OK - \"%.*s\"", (int) path_len, path_begin);
+            _respond_with_200(conn, http_conn->store, file);
+        } else {
+            HTTPD_ERROR("404 Not Found - \"%.*s\"", (int) path_len, path_begin);
+            _respond_with_404(conn);
+        }
 
+        begin = header_end;
+
+        if (UNLIKELY(http_conn->store != worker_store))
+            keep_alive = false; // The directory has been reloaded.
+
+        if (!keep_alive) {
+            http_conn->closed = true;
             conn.close();
-        }, size
-    );
+            break;
+        }
+    }
 
-    #undef BAD_REQUEST
+    return begin - buffer;
 }
 
-void _respond_with_200(mpipe_t::tcp_t::conn_t conn, const file_t *file)
+static const char *_find_header_end(const char *begin, const char *end)
 {
-    constexpr char header[]     = "HTTP/1.1 200 OK\r\n"
-                                  "Content-Type: text/html\r\n"
-                                  "Content-Length: %10zu\r\n"
-                                  "\r\n";
-
-    constexpr size_t header_len =   sizeof (header) - sizeof ('\0')
-                                  - sizeof ("%10zu")
-                                  + sizeof ("4294967295");
+    // The header ends with an empty line. Lines end with "\r\n", or with "\n"
+    // for some clients.
 
-    size_t total_len = header_len + file->content_len;
+    const char *line_end;
 
-    #ifdef USE_PRECOMPUTED_CHECKSUMS
-        mpipe_t::tcp_t::writer_sum_t writer =
-    #else
-        mpipe_t::tcp_t::writer_t writer =
-    #endif /* USE_PRECOMPUTED_CHECKSUMS */
-        [file](size_t offset, mpipe_t::cursor_t out)
-        {
-            size_t content_offset;
+    while ((line_end = (const char *) memchr(begin, '\n', end - begin))) {
+        const char *next = line_end + 1;
 
-            #ifdef USE_PRECOMPUTED_CHECKSUMS
-                partial_sum_t partial_sum;
-            #endif /* USE_PRECOMPUTED_CHECKSUMS */
+        if (next < end && *next == '\n')
+            return next + 1;
 
-            // Writes the HTTP header if required.
-            if (offset < header_len) {
-                tmc_mem_prefetch(header, sizeof (header));
+        if (end - next >= 2 && next[0] == '\r' && next[1] == '\n')
+            return next + 2;
 
-                char buffer[header_len + 1];
+        begin = next;
+    }
 
-                snprintf(buffer, sizeof (buffer), header, file->content_len);
+    return nullptr;
+}
 
-                size_t to_write = min(out.size(), header_len - offset);
+static void _bad_request(
+    mpipe_t::tcp_t::conn_t conn, http_conn_t *http_conn, const char *why
+)
+{
+    HTTPD_ERROR("400 Bad Request (%s)", why);
 
-                out            = out.write(buffer + offset, to_write);
-                content_offset = 0;
+    _respond_with_400(conn);
 
-                #ifdef USE_PRECOMPUTED_CHECKSUMS
-                    partial_sum = partial_sum_t(buffer + offset, to_write);
-                #endif /* USE_PRECOMPUTED_CHECKSUMS */
-            } else {
-                content_offset = offset - header_len;
+    http_conn->closed = true;
+    http_conn->pending.clear();
+    conn.close();
+}
 
-                #ifdef USE_PRECOMPUTED_CHECKSUMS
-                    partial_sum = partial_sum_t::ZERO;
-                #endif /* USE_PRECOMPUTED_CHECKSUMS */
-            }
+void _respond_with_200(
+    mpipe_t::tcp_t::conn_t conn, const shared_ptr<const store_t> &store,
+    const file_t *file
+)
+{
+    #ifdef USE_PRECOMPUTED_CHECKSUMS
+        mpipe_t::tcp_t::static_data_t content = {
+            file->content, file->content_len, _file_sums(store, file)
+        };
+    #else
+        mpipe_t::tcp_t::static_data_t content = {
+            file->content, file->content_len, nullptr
+        };
+    #endif /* USE_PRECOMPUTED_CHECKSUMS */
 
-            size_t out_size     = out.size();
+    const char  *header     = file->header;
+    size_t      header_len  = file->header_len;
+
+    #ifdef MPIPE_ZERO_COPY
+        // Only the header is written into transmission buffers. Segments
+        // directly reference the content.
+        conn.send(
+            header_len,
+            [header](size_t offset, mpipe_t::cursor_t out)
+            {
+                out.write(header + offset, out.size());
+            }, content, _do_nothing /* Does nothing on ACK */
+        );
+    #else
+        // Copies the header and the content into the transmission buffers.
+        // Without precomputed checksums, the content is summed while it is
+        // copied.
+        mpipe_t::tcp_t::writer_sum_t writer =
+            [header, header_len, content](
+                size_t offset, mpipe_t::cursor_t out
+            )
+            {
+                partial_sum_t sum = partial_sum_t::ZERO;
 
-            tmc_mem_prefetch(file->content + content_offset, out_size);
+                if (offset < header_len) {
+                    size_t n = min(out.size(), header_len - offset);
+                    out = out.write_and_sum(header + offset, n, &sum);
+                    offset = 0;
+                } else
+                    offset -= header_len;
 
-            #ifdef USE_PRECOMPUTED_CHECKSUMS
-                size_t content_end  = content_offset + out_size;
-                file->precomputed_sums.prefetch(content_offset, content_end);
-            #endif /* USE_PRECOMPUTED_CHECKSUMS */
+                tmc_mem_prefetch(content.data + offset, out.size());
 
-            // Writes the file content if required.
-            if (out_size > 0) {
-                assert(out_size <= file->content_len - content_offset);
-                out.write(file->content + content_offset, out_size);
-            }
+                #ifdef USE_PRECOMPUTED_CHECKSUMS
+                    if (content.sums != nullptr)
+                        content.sums->prefetch(offset, offset + out.size());
+                #endif /* USE_PRECOMPUTED_CHECKSUMS */
 
-            #ifdef USE_PRECOMPUTED_CHECKSUMS
-                // Returns the precomputed checksum sums.
-                return (partial_sum_t) partial_sum.append(
-                    file->precomputed_sums.sum(content_offset, content_end)
-                );
-            #endif /* USE_PRECOMPUTED_CHECKSUMS */
-        };
+                return sum.append(content.write(offset, out));
+            };
 
-    conn.send(total_len, writer, _do_nothing /* Does nothing on ACK */);
+        conn.send(
+            header_len + content.size, writer,
+            _do_nothing /* Does nothing on ACK */
+        );
+    #endif /* MPIPE_ZERO_COPY */
 }
 
 #define RESPOND_WITH_CONTENT(CONTENT)                                          \
@@ -545,12 +1199,18 @@ void _respond_with_200(mpipe_t::tcp_t::conn_t conn, const file_t *file)
 
 void _respond_with_400(mpipe_t::tcp_t::conn_t conn)
 {
-    RESPOND_WITH_CONTENT("HTTP/1.1 400 Bad Request\r\n\r\n");
+    RESPOND_WITH_CONTENT(
+        "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\n\r\n"
+    );
 }
 
 void _respond_with_404(mpipe_t::tcp_t::conn_t conn)
 {
-    RESPOND_WITH_CONTENT("HTTP/1.1 404 Not Found\r\n\r\n");
+    // The empty body lets the client send its next request on the same
+    // connection.
+    RESPOND_WITH_CONTENT(
+        "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n"
+    );
 }
 
 #undef RESPOND_WITH_CONTENT
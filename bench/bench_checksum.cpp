@@ -0,0 +1,226 @@
+//
+// Compares the throughput of the ones' complement sum kernels, and of the fused
+// copy and sum.
+//
+// Usage: ./bench/bench_checksum [<iterations>]
+//
+// Should be compiled with NDEBUG, as '_ones_complement_sum()' otherwise checks
+// each of its results with the naive kernel.
+//
+// Copyright 2015 Raphael Javaux <raphaeljavaux@gmail.com>
+// University of Liege.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "net/checksum.hpp"     // checksum_kernel_t, _checksum_kernels(),
+                                // _ones_complement_copy_and_sum(),
+                                // _ones_complement_sum_naive()
+
+using namespace std;
+
+using namespace rusty::net;
+
+// Buffer sizes which are benchmarked: IPv4 header, TCP header with options,
+// small and full Ethernet segments and Jumbo frames.
+static const size_t SIZES[] = { 20, 40, 64, 256, 1460, 8960, 65536 };
+
+static const size_t DEFAULT_ITERATIONS = 1000000;
+
+// Used to prevent the compiler from removing the benchmarked calls.
+static volatile uint16_t _sink;
+
+// Checks that every kernel gives the same sum as the naive one, for every size
+// up to 'max_size' and every alignment.
+static bool _check_kernels(const char *buffer, size_t max_size);
+
+// Checks that '_ones_complement_copy_and_sum()' copies the buffer and gives the
+// same sum as the naive kernel, for every size up to 'max_size' and every
+// source and destination alignment.
+static bool _check_copy_and_sum(const char *buffer, size_t max_size);
+
+// Compares '_ones_complement_copy_and_sum()' with a 'memcpy()' followed by
+// '_ones_complement_sum()'.
+static void _bench_copy_and_sum(
+    const char *buffer, char *dst_buffer, size_t iterations
+);
+
+int main(int argc, char **argv)
+{
+    size_t iterations = DEFAULT_ITERATIONS;
+    if (argc == 2)
+        iterations = atol(argv[1]);
+    else if (argc > 2) {
+        fprintf(stderr, "Usage: %s [<iterations>]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    static const size_t MAX_SIZE = SIZES[sizeof (SIZES) / sizeof (size_t) - 1];
+
+    // Extra bytes give room for misaligned buffers.
+    char *buffer = new char[MAX_SIZE + 16];
+    srand(0);
+    for (size_t i = 0; i < MAX_SIZE + 16; i++)
+        buffer[i] = (char) rand();
+
+    char *dst_buffer = new char[MAX_SIZE + 16];
+
+    if (!_check_kernels(buffer, 512) || !_check_copy_and_sum(buffer, 512))
+        return EXIT_FAILURE;
+
+    printf("%-10s %8s %6s %12s %10s\n", "kernel", "size", "align", "ns/call",
+           "GB/s");
+
+    for (size_t size : SIZES) {
+        // Keeps the total number of summed bytes roughly constant.
+        size_t n = iterations * SIZES[0] / size + 1;
+
+        for (size_t align : { 0, 1 }) {
+            const char *data = buffer + align;
+
+            for (
+                const checksum_kernel_t *kernel = _checksum_kernels();
+                kernel->name != nullptr;
+                kernel++
+            ) {
+                auto start = chrono::steady_clock::now();
+
+                for (size_t i = 0; i < n; i++)
+                    _sink = kernel->sum(data, size);
+
+                auto end = chrono::steady_clock::now();
+
+                double ns = chrono::duration<double, nano>(end - start).count()
+                          / n;
+
+                printf("%-10s %8zu %6zu %12.2f %10.2f\n", kernel->name, size,
+                       align, ns, size / ns);
+            }
+        }
+    }
+
+    _bench_copy_and_sum(buffer, dst_buffer, iterations);
+
+    delete[] buffer;
+    delete[] dst_buffer;
+
+    return EXIT_SUCCESS;
+}
+
+static bool _check_kernels(const char *buffer, size_t max_size)
+{
+    for (
+        const checksum_kernel_t *kernel = _checksum_kernels();
+        kernel->name != nullptr;
+        kernel++
+    ) {
+        for (size_t align = 0; align < 16; align++) {
+            for (size_t size = 0; size <= max_size; size++) {
+                const char *data = buffer + align;
+
+                uint16_t expected = _ones_complement_sum_naive(data, size),
+                         sum      = kernel->sum(data, size);
+
+                if (sum != expected) {
+                    fprintf(
+                        stderr, "Kernel %s failed on %zu bytes aligned on %zu "
+                        "(0x%04x instead of 0x%04x)\n", kernel->name, size,
+                        align, sum, expected
+                    );
+                    return false;
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+static bool _check_copy_and_sum(const char *buffer, size_t max_size)
+{
+    char *dst_buffer = new char[max_size + 16];
+
+    for (size_t src_align = 0; src_align < 8; src_align++) {
+        for (size_t dst_align = 0; dst_align < 8; dst_align++) {
+            for (size_t size = 0; size <= max_size; size++) {
+                const char  *src = buffer + src_align;
+                char        *dst = dst_buffer + dst_align;
+
+                uint16_t expected = _ones_complement_sum_naive(src, size),
+                         sum      = _ones_complement_copy_and_sum(
+                            dst, src, size
+                         );
+
+                if (sum != expected || memcmp(dst, src, size) != 0) {
+                    fprintf(
+                        stderr, "Copy and sum failed on %zu bytes aligned on "
+                        "%zu (source) and %zu (destination)\n", size,
+                        src_align, dst_align
+                    );
+                    delete[] dst_buffer;
+                    return false;
+                }
+            }
+        }
+    }
+
+    delete[] dst_buffer;
+    return true;
+}
+
+static void _bench_copy_and_sum(
+    const char *buffer, char *dst_buffer, size_t iterations
+)
+{
+    printf("\n%-16s %8s %6s %12s %10s\n", "copy", "size", "align", "ns/call",
+           "GB/s");
+
+    for (size_t size : SIZES) {
+        size_t n = iterations * SIZES[0] / size + 1;
+
+        // Destinations with the same and with a different alignment than the
+        // source (mPIPE buffers usually start payloads on a 2 bytes boundary).
+        for (size_t dst_align : { 0, 2 }) {
+            char *dst = dst_buffer + dst_align;
+
+            for (bool fused : { false, true }) {
+                auto start = chrono::steady_clock::now();
+
+                for (size_t i = 0; i < n; i++) {
+                    if (fused)
+                        _sink = _ones_complement_copy_and_sum(dst, buffer, size);
+                    else {
+                        memcpy(dst, buffer, size);
+                        _sink = _ones_complement_sum(dst, size);
+                    }
+                }
+
+                auto end = chrono::steady_clock::now();
+
+                double ns = chrono::duration<double, nano>(end - start).count()
+                          / n;
+
+                printf("%-16s %8zu %6zu %12.2f %10.2f\n",
+                       fused ? "copy_and_sum" : "memcpy+sum", size, dst_align,
+                       ns, size / ns);
+            }
+        }
+    }
+}
@@ -0,0 +1,106 @@
+//
+// Compares two results files written by the benchmarks.
+//
+// Usage: ./bench/bench_compare <baseline results> <results> [<threshold %>]
+//
+// Prints, for each measure of the baseline, its relative change in the second
+// file. Changes larger than the threshold (5 % by default) are flagged as
+// better or worse. Exits with a failure status if a measure is worse.
+//
+// Copyright 2015 Raphael Javaux <raphaeljavaux@gmail.com>
+// University of Liege.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <cstdio>
+#include <cstdlib>
+
+#include "bench/results.hpp"    // results_t
+
+using namespace std;
+
+using namespace rusty::bench;
+
+static const double DEFAULT_THRESHOLD = 5.0;
+
+int main(int argc, char **argv)
+{
+    if (argc < 3 || argc > 4) {
+        fprintf(
+            stderr, "Usage: %s <baseline results> <results> [<threshold %%>]\n",
+            argv[0]
+        );
+        return EXIT_FAILURE;
+    }
+
+    results_t baseline, results;
+
+    if (!baseline.load(argv[1])) {
+        fprintf(stderr, "Failed to read %s\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+
+    if (!results.load(argv[2])) {
+        fprintf(stderr, "Failed to read %s\n", argv[2]);
+        return EXIT_FAILURE;
+    }
+
+    double threshold = argc == 4 ? atof(argv[3]) : DEFAULT_THRESHOLD;
+
+    printf(
+        "%-40s %14s %14s %8s %9s\n", "benchmark", "baseline", "value", "unit",
+        "change"
+    );
+
+    size_t n_worse = 0;
+
+    for (const result_t &before : baseline.results) {
+        const result_t *after = results.find(before.name);
+
+        if (after == nullptr) {
+            printf(
+                "%-40s %14.2f %14s %8s\n", before.name.c_str(), before.value,
+                "-", before.unit.c_str()
+            );
+            continue;
+        }
+
+        double change = before.value != 0
+                      ? (after->value - before.value) / before.value * 100.0
+                      : 0.0;
+
+        const char *verdict = "";
+        if (change > threshold || change < -threshold) {
+            bool improved = (before.lower_is_better() && change < 0)
+                         || (before.higher_is_better() && change > 0);
+            bool degraded = (before.lower_is_better() && change > 0)
+                         || (before.higher_is_better() && change < 0);
+
+            if (improved)
+                verdict = "better";
+            else if (degraded) {
+                verdict = "worse";
+                n_worse++;
+            }
+        }
+
+        printf(
+            "%-40s %14.2f %14.2f %8s %+8.1f%% %s\n", before.name.c_str(),
+            before.value, after->value, before.unit.c_str(), change, verdict
+        );
+    }
+
+    return n_worse == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
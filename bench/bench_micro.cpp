@@ -0,0 +1,826 @@
+//
+// Measures the cost of the building blocks of the network stack: checksums,
+// cursors, timer managers, TCB lookups, the reassembly of out of order TCP
+// segments and the recovery of a lost TCP segment.
+//
+// The reassembly benchmark also checks the data received by the application,
+// and fails if the stream is corrupted. The loss recovery benchmark fails if
+// the lost segment isn't retransmitted on the third duplicate ACK.
+//
+// Usage: ./bench/bench_micro [<iterations> [<results file>]]
+//
+// When a results file is given, measures are also written to it and can be
+// compared with the ones of another run with 'bench_compare'.
+//
+// Copyright 2015 Raphael Javaux <raphaeljavaux@gmail.com>
+// University of Liege.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <cassert>
+#include <cctype>               // isdigit()
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h>          // htonl(), htons(), ntohl(), ntohs()
+
+#include "bench/loopback.hpp"   // make_cursor(), BUFFER_ALIGN
+#include "bench/results.hpp"    // results_t
+#include "driver/buffer.hpp"    // cursor_t
+#include "driver/clock.hpp"     // cpu_clock_t
+#include "driver/timer.hpp"     // cpu_timer_manager_t
+#include "driver/timer_wheel.hpp" // wheel_timer_manager_t
+#include "net/checksum.hpp"     // _ones_complement_sum(), precomputed_sums_t,
+                                // checksum_t
+#include "net/conn_table.hpp"   // conn_table_t
+#include "net/endian.hpp"       // net_t
+#include "net/ipv4.hpp"         // ipv4_addr_t
+#include "net/tcp.hpp"          // tcp_tcb_id_t, tcp_flow_hash_t
+
+using namespace std;
+
+using namespace rusty::bench;
+using namespace rusty::driver;
+using namespace rusty::net;
+
+static const size_t DEFAULT_ITERATIONS = 1000000;
+
+// Sizes of the summed buffers: IPv4 header, small and full Ethernet segments.
+static const size_t CHECKSUM_SIZES[] = { 20, 64, 1460 };
+
+// Size of the data of the precomputed sums (a large web page), and of the
+// summed sections (a full Ethernet segment and a TSO segment).
+static const size_t PRECOMPUTED_DATA_SIZE       = 1 << 20;
+static const size_t PRECOMPUTED_SECTION_SIZES[] = { 1460, 65536 };
+
+// Number of timers scheduled by each round of the timer benchmarks.
+static const size_t N_TIMERS = 10000;
+
+// Number of connections in the TCB tables.
+static const size_t TCB_TABLE_SIZES[] = { 1024, 65536 };
+
+typedef buffer::cursor_t                            cursor_t;
+
+typedef tcp_tcb_id_t<ipv4_addr_t, uint16_t>         tcb_id_t;
+
+typedef loopback_t<>                                loopback_phys_t;
+typedef loopback_phys_t::ethernet_t                 loopback_ethernet_t;
+typedef loopback_ethernet_t::ipv4_ethernet_t::tcp_ipv4_t loopback_tcp_t;
+
+// Segments given to the TCP layer by each round of the reassembly benchmark,
+// as offsets and sizes in the data of the round.
+//
+// The two first segments are out of order and overlap. The last one fills the
+// gap and overlaps the first stored segment.
+struct reassembly_segment_t {
+    size_t      offset;
+    size_t      size;
+};
+
+static const reassembly_segment_t REASSEMBLY_SEGMENTS[] = {
+    { 1000, 1000 }, { 1500, 1000 }, { 0, 1500 }
+};
+
+static const size_t REASSEMBLY_ROUND_SIZE = 2500;
+
+// Each round of the reassembly benchmark processes three segments.
+static const size_t REASSEMBLY_ITERATIONS_PER_ROUND = 100;
+
+// Number of segments sent by the server of the loss recovery benchmark, the
+// first one being lost. This is the initial window for the default MSS.
+static const size_t LOSS_N_SEGMENTS = 4;
+
+static const uint16_t LOSS_MSS = 536;
+
+// Each round of the loss recovery benchmark opens a new connection.
+static const size_t LOSS_ITERATIONS_PER_ROUND = 1000;
+static const size_t LOSS_MAX_ROUNDS           = 1000;
+
+// Addresses, ports and initial sequence numbers of the connections of the
+// reassembly and loss recovery benchmarks.
+static const uint8_t  SERVER_ETHER[]    = { 0x02, 0, 0, 0, 0, 0x01 };
+static const uint8_t  CLIENT_ETHER[]    = { 0x02, 0, 0, 0, 0, 0x02 };
+static const uint32_t SERVER_IPV4       = 0x0A000001; // 10.0.0.1
+static const uint32_t CLIENT_IPV4       = 0x0A000002; // 10.0.0.2
+static const uint16_t SERVER_PORT       = 80;
+static const uint16_t CLIENT_PORT       = 40000;
+static const uint32_t SERVER_ISS        = 1000000;
+static const uint32_t CLIENT_ISS        = 2000000;
+
+static const uint8_t  TCP_FLAG_SYN      = 0x02;
+static const uint8_t  TCP_FLAG_ACK      = 0x10;
+
+static const uint8_t  TCP_OPT_NOP       = 1;
+static const uint8_t  TCP_OPT_MSS       = 2;
+static const uint8_t  TCP_OPT_SACK_PERM = 4;
+static const uint8_t  TCP_OPT_SACK      = 5;
+
+// Used to prevent the compiler from removing the benchmarked calls.
+static volatile uint64_t _sink;
+
+// Calls 'f(i)' for 'i' in [0, n) and returns the mean duration of a call, in
+// nanoseconds.
+template <typename F>
+static double _measure(size_t n, F f);
+
+// Prints the measure and adds it to the results.
+static void _report(
+    results_t *results, const string &name, double value, const char *unit
+);
+
+static void _bench_checksums(results_t *results, size_t iterations);
+
+static void _bench_cursors(results_t *results, size_t iterations);
+
+// Measures the cost of scheduling and removing a timer, and of executing an
+// expired timer.
+template <typename timer_manager_t>
+static void _bench_timers(
+    results_t *results, const char *name, size_t iterations
+);
+
+// Measures the lookup of existing connections in a TCB table.
+template <typename hash_t>
+static void _bench_tcb_lookup(
+    results_t *results, const char *name, size_t iterations
+);
+
+// Measures the reassembly of overlapping out of order segments on a single
+// connection, and checks that the application receives the whole stream.
+//
+// Dies if a byte is lost, duplicated or corrupted.
+static void _bench_tcp_reassembly(results_t *results, size_t iterations);
+
+// Measures the processing of the three duplicate ACKs which follow the loss of
+// the first segment of a SACK enabled connection.
+//
+// Dies if the lost segment isn't retransmitted by these ACKs, as the
+// retransmission timer is never executed.
+static void _bench_tcp_loss_recovery(results_t *results, size_t iterations);
+
+// Writes a frame carrying a TCP segment from the client to the server of the
+// benchmarks, with valid checksums. Returns the size of the frame.
+//
+// The payload is made of the bytes of the stream starting at 'offset' (see
+// '_stream_byte()'). The size of the options must be a multiple of 4 bytes.
+static size_t _write_tcp_frame(
+    char *frame, uint32_t seq, uint32_t ack, uint8_t flags, size_t offset,
+    size_t payload_size, uint16_t client_port = CLIENT_PORT,
+    const uint8_t *options = nullptr, size_t options_size = 0
+);
+
+// Returns the byte at the given offset of the stream sent by the client of the
+// reassembly benchmark.
+static inline char _stream_byte(size_t offset);
+
+// Parses a strictly positive decimal count from the command line. Returns
+// 'false' if the string is not such a number.
+static bool _parse_count(const char *str, size_t *count);
+
+int main(int argc, char **argv)
+{
+    size_t      iterations   = DEFAULT_ITERATIONS;
+    const char  *results_path = nullptr;
+
+    if (argc > 3 || (argc >= 2 && !_parse_count(argv[1], &iterations))) {
+        fprintf(stderr, "Usage: %s [<iterations> [<results file>]]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (argc == 3)
+        results_path = argv[2];
+
+    results_t results;
+
+    printf("%-32s %12s %8s\n", "benchmark", "value", "unit");
+
+    _bench_checksums(&results, iterations);
+    _bench_cursors(&results, iterations);
+
+    _bench_timers<cpu_timer_manager_t<>>(&results, "cpu_timers", iterations);
+    _bench_timers<wheel_timer_manager_t<>>(
+        &results, "wheel_timers", iterations
+    );
+
+    _bench_tcb_lookup<hash<tcb_id_t>>(&results, "tcb_lookup.hash", iterations);
+    _bench_tcb_lookup<tcp_flow_hash_t<ipv4_addr_t, uint16_t>>(
+        &results, "tcb_lookup.crc32c", iterations
+    );
+
+    _bench_tcp_reassembly(&results, iterations);
+    _bench_tcp_loss_recovery(&results, iterations);
+
+    if (results_path != nullptr && !results.save(results_path, "micro")) {
+        fprintf(stderr, "Failed to write %s\n", results_path);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+template <typename F>
+static double _measure(size_t n, F f)
+{
+    auto start = chrono::steady_clock::now();
+
+    for (size_t i = 0; i < n; i++)
+        f(i);
+
+    auto end = chrono::steady_clock::now();
+
+    return chrono::duration<double, nano>(end - start).count() / n;
+}
+
+static void _report(
+    results_t *results, const string &name, double value, const char *unit
+)
+{
+    printf("%-32s %12.2f %8s\n", name.c_str(), value, unit);
+    results->add(name, value, unit);
+}
+
+static void _bench_checksums(results_t *results, size_t iterations)
+{
+    char *data = new char[PRECOMPUTED_DATA_SIZE];
+    srand(0);
+    for (size_t i = 0; i < PRECOMPUTED_DATA_SIZE; i++)
+        data[i] = (char) rand();
+
+    for (size_t size : CHECKSUM_SIZES) {
+        double ns = _measure(iterations, [data, size](size_t) {
+            _sink = _ones_complement_sum(data, size);
+        });
+
+        _report(results, "checksum." + to_string(size), ns, "ns");
+    }
+
+    precomputed_sums_t sums(data, PRECOMPUTED_DATA_SIZE);
+
+    for (size_t size : PRECOMPUTED_SECTION_SIZES) {
+        // Sums sections starting at pseudo-random offsets, so the blocks
+        // which are summed on the fly are not always the same.
+        size_t max_begin = PRECOMPUTED_DATA_SIZE - size;
+
+        double ns = _measure(iterations, [&sums, size, max_begin](size_t i) {
+            size_t begin = (i * 2654435761u) % max_begin;
+            _sink = sums.sum(begin, begin + size).sum;
+        });
+
+        _report(results, "precomputed_sums." + to_string(size), ns, "ns");
+    }
+
+    delete[] data;
+}
+
+static void _bench_cursors(results_t *results, size_t iterations)
+{
+    // Frame of a full Ethernet segment, starting two bytes after the beginning
+    // of the buffer as in mPIPE buffers.
+    static const size_t FRAME_SIZE = 2048;
+
+    char *buffer;
+    if (posix_memalign((void **) &buffer, BUFFER_ALIGN, FRAME_SIZE + 2) != 0)
+        return;
+
+    memset(buffer, 0, FRAME_SIZE + 2);
+
+    cursor_t frame = make_cursor(buffer + 2, FRAME_SIZE);
+
+    double ns = _measure(iterations, [&frame](size_t i) {
+        _sink = frame.drop(14 + i % 2).size();
+    });
+    _report(results, "cursor.drop", ns, "ns");
+
+    ns = _measure(iterations, [&frame](size_t i) {
+        _sink = frame.take(1460 + i % 2).size();
+    });
+    _report(results, "cursor.take", ns, "ns");
+
+    ns = _measure(iterations, [&frame](size_t) {
+        uint64_t header[5];
+        frame.read(&header);
+        _sink = header[0];
+    });
+    _report(results, "cursor.read", ns, "ns");
+
+    // Parsing of the headers of a TCP segment, as done by the network layers.
+    ns = _measure(iterations, [&frame](size_t) {
+        uint64_t ipv4_header[3], tcp_header[3];
+
+        cursor_t ipv4   = frame.drop(14);
+        cursor_t tcp    = ipv4.take(1500).read(&ipv4_header).drop(4);
+        cursor_t data   = tcp.read(&tcp_header);
+
+        _sink = ipv4_header[0] + tcp_header[0] + data.size();
+    });
+    _report(results, "cursor.parse_segment", ns, "ns");
+
+    free(buffer);
+}
+
+template <typename timer_manager_t>
+static void _bench_timers(
+    results_t *results, const char *name, size_t iterations
+)
+{
+    timer_manager_t timers;
+
+    size_t n_rounds = iterations / N_TIMERS + 1;
+
+    vector<typename timer_manager_t::timer_id_t> timer_ids(N_TIMERS);
+
+    // Retransmission timers of a large number of connections, most of them
+    // being removed before expiring.
+    double total_ns = 0;
+    for (size_t round = 0; round < n_rounds; round++) {
+        total_ns += _measure(N_TIMERS, [&timers, &timer_ids](size_t i) {
+            uint64_t delay = 200000 + (i * 2654435761u) % 1000000;
+            timer_ids[i] = timers.schedule(delay, []() { });
+        });
+
+        total_ns += _measure(N_TIMERS, [&timers, &timer_ids](size_t i) {
+            timers.remove(timer_ids[i]);
+        });
+    }
+
+    _report(
+        results, string(name) + ".schedule_remove", total_ns / n_rounds, "ns"
+    );
+
+    // Timers which expire immediately. 'tick()' is called until every timer
+    // has been executed.
+    total_ns = 0;
+    for (size_t round = 0; round < n_rounds; round++) {
+        for (size_t i = 0; i < N_TIMERS; i++)
+            timers.schedule(0, []() { _sink = _sink + 1; });
+
+        auto start = chrono::steady_clock::now();
+
+        while (timers.size() > 0)
+            timers.tick();
+
+        auto end = chrono::steady_clock::now();
+
+        total_ns += chrono::duration<double, nano>(end - start).count()
+                  / N_TIMERS;
+    }
+
+    _report(results, string(name) + ".tick", total_ns / n_rounds, "ns");
+}
+
+template <typename hash_t>
+static void _bench_tcb_lookup(
+    results_t *results, const char *name, size_t iterations
+)
+{
+    for (size_t size : TCB_TABLE_SIZES) {
+        conn_table_t<tcb_id_t, uint64_t, hash_t> table;
+
+        // Connections from many clients to a single local port.
+        vector<tcb_id_t> tcb_ids(size);
+        for (size_t i = 0; i < size; i++) {
+            tcb_id_t tcb_id;
+            tcb_id.raddr = ipv4_addr_t { (uint32_t) (0x0A000000 + i / 16) };
+            tcb_id.rport = (uint16_t) (1024 + i % 16);
+            tcb_id.lport = (uint16_t) 80;
+
+            tcb_ids[i] = tcb_id;
+            table.emplace(tcb_id, i);
+        }
+
+        double ns = _measure(iterations, [&table, &tcb_ids, size](size_t i) {
+            _sink = *table.find(tcb_ids[(i * 2654435761u) % size]);
+        });
+
+        _report(
+            results, string(name) + "." + to_string(size), ns, "ns"
+        );
+    }
+}
+
+static void _bench_tcp_reassembly(results_t *results, size_t iterations)
+{
+    static const size_t FRAME_SIZE = 2048;
+
+    static const size_t N_SEGMENTS =
+        sizeof (REASSEMBLY_SEGMENTS) / sizeof (REASSEMBLY_SEGMENTS[0]);
+
+    // The network stack answers the SYN segment with SERVER_ISS.
+    loopback_phys_t::fixed_tcp_seq = true;
+    loopback_phys_t::next_tcp_seq  = loopback_phys_t::seq_t(SERVER_ISS);
+
+    net_t<loopback_ethernet_t::addr_t> server_ether, client_ether;
+    memcpy(server_ether.net.value, SERVER_ETHER, sizeof SERVER_ETHER);
+    memcpy(client_ether.net.value, CLIENT_ETHER, sizeof CLIENT_ETHER);
+
+    net_t<ipv4_addr_t> server_ipv4, client_ipv4;
+    server_ipv4.net.value = htonl(SERVER_IPV4);
+    client_ipv4.net.value = htonl(CLIENT_IPV4);
+
+    loopback_phys_t loopback;
+    loopback.init(server_ether, server_ipv4, { { client_ipv4, client_ether } });
+
+    // Checks every delivered byte.
+
+    size_t received = 0;
+
+    loopback.ethernet.ipv4.tcp.listen(SERVER_PORT,
+    [&received](loopback_tcp_t::conn_t conn) {
+        loopback_tcp_t::conn_handlers_t handlers;
+
+        handlers.new_data = [&received](loopback_phys_t::cursor_t in) {
+            in.for_each([&received](const void *data, size_t size) {
+                const char *bytes = (const char *) data;
+
+                for (size_t i = 0; i < size; i++) {
+                    if (bytes[i] != _stream_byte(received + i)) {
+                        DRIVER_DIE(
+                            "Reassembly: corrupted byte at offset %zu",
+                            received + i
+                        );
+                    }
+                }
+
+                received += size;
+            });
+        };
+        handlers.remote_close   = [conn]() mutable { conn.close(); };
+        handlers.close          = []() { };
+        handlers.reset          = []() {
+            DRIVER_DIE("Reassembly: the connection has been reset");
+        };
+
+        return handlers;
+    });
+
+    // One buffer per segment of a round, as out of order segments are kept
+    // by the TCP layer until the gap is filled.
+
+    vector<char *> frames(N_SEGMENTS);
+    for (char *&frame : frames) {
+        if (posix_memalign((void **) &frame, BUFFER_ALIGN, FRAME_SIZE) != 0)
+            DRIVER_DIE("Unable to allocate the frames");
+    }
+
+    // Three-way handshake.
+
+    size_t size = _write_tcp_frame(
+        frames[0], CLIENT_ISS, 0, TCP_FLAG_SYN, 0, 0
+    );
+    loopback.receive_frame(frames[0], size);
+    loopback.ethernet.end_of_batch();
+
+    size = _write_tcp_frame(
+        frames[0], CLIENT_ISS + 1, SERVER_ISS + 1, TCP_FLAG_ACK, 0, 0
+    );
+    loopback.receive_frame(frames[0], size);
+    loopback.ethernet.end_of_batch();
+
+    loopback_phys_t::fixed_tcp_seq = false;
+
+    // Rounds.
+
+    size_t n_rounds = max(iterations / REASSEMBLY_ITERATIONS_PER_ROUND,
+                          (size_t) 1);
+
+    double total_ns = 0;
+
+    for (size_t round = 0; round < n_rounds; round++) {
+        size_t round_offset = round * REASSEMBLY_ROUND_SIZE;
+
+        vector<size_t> sizes(N_SEGMENTS);
+        for (size_t i = 0; i < N_SEGMENTS; i++) {
+            const reassembly_segment_t &segment = REASSEMBLY_SEGMENTS[i];
+            size_t offset = round_offset + segment.offset;
+
+            sizes[i] = _write_tcp_frame(
+                frames[i], CLIENT_ISS + 1 + offset, SERVER_ISS + 1,
+                TCP_FLAG_ACK, offset, segment.size
+            );
+        }
+
+        auto start = chrono::steady_clock::now();
+
+        loopback.timers.tick();
+
+        for (size_t i = 0; i < N_SEGMENTS; i++)
+            loopback.receive_frame(frames[i], sizes[i]);
+
+        loopback.ethernet.end_of_batch();
+
+        auto end = chrono::steady_clock::now();
+
+        total_ns += chrono::duration<double, nano>(end - start).count();
+
+        if (received != round_offset + REASSEMBLY_ROUND_SIZE) {
+            DRIVER_DIE(
+                "Reassembly: %zu bytes received after round %zu, expected %zu",
+                received, round, round_offset + REASSEMBLY_ROUND_SIZE
+            );
+        }
+    }
+
+    _report(results, "tcp_reassembly.overlap", total_ns / n_rounds, "ns");
+
+    for (char *frame : frames)
+        free(frame);
+}
+
+static void _bench_tcp_loss_recovery(results_t *results, size_t iterations)
+{
+    static const size_t FRAME_SIZE = 2048;
+
+    static const size_t DATA_SIZE = LOSS_N_SEGMENTS * LOSS_MSS;
+
+    // MSS and SACK-permitted options.
+    static const uint8_t SYN_OPTIONS[] = {
+        TCP_OPT_MSS, 4, LOSS_MSS >> 8, LOSS_MSS & 0xFF,
+        TCP_OPT_NOP, TCP_OPT_NOP, TCP_OPT_SACK_PERM, 2
+    };
+
+    net_t<loopback_ethernet_t::addr_t> server_ether, client_ether;
+    memcpy(server_ether.net.value, SERVER_ETHER, sizeof SERVER_ETHER);
+    memcpy(client_ether.net.value, CLIENT_ETHER, sizeof CLIENT_ETHER);
+
+    net_t<ipv4_addr_t> server_ipv4, client_ipv4;
+    server_ipv4.net.value = htonl(SERVER_IPV4);
+    client_ipv4.net.value = htonl(CLIENT_IPV4);
+
+    loopback_phys_t loopback;
+    loopback.init(server_ether, server_ipv4, { { client_ipv4, client_ether } });
+
+    // Answers any received data with DATA_SIZE bytes.
+
+    vector<char> data(DATA_SIZE);
+    for (size_t i = 0; i < DATA_SIZE; i++)
+        data[i] = _stream_byte(i);
+
+    loopback.ethernet.ipv4.tcp.listen(SERVER_PORT,
+    [&data](loopback_tcp_t::conn_t conn) {
+        loopback_tcp_t::conn_handlers_t handlers;
+
+        handlers.new_data =
+        [conn, &data](loopback_phys_t::cursor_t in) mutable {
+            conn.send(
+                DATA_SIZE,
+                [&data](size_t offset, loopback_phys_t::cursor_t out) {
+                    out.write(data.data() + offset, out.size());
+                },
+                []() { }
+            );
+        };
+        handlers.remote_close   = [conn]() mutable { conn.close(); };
+        handlers.close          = []() { };
+        handlers.reset          = []() {
+            DRIVER_DIE("Loss recovery: the connection has been reset");
+        };
+
+        return handlers;
+    });
+
+    // Records the sequence numbers of the transmitted data segments.
+
+    vector<uint32_t> sent_seqs;
+
+    loopback.on_send = [&sent_seqs](const char *frame, size_t size) {
+        const uint8_t *ipv4 = (const uint8_t *) frame + 14;
+        const uint8_t *tcp  = ipv4 + (ipv4[0] & 0xF) * 4;
+
+        uint16_t ipv4_size;
+        uint32_t seq;
+        memcpy(&ipv4_size, ipv4 + 2, 2);
+        memcpy(&seq, tcp + 4, 4);
+
+        size_t payload_size = ntohs(ipv4_size) - (tcp - ipv4)
+                            - (tcp[12] >> 4) * 4;
+
+        if (payload_size > 0)
+            sent_seqs.push_back(ntohl(seq));
+    };
+
+    char *frame;
+    if (posix_memalign((void **) &frame, BUFFER_ALIGN, FRAME_SIZE) != 0)
+        DRIVER_DIE("Unable to allocate the frame");
+
+    // Duplicate ACKs of the three last segments, with their SACK blocks.
+
+    vector<char *> dupacks(LOSS_N_SEGMENTS - 1);
+    for (char *&dupack : dupacks) {
+        if (posix_memalign((void **) &dupack, BUFFER_ALIGN, FRAME_SIZE) != 0)
+            DRIVER_DIE("Unable to allocate the frames");
+    }
+
+    vector<size_t> dupack_sizes(dupacks.size());
+
+    size_t n_rounds = min(
+        max(iterations / LOSS_ITERATIONS_PER_ROUND, (size_t) 1),
+        LOSS_MAX_ROUNDS
+    );
+
+    double total_ns = 0;
+
+    for (size_t round = 0; round < n_rounds; round++) {
+        uint16_t port = CLIENT_PORT + round;
+
+        uint32_t data_begin = SERVER_ISS + 1;
+
+        // Three-way handshake, followed by a one byte request.
+
+        loopback_phys_t::fixed_tcp_seq = true;
+        loopback_phys_t::next_tcp_seq  = loopback_phys_t::seq_t(SERVER_ISS);
+
+        size_t size = _write_tcp_frame(
+            frame, CLIENT_ISS, 0, TCP_FLAG_SYN, 0, 0, port, SYN_OPTIONS,
+            sizeof SYN_OPTIONS
+        );
+        loopback.receive_frame(frame, size);
+        loopback.ethernet.end_of_batch();
+
+        loopback_phys_t::fixed_tcp_seq = false;
+
+        size = _write_tcp_frame(
+            frame, CLIENT_ISS + 1, data_begin, TCP_FLAG_ACK, 0, 1, port
+        );
+
+        sent_seqs.clear();
+        loopback.receive_frame(frame, size);
+        loopback.ethernet.end_of_batch();
+
+        if (sent_seqs.size() != LOSS_N_SEGMENTS) {
+            DRIVER_DIE(
+                "Loss recovery: %zu segments sent, expected %zu",
+                sent_seqs.size(), LOSS_N_SEGMENTS
+            );
+        }
+
+        // The first segment is lost. Each following segment is SACKed by a
+        // duplicate ACK.
+
+        for (size_t i = 0; i < dupacks.size(); i++) {
+            uint32_t sack_begin = htonl(data_begin + LOSS_MSS);
+            uint32_t sack_end   = htonl(data_begin + (i + 2) * LOSS_MSS);
+
+            uint8_t options[12] = { TCP_OPT_NOP, TCP_OPT_NOP, TCP_OPT_SACK, 10 };
+            memcpy(options + 4, &sack_begin, 4);
+            memcpy(options + 8, &sack_end, 4);
+
+            dupack_sizes[i] = _write_tcp_frame(
+                dupacks[i], CLIENT_ISS + 2, data_begin, TCP_FLAG_ACK, 0, 0,
+                port, options, sizeof options
+            );
+        }
+
+        sent_seqs.clear();
+
+        auto start = chrono::steady_clock::now();
+
+        for (size_t i = 0; i < dupacks.size(); i++)
+            loopback.receive_frame(dupacks[i], dupack_sizes[i]);
+
+        loopback.ethernet.end_of_batch();
+
+        auto end = chrono::steady_clock::now();
+
+        total_ns += chrono::duration<double, nano>(end - start).count();
+
+        if (sent_seqs.empty() || sent_seqs.front() != data_begin) {
+            DRIVER_DIE(
+                "Loss recovery: the lost segment hasn't been retransmitted "
+                "after round %zu", round
+            );
+        }
+
+        // Acknowledges the whole data.
+
+        size = _write_tcp_frame(
+            frame, CLIENT_ISS + 2, data_begin + DATA_SIZE, TCP_FLAG_ACK, 0, 0,
+            port
+        );
+        loopback.receive_frame(frame, size);
+        loopback.ethernet.end_of_batch();
+    }
+
+    _report(results, "tcp_loss_recovery.sack", total_ns / n_rounds, "ns");
+
+    for (char *dupack : dupacks)
+        free(dupack);
+    free(frame);
+}
+
+static size_t _write_tcp_frame(
+    char *frame, uint32_t seq, uint32_t ack, uint8_t flags, size_t offset,
+    size_t payload_size, uint16_t client_port, const uint8_t *options,
+    size_t options_size
+)
+{
+    static const size_t ETH_HEADER_SIZE     = 14;
+    static const size_t IPV4_HEADER_SIZE    = 20;
+    static const size_t PSEUDO_HEADER_SIZE  = 12;
+
+    assert(options_size % 4 == 0);
+
+    const size_t TCP_HEADER_SIZE = 20 + options_size;
+
+    size_t tcp_size     = TCP_HEADER_SIZE + payload_size;
+    size_t ipv4_size    = IPV4_HEADER_SIZE + tcp_size;
+
+    uint8_t *eth    = (uint8_t *) frame;
+    uint8_t *ipv4   = eth + ETH_HEADER_SIZE;
+    uint8_t *tcp    = ipv4 + IPV4_HEADER_SIZE;
+
+    uint16_t u16;
+    uint32_t u32;
+
+    memcpy(eth,     SERVER_ETHER, 6);
+    memcpy(eth + 6, CLIENT_ETHER, 6);
+    u16 = htons(0x0800);                memcpy(eth + 12, &u16, 2);
+
+    memset(ipv4, 0, IPV4_HEADER_SIZE);
+    ipv4[0] = 0x45;                     // IPv4, 5 words header.
+    u16 = htons(ipv4_size);             memcpy(ipv4 + 2, &u16, 2);
+    ipv4[8] = 64;                       // TTL
+    ipv4[9] = 6;                        // TCP
+    u32 = htonl(CLIENT_IPV4);           memcpy(ipv4 + 12, &u32, 4);
+    u32 = htonl(SERVER_IPV4);           memcpy(ipv4 + 16, &u32, 4);
+
+    checksum_t ipv4_check(ipv4, IPV4_HEADER_SIZE);
+    memcpy(ipv4 + 10, &ipv4_check.value.net, 2);
+
+    memset(tcp, 0, TCP_HEADER_SIZE);
+    u16 = htons(client_port);           memcpy(tcp, &u16, 2);
+    u16 = htons(SERVER_PORT);           memcpy(tcp + 2, &u16, 2);
+    u32 = htonl(seq);                   memcpy(tcp + 4, &u32, 4);
+    u32 = htonl(ack);                   memcpy(tcp + 8, &u32, 4);
+    tcp[12] = TCP_HEADER_SIZE / 4 << 4; // Data offset.
+    tcp[13] = flags;
+    u16 = htons(65535);                 memcpy(tcp + 14, &u16, 2);
+
+    if (options_size > 0)
+        memcpy(tcp + 20, options, options_size);
+
+    for (size_t i = 0; i < payload_size; i++)
+        tcp[TCP_HEADER_SIZE + i] = _stream_byte(offset + i);
+
+    // The TCP checksum is computed over a pseudo-header which precedes the
+    // segment. Its 12 bytes overwrite the end of the IPv4 header, which is
+    // restored afterwards.
+
+    uint8_t *pseudo = tcp - PSEUDO_HEADER_SIZE;
+
+    uint8_t saved[PSEUDO_HEADER_SIZE];
+    memcpy(saved, pseudo, PSEUDO_HEADER_SIZE);
+
+    u32 = htonl(CLIENT_IPV4);           memcpy(pseudo, &u32, 4);
+    u32 = htonl(SERVER_IPV4);           memcpy(pseudo + 4, &u32, 4);
+    pseudo[8] = 0;
+    pseudo[9] = 6;
+    u16 = htons(tcp_size);              memcpy(pseudo + 10, &u16, 2);
+
+    checksum_t tcp_check(pseudo, PSEUDO_HEADER_SIZE + tcp_size);
+
+    memcpy(pseudo, saved, PSEUDO_HEADER_SIZE);
+    memcpy(tcp + 16, &tcp_check.value.net, 2);
+
+    return ETH_HEADER_SIZE + ipv4_size;
+}
+
+static inline char _stream_byte(size_t offset)
+{
+    // 251 is prime, so the pattern never aligns with the rounds.
+    return (char) (offset % 251);
+}
+
+static bool _parse_count(const char *str, size_t *count)
+{
+    // 'strtoull()' would otherwise skip spaces and accept negative numbers.
+    if (!isdigit((unsigned char) str[0]))
+        return false;
+
+    char *end;
+    errno = 0;
+    unsigned long long value = strtoull(str, &end, 10);
+
+    if (*end != '\0' || errno != 0 || value == 0)
+        return false;
+
+    *count = value;
+    return true;
+}
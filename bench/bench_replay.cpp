@@ -0,0 +1,582 @@
+//
+// Replays a packet trace through the network stack, on the loopback physical
+// layer, and measures the processing rate of the received frames.
+//
+// Usage: ./bench/bench_replay <trace.pcap> <ipv4> [<rounds> [<results file>]]
+//
+// The trace must be a pcap file of Ethernet frames captured on a server whose
+// IPv4 address is <ipv4>. Only the frames received by the server are given to
+// the network stack; the ones it sent are used to:
+//
+// * listen on the TCP ports which accepted connections, with an application
+//   which discards the received data;
+// * learn the Ethernet addresses of the clients, which are given as static ARP
+//   entries;
+// * reuse the initial sequence numbers of the server, so the segments of the
+//   trace acknowledge the SYN-ACK segments of the network stack.
+//
+// The trace is replayed <rounds> times, each time on a new network stack.
+// Counters of the network stack are given for a single round.
+//
+// Copyright 2015 Raphael Javaux <raphaeljavaux@gmail.com>
+// University of Liege.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <algorithm>            // find(), min()
+#include <cctype>               // isdigit()
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>            // PRIu64
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h>          // inet_aton()
+#include <net/ethernet.h>       // ETH_ALEN, ETHERTYPE_ARP, ETHERTYPE_IP
+
+#include "bench/loopback.hpp"   // loopback_t, BUFFER_ALIGN
+#include "bench/results.hpp"    // results_t
+#include "net/endian.hpp"       // net_t, to_host()
+#include "net/ipv4.hpp"         // ipv4_addr_t
+#include "util/cycle.hpp"       // get_cycle_count()
+
+using namespace std;
+
+using namespace rusty::bench;
+using namespace rusty::net;
+
+typedef loopback_t<>                                    loopback_phys_t;
+typedef loopback_phys_t::ethernet_t                     loopback_ethernet_t;
+typedef loopback_ethernet_t::ipv4_ethernet_t::tcp_ipv4_t loopback_tcp_t;
+typedef loopback_ethernet_t::arp_ethernet_ipv4_t::static_entry_t
+                                                        arp_entry_t;
+
+// Same default as the mPIPE driver.
+static const size_t RX_BATCH_SIZE = 16;
+
+static const size_t DEFAULT_ROUNDS = 100;
+
+// pcap file format (https://wiki.wireshark.org/Development/LibpcapFileFormat).
+
+static const uint32_t PCAP_MAGIC            = 0xA1B2C3D4;
+static const uint32_t PCAP_MAGIC_NSEC       = 0xA1B23C4D;
+static const uint32_t PCAP_LINKTYPE_ETHERNET = 1;
+
+struct pcap_header_t {
+    uint32_t    magic;
+    uint16_t    version_major;
+    uint16_t    version_minor;
+    int32_t     thiszone;
+    uint32_t    sigfigs;
+    uint32_t    snaplen;
+    uint32_t    network;
+} __attribute__ ((__packed__));
+
+struct pcap_record_t {
+    uint32_t    ts_sec;
+    uint32_t    ts_frac;
+    uint32_t    incl_len;
+    uint32_t    orig_len;
+} __attribute__ ((__packed__));
+
+// Offsets of the fields read in the frames of the trace.
+static const size_t ETH_TYPE_OFFSET     = 12;
+static const size_t ETH_HEADER_SIZE     = 14;
+static const size_t IPV4_SADDR_OFFSET   = 12;
+static const size_t IPV4_DADDR_OFFSET   = 16;
+static const size_t TCP_SEQ_OFFSET      = 4;
+static const size_t TCP_FLAGS_OFFSET    = 13;
+
+static const uint8_t TCP_FLAG_SYN       = 0x02;
+static const uint8_t TCP_FLAG_ACK       = 0x10;
+
+// Frame received by the server, copied in a buffer aligned as an mPIPE buffer.
+struct frame_t {
+    char        *data;
+    size_t      size;
+
+    // True if the frame is a SYN segment answered by the server of the trace.
+    // 'iss' is then the initial sequence number of the server.
+    bool        has_iss;
+    uint32_t    iss;
+};
+
+struct trace_t {
+    // Ethernet address of the server.
+    net_t<loopback_ethernet_t::addr_t> ether_addr;
+
+    vector<frame_t>                 frames;
+
+    vector<arp_entry_t>             arp_entries;
+
+    // Ports on which the server accepted connections.
+    vector<uint16_t>                tcp_ports;
+
+    // Memory which holds the frames.
+    char                            *mem;
+};
+
+// Reads the frames of the trace.
+//
+// Fails if the file is not a pcap trace of Ethernet frames, or if it doesn't
+// contain any IPv4 datagram sent to 'ipv4_addr'.
+static bool _load_trace(
+    const char *path, net_t<ipv4_addr_t> ipv4_addr, trace_t *trace
+);
+
+// Gives the frames of the trace to a new network stack, by batches of
+// RX_BATCH_SIZE frames.
+//
+// Adds the processing time to 'cycles' and 'seconds'. If 'stats' is not
+// 'nullptr', adds the counters of the network stack to it.
+static void _replay(
+    const trace_t &trace, net_t<ipv4_addr_t> ipv4_addr, uint64_t *cycles,
+    double *seconds, results_t *stats
+);
+
+// Creates the handlers of a connection which discards the received data and
+// which closes when the remote closes.
+static loopback_tcp_t::conn_handlers_t _discard_conn(
+    loopback_tcp_t::conn_t conn
+);
+
+static void _do_nothing(void);
+
+// Parses a strictly positive decimal count from the command line. Returns
+// 'false' if the string is not such a number.
+static bool _parse_count(const char *str, size_t *count);
+
+int main(int argc, char **argv)
+{
+    size_t rounds = DEFAULT_ROUNDS;
+
+    if (
+           argc < 3 || argc > 5
+        || (argc >= 4 && !_parse_count(argv[3], &rounds))
+    ) {
+        fprintf(
+            stderr, "Usage: %s <trace.pcap> <ipv4> [<rounds> [<results file>]]"
+            "\n", argv[0]
+        );
+        return EXIT_FAILURE;
+    }
+
+    struct in_addr in_addr;
+    if (inet_aton(argv[2], &in_addr) != 1) {
+        fprintf(stderr, "Failed to parse the IPv4.\n");
+        return EXIT_FAILURE;
+    }
+    net_t<ipv4_addr_t> ipv4_addr = ipv4_addr_t::from_in_addr(in_addr);
+
+    const char *results_path = argc == 5 ? argv[4] : nullptr;
+
+    trace_t trace;
+    if (!_load_trace(argv[1], ipv4_addr, &trace))
+        return EXIT_FAILURE;
+
+    printf(
+        "%zu frames received by %s (%s), %zu TCP ports, %zu clients\n",
+        trace.frames.size(),
+        loopback_ethernet_t::addr_t::to_alpha(trace.ether_addr),
+        ipv4_addr_t::to_alpha(ipv4_addr), trace.tcp_ports.size(),
+        trace.arp_entries.size()
+    );
+
+    uint64_t    cycles  = 0;
+    double      seconds = 0;
+
+    results_t results;
+
+    // Counters of the network stack are only reported for the first round, as
+    // every round processes the same frames.
+    for (size_t round = 0; round < rounds; round++) {
+        _replay(
+            trace, ipv4_addr, &cycles, &seconds,
+            round == 0 ? &results : nullptr
+        );
+    }
+
+    uint64_t n_packets = trace.frames.size() * rounds;
+
+    results.results.insert(
+        results.results.begin(), {
+            { "replay.packets_per_sec", n_packets / seconds, "pps" },
+            {
+                "replay.cycles_per_packet", (double) cycles / n_packets,
+                "cycles"
+            },
+            { "replay.ns_per_packet", seconds * 1e9 / n_packets, "ns" }
+        }
+    );
+
+    for (const result_t &result : results.results) {
+        printf(
+            "%-40s %14.2f %8s\n", result.name.c_str(), result.value,
+            result.unit.c_str()
+        );
+    }
+
+    free(trace.mem);
+
+    if (results_path != nullptr && !results.save(results_path, "replay")) {
+        fprintf(stderr, "Failed to write %s\n", results_path);
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
+
+static void _replay(
+    const trace_t &trace, net_t<ipv4_addr_t> ipv4_addr, uint64_t *cycles,
+    double *seconds, results_t *stats
+)
+{
+    loopback_phys_t loopback;
+    loopback.init(trace.ether_addr, ipv4_addr, trace.arp_entries);
+
+    for (uint16_t port : trace.tcp_ports)
+        loopback.ethernet.ipv4.tcp.listen(port, _discard_conn);
+
+    size_t n_frames = trace.frames.size();
+
+    auto        start        = chrono::steady_clock::now();
+    uint64_t    start_cycles = get_cycle_count();
+
+    for (size_t i = 0; i < n_frames; i += RX_BATCH_SIZE) {
+        loopback.timers.tick();
+
+        size_t batch_end = min(i + RX_BATCH_SIZE, n_frames);
+
+        for (size_t j = i; j < batch_end; j++) {
+            const frame_t &frame = trace.frames[j];
+
+            loopback_phys_t::fixed_tcp_seq = frame.has_iss;
+            loopback_phys_t::next_tcp_seq  = frame.iss;
+
+            loopback.receive_frame(frame.data, frame.size);
+        }
+
+        loopback.ethernet.end_of_batch();
+    }
+
+    uint64_t    end_cycles = get_cycle_count();
+    auto        end        = chrono::steady_clock::now();
+
+    *cycles  += end_cycles - start_cycles;
+    *seconds += chrono::duration<double>(end - start).count();
+
+    if (stats == nullptr)
+        return;
+
+    stats->add("replay.rx_packets", n_frames, "count");
+    stats->add("replay.tx_packets", loopback.tx_packets, "count");
+    stats->add("replay.tx_bytes", loopback.tx_bytes, "count");
+
+    loopback.ethernet.for_each_stat(
+        [stats](const char *name, uint64_t value)
+        {
+            stats->add(string("replay.") + name, value, "count");
+        }
+    );
+}
+
+// Reads a 32 bits integer in network byte order.
+static inline uint32_t _read_u32(const char *data)
+{
+    uint32_t value;
+    memcpy(&value, data, sizeof value);
+    return to_host(value);
+}
+
+static inline uint16_t _read_u16(const char *data)
+{
+    uint16_t value;
+    memcpy(&value, data, sizeof value);
+    return to_host(value);
+}
+
+// Returns the offset of the TCP header of the IPv4 frame, or zero if the frame
+// doesn't contain a complete TCP header.
+static size_t _tcp_header_offset(const string &frame)
+{
+    static const size_t IPV4_PROTOCOL_OFFSET = 9;
+    static const uint8_t IPPROTO_TCP_VALUE   = 6;
+
+    const char *ip = frame.data() + ETH_HEADER_SIZE;
+
+    size_t ihl = ((uint8_t) ip[0] & 0xF) * 4;
+
+    if (
+           frame.size() < ETH_HEADER_SIZE + ihl + 20
+        || (uint8_t) ip[IPV4_PROTOCOL_OFFSET] != IPPROTO_TCP_VALUE
+    )
+        return 0;
+
+    return ETH_HEADER_SIZE + ihl;
+}
+
+static bool _load_trace(
+    const char *path, net_t<ipv4_addr_t> ipv4_addr, trace_t *trace
+)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == nullptr) {
+        fprintf(stderr, "Unable to open %s\n", path);
+        return false;
+    }
+
+    pcap_header_t header;
+    if (fread(&header, sizeof header, 1, file) != 1) {
+        fprintf(stderr, "%s is not a pcap file\n", path);
+        fclose(file);
+        return false;
+    }
+
+    // Traces written on a host of the other endianness have their fields
+    // swapped.
+    bool swapped = header.magic == __builtin_bswap32(PCAP_MAGIC)
+                || header.magic == __builtin_bswap32(PCAP_MAGIC_NSEC);
+
+    auto u32 = [swapped](uint32_t value) {
+        return swapped ? __builtin_bswap32(value) : value;
+    };
+
+    if (
+           !swapped && header.magic != PCAP_MAGIC
+        && header.magic != PCAP_MAGIC_NSEC
+    ) {
+        fprintf(stderr, "%s is not a pcap file\n", path);
+        fclose(file);
+        return false;
+    }
+
+    if (u32(header.network) != PCAP_LINKTYPE_ETHERNET) {
+        fprintf(stderr, "%s doesn't contain Ethernet frames\n", path);
+        fclose(file);
+        return false;
+    }
+
+    // Reads every frame of the trace.
+
+    vector<string> frames;
+
+    pcap_record_t record;
+    while (fread(&record, sizeof record, 1, file) == 1) {
+        string frame(u32(record.incl_len), '\0');
+
+        if (fread(&frame[0], 1, frame.size(), file) != frame.size()) {
+            fprintf(stderr, "%s is truncated\n", path);
+            fclose(file);
+            return false;
+        }
+
+        // Ignores truncated frames.
+        if (frame.size() == u32(record.orig_len))
+            frames.push_back(move(frame));
+    }
+
+    fclose(file);
+
+    // Splits the frames sent to and by the server, and retains the initial
+    // sequence numbers of its SYN-ACK segments.
+
+    uint32_t local = ipv4_addr.net.value;
+
+    vector<const string *>  received;
+    map<uint64_t, uint32_t> server_iss;   // (raddr, rport, lport) -> ISS
+
+    // Identifier of a TCP connection.
+    auto conn_key = [](uint32_t raddr, uint16_t rport, uint16_t lport) {
+        return ((uint64_t) raddr << 32) | ((uint64_t) rport << 16) | lport;
+    };
+
+    bool has_ether_addr = false;
+
+    for (const string &frame : frames) {
+        if (frame.size() < ETH_HEADER_SIZE + 20)
+            continue;
+
+        const char *data = frame.data();
+        uint16_t type = _read_u16(data + ETH_TYPE_OFFSET);
+
+        if (type == ETHERTYPE_ARP) {
+            received.push_back(&frame);
+            continue;
+        } else if (type != ETHERTYPE_IP)
+            continue;
+
+        const char *ip = data + ETH_HEADER_SIZE;
+
+        uint32_t saddr, daddr;
+        memcpy(&saddr, ip + IPV4_SADDR_OFFSET, sizeof saddr);
+        memcpy(&daddr, ip + IPV4_DADDR_OFFSET, sizeof daddr);
+
+        size_t tcp_offset = _tcp_header_offset(frame);
+        uint8_t flags     = tcp_offset > 0
+                          ? (uint8_t) data[tcp_offset + TCP_FLAGS_OFFSET] : 0;
+
+        if (daddr == local) {
+            received.push_back(&frame);
+
+            if (!has_ether_addr) {
+                memcpy(trace->ether_addr.net.value, data, ETH_ALEN);
+                has_ether_addr = true;
+            }
+
+            // Learns the Ethernet address of the client.
+            arp_entry_t entry;
+            entry.proto_addr.net = ipv4_addr_t { saddr };
+            memcpy(entry.data_link_addr.net.value, data + ETH_ALEN, ETH_ALEN);
+
+            bool known = false;
+            for (const arp_entry_t &other : trace->arp_entries) {
+                if (other.proto_addr == entry.proto_addr) {
+                    known = true;
+                    break;
+                }
+            }
+
+            if (!known)
+                trace->arp_entries.push_back(entry);
+        } else if (
+               saddr == local
+            && (flags & (TCP_FLAG_SYN | TCP_FLAG_ACK))
+                == (TCP_FLAG_SYN | TCP_FLAG_ACK)
+        ) {
+            const char *tcp = data + tcp_offset;
+
+            uint16_t lport = _read_u16(tcp),
+                     rport = _read_u16(tcp + 2);
+
+            server_iss[conn_key(daddr, rport, lport)] =
+                _read_u32(tcp + TCP_SEQ_OFFSET);
+
+            if (
+                   find(trace->tcp_ports.begin(), trace->tcp_ports.end(), lport)
+                == trace->tcp_ports.end()
+            )
+                trace->tcp_ports.push_back(lport);
+        }
+    }
+
+    if (!has_ether_addr) {
+        fprintf(
+            stderr, "%s doesn't contain any datagram sent to %s\n", path,
+            ipv4_addr_t::to_alpha(ipv4_addr)
+        );
+        return false;
+    }
+
+    // Copies the received frames in buffers aligned as mPIPE buffers. Frames
+    // start two bytes after the beginning of their buffer, so the IPv4 header
+    // is aligned on a 4 bytes boundary.
+
+    static const size_t FRAME_OFFSET = 2;
+
+    size_t mem_size = 0;
+    for (const string *frame : received) {
+        mem_size += (FRAME_OFFSET + frame->size() + BUFFER_ALIGN - 1)
+                  / BUFFER_ALIGN * BUFFER_ALIGN;
+    }
+
+    if (posix_memalign((void **) &trace->mem, BUFFER_ALIGN, mem_size) != 0) {
+        fprintf(stderr, "Unable to allocate the frames\n");
+        return false;
+    }
+
+    char *buffer = trace->mem;
+
+    for (const string *frame : received) {
+        frame_t copy;
+        copy.data       = buffer + FRAME_OFFSET;
+        copy.size       = frame->size();
+        copy.has_iss    = false;
+        copy.iss        = 0;
+
+        memcpy(copy.data, frame->data(), frame->size());
+
+        bool is_ipv4 =
+            _read_u16(frame->data() + ETH_TYPE_OFFSET) == ETHERTYPE_IP;
+        size_t tcp_offset = is_ipv4 ? _tcp_header_offset(*frame) : 0;
+
+        if (
+               tcp_offset > 0
+            && ((uint8_t) (*frame)[tcp_offset + TCP_FLAGS_OFFSET]
+                & (TCP_FLAG_SYN | TCP_FLAG_ACK)) == TCP_FLAG_SYN
+        ) {
+            const char *ip  = frame->data() + ETH_HEADER_SIZE;
+            const char *tcp = frame->data() + tcp_offset;
+
+            uint32_t saddr;
+            memcpy(&saddr, ip + IPV4_SADDR_OFFSET, sizeof saddr);
+
+            auto it = server_iss.find(
+                conn_key(saddr, _read_u16(tcp), _read_u16(tcp + 2))
+            );
+
+            if (it != server_iss.end()) {
+                copy.has_iss = true;
+                copy.iss     = it->second;
+            }
+        }
+
+        trace->frames.push_back(copy);
+
+        buffer += (FRAME_OFFSET + frame->size() + BUFFER_ALIGN - 1)
+                / BUFFER_ALIGN * BUFFER_ALIGN;
+    }
+
+    return true;
+}
+
+static loopback_tcp_t::conn_handlers_t _discard_conn(
+    loopback_tcp_t::conn_t conn
+)
+{
+    loopback_tcp_t::conn_handlers_t handlers;
+
+    handlers.new_data       = [](loopback_phys_t::cursor_t) { };
+    handlers.remote_close   = [conn]() mutable { conn.close(); };
+    handlers.close          = _do_nothing;
+    handlers.reset          = _do_nothing;
+
+    return handlers;
+}
+
+static void _do_nothing(void)
+{
+}
+
+static bool _parse_count(const char *str, size_t *count)
+{
+    // 'strtoull()' would otherwise skip spaces and accept negative numbers.
+    if (!isdigit((unsigned char) str[0]))
+        return false;
+
+    char *end;
+    errno = 0;
+    unsigned long long value = strtoull(str, &end, 10);
+
+    if (*end != '\0' || errno != 0 || value == 0)
+        return false;
+
+    *count = value;
+    return true;
+}
@@ -0,0 +1,241 @@
+//
+// Physical layer which runs the network stack on frames held in memory,
+// without any mPIPE queue.
+//
+// Copyright 2015 Raphael Javaux <raphaeljavaux@gmail.com>
+// University of Liege.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __RUSTY_BENCH_LOOPBACK_HPP__
+#define __RUSTY_BENCH_LOOPBACK_HPP__
+
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>              // posix_memalign(), free()
+#include <functional>           // function
+#include <memory>               // allocator
+#include <utility>              // move()
+#include <vector>
+
+#ifdef __tilegx__
+    #include <gxio/mpipe.h>     // gxio_mpipe_bdesc_t
+#endif /* __tilegx__ */
+
+#include "driver/buffer.hpp"    // cursor_t, static_extent_t, DRIVER_DIE()
+#include "driver/clock.hpp"     // cpu_clock_t
+#include "driver/cpu.hpp"       // cycles_t, CYCLES_PER_SECOND
+#include "driver/timer.hpp"     // cpu_timer_manager_t
+#include "driver/timer_wheel.hpp" // wheel_timer_manager_t
+#include "net/endian.hpp"       // net_t
+#include "net/ethernet.hpp"     // ethernet_t
+#include "util/cycle.hpp"       // get_cycle_count()
+
+using namespace std;
+
+namespace rusty {
+namespace bench {
+
+// Cursors given to the network stack reference packet buffers as mPIPE
+// buffers would. Buffers must start on a 128 bytes boundary and can't be larger
+// than the largest mPIPE buffer.
+static const size_t BUFFER_ALIGN    = 128;
+static const size_t MAX_BUFFER_SIZE = 16384;
+
+// Returns an unmanaged cursor over the 'size' bytes at 'data', which must be in
+// a buffer aligned on BUFFER_ALIGN bytes, at less than BUFFER_ALIGN bytes from
+// its beginning.
+//
+// The memory doesn't need to be registered, as it is never given to the mPIPE.
+// Off the TILE-Gx, the cursor is an unmanaged cursor of the host driver.
+inline driver::buffer::cursor_t make_cursor(char *data, size_t size)
+{
+    size_t offset = (uintptr_t) data % BUFFER_ALIGN;
+    assert(offset + size <= MAX_BUFFER_SIZE);
+
+    #ifdef __tilegx__
+        gxio_mpipe_bdesc_t bdesc;
+        bdesc.word          = 0;
+        bdesc.va            = ((uintptr_t) data - offset) >> 7;
+        bdesc.__reserved_0  = offset;
+        bdesc.size          = GXIO_MPIPE_BUFFER_SIZE_16384;
+        bdesc.c             = MPIPE_EDMA_DESC_WORD1__C_VAL_UNCHAINED;
+
+        return driver::buffer::cursor_t(nullptr, &bdesc, size, false);
+    #else
+        (void) offset;
+        return driver::buffer::cursor_t(nullptr, nullptr, data, size, false);
+    #endif /* __tilegx__ */
+}
+
+// Physical layer which gives frames to the Ethernet layer from the calling
+// thread and which discards the frames sent by the network stack.
+//
+// Implements the interface of 'mpipe_t::instance_t' that the network layers
+// need: member types, 'send_packet()', 'max_packet_size()', 'tx_congested()'
+// and 'get_current_tcp_seq()'.
+template <typename alloc_t = allocator<char *>>
+struct loopback_t {
+    //
+    // Member types
+    //
+
+    typedef loopback_t<alloc_t>                 this_t;
+
+    typedef driver::cpu_clock_t                 clock_t;
+    typedef driver::buffer::cursor_t            cursor_t;
+    typedef driver::buffer::static_extent_t     static_extent_t;
+
+    #ifdef USE_TIMER_WHEEL
+        typedef driver::wheel_timer_manager_t<alloc_t> timer_manager_t;
+    #else
+        typedef driver::cpu_timer_manager_t<alloc_t>   timer_manager_t;
+    #endif /* USE_TIMER_WHEEL */
+
+    typedef net::ethernet_t<this_t, alloc_t>    ethernet_t;
+    typedef typename ethernet_t::ipv4_ethernet_t::tcp_ipv4_t::seq_t seq_t;
+
+    //
+    // Static fields
+    //
+
+    // Initial sequence number returned by 'get_current_tcp_seq()' when
+    // 'fixed_tcp_seq' is true.
+    //
+    // Allows a replayed trace to acknowledge the SYN-ACK segments of the
+    // network stack.
+    static bool                                 fixed_tcp_seq;
+    static seq_t                                next_tcp_seq;
+
+    //
+    // Fields
+    //
+
+    // Declared before 'ethernet' as the timers of the network stack are
+    // removed when it is destructed.
+    timer_manager_t                             timers;
+
+    ethernet_t                                  ethernet;
+
+    // Transmitted frames are written in this buffer and are discarded.
+    char                                        *tx_buffer;
+
+    uint64_t                                    tx_packets = 0;
+    uint64_t                                    tx_bytes   = 0;
+
+    // If set, called with the written part of each transmitted frame, before
+    // it is discarded.
+    function<void(const char *, size_t)>        on_send;
+
+    //
+    // Methods
+    //
+
+    loopback_t(alloc_t alloc = alloc_t())
+        : timers(alloc), ethernet(alloc), tx_buffer(nullptr)
+    {
+        if (posix_memalign(
+            (void **) &tx_buffer, BUFFER_ALIGN, MAX_BUFFER_SIZE
+        ) != 0)
+            DRIVER_DIE("Unable to allocate the transmission buffer");
+    }
+
+    loopback_t(const loopback_t &other) = delete;
+
+    ~loopback_t(void)
+    {
+        free(tx_buffer);
+    }
+
+    void init(
+        net_t<typename ethernet_t::addr_t> ether_addr,
+        net_t<typename ethernet_t::ipv4_ethernet_t::addr_t> ipv4_addr,
+        vector<typename ethernet_t::arp_ethernet_ipv4_t::static_entry_t>
+            static_arp_entries
+    )
+    {
+        ethernet.init(this, &timers, ether_addr, ipv4_addr, static_arp_entries);
+    }
+
+    // Gives the frame to the Ethernet layer. See 'make_cursor()' for the
+    // alignment of 'data'.
+    inline void receive_frame(char *data, size_t size)
+    {
+        ethernet.receive_frame(make_cursor(data, size));
+    }
+
+    template <typename packet_writer_t>
+    inline void send_packet(size_t packet_size, packet_writer_t packet_writer)
+    {
+        this->send_packet(packet_size, move(packet_writer), static_extent_t());
+    }
+
+    // The static tail of the packet is never read.
+    template <typename packet_writer_t>
+    inline void send_packet(
+        size_t packet_size, packet_writer_t packet_writer,
+        static_extent_t tail
+    )
+    {
+        assert(packet_size <= max_packet_size());
+        assert(tail.size <= packet_size);
+
+        packet_writer(make_cursor(tx_buffer, packet_size - tail.size));
+
+        if (on_send)
+            on_send(tx_buffer, packet_size - tail.size);
+
+        tx_packets++;
+        tx_bytes += packet_size;
+    }
+
+    // Same limit as the mPIPE driver.
+    inline size_t max_packet_size(void)
+    {
+        #ifdef MPIPE_JUMBO_FRAMES
+            return 9014;
+        #else
+            return 1500;
+        #endif /* MPIPE_JUMBO_FRAMES */
+    }
+
+    // Transmitted frames are discarded, buffers never run out.
+    inline bool tx_congested(size_t packet_size) const
+    {
+        return false;
+    }
+
+    static inline seq_t get_current_tcp_seq(void)
+    {
+        if (fixed_tcp_seq)
+            return next_tcp_seq;
+
+        // Same clock as the mPIPE driver (incremented every ~ 4 µs).
+        static const driver::cpu::cycles_t DELAY =
+            driver::cpu::CYCLES_PER_SECOND * 4 / 1000000;
+
+        return seq_t((uint32_t) get_cycle_count() / DELAY);
+    }
+};
+
+template <typename alloc_t>
+bool loopback_t<alloc_t>::fixed_tcp_seq = false;
+
+template <typename alloc_t>
+typename loopback_t<alloc_t>::seq_t loopback_t<alloc_t>::next_tcp_seq;
+
+} } /* namespace rusty::bench */
+
+#endif /* __RUSTY_BENCH_LOOPBACK_HPP__ */
@@ -0,0 +1,200 @@
+//
+// Results file of the benchmarks, which can be compared between separate runs
+// with 'bench_compare'.
+//
+// A results file is a text file with one measure per line:
+//
+//      <name> <value> <unit>
+//
+// Names and units don't contain spaces. Lines starting with '#' are comments
+// and describe the run (date, host and compilation flags).
+//
+// Copyright 2015 Raphael Javaux <raphaeljavaux@gmail.com>
+// University of Liege.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __RUSTY_BENCH_RESULTS_HPP__
+#define __RUSTY_BENCH_RESULTS_HPP__
+
+#include <cstdio>
+#include <cstring>
+#include <ctime>                // time(), strftime()
+#include <string>
+#include <vector>
+
+#include <unistd.h>             // gethostname()
+
+using namespace std;
+
+namespace rusty {
+namespace bench {
+
+struct result_t {
+    string      name;
+    double      value;
+    string      unit;
+
+    // True if a smaller value is a better result (durations).
+    inline bool lower_is_better(void) const
+    {
+        return unit == "ns" || unit == "cycles";
+    }
+
+    // True if a larger value is a better result (throughputs). Counters
+    // ("count" unit) are neither better nor worse.
+    inline bool higher_is_better(void) const
+    {
+        return unit == "pps" || unit == "GB/s";
+    }
+};
+
+struct results_t {
+    vector<result_t>    results;
+
+    inline void add(const string &name, double value, const string &unit)
+    {
+        results.push_back({ name, value, unit });
+    }
+
+    // Returns the measure with the given name, or 'nullptr'.
+    const result_t *find(const string &name) const
+    {
+        for (const result_t &result : results) {
+            if (result.name == name)
+                return &result;
+        }
+
+        return nullptr;
+    }
+
+    // Writes the results to the file, preceded by a description of the run.
+    //
+    // Returns 'false' if the file can't be written.
+    bool save(const char *path, const char *benchmark) const
+    {
+        FILE *file = fopen(path, "w");
+        if (file == nullptr)
+            return false;
+
+        char date[64];
+        time_t now = time(nullptr);
+        strftime(date, sizeof date, "%Y-%m-%dT%H:%M:%S", localtime(&now));
+
+        char host[256] = "unknown";
+        gethostname(host, sizeof host - 1);
+
+        fprintf(file, "# benchmark %s\n", benchmark);
+        fprintf(file, "# date %s\n", date);
+        fprintf(file, "# host %s\n", host);
+        fprintf(file, "# flags%s\n", _flags());
+
+        for (const result_t &result : results) {
+            fprintf(
+                file, "%s %.6g %s\n", result.name.c_str(), result.value,
+                result.unit.c_str()
+            );
+        }
+
+        bool success = !ferror(file);
+        return fclose(file) == 0 && success;
+    }
+
+    // Reads the results from a file written by 'save()'.
+    //
+    // Returns 'false' if the file can't be read or is malformed.
+    bool load(const char *path)
+    {
+        FILE *file = fopen(path, "r");
+        if (file == nullptr)
+            return false;
+
+        char line[512];
+        while (fgets(line, sizeof line, file) != nullptr) {
+            if (line[0] == '#' || line[0] == '\n')
+                continue;
+
+            char name[256], unit[64];
+            double value;
+
+            if (sscanf(line, "%255s %lf %63s", name, &value, unit) != 3) {
+                fclose(file);
+                return false;
+            }
+
+            add(name, value, unit);
+        }
+
+        fclose(file);
+        return true;
+    }
+
+private:
+    // Compilation flags which change the performances of the network stack.
+    static const char *_flags(void)
+    {
+        return ""
+            #ifdef USE_TILE_ALLOCATOR
+                " USE_TILE_ALLOCATOR"
+            #endif
+            #ifdef USE_SLAB_ALLOCATOR
+                " USE_SLAB_ALLOCATOR"
+            #endif
+            #ifdef USE_TIMER_WHEEL
+                " USE_TIMER_WHEEL"
+            #endif
+            #ifdef USE_PRECOMPUTED_CHECKSUMS
+                " USE_PRECOMPUTED_CHECKSUMS"
+            #endif
+            #ifdef TCP_LAZY_TIMERS
+                " TCP_LAZY_TIMERS"
+            #endif
+            #ifdef TCP_FLOW_HASH
+                " TCP_FLOW_HASH"
+            #endif
+            #ifdef TCP_CC_CUBIC
+                " TCP_CC_CUBIC"
+            #endif
+            #ifdef TCP_CC_BBR
+                " TCP_CC_BBR"
+            #endif
+            #ifdef TCP_PACING
+                " TCP_PACING"
+            #endif
+            #ifdef MPIPE_JUMBO_FRAMES
+                " MPIPE_JUMBO_FRAMES"
+            #endif
+            #ifdef MPIPE_CHAINED_BUFFERS
+                " MPIPE_CHAINED_BUFFERS"
+            #endif
+            #ifdef MPIPE_ZERO_COPY
+                " MPIPE_ZERO_COPY"
+            #endif
+            #ifdef USE_TRACING
+                " USE_TRACING"
+            #endif
+            #ifdef BRANCH_PREDICT
+                " BRANCH_PREDICT"
+            #endif
+            #ifdef NDEBUG
+                " NDEBUG"
+            #endif
+            ;
+    }
+};
+
+} } /* namespace rusty::bench */
+
+#endif /* __RUSTY_BENCH_RESULTS_HPP__ */
@@ -164,7 +164,15 @@ struct tile_allocator_t {
     {
         // DRIVER_DEBUG("allocate<%s>(%zu)", typeid (T).name(), length);
 
-        return (T*) tmc_mspace_malloc(*mspace, length * sizeof (T));
+        // Objects aligned on cache lines (e.g. the counters of the workers)
+        // need more than the alignment of 'tmc_mspace_malloc()', which is
+        // only suitable for the scalar types.
+        if (alignof (T) > __BIGGEST_ALIGNMENT__) {
+            return (T*) tmc_mspace_memalign(
+                *mspace, alignof (T), length * sizeof (T)
+            );
+        } else
+            return (T*) tmc_mspace_malloc(*mspace, length * sizeof (T));
     }
 
     inline void deallocate(T* ptr, size_t length)
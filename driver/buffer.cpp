@@ -19,30 +19,21 @@
 //
 
 #include <cstdint>
-#include <memory>               // shared_ptr, make_shared
-
-#include <arch/cycle.h>         // get_cycle_count()
-
-#include <gxio/mpipe.h>         // MPIPE_EDMA_DESC_*
 
 #include "driver/driver.hpp"
 
 #include "driver/buffer.hpp"
-#include "driver/allocator.hpp"
 
 namespace rusty {
 namespace driver {
 namespace buffer {
 
+thread_local _buffer_desc_pool_t _buffer_desc_pool = { nullptr };
+
 #ifdef MPIPE_CHAINED_BUFFERS
-    const cursor_t cursor_t::EMPTY = {
-        shared_ptr<_buffer_desc_t>(nullptr), nullptr, 0,
-        shared_ptr<cursor_t>(nullptr), 0
-    };
+    const cursor_t cursor_t::EMPTY = { _buffer_desc_ref_t(), nullptr, 0, 0 };
 #else
-    const cursor_t cursor_t::EMPTY = {
-        shared_ptr<_buffer_desc_t>(nullptr), nullptr, 0
-    };
+    const cursor_t cursor_t::EMPTY = { _buffer_desc_ref_t(), nullptr, 0 };
 #endif /* MPIPE_CHAINED_BUFFERS */
 
 } } } /* namespace rusty::driver::buffer */
@@ -1,5 +1,6 @@
 //
-// Provides an higher level interface to mPIPE buffers.
+// Provides an higher level interface to mPIPE buffers, and to the packet
+// buffers of the host driver on other architectures (see 'driver/host.hpp').
 //
 // Copyright 2015 Raphael Javaux <raphaeljavaux@gmail.com>
 // University of Liege.
@@ -23,12 +24,17 @@
 
 #include <algorithm>        // min()
 #include <cassert>
+#include <cstdint>
 #include <cstring>
-#include <functional>
-#include <memory>           // shared_ptr
+#include <memory>           // allocator
+#include <utility>          // move(), swap()
 
-#include <gxio/mpipe.h>     // gxio_mpipe_*
+#ifdef __tilegx__
+    #include <gxio/mpipe.h> // gxio_mpipe_*
+#endif /* __tilegx__ */
 
+#include "driver/driver.hpp"  // DRIVER_DIE()
+#include "net/checksum.hpp"   // partial_sum_t
 #include "util/macros.hpp"
 
 using namespace std;
@@ -37,8 +43,238 @@ namespace rusty {
 namespace driver {
 namespace buffer {
 
+#ifndef __tilegx__
+    // Free packet buffers of a worker of the host driver.
+    //
+    // Buffers all have 'buffer_size' bytes. The storage of the buffers and of
+    // the stack is owned by the driver. As a stack is never shared between
+    // workers, it doesn't require any synchronization.
+    struct host_buffer_stack_t {
+        char                **buffers;      // Free buffers.
+        size_t              n_free;
+
+        size_t              buffer_size;
+
+        // Returns 'nullptr' if the stack is empty.
+        inline char *pop(void)
+        {
+            if (UNLIKELY(n_free == 0))
+                return nullptr;
+
+            return buffers[--n_free];
+        }
+
+        inline void push(char *buffer)
+        {
+            buffers[n_free++] = buffer;
+        }
+    };
+#endif /* __tilegx__ */
+
 // Used internally to manage an mPIPE buffer life cycle.
-struct _buffer_desc_t;
+//
+// Descriptors are reference counted by the cursors which reference them. As
+// cursors are never shared between workers, the counter is not atomic.
+struct _buffer_desc_t {
+    #ifdef __tilegx__
+        gxio_mpipe_context_t    *context;
+        gxio_mpipe_bdesc_t      bdesc;
+    #else
+        host_buffer_stack_t     *stack;     // Stack to which 'buffer' will be
+        char                    *buffer;    // returned.
+    #endif /* __tilegx__ */
+
+    bool                    is_managed; // If true, the buffer will be released
+                                        // when the last reference will be
+                                        // dropped.
+
+    uint32_t                n_refs;
+
+    #ifdef MPIPE_CHAINED_BUFFERS
+        char                *data;      // First byte of the packet data in
+        size_t              size;       // this buffer and its size.
+    #endif /* MPIPE_CHAINED_BUFFERS */
+
+    // Next buffer of the chain (which is referenced by this descriptor) or
+    // next free descriptor when the descriptor is in a pool.
+    _buffer_desc_t          *next;
+};
+
+// Free list of buffer descriptors.
+//
+// Each worker thread has its own pool ('_buffer_desc_pool'). The pool is
+// refilled by chunks of CHUNK_SIZE descriptors allocated with the allocator of
+// the cursors. Chunks are never released, as the number of descriptors in use
+// is bounded by the number of mPIPE buffers.
+//
+// Descriptors must be released by the thread which allocated them.
+struct _buffer_desc_pool_t {
+    static constexpr size_t CHUNK_SIZE = 64;
+
+    _buffer_desc_t          *free_list;
+
+    #ifdef __tilegx__
+        template <typename alloc_t>
+        inline _buffer_desc_t *allocate(
+            gxio_mpipe_context_t *context, gxio_mpipe_bdesc_t bdesc,
+            bool is_managed, alloc_t alloc
+        )
+        {
+            _buffer_desc_t *desc = _pop(is_managed, alloc);
+
+            desc->context       = context;
+            desc->bdesc         = bdesc;
+
+            return desc;
+        }
+    #else
+        template <typename alloc_t>
+        inline _buffer_desc_t *allocate(
+            host_buffer_stack_t *stack, char *buffer, bool is_managed,
+            alloc_t alloc
+        )
+        {
+            _buffer_desc_t *desc = _pop(is_managed, alloc);
+
+            desc->stack         = stack;
+            desc->buffer        = buffer;
+
+            return desc;
+        }
+    #endif /* __tilegx__ */
+
+    // Releases the descriptor, its packet buffer if it's managed, and the
+    // following descriptors of the chain which are not referenced anymore.
+    inline void release(_buffer_desc_t *desc)
+    {
+        while (desc != nullptr) {
+            assert(desc->n_refs == 0);
+
+            if (desc->is_managed) {
+                #ifdef __tilegx__
+                    gxio_mpipe_push_buffer_bdesc(desc->context, desc->bdesc);
+                #else
+                    desc->stack->push(desc->buffer);
+                #endif /* __tilegx__ */
+            }
+
+            _buffer_desc_t *next = desc->next;
+
+            desc->next = free_list;
+            free_list = desc;
+
+            if (next == nullptr || --next->n_refs > 0)
+                return;
+
+            desc = next;
+        }
+    }
+
+private:
+    // Takes a descriptor from the free list and initializes its
+    // driver-independent fields.
+    template <typename alloc_t>
+    inline _buffer_desc_t *_pop(bool is_managed, alloc_t alloc)
+    {
+        if (UNLIKELY(free_list == nullptr))
+            _refill(alloc);
+
+        _buffer_desc_t *desc = free_list;
+        free_list = desc->next;
+
+        desc->is_managed    = is_managed;
+        desc->n_refs        = 0;
+        desc->next          = nullptr;
+
+        return desc;
+    }
+
+    template <typename alloc_t>
+    void _refill(alloc_t alloc)
+    {
+        typedef typename alloc_t::template rebind<_buffer_desc_t>::other
+                desc_alloc_t;
+
+        _buffer_desc_t *chunk = desc_alloc_t(alloc).allocate(CHUNK_SIZE);
+        if (UNLIKELY(chunk == nullptr))
+            DRIVER_DIE("Unable to allocate buffer descriptors");
+
+        for (size_t i = 0; i < CHUNK_SIZE; i++) {
+            chunk[i].next = free_list;
+            free_list = &chunk[i];
+        }
+    }
+};
+
+extern thread_local _buffer_desc_pool_t _buffer_desc_pool;
+
+// Intrusive and non-atomic reference to a '_buffer_desc_t'.
+//
+// Copying a reference only increments the counter of the descriptor. The
+// descriptor is returned to the worker's pool when its last reference is
+// destructed.
+struct _buffer_desc_ref_t {
+    _buffer_desc_t          *desc;
+
+    inline _buffer_desc_ref_t(void) : desc(nullptr)
+    {
+    }
+
+    // Adds a reference to the descriptor.
+    inline explicit _buffer_desc_ref_t(_buffer_desc_t *_desc) : desc(_desc)
+    {
+        if (desc != nullptr)
+            desc->n_refs++;
+    }
+
+    inline _buffer_desc_ref_t(const _buffer_desc_ref_t &other)
+        : _buffer_desc_ref_t(other.desc)
+    {
+    }
+
+    inline _buffer_desc_ref_t(_buffer_desc_ref_t &&other) : desc(other.desc)
+    {
+        other.desc = nullptr;
+    }
+
+    inline ~_buffer_desc_ref_t(void)
+    {
+        if (desc != nullptr && --desc->n_refs == 0)
+            _buffer_desc_pool.release(desc);
+    }
+
+    inline _buffer_desc_ref_t &operator=(_buffer_desc_ref_t other)
+    {
+        swap(desc, other.desc);
+        return *this;
+    }
+
+    inline _buffer_desc_t *operator->(void) const
+    {
+        return desc;
+    }
+};
+
+// Memory region which is transmitted by reference after the content of a
+// packet buffer, instead of being copied into it.
+//
+// The memory must be registered with the mPIPE (see
+// 'mpipe_t::alloc_static_mem()') and must not be modified or released before
+// the packet has been transmitted.
+struct static_extent_t {
+    const char  *data;
+    size_t      size;
+
+    // Empty extent.
+    inline static_extent_t(void) : data(nullptr), size(0)
+    {
+    }
+
+    inline static_extent_t(const char *_data, size_t _size)
+        : data(_data), size(_size)
+    {
+    }
+};
 
 // Structure which can be used as an iterator to read and write into an mPIPE
 // (possibly chained) buffer.
@@ -48,11 +284,17 @@ struct _buffer_desc_t;
 // modified. This makes it easier to use (you can chain methods, e.g.
 // 'cursor.read(&a).drop(10).read(&b);') and backtracking is just a matter of
 // reusing an old cursor.
+//
+// Cursors are cheap to copy: buffer descriptors are taken from a per-worker
+// pool and are reference counted without atomic operations. Functions given to
+// 'read_with()', 'write_with()' and 'for_each()' are template parameters and
+// are never converted to 'std::function'.
 struct cursor_t {
 
     // A cursor state is represented by the current buffer descriptor, the next
     // byte to read/write in the current buffer, the remaining bytes in this
-    // buffer and a reference to the cursor containing the next buffer descriptor.
+    // buffer and the total number of bytes in the following buffers of the
+    // chain (which are referenced by the current buffer descriptor).
     //
     // 'current_size' can only be equal to zero if there is no buffer after.
     // That is, if the end of the current buffer is reached ('current_size'
@@ -63,19 +305,20 @@ struct cursor_t {
     // State of the cursor at the end of the buffer chain.
     static const cursor_t           EMPTY;
 
-    shared_ptr<_buffer_desc_t>      desc;
+    _buffer_desc_ref_t              desc;
 
     char                            *current;       // Next byte to read/write.
     size_t                          current_size;
 
     #ifdef MPIPE_CHAINED_BUFFERS
 
-        shared_ptr<cursor_t>            next;           // Following buffers.
         size_t                          next_size;      // Total size of
                                                         // following buffers.
 
     #endif /* MPIPE_CHAINED_BUFFERS */
 
+#ifdef __tilegx__
+
     // Creates a buffer's cursor from an ingress packet descriptor.
     //
     // If 'managed' is true, buffer descriptors will be freed automatically by
@@ -115,6 +358,63 @@ struct cursor_t {
         _init_with_bdesc(context, bdesc, total_size, managed, alloc);
     }
 
+    #ifdef MPIPE_CHAINED_BUFFERS
+        // Creates a buffer's cursor over a set of independent buffers, as if
+        // they were chained. Buffers are used in order and 'total_size' bytes
+        // must fit in them.
+        //
+        // This is used to write frames larger than a single buffer, which are
+        // then transmitted with one egress descriptor per buffer.
+        //
+        // Complexity: O(n) where 'n' is the number of buffer descriptors.
+        template <typename alloc_t>
+        inline cursor_t(
+            gxio_mpipe_context_t *context, const gxio_mpipe_bdesc_t *bdescs,
+            size_t n_bdescs, size_t total_size, bool managed, alloc_t alloc
+        )
+        {
+            _init_with_bdescs(
+                context, bdescs, n_bdescs, total_size, managed, alloc
+            );
+        }
+    #endif /* MPIPE_CHAINED_BUFFERS */
+
+#else
+
+    // Creates a buffer's cursor over the 'size' bytes at 'data', in a single
+    // packet buffer of the host driver.
+    //
+    // If 'managed' is true, 'buffer' will be returned to 'stack' when the last
+    // cursor referencing it is destructed. Unmanaged cursors don't use any
+    // buffer descriptor, and 'stack' and 'buffer' can be 'nullptr'.
+    //
+    // Complexity: O(1).
+    template <typename alloc_t = allocator<char *>>
+    inline cursor_t(
+        host_buffer_stack_t *stack, char *buffer, char *data, size_t size,
+        bool managed, alloc_t alloc = alloc_t()
+    ) : current(data), current_size(size)
+    {
+        if (managed) {
+            _buffer_desc_t *first = _buffer_desc_pool.allocate(
+                stack, buffer, true, alloc
+            );
+
+            #ifdef MPIPE_CHAINED_BUFFERS
+                first->data = data;
+                first->size = size;
+            #endif /* MPIPE_CHAINED_BUFFERS */
+
+            desc = _buffer_desc_ref_t(first);
+        }
+
+        #ifdef MPIPE_CHAINED_BUFFERS
+            next_size = 0;
+        #endif /* MPIPE_CHAINED_BUFFERS */
+    }
+
+#endif /* __tilegx__ */
+
     // Returns the total number of remaining bytes.
     //
     // Complexity: O(1).
@@ -153,14 +453,11 @@ struct cursor_t {
     {
         #ifdef MPIPE_CHAINED_BUFFERS
             if (n <= current_size)
-                return cursor_t(desc, current, n, nullptr, 0);
+                return cursor_t(desc, current, n, 0);
             else if (n >= size())
                 return *this;
-            else {
-                return cursor_t(
-                    desc, current, current_size, next, next_size - n
-                );
-            }
+            else
+                return cursor_t(desc, current, current_size, n - current_size);
         #else
             return cursor_t(desc, current, min(current_size, n));
         #endif/* MPIPE_CHAINED_BUFFERS */
@@ -180,7 +477,7 @@ struct cursor_t {
                 cursor_t cursor = *this;
                 while (n > 0 && n >= cursor.current_size) {
                     n -= cursor.current_size;
-                    cursor = *(cursor.next);
+                    cursor = cursor._next_buffer();
                 }
 
                 return cursor._drop_in_buffer(n);
@@ -240,10 +537,11 @@ struct cursor_t {
         #ifdef MPIPE_CHAINED_BUFFERS
             cursor_t cursor = *this;
 
-            while (n > cursor.current_size) {
+            while (n > 0 && n >= cursor.current_size) {
                 memcpy(data, cursor.current, cursor.current_size);
+                data += cursor.current_size;
                 n -= cursor.current_size;
-                cursor = *(cursor.next);
+                cursor = cursor._next_buffer();
             }
 
             if (n > 0) {
@@ -279,10 +577,11 @@ struct cursor_t {
         #ifdef MPIPE_CHAINED_BUFFERS
             cursor_t cursor = *this;
 
-            while (n > cursor.current_size) {
+            while (n > 0 && n >= cursor.current_size) {
                 memcpy(cursor.current, data, cursor.current_size);
+                data += cursor.current_size;
                 n -= cursor.current_size;
-                cursor = *(cursor.next);
+                cursor = cursor._next_buffer();
             }
 
             if (n > 0) {
@@ -304,6 +603,49 @@ struct cursor_t {
         return write((const char *) data, sizeof (T));
     }
 
+    // Same as 'write()', but also sets 'sum' to the partial checksum of the
+    // written bytes.
+    //
+    // Bytes are summed while they are copied, which is faster than calling
+    // 'write()' and then computing the sum of the written cursor.
+    //
+    // Complexity: O(n) where 'n' is the number of bytes to write.
+    inline cursor_t write_and_sum(
+        const char *data, size_t n, net::partial_sum_t *sum
+    ) const
+    {
+        assert(can(n));
+
+        #ifdef MPIPE_CHAINED_BUFFERS
+            cursor_t cursor = *this;
+            net::partial_sum_t partial_sum = net::partial_sum_t::ZERO;
+
+            while (n > 0 && n >= cursor.current_size) {
+                partial_sum = partial_sum.append(
+                    net::partial_sum_t::copy_and_sum(
+                        cursor.current, data, cursor.current_size
+                    )
+                );
+                data += cursor.current_size;
+                n -= cursor.current_size;
+                cursor = cursor._next_buffer();
+            }
+
+            if (n > 0) {
+                partial_sum = partial_sum.append(
+                    net::partial_sum_t::copy_and_sum(cursor.current, data, n)
+                );
+                cursor = cursor._drop_in_buffer(n);
+            }
+
+            *sum = partial_sum;
+            return cursor;
+        #else
+            *sum = net::partial_sum_t::copy_and_sum(current, data, n);
+            return _drop_in_buffer(n);
+        #endif /* MPIPE_CHAINED_BUFFERS */
+    }
+
     // -------------------------------------------------------------------------
 
     //
@@ -341,7 +683,7 @@ struct cursor_t {
 
         #ifdef MPIPE_CHAINED_BUFFERS
             if (n == current_size)
-                return *next;
+                return _next_buffer();
             else
                 return _drop_in_buffer(n);
         #else
@@ -364,7 +706,7 @@ struct cursor_t {
 
         #ifdef MPIPE_CHAINED_BUFFERS
             if (n == current_size)
-                return *next;
+                return _next_buffer();
             else
                 return _drop_in_buffer(n);
         #else
@@ -397,8 +739,8 @@ struct cursor_t {
     //
     // Complexity: O(1) (best-case) or O(n) (worst-case) where 'n' is the number
     // of bytes to read.
-    template <typename R>
-    inline R read_with(function<R(const char *, cursor_t)> f, size_t n) const
+    template <typename R, typename F>
+    inline R read_with(F f, size_t n) const
     {
         #ifdef MPIPE_CHAINED_BUFFERS
             if (can_in_place(n)) {
@@ -419,8 +761,8 @@ struct cursor_t {
     }
 
     // Equivalent to 'read_with<R>(f, sizeof (T))'.
-    template <typename T, typename R>
-    inline R read_with(function<R(const T *, cursor_t)> f) const
+    template <typename T, typename R, typename F>
+    inline R read_with(F f) const
     {
         #ifdef MPIPE_CHAINED_BUFFERS
              if (can_in_place<T>()) {
@@ -449,7 +791,8 @@ struct cursor_t {
     //
     // Complexity: O(1) (best-case) or O(n) (worst-case) where 'n' is the number
     // of bytes to read.
-    inline cursor_t read_with(function<void(const char *)> f, size_t n) const
+    template <typename F>
+    inline cursor_t read_with(F f, size_t n) const
     {
         return read_with<cursor_t>([&f](const char *data, cursor_t cursor) {
             f(data);
@@ -458,8 +801,8 @@ struct cursor_t {
     }
 
     // Equivalent to 'read_with(f, sizeof (T))'.
-    template <typename T>
-    inline cursor_t read_with(function<void(const T *)> f) const
+    template <typename T, typename F>
+    inline cursor_t read_with(F f) const
     {
         return read_with<T, cursor_t>([&f](const T *data, cursor_t cursor) {
             f(data);
@@ -476,7 +819,8 @@ struct cursor_t {
     //
     // Complexity: O(1) (best-case) or O(n) (worst-case) where 'n' is the number
     // of bytes to write.
-    inline cursor_t write_with(function<void(char *)> f, size_t n)
+    template <typename F>
+    inline cursor_t write_with(F f, size_t n)
     {
         #ifdef MPIPE_CHAINED_BUFFERS
             if (can_in_place(n)) {
@@ -499,8 +843,8 @@ struct cursor_t {
     }
 
     // Equivalent to 'write_with(f, sizeof (T))'.
-    template <typename T>
-    inline cursor_t write_with(function<void(T *)> f)
+    template <typename T, typename F>
+    inline cursor_t write_with(F f)
     {
         #ifdef MPIPE_CHAINED_BUFFERS
             if (can_in_place<T>()) {
@@ -525,14 +869,15 @@ struct cursor_t {
     // Executes the given function on each buffer, in order.
     //
     // Complexity: O(n).
-    inline void for_each(function<void(const char *, size_t)> f) const
+    template <typename F>
+    inline void for_each(F f) const
     {
         #ifdef MPIPE_CHAINED_BUFFERS
             cursor_t cursor = *this;
 
             while (!cursor.empty()) {
                 f(cursor.current, cursor.current_size);
-                cursor = *cursor._next;
+                cursor = cursor._next_buffer();
             }
         #else
             if (!empty())
@@ -543,29 +888,40 @@ struct cursor_t {
 private:
     #ifdef MPIPE_CHAINED_BUFFERS
         cursor_t(
-            shared_ptr<_buffer_desc_t> _desc, char *_current,
-            size_t _current_size,
-            shared_ptr<cur> _next, size_t _next_size
-        ) : desc(_desc), current(_current), current_size(_current_size),
-            next(_next), next_size(_next_size)
+            _buffer_desc_ref_t _desc, char *_current, size_t _current_size,
+            size_t _next_size
+        ) : desc(move(_desc)), current(_current), current_size(_current_size),
+            next_size(_next_size)
     #else
         cursor_t(
-            shared_ptr<_buffer_desc_t> _desc, char *_current,
-            size_t _current_size
-        ) : desc(_desc), current(_current), current_size(_current_size)
+            _buffer_desc_ref_t _desc, char *_current, size_t _current_size
+        ) : desc(move(_desc)), current(_current), current_size(_current_size)
     #endif /* MPIPE_CHAINED_BUFFERS */
     {
     }
 
-    // Complexity: O(n) where 'n' is the number of buffer descriptors in the
-    // chain.
-    //
-    // The allocator is used to allocate the 'shared_ptr'.
-    template <typename alloc_t = allocator<char *>>
-    void _init_with_bdesc(
-        gxio_mpipe_context_t *context, gxio_mpipe_bdesc_t *bdesc,
-        size_t total_size, bool managed, alloc_t alloc = alloc_t()
-    );
+    #ifdef __tilegx__
+        // Complexity: O(n) where 'n' is the number of buffer descriptors in
+        // the chain.
+        //
+        // The allocator is used to refill the worker's pool of buffer
+        // descriptors.
+        template <typename alloc_t = allocator<char *>>
+        void _init_with_bdesc(
+            gxio_mpipe_context_t *context, gxio_mpipe_bdesc_t *bdesc,
+            size_t total_size, bool managed, alloc_t alloc = alloc_t()
+        );
+
+        #ifdef MPIPE_CHAINED_BUFFERS
+            // Complexity: O(n) where 'n' is the number of buffer descriptors.
+            template <typename alloc_t>
+            void _init_with_bdescs(
+                gxio_mpipe_context_t *context,
+                const gxio_mpipe_bdesc_t *bdescs, size_t n_bdescs,
+                size_t total_size, bool managed, alloc_t alloc
+            );
+        #endif /* MPIPE_CHAINED_BUFFERS */
+    #endif /* __tilegx__ */
 
     // Returns a new cursor which references 'n' bytes after the cursor.
     //
@@ -576,40 +932,39 @@ private:
     inline cursor_t _drop_in_buffer(size_t n) const
     {
         #ifdef MPIPE_CHAINED_BUFFERS
-            assert(can_in_place(n) && (n < current_size || next == nullptr));
+            assert(can_in_place(n) && (n < current_size || next_size == 0));
 
-            return {
-                desc, current + n, current_size - n,
-                next, next_size
-            };
+            return { desc, current + n, current_size - n, next_size };
         #else
             assert(can_in_place(n));
 
             return { desc, current + n, current_size - n };
         #endif
     }
-};
-
-struct _buffer_desc_t {
-    gxio_mpipe_context_t    *context;
-    gxio_mpipe_bdesc_t      bdesc;
-    bool                    is_managed; // If true, the buffer will be released
-                                        // when this object will be destructed.
-
-    _buffer_desc_t(
-        gxio_mpipe_context_t *_context, gxio_mpipe_bdesc_t _bdesc,
-        bool _is_managed
-    ) : context(_context), bdesc(_bdesc), is_managed(_is_managed)
-    {
-    }
 
-    ~_buffer_desc_t(void)
-    {
-        if (is_managed)
-            gxio_mpipe_push_buffer_bdesc(context, bdesc);
-    }
+    #ifdef MPIPE_CHAINED_BUFFERS
+        // Returns a cursor to the first byte of the next buffer of the chain,
+        // or 'EMPTY' if there is no following buffer.
+        //
+        // Complexity: O(1).
+        inline cursor_t _next_buffer(void) const
+        {
+            if (next_size == 0)
+                return EMPTY;
+
+            _buffer_desc_t *next = desc->next;
+            assert(next != nullptr);
+
+            size_t size = min(next->size, next_size);
+            return {
+                _buffer_desc_ref_t(next), next->data, size, next_size - size
+            };
+        }
+    #endif /* MPIPE_CHAINED_BUFFERS */
 };
 
+#ifdef __tilegx__
+
 template <typename alloc_t>
 void cursor_t::_init_with_bdesc(
     gxio_mpipe_context_t *context, gxio_mpipe_bdesc_t *bdesc, size_t total_size,
@@ -631,9 +986,11 @@ void cursor_t::_init_with_bdesc(
         return;
     }
 
-    // Allocates a manageable buffer descriptor.
-    // desc = make_shared<_buffer_desc_t>(context, *bdesc, is_managed);
-    desc = allocate_shared<_buffer_desc_t>(alloc, context, *bdesc, is_managed);
+    // Allocates a manageable buffer descriptor from the worker's pool.
+    _buffer_desc_t *first = _buffer_desc_pool.allocate(
+        context, *bdesc, is_managed, alloc
+    );
+    desc = _buffer_desc_ref_t(first);
 
     // The last 42 bits of the buffer descriptor contain the virtual address of
     // the buffer with the lower 7 bits being the offset of packet data inside
@@ -643,41 +1000,122 @@ void cursor_t::_init_with_bdesc(
     // is written in the first 8 bytes of the buffer and the offset is at least
     // 8 bytes.
 
-    char    *va    = (char *) ((intptr_t) bdesc->va << 7);
-    size_t  offset = bdesc->__reserved_0;
+    #ifdef MPIPE_CHAINED_BUFFERS
+        // Builds the descriptors of the whole chain. Each descriptor holds a
+        // reference to the descriptor of the following buffer.
 
-    current = va + offset;
+        _buffer_desc_t  *last       = first;
+        size_t          remaining   = total_size;
 
-    #ifdef MPIPE_CHAINED_BUFFERS
-        size_t buffer_size = gxio_mpipe_buffer_size_enum_to_buffer_size(
-            (gxio_mpipe_buffer_size_enum_t) bdesc->size
-        );
+        for (;;) {
+            char    *va    = (char *) ((intptr_t) last->bdesc.va << 7);
+            size_t  offset = last->bdesc.__reserved_0;
 
-        switch (bdesc->c) {
-        case MPIPE_EDMA_DESC_WORD1__C_VAL_UNCHAINED:
-            assert(total_size <= buffer_size - offset);
+            size_t buffer_size = gxio_mpipe_buffer_size_enum_to_buffer_size(
+                (gxio_mpipe_buffer_size_enum_t) last->bdesc.size
+            );
 
-            current_size = total_size;
-            next         = nullptr;
-            next_size    = 0;
-            return;
-        case MPIPE_EDMA_DESC_WORD1__C_VAL_CHAINED:
-            current_size = min(total_size, buffer_size - offset);
-            next_size    = total_size - current_size;
-            next         = make_shared<cursor_t>(
-                context, (gxio_mpipe_bdesc_t *) va, next_size, is_managed
+            last->data = va + offset;
+
+            switch (last->bdesc.c) {
+            case MPIPE_EDMA_DESC_WORD1__C_VAL_UNCHAINED:
+                assert(remaining <= buffer_size - offset);
+                last->size = remaining;
+                break;
+            case MPIPE_EDMA_DESC_WORD1__C_VAL_CHAINED:
+                last->size = min(remaining, buffer_size - offset);
+                break;
+            default:
+                DRIVER_DIE("Invalid buffer descriptor");
+            };
+
+            remaining -= last->size;
+            if (remaining == 0)
+                break;
+
+            gxio_mpipe_bdesc_t *next_bdesc = (gxio_mpipe_bdesc_t *) va;
+            assert(next_bdesc->c != MPIPE_EDMA_DESC_WORD1__C_VAL_INVALID);
+
+            last->next = _buffer_desc_pool.allocate(
+                context, *next_bdesc, is_managed, alloc
             );
-            return;
-        default:
-            DRIVER_DIE("Invalid buffer descriptor");
-        };
+            last->next->n_refs = 1;
+            last = last->next;
+        }
+
+        current      = first->data;
+        current_size = first->size;
+        next_size    = total_size - current_size;
     #else
         assert(bdesc->c == MPIPE_EDMA_DESC_WORD1__C_VAL_UNCHAINED);
 
+        char    *va    = (char *) ((intptr_t) bdesc->va << 7);
+        size_t  offset = bdesc->__reserved_0;
+
+        current      = va + offset;
         current_size = total_size;
     #endif /* MPIPE_CHAINED_BUFFERS */
 }
 
+#ifdef MPIPE_CHAINED_BUFFERS
+    template <typename alloc_t>
+    void cursor_t::_init_with_bdescs(
+        gxio_mpipe_context_t *context, const gxio_mpipe_bdesc_t *bdescs,
+        size_t n_bdescs, size_t total_size, bool is_managed, alloc_t alloc
+    )
+    {
+        if (n_bdescs == 0 || total_size == 0) {
+            assert(total_size == 0);
+            *this = EMPTY;
+            return;
+        }
+
+        // Builds a chain of descriptors, each of them referencing the
+        // descriptor of the following buffer.
+
+        _buffer_desc_t  *first      = nullptr;
+        _buffer_desc_t  *last       = nullptr;
+        size_t          remaining   = total_size;
+
+        for (size_t i = 0; i < n_bdescs && remaining > 0; i++) {
+            const gxio_mpipe_bdesc_t *bdesc = &bdescs[i];
+
+            _buffer_desc_t *desc = _buffer_desc_pool.allocate(
+                context, *bdesc, is_managed, alloc
+            );
+
+            char    *va    = (char *) ((intptr_t) bdesc->va << 7);
+            size_t  offset = bdesc->__reserved_0;
+
+            size_t buffer_size = gxio_mpipe_buffer_size_enum_to_buffer_size(
+                (gxio_mpipe_buffer_size_enum_t) bdesc->size
+            );
+
+            desc->data = va + offset;
+            desc->size = min(remaining, buffer_size - offset);
+            remaining -= desc->size;
+
+            if (first == nullptr)
+                first = desc;
+            else {
+                desc->n_refs = 1;
+                last->next = desc;
+            }
+
+            last = desc;
+        }
+
+        assert(remaining == 0);
+
+        desc         = _buffer_desc_ref_t(first);
+        current      = first->data;
+        current_size = first->size;
+        next_size    = total_size - current_size;
+    }
+#endif /* MPIPE_CHAINED_BUFFERS */
+
+#endif /* __tilegx__ */
+
 } } } /* namespace rusty::driver:buffer */
 
 #endif /* __RUSTY_DRIVERS_BUFFER_HPP__ */
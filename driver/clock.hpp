@@ -29,9 +29,8 @@
 #include <cmath>            // round()
 #include <cstdint>
 
-#include <arch/cycle.h>     // get_cycle_count()
-
 #include "driver/cpu.hpp"   // CYCLES_PER_SECOND, cycles_t
+#include "util/cycle.hpp"   // get_cycle_count()
 
 using namespace std;
 
@@ -55,26 +54,36 @@ struct cpu_clock_t {
         {
         }
 
+        // Creates a time interval from a number of CPU cycles.
+        //
+        // 'interval_t { cycles }' would call the microseconds constructor.
+        static inline interval_t from_cycles(cycles_t cycles)
+        {
+            interval_t interval;
+            interval.cycles = cycles;
+            return interval;
+        }
+
         // Returns the number of microseconds (10^-6) in the time interval.
-        inline uint64_t microsec(void)
+        inline uint64_t microsec(void) const
         {
             return this->cycles * 1000000 / CYCLES_PER_SECOND;
         }
 
         inline interval_t operator+(interval_t other) const
         {
-            return (interval_t) { this->cycles + other.cycles };
+            return from_cycles(this->cycles + other.cycles);
         }
 
         // If 'this' is < than 'other', is the same as 'other - this'.
         inline interval_t operator-(interval_t other) const
         {
-            return (interval_t) { this->cycles - other.cycles };
+            return from_cycles(this->cycles - other.cycles);
         }
 
         inline interval_t operator*(double factor) const
         {
-            return (interval_t) { (cycles_t) round(this->cycles * factor) };
+            return from_cycles((cycles_t) round(this->cycles * factor));
         }
 
         inline interval_t operator*=(double factor)
@@ -106,7 +115,7 @@ struct cpu_clock_t {
         inline interval_t operator-(time_t other) const
         {
             assert(this->cycles >= other.cycles);
-            return (interval_t) { this->cycles - other.cycles };
+            return interval_t::from_cycles(this->cycles - other.cycles);
         }
 
         inline time_t operator+(interval_t interval) const
@@ -114,6 +123,11 @@ struct cpu_clock_t {
             return (time_t) { this->cycles + interval.cycles };
         }
 
+        inline bool operator<(time_t other) const
+        {
+            return this->cycles < other.cycles;
+        }
+
         // Returns a 'time_t' object representing the current time.
         inline static time_t now(void)
         {
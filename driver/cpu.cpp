@@ -1,5 +1,6 @@
 //
-// Provides functions to manage dataplane Tiles.
+// Provides functions to manage dataplane Tiles, and the frequency of the cycle
+// counter.
 //
 // Copyright 2015 Raphael Javaux <raphaeljavaux@gmail.com>
 // University of Liege.
@@ -21,12 +22,16 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstdint>
+#include <ctime>            // clock_gettime()
 #include <errno.h>
 
-#include <tmc/cpus.h>       // tmc_cpus_*
-#include <sys/dataplane.h>  // set_dataplane
+#ifdef __tilegx__
+    #include <tmc/cpus.h>       // tmc_cpus_*
+    #include <sys/dataplane.h>  // set_dataplane
+#endif /* __tilegx__ */
 
 #include "driver/driver.hpp"
+#include "util/cycle.hpp"   // get_cycle_count()
 
 #include "driver/cpu.hpp"
 
@@ -36,6 +41,56 @@ namespace rusty {
 namespace driver {
 namespace cpu {
 
+#if    !defined(__tilegx__) && !defined(HOST_CYCLES_PER_SECOND) \
+    && (defined(__x86_64__) || defined(__i386__))
+
+// Duration during which the time-stamp counter is compared to the monotonic
+// clock, in nanoseconds. Reading both clocks costs a few tens of nanoseconds,
+// the measured frequency is thus accurate to a few parts per million.
+static const uint64_t MEASURE_DURATION = 20000000; // 20 ms
+
+static uint64_t _monotonic_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+// Counts the cycles elapsed while the monotonic clock advances by
+// MEASURE_DURATION.
+static cycles_t _measure_cycles_per_second(void)
+{
+    uint64_t start_ns       = _monotonic_ns();
+    uint64_t start_cycles   = get_cycle_count();
+
+    uint64_t end_ns;
+    do
+        end_ns = _monotonic_ns();
+    while (end_ns - start_ns < MEASURE_DURATION);
+
+    uint64_t end_cycles     = get_cycle_count();
+
+    return (end_cycles - start_cycles) * 1000000000 / (end_ns - start_ns);
+}
+
+static cycles_t _cycles_per_second;
+
+// Static objects (such as the intervals of the TCP timers) are converted to
+// cycles when they are initialized. The highest priority makes sure the
+// frequency is measured before.
+__attribute__ ((constructor (101)))
+static void _init_cycles_per_second(void)
+{
+    _cycles_per_second = _measure_cycles_per_second();
+}
+
+// The reference itself is initialized at compile time.
+const cycles_t &CYCLES_PER_SECOND = _cycles_per_second;
+
+#endif /* !__tilegx__ && !HOST_CYCLES_PER_SECOND && x86 */
+
+#ifdef __tilegx__
+
 void bind_to_dataplane(unsigned int n)
 {
     int result;
@@ -67,4 +122,6 @@ void bind_to_dataplane(unsigned int n)
     #endif
 }
 
+#endif /* __tilegx__ */
+
 } } } /* namespace rusty::driver::cpu */
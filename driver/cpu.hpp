@@ -1,5 +1,6 @@
 //
-// Provides functions to manage dataplane Tiles.
+// Provides functions to manage dataplane Tiles, and the frequency of the cycle
+// counter.
 //
 // Copyright 2015 Raphael Javaux <raphaeljavaux@gmail.com>
 // University of Liege.
@@ -30,13 +31,35 @@ namespace cpu {
 // CPU cycle counter value.
 typedef uint64_t cycles_t;
 
-// CPU Frequency in Hz.
-static constexpr cycles_t CYCLES_PER_SECOND = 1200000000;
+#ifdef __tilegx__
+    // CPU Frequency in Hz.
+    static constexpr cycles_t CYCLES_PER_SECOND = 1200000000;
+#else
+    // Frequency of the counter read by 'get_cycle_count()' (see
+    // 'util/cycle.hpp'), in Hz. Timers and TCP sequence numbers are derived
+    // from it.
+    //
+    // Can be given at compile time with -DHOST_CYCLES_PER_SECOND.
+    #if defined(HOST_CYCLES_PER_SECOND)
+        static constexpr cycles_t CYCLES_PER_SECOND = HOST_CYCLES_PER_SECOND;
+    #elif defined(__x86_64__) || defined(__i386__)
+        // Frequency of the time-stamp counter, which doesn't follow frequency
+        // scaling. Measured against CLOCK_MONOTONIC when the program starts,
+        // before the other static objects are initialized.
+        extern const cycles_t &CYCLES_PER_SECOND;
+    #else
+        // 'get_cycle_count()' reads a nanoseconds clock.
+        static constexpr cycles_t CYCLES_PER_SECOND = 1000000000;
+    #endif /* HOST_CYCLES_PER_SECOND */
+#endif /* __tilegx__ */
 
-// Binds the current task to the n-th available dataplane Tile (first CPU is 0).
-//
-// Fails if there is less than n + 1 dataplane Tiles.
-void bind_to_dataplane(unsigned int n);
+#ifdef __tilegx__
+    // Binds the current task to the n-th available dataplane Tile (first CPU
+    // is 0).
+    //
+    // Fails if there is less than n + 1 dataplane Tiles.
+    void bind_to_dataplane(unsigned int n);
+#endif /* __tilegx__ */
 
 } } } /* namespace rusty::driver:cpu */
 
@@ -1,5 +1,5 @@
 //
-// Various pre-processor macros used by the mPIPE driver.
+// Various pre-processor macros used by the mPIPE and host drivers.
 //
 // Copyright 2015 Raphael Javaux <raphaeljavaux@gmail.com>
 // University of Liege.
@@ -21,7 +21,9 @@
 #ifndef __RUSTY_DRIVER_DRIVER_HPP__
 #define __RUSTY_DRIVER_DRIVER_HPP__
 
-#include <gxio/mpipe.h>     // gxio_strerror
+#ifdef __tilegx__
+    #include <gxio/mpipe.h> // gxio_strerror
+#endif /* __tilegx__ */
 
 #include "util/macros.hpp"
 
@@ -45,6 +47,7 @@
         DRIVER_DIE("%s: (error: %d)", (WHAT), VAL);                            \
   } while (0)
 
+#ifdef __tilegx__
 // Checks for errors from the GXIO API, which returns negative error codes.
 #define VERIFY_GXIO(VAL, WHAT)                                                 \
   do {                                                                         \
@@ -52,5 +55,6 @@
     if (__val < 0)                                                             \
         DRIVER_DIE("%s: (%ld) %s", (WHAT), __val, gxio_strerror(__val));       \
   } while (0)
+#endif /* __tilegx__ */
 
 #endif /* __RUSTY_DRIVER_DRIVER_HPP__ */
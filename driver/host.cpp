@@ -0,0 +1,672 @@
+//
+// Driver which runs the network stack on the network interfaces of a Linux
+// host, on architectures without an mPIPE.
+//
+// Copyright 2015 Raphael Javaux <raphaeljavaux@gmail.com>
+// University of Liege.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <algorithm>            // min()
+#include <cassert>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>              // posix_memalign(), free()
+#include <cstring>              // memset(), memcpy(), strncpy()
+#include <functional>
+#include <memory>               // allocator
+#include <utility>              // move()
+
+#include <arpa/inet.h>          // htons()
+#include <net/ethernet.h>       // ETH_P_ALL, ETH_HLEN, ETH_ALEN
+#include <net/if.h>             // if_nametoindex(), ifreq
+#include <netinet/in.h>         // IPPROTO_TCP
+#include <linux/filter.h>       // sock_filter, sock_fprog, BPF_*
+#include <linux/if_packet.h>    // sockaddr_ll, PACKET_*
+#include <pthread.h>            // pthread_*
+#include <sched.h>              // cpu_set_t, CPU_*
+#include <sys/ioctl.h>          // ioctl(), SIOCGIFHWADDR, SIOCGIFMTU
+#include <sys/socket.h>         // socket(), recvmmsg(), sendmmsg()
+#include <unistd.h>             // close(), getpid(), sysconf()
+
+#include "driver/buffer.hpp"    // cursor_t, host_buffer_stack_t
+#include "driver/driver.hpp"    // VERIFY_ERRNO, VERIFY_PTHREAD
+#include "net/endian.hpp"       // net_t
+#include "net/ethernet.hpp"     // ethernet_t
+
+#include "driver/host.hpp"
+
+using namespace std;
+
+using namespace rusty::net;
+
+namespace rusty {
+namespace driver {
+
+// Returns the hardware address of the interface (in network byte order).
+static net_t<host_t::ethernet_t::addr_t> _ether_addr(
+    int sock, const char *link_name
+);
+
+// Returns the MTU of the interface.
+static size_t _mtu(int sock, const char *link_name);
+
+// Opens a packet socket which receives every frame of the interface, and
+// makes it join the fanout group.
+static int _open_socket(int ifindex, int fanout_id);
+
+host_t::instance_t::instance_t(alloc_t _alloc)
+    : alloc(_alloc), ethernet(_alloc), timers(_alloc)
+{
+}
+
+void host_t::instance_t::run(void)
+{
+    int result;
+
+    // Binds the instance to its CPU.
+
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    CPU_SET(this->cpu_id, &cpu_set);
+
+    result = pthread_setaffinity_np(pthread_self(), sizeof (cpu_set), &cpu_set);
+    VERIFY_PTHREAD(result, "pthread_setaffinity_np()");
+
+    #ifdef USE_TRACING
+        util::current_tracer() = &this->tracer;
+    #endif /* USE_TRACING */
+
+    // Polling loop over the socket. Executes timers and applies the ARP updates
+    // of the other workers between batches of received frames.
+
+    while (LIKELY(this->parent->is_running)) {
+        this->timers.tick();
+
+        this->stats.timers.set(this->timers.size());
+
+        this->arp_updates.drain([this](arp_update_t update) {
+            this->ethernet.arp.apply_update(
+                update.ether_addr, update.ipv4_addr
+            );
+        });
+
+        this->messages.execute();
+
+        size_t n_buffers = this->_fill_rx_buffers();
+
+        if (UNLIKELY(n_buffers == 0)) {
+            // Every buffer is held by the network stack. Frames are dropped by
+            // the kernel until some buffers are released.
+            this->stats.rx_no_buffer.inc();
+            this->flush();
+            continue;
+        }
+
+        // Never blocks, so the timers and the messages keep being executed
+        // when no frame is received.
+        result = recvmmsg(
+            this->sock, this->rx_msgs.data(), n_buffers, MSG_DONTWAIT, nullptr
+        );
+
+        if (UNLIKELY(result <= 0)) {
+            if (result < 0 && errno != EAGAIN && errno != EINTR)
+                DRIVER_DEBUG("recvmmsg() failed (errno: %d)", errno);
+
+            // No frame is available. Transmits the packets emitted by the
+            // timers and the closures, and retries.
+            this->flush();
+            continue;
+        }
+
+        TRACE_BEGIN(batch_begin);
+
+        size_t n_msgs = (size_t) result;
+
+        this->stats.rx_batch.set(n_msgs);
+
+        for (size_t i = 0; i < n_msgs; i++) {
+            char            *buffer = this->rx_buffers[i];
+            struct mmsghdr  *msg    = &this->rx_msgs[i];
+
+            // Frames transmitted by the host, including the ones of the
+            // workers, are also delivered to packet sockets.
+            if (UNLIKELY(this->rx_addrs[i].sll_pkttype == PACKET_OUTGOING)) {
+                this->buffers.push(buffer);
+                continue;
+            }
+
+            if (UNLIKELY(msg->msg_hdr.msg_flags & MSG_TRUNC)) {
+                this->stats.rx_dropped.inc();
+                this->buffers.push(buffer);
+
+                DRIVER_DEBUG("Truncated frame dropped");
+                continue;
+            }
+
+            this->stats.rx_packets.inc();
+
+            // The buffer will be returned to the worker's stack when the
+            // cursor will be destructed.
+            cursor_t cursor(
+                &this->buffers, buffer, buffer + RX_BUFFER_OFFSET,
+                msg->msg_len, true, this->alloc
+            );
+
+            DRIVER_DEBUG("Receives a %zu bytes packet", cursor.size());
+
+            // Starts to load the connection state of the next frame before
+            // processing this one.
+            if (i + 1 < n_msgs) {
+                this->ethernet.prefetch_frame(
+                    this->rx_buffers[i + 1] + RX_BUFFER_OFFSET,
+                    this->rx_msgs[i + 1].msg_len
+                );
+            }
+
+            TRACE_END(TRACE_RX_QUEUE, batch_begin);
+
+            TRACE_BEGIN(frame_begin);
+            this->ethernet.receive_frame(cursor);
+            TRACE_END(TRACE_RX_FRAME, frame_begin);
+        }
+
+        // Moves the buffers which didn't receive a frame to the first slots.
+        for (size_t i = n_msgs; i < this->rx_buffers_count; i++)
+            this->rx_buffers[i - n_msgs] = this->rx_buffers[i];
+        this->rx_buffers_count -= n_msgs;
+
+        // Sends the acknowledgments which have been merged over the batch.
+        this->ethernet.end_of_batch();
+
+        // Transmits the packets emitted by the timers and while processing the
+        // batch.
+        this->flush();
+    }
+}
+
+size_t host_t::instance_t::_fill_rx_buffers(void)
+{
+    size_t batch_size = this->rx_buffers.size();
+
+    while (this->rx_buffers_count < batch_size) {
+        char *buffer = this->buffers.pop();
+        if (buffer == nullptr)
+            break;
+
+        this->rx_buffers[this->rx_buffers_count++] = buffer;
+    }
+
+    // 'recvmmsg()' overwrites the length of the addresses.
+    for (size_t i = 0; i < this->rx_buffers_count; i++) {
+        this->rx_iovecs[i].iov_base = this->rx_buffers[i] + RX_BUFFER_OFFSET;
+        this->rx_msgs[i].msg_hdr.msg_namelen = sizeof (struct sockaddr_ll);
+    }
+
+    return this->rx_buffers_count;
+}
+
+void host_t::instance_t::_flush_tx_batch(void)
+{
+    assert(this->tx_batch_count > 0);
+
+    TRACE_SCOPE(TRACE_TX_FLUSH);
+
+    DRIVER_DEBUG("Transmits %zu frames", this->tx_batch_count);
+
+    size_t sent = 0;
+
+    while (sent < this->tx_batch_count) {
+        int result = sendmmsg(
+            this->sock, &this->tx_msgs[sent], this->tx_batch_count - sent, 0
+        );
+
+        this->stats.tx_calls.inc();
+
+        if (UNLIKELY(result < 0)) {
+            if (errno == EINTR)
+                continue;
+
+            // The first remaining frame has been refused (e.g. the
+            // transmission queue of the interface is full). It is dropped, as
+            // it would have been by the link.
+            DRIVER_DEBUG("sendmmsg() failed (errno: %d)", errno);
+            this->stats.tx_dropped.inc();
+            sent++;
+        } else
+            sent += result;
+    }
+
+    this->tx_batch_count = 0;
+}
+
+host_t::host_t(
+    const char *link_name, net_t<ipv4_t::addr_t> ipv4_addr, int n_workers,
+    int first_cpu, vector<arp_ipv4_t::static_entry_t> static_arp_entries,
+    size_t _rx_batch_size
+) : instances(n_workers), rx_batch_size(_rx_batch_size)
+{
+    int result;
+
+    assert(n_workers > 0);
+    assert(_rx_batch_size > 0);
+
+    this->ifindex = if_nametoindex(link_name);
+    if (this->ifindex == 0)
+        DRIVER_DIE("Unknown network interface: %s", link_name);
+
+    // Each 'host_t' instance has its own fanout group.
+    static int n_groups = 0;
+    this->fanout_id = (getpid() + n_groups++) & 0xFFFF;
+
+    //
+    // Checks if there is enough CPUs for the requested number of workers.
+    //
+
+    long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    VERIFY_ERRNO(n_cpus, "sysconf()");
+
+    if (first_cpu + n_workers > n_cpus) {
+        DRIVER_DIE(
+            "There is not enough CPUs for the requested number of workers "
+            "(%d requested, having %ld)", first_cpu + n_workers, n_cpus
+        );
+    }
+
+    //
+    // Interface
+    //
+
+    {
+        int sock = socket(AF_PACKET, SOCK_RAW, 0);
+        VERIFY_ERRNO(sock, "socket()");
+
+        this->ether_addr = _ether_addr(sock, link_name);
+
+        // The Ethernet layer doesn't send frames larger than the MTU, plus the
+        // Ethernet header.
+        size_t max_frame_size = BUFFER_SIZE - RX_BUFFER_OFFSET;
+        this->max_packet_size = min(
+            _mtu(sock, link_name) + ETH_HLEN, max_frame_size
+        );
+
+        result = close(sock);
+        VERIFY_ERRNO(result, "close()");
+    }
+
+    //
+    // Allocates and constructs the stack instance for each worker, with its
+    // socket and its buffers.
+    //
+
+    for (int i = 0; i < n_workers; i++) {
+        allocator<instance_t> alloc;
+
+        // 'allocator<instance_t>' doesn't honor the cache line alignment of
+        // the instance before C++17.
+        instance_t *instance;
+        result = posix_memalign(
+            (void **) &instance, alignof (instance_t), sizeof (instance_t)
+        );
+        if (result != 0)
+            DRIVER_DIE("Unable to allocate the instance");
+
+        new (instance) instance_t(alloc_t(alloc));
+
+        this->instances[i] = instance;
+
+        instance->parent = this;
+        instance->cpu_id = first_cpu + i;
+        instance->sock   = _open_socket(this->ifindex, this->fanout_id);
+
+        // Buffers
+
+        size_t n_buffers = N_RX_BUFFERS + TX_BATCH_SIZE;
+
+        result = posix_memalign(
+            (void **) &instance->buffer_mem, util::CACHE_LINE_SIZE,
+            n_buffers * BUFFER_SIZE
+        );
+        if (result != 0)
+            DRIVER_DIE("Unable to allocate the packet buffers");
+
+        instance->free_buffers.resize(N_RX_BUFFERS);
+        for (size_t j = 0; j < N_RX_BUFFERS; j++)
+            instance->free_buffers[j] = instance->buffer_mem + j * BUFFER_SIZE;
+
+        instance->buffers.buffers       = instance->free_buffers.data();
+        instance->buffers.n_free        = N_RX_BUFFERS;
+        instance->buffers.buffer_size   = BUFFER_SIZE;
+
+        instance->tx_buffer_mem =
+            instance->buffer_mem + N_RX_BUFFERS * BUFFER_SIZE;
+
+        // Message headers. Only the buffers and the lengths change between
+        // calls.
+
+        instance->rx_buffers.resize(_rx_batch_size);
+        instance->rx_msgs.resize(_rx_batch_size);
+        instance->rx_iovecs.resize(_rx_batch_size);
+        instance->rx_addrs.resize(_rx_batch_size);
+
+        for (size_t j = 0; j < _rx_batch_size; j++) {
+            struct msghdr *hdr = &instance->rx_msgs[j].msg_hdr;
+            memset(hdr, 0, sizeof (*hdr));
+            hdr->msg_name       = &instance->rx_addrs[j];
+            hdr->msg_namelen    = sizeof (struct sockaddr_ll);
+            hdr->msg_iov        = &instance->rx_iovecs[j];
+            hdr->msg_iovlen     = 1;
+
+            instance->rx_iovecs[j].iov_len = BUFFER_SIZE - RX_BUFFER_OFFSET;
+        }
+
+        for (size_t j = 0; j < TX_BATCH_SIZE; j++) {
+            struct msghdr *hdr = &instance->tx_msgs[j].msg_hdr;
+            memset(hdr, 0, sizeof (*hdr));
+            hdr->msg_iov        = &instance->tx_iovecs[2 * j];
+        }
+    }
+
+    //
+    // Initializes the network protocols stacks.
+    //
+
+    for (int i = 0; i < n_workers; i++) {
+        instance_t *instance = this->instances[i];
+
+        instance->ethernet.init(
+            instance, &instance->timers, this->ether_addr, ipv4_addr,
+            static_arp_entries
+        );
+
+        // Active connections only use the local ports which the fanout program
+        // steers to this worker (see '_open_socket()').
+        #ifdef PACKET_FANOUT_CBPF
+            instance->ethernet.ipv4.tcp.set_ephemeral_ports(
+                tcp_t::DEFAULT_EPHEMERAL_FIRST, tcp_t::DEFAULT_EPHEMERAL_LAST,
+                [i, n_workers](tcp_t::tcb_id_t tcb_id) {
+                    return tcb_id.lport.host() % n_workers == i;
+                }
+            );
+        #endif /* PACKET_FANOUT_CBPF */
+
+        // Replicates the mappings learned by the worker to the ARP caches of
+        // the other workers.
+        instance->ethernet.arp.update_handler = [this, instance](
+            net_t<ethernet_t::addr_t> ether_addr,
+            net_t<ipv4_t::addr_t> ipv4_addr
+        ) {
+            for (instance_t *other : this->instances) {
+                if (other == instance)
+                    continue;
+
+                if (!other->arp_updates.push({ ether_addr, ipv4_addr })) {
+                    DRIVER_DEBUG(
+                        "ARP update dropped (queue of CPU %d is full)",
+                        other->cpu_id
+                    );
+                }
+            }
+        };
+    }
+}
+
+host_t::~host_t(void)
+{
+    int result;
+
+    for (instance_t *instance : this->instances) {
+        result = close(instance->sock);
+        VERIFY_ERRNO(result, "close()");
+
+        // The network stack is destructed first, as its cursors return their
+        // buffers when released.
+        char *buffer_mem = instance->buffer_mem;
+
+        instance->~instance_t();
+        free(instance);
+
+        free(buffer_mem);
+    }
+}
+
+// Wrapper over 'instance_t::run()' for 'pthread_create()'.
+static void *_worker_runner(void *instance_void)
+{
+    ((host_t::instance_t *) instance_void)->run();
+    return nullptr;
+}
+
+void host_t::run(void)
+{
+    this->is_running = true;
+
+    // Starts the worker threads.
+    for (instance_t *instance : instances) {
+        int result = pthread_create(
+            &instance->thread, nullptr, _worker_runner, instance
+        );
+        VERIFY_PTHREAD(result, "pthread_create()");
+    }
+}
+
+void host_t::stop(void)
+{
+    this->is_running = false;
+}
+
+void host_t::join(void)
+{
+    // Waits for all threads to exit.
+    for (instance_t *instance : instances)
+        pthread_join(instance->thread, nullptr);
+}
+
+void host_t::broadcast(function<void(instance_t *)> f)
+{
+    for (instance_t *instance : this->instances) {
+        if (!this->is_running) {
+            f(instance);
+            continue;
+        }
+
+        function<void()> message = [f, instance]() { f(instance); };
+
+        while (!instance->post(message))
+            ; // The worker's queue is full. Retries.
+    }
+}
+
+// Replicates the call to every worker TCP stack.
+void host_t::tcp_listen(
+    tcp_t::port_t port, tcp_t::new_conn_callback_t new_conn_callback
+)
+{
+    this->tcp_listen(port, new_conn_callback, tcp_t::listen_options_t());
+}
+
+void host_t::tcp_listen(
+    tcp_t::port_t port, tcp_t::new_conn_callback_t new_conn_callback,
+    tcp_t::listen_options_t options
+)
+{
+    this->broadcast([port, new_conn_callback, options](instance_t *instance) {
+        instance->ethernet.ipv4.tcp.listen(port, new_conn_callback, options);
+    });
+}
+
+// Posts the connection to the workers in turn.
+void host_t::tcp_connect(
+    net_t<ipv4_t::addr_t> raddr, tcp_t::port_t rport,
+    tcp_t::new_conn_callback_t new_conn_callback,
+    tcp_t::conn_failed_callback_t connect_failed
+)
+{
+    instance_t *instance = this->instances[this->next_connect_worker];
+
+    this->next_connect_worker =
+        (this->next_connect_worker + 1) % this->instances.size();
+
+    function<void()> message =
+        [instance, raddr, rport, new_conn_callback, connect_failed]()
+        {
+            tcp_t *tcp = &instance->ethernet.ipv4.tcp;
+
+            bool opened = tcp->connect(raddr, rport, new_conn_callback);
+
+            if (!opened && connect_failed)
+                connect_failed();
+        };
+
+    if (!this->is_running) {
+        message();
+        return;
+    }
+
+    while (!instance->post(message))
+        ; // The worker's queue is full. Retries.
+}
+
+static net_t<host_t::ethernet_t::addr_t> _ether_addr(
+    int sock, const char *link_name
+)
+{
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof (ifr));
+    strncpy(ifr.ifr_name, link_name, IFNAMSIZ - 1);
+
+    int result = ioctl(sock, SIOCGIFHWADDR, &ifr);
+    VERIFY_ERRNO(result, "ioctl(SIOCGIFHWADDR)");
+
+    net_t<host_t::ethernet_t::addr_t> addr;
+    memcpy(&addr.net.value, ifr.ifr_hwaddr.sa_data, ETH_ALEN);
+
+    return addr;
+}
+
+static size_t _mtu(int sock, const char *link_name)
+{
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof (ifr));
+    strncpy(ifr.ifr_name, link_name, IFNAMSIZ - 1);
+
+    int result = ioctl(sock, SIOCGIFMTU, &ifr);
+    VERIFY_ERRNO(result, "ioctl(SIOCGIFMTU)");
+
+    return ifr.ifr_mtu;
+}
+
+static int _open_socket(int ifindex, int fanout_id)
+{
+    int result;
+
+    // The socket doesn't receive any frame until it is bound to the interface.
+    int sock = socket(AF_PACKET, SOCK_RAW, 0);
+    VERIFY_ERRNO(sock, "socket()");
+
+    struct sockaddr_ll addr;
+    memset(&addr, 0, sizeof (addr));
+    addr.sll_family     = AF_PACKET;
+    addr.sll_protocol   = htons(ETH_P_ALL);
+    addr.sll_ifindex    = ifindex;
+
+    result = bind(sock, (struct sockaddr *) &addr, sizeof (addr));
+    VERIFY_ERRNO(result, "bind()");
+
+    #ifdef PACKET_IGNORE_OUTGOING
+        // Avoids copying the transmitted frames to the socket (Linux 4.20 and
+        // later). Older kernels still deliver them, they are then ignored by
+        // 'run()'.
+        int ignore_outgoing = 1;
+        result = setsockopt(
+            sock, SOL_PACKET, PACKET_IGNORE_OUTGOING, &ignore_outgoing,
+            sizeof (ignore_outgoing)
+        );
+        VERIFY_ERRNO(result, "setsockopt(PACKET_IGNORE_OUTGOING)");
+    #endif /* PACKET_IGNORE_OUTGOING */
+
+    #ifdef PACKET_FANOUT_CBPF
+        // Frames are dispatched to the sockets of the group by a BPF program
+        // (Linux 4.2 and later). The kernel gives a frame to the socket whose
+        // index, in the order the sockets joined the group, is the value
+        // returned by the program modulo the number of sockets.
+        //
+        // TCP segments sent to an ephemeral port go to the worker given by
+        // the port, as chosen by 'tcp_t::connect()'. The other TCP segments
+        // go to the worker given by their source address and port, so that
+        // the segments of a connection are always received by the same
+        // worker. Other frames go to the first worker.
+        struct sock_filter steering[] = {
+            // Checks that the frame is an IPv4 packet which holds a TCP
+            // header.
+            BPF_STMT(
+                BPF_LD | BPF_H | BPF_ABS,
+                (uint32_t) (SKF_AD_OFF + SKF_AD_PROTOCOL)
+            ),
+            BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETH_P_IP, 0, 12),
+            BPF_STMT(BPF_LD | BPF_B | BPF_ABS, (uint32_t) (SKF_NET_OFF + 9)),
+            BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_TCP, 0, 10),
+            BPF_STMT(BPF_LD | BPF_H | BPF_ABS, (uint32_t) (SKF_NET_OFF + 6)),
+            BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x1FFF, 8, 0),
+
+            // Loads the destination port.
+            BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, (uint32_t) SKF_NET_OFF),
+            BPF_STMT(BPF_LD | BPF_H | BPF_IND, (uint32_t) (SKF_NET_OFF + 2)),
+            BPF_JUMP(
+                BPF_JMP | BPF_JGE | BPF_K,
+                host_t::tcp_t::DEFAULT_EPHEMERAL_FIRST, 4, 0
+            ),
+
+            // Mixes the source port with the source address.
+            BPF_STMT(BPF_LD | BPF_H | BPF_IND, (uint32_t) SKF_NET_OFF),
+            BPF_STMT(BPF_MISC | BPF_TAX, 0),
+            BPF_STMT(BPF_LD | BPF_W | BPF_ABS, (uint32_t) (SKF_NET_OFF + 12)),
+            BPF_STMT(BPF_ALU | BPF_XOR | BPF_X, 0),
+
+            BPF_STMT(BPF_RET | BPF_A, 0),
+            BPF_STMT(BPF_RET | BPF_K, 0),
+        };
+
+        int fanout = fanout_id | (PACKET_FANOUT_CBPF << 16);
+    #else
+        // Frames are dispatched to the sockets of the group by the hash of
+        // their flow, which is the RSS hash of the NIC when it provides one.
+        // The segments of a TCP connection are thus always received by the
+        // same worker, but active connections can't choose it.
+        int fanout = fanout_id | (PACKET_FANOUT_HASH << 16);
+    #endif /* PACKET_FANOUT_CBPF */
+
+    result = setsockopt(
+        sock, SOL_PACKET, PACKET_FANOUT, &fanout, sizeof (fanout)
+    );
+    VERIFY_ERRNO(result, "setsockopt(PACKET_FANOUT)");
+
+    #ifdef PACKET_FANOUT_CBPF
+        // The program is shared by the group. Setting it again when another
+        // socket joins doesn't change it.
+        struct sock_fprog program;
+        program.len     = sizeof (steering) / sizeof (steering[0]);
+        program.filter  = steering;
+
+        result = setsockopt(
+            sock, SOL_PACKET, PACKET_FANOUT_DATA, &program, sizeof (program)
+        );
+        VERIFY_ERRNO(result, "setsockopt(PACKET_FANOUT_DATA)");
+    #endif /* PACKET_FANOUT_CBPF */
+
+    return sock;
+}
+
+} } /* namespace rusty::driver */
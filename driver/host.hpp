@@ -0,0 +1,609 @@
+//
+// Driver which runs the network stack on the network interfaces of a Linux
+// host, on architectures without an mPIPE.
+//
+// Each worker owns a raw packet socket (AF_PACKET) bound to the interface.
+// The sockets of the workers of an interface join a fanout group which
+// dispatches the received frames by their flow, as the mPIPE load balancer
+// would. Frames are received and transmitted by batches, with a
+// single system call per batch ('recvmmsg()' and 'sendmmsg()').
+//
+// The network stack must be given an IPv4 address which is not assigned to the
+// interface by Linux, so that the Linux network stack ignores the TCP segments
+// and the ARP messages of this address.
+//
+// Copyright 2015 Raphael Javaux <raphaeljavaux@gmail.com>
+// University of Liege.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __RUSTY_DRIVER_HOST_HPP__
+#define __RUSTY_DRIVER_HOST_HPP__
+
+#include <array>
+#include <cassert>
+#include <functional>
+#include <memory>               // allocator
+#include <utility>              // move()
+#include <vector>
+
+#include <linux/if_packet.h>    // sockaddr_ll
+#include <pthread.h>            // pthread_t
+#include <sys/socket.h>         // mmsghdr
+#include <sys/uio.h>            // iovec
+
+#include "driver/slab_allocator.hpp" // slab_allocator_t
+#include "driver/clock.hpp"     // cpu_clock_t
+#include "driver/cpu.hpp"       // cycles_t, CYCLES_PER_SECOND
+#include "driver/driver.hpp"    // DRIVER_DEBUG()
+#include "driver/message_ring.hpp" // message_ring_t
+#include "driver/buffer.hpp"    // cursor_t, host_buffer_stack_t
+#include "driver/timer.hpp"     // cpu_timer_manager_t
+#include "driver/timer_wheel.hpp" // wheel_timer_manager_t
+#include "net/endian.hpp"       // net_t
+#include "net/ethernet.hpp"     // ethernet_t
+#include "util/cycle.hpp"       // get_cycle_count()
+#include "util/mpsc_ring.hpp"   // mpsc_ring_t
+#include "util/stats.hpp"       // counter_t, CACHE_LINE_SIZE
+#include "util/trace.hpp"       // tracer_t, TRACE_SCOPE()
+
+using namespace std;
+
+using namespace rusty::net;
+
+namespace rusty {
+namespace driver {
+
+// Contains the sockets and the buffers of the workers of a network interface.
+//
+// Provides the same interface as 'mpipe_t' to the Ethernet layer and to the
+// application.
+struct host_t {
+    //
+    // Paramaters.
+    //
+
+    // Maximum number of frames a worker accumulates before giving them to
+    // 'sendmmsg()'.
+    //
+    // Frames are anyway transmitted at the end of every batch of received
+    // frames.
+    static constexpr size_t TX_BATCH_SIZE           = 64;
+
+    // Default maximum number of frames a worker receives with a single call to
+    // 'recvmmsg()' (see 'DEFAULT_RX_BATCH_SIZE' in 'driver/mpipe.hpp'). Can be
+    // changed for every 'host_t' instance.
+    static constexpr size_t DEFAULT_RX_BATCH_SIZE   = 16;
+
+    // Number of receive buffers of each worker.
+    //
+    // Buffers are held by the network stack while frames are waiting in
+    // reassembly queues. Frames are dropped by the kernel when a worker has no
+    // free buffer.
+    static constexpr size_t N_RX_BUFFERS            = 4096;
+
+    // Size of the receive and transmission buffers, which bounds the size of
+    // the frames.
+    #ifdef MPIPE_JUMBO_FRAMES
+        static constexpr size_t BUFFER_SIZE         = 9216;
+    #else
+        static constexpr size_t BUFFER_SIZE         = 2048;
+    #endif /* MPIPE_JUMBO_FRAMES */
+
+    // Received frames start two bytes after the beginning of their buffer, so
+    // that the headers following the Ethernet header are aligned, as in mPIPE
+    // buffers.
+    static constexpr size_t RX_BUFFER_OFFSET        = 2;
+
+    // Number of ARP cache updates which can be waiting to be applied by a
+    // worker (see 'ARP_UPDATES_RING_SIZE' in 'driver/mpipe.hpp').
+    //
+    // Must be a power of 2.
+    static constexpr size_t ARP_UPDATES_RING_SIZE   = 256;
+
+    // Number of closures which can be waiting to be executed by a worker (see
+    // 'host_t::instance_t::post()').
+    //
+    // Must be a power of 2.
+    static constexpr size_t MESSAGE_RING_SIZE       = 64;
+
+    //
+    // Member types
+    //
+
+    #if defined(USE_SLAB_ALLOCATOR)
+        // Allocates small objects from slabs which are obtained from the
+        // standard allocator.
+        typedef slab_allocator_t<char *>                    alloc_t;
+    #else
+        // Uses the standard allocator.
+        typedef allocator<char *>                           alloc_t;
+    #endif
+
+    // Each worker thread will be given a host instance, with its own socket.
+    struct instance_t {
+        //
+        // Member types
+        //
+
+        typedef cpu_clock_t                     clock_t;
+
+        // Cursor which will abstract how the upper (Ethernet) layer will read
+        // from and write to memory in packet buffers.
+        typedef buffer::cursor_t                cursor_t;
+
+        // Memory which is transmitted by 'send_packet()' after the content of
+        // the packet buffer. The kernel copies it, so it doesn't need to be
+        // registered as for the mPIPE.
+        typedef buffer::static_extent_t         static_extent_t;
+
+        // Upper layers (ARP, TCP) use the timer manager of the physical
+        // layer.
+        #ifdef USE_TIMER_WHEEL
+            typedef wheel_timer_manager_t<alloc_t>  timer_manager_t;
+        #else
+            typedef cpu_timer_manager_t<alloc_t>    timer_manager_t;
+        #endif /* USE_TIMER_WHEEL */
+
+        // Mapping learned by the ARP environment of another worker.
+        struct arp_update_t {
+            typedef net::ethernet_t<instance_t, alloc_t> ethernet_t;
+
+            net_t<ethernet_t::addr_t>                   ether_addr;
+            net_t<ethernet_t::ipv4_ethernet_t::addr_t>  ipv4_addr;
+        };
+
+        // Counters of the worker (see 'for_each_stat()').
+        struct alignas(util::CACHE_LINE_SIZE) stats_t {
+            util::counter_t                     rx_packets;
+
+            // Frames dropped by the driver as they were larger than a buffer.
+            util::counter_t                     rx_dropped;
+
+            // Iterations of the polling loop during which no buffer was
+            // available to receive frames.
+            util::counter_t                     rx_no_buffer;
+
+            // Frames returned by the last call to 'recvmmsg()'.
+            util::counter_t                     rx_batch;
+
+            util::counter_t                     tx_packets;
+
+            // Frames refused by the kernel.
+            util::counter_t                     tx_dropped;
+
+            // Calls to 'sendmmsg()'.
+            util::counter_t                     tx_calls;
+
+            // Timers scheduled at the end of the last iteration of the polling
+            // loop.
+            util::counter_t                     timers;
+        };
+
+        //
+        // Fields
+        //
+
+        host_t                                  *parent;
+        pthread_t                               thread;
+
+        alloc_t                                 alloc;
+
+        // CPU dedicated to the execution of this worker.
+        int                                     cpu_id;
+
+        // Packet socket bound to the interface, in the fanout group of the
+        // interface.
+        int                                     sock;
+
+        // Memory of the N_RX_BUFFERS receive buffers, followed by the
+        // TX_BATCH_SIZE transmission buffers.
+        char                                    *buffer_mem;
+
+        // Free receive buffers. Buffers which are given to 'recvmmsg()' are
+        // removed from the stack, and are returned to it when the last cursor
+        // which references their frame is destructed.
+        vector<char *>                          free_buffers;
+        buffer::host_buffer_stack_t             buffers;
+
+        // Receive buffers given to the next call to 'recvmmsg()', and their
+        // message headers. Up to 'parent->rx_batch_size' buffers.
+        vector<char *>                          rx_buffers;
+        size_t                                  rx_buffers_count = 0;
+        vector<struct mmsghdr>                  rx_msgs;
+        vector<struct iovec>                    rx_iovecs;
+        vector<struct sockaddr_ll>              rx_addrs;
+
+        // Frames which have not yet been given to 'sendmmsg()'. The i-th frame
+        // is written in the i-th transmission buffer and is gathered from the
+        // iovecs '2 * i' (buffer) and '2 * i + 1' (static tail).
+        char                                    *tx_buffer_mem;
+        array<struct mmsghdr, TX_BATCH_SIZE>    tx_msgs;
+        array<struct iovec, 2 * TX_BATCH_SIZE>  tx_iovecs;
+        size_t                                  tx_batch_count = 0;
+
+        // Upper Ethernet data-link layer.
+        net::ethernet_t<instance_t, alloc_t>    ethernet;
+
+        timer_manager_t                         timers;
+
+        // Each worker has its own ARP cache. Mappings learned from received
+        // ARP messages are pushed to the 'arp_updates' queue of every other
+        // worker, which applies them in its polling loop.
+        util::mpsc_ring_t<arp_update_t, ARP_UPDATES_RING_SIZE> arp_updates;
+
+        // Closures posted by other threads, executed by the polling loop.
+        message_ring_t<MESSAGE_RING_SIZE>       messages;
+
+        stats_t                                 stats;
+
+        #ifdef USE_TRACING
+            // Latencies of the processing stages of the worker. Disabled
+            // until 'tracer.enabled' is set.
+            util::tracer_t                      tracer;
+        #endif /* USE_TRACING */
+
+        //
+        // Methods
+        //
+
+        instance_t(alloc_t _alloc);
+
+        // Binds the thread to the worker's CPU and polls the socket. Doesn't
+        // return until 'parent->stop()' is called.
+        //
+        // Forwards any received frame to the upper (Ethernet) data-link layer.
+        //
+        // Frames are received by batches of at most 'parent->rx_batch_size'
+        // frames. Timers, ARP updates from other workers and posted closures
+        // are executed once per batch.
+        void run(void);
+
+        // Queues the closure for its execution by the polling loop of the
+        // worker, between two batches of received frames.
+        //
+        // The closure is executed by the worker's thread and can thus access
+        // its network stack. Returns 'false' if the worker's queue is full
+        // (see MESSAGE_RING_SIZE). Can be called by any thread.
+        inline bool post(function<void()> f);
+
+        // Calls 'f(const char *name, uint64_t value)' with every counter of
+        // the worker and of its network stack.
+        //
+        // Can be called by any thread, while the worker is running.
+        template <typename F>
+        void for_each_stat(F f) const;
+
+        // Sends a packet of the given size on the interface by calling the
+        // 'packet_writer' with a cursor corresponding to a transmission
+        // buffer.
+        //
+        // The packet is not immediately given to the kernel but is queued
+        // until the next call to 'flush()'.
+        //
+        // 'packet_writer' is any callable accepting a 'cursor_t'. It is called
+        // before the function returns.
+        template <typename packet_writer_t>
+        inline void send_packet(
+            size_t packet_size, packet_writer_t packet_writer
+        );
+
+        // Same as the previous 'send_packet()' but the last 'tail.size' bytes
+        // of the packet are gathered from the given static memory by the
+        // kernel. The cursor given to 'packet_writer' only references the
+        // first 'packet_size - tail.size' bytes.
+        template <typename packet_writer_t>
+        inline void send_packet(
+            size_t packet_size, packet_writer_t packet_writer,
+            static_extent_t tail
+        );
+
+        // Gives the queued frames to the kernel.
+        //
+        // Automatically called by 'run()' after each batch of received
+        // frames, and by 'send_packet()' when 'tx_msgs' is full.
+        inline void flush(void);
+
+        // Maximum packet size. Doesn't change after initialization.
+        inline size_t max_packet_size(void);
+
+        // Always 'false', as frames are copied into the reserved transmission
+        // buffers of the worker, which are released by 'flush()'.
+        inline bool tx_congested(size_t packet_size) const;
+
+        //
+        // Static methods
+        //
+
+        // Returns the current TCP sequence number.
+        static inline
+        net::ethernet_t<instance_t, alloc_t>::ipv4_ethernet_t::tcp_ipv4_t::seq_t
+        get_current_tcp_seq(void);
+
+    private:
+        // Gives a free buffer to each empty slot of 'rx_buffers', and prepares
+        // the message headers of 'recvmmsg()'.
+        //
+        // Returns the number of buffers which can receive a frame.
+        size_t _fill_rx_buffers(void);
+
+        // Gives the frames of 'tx_msgs' to 'sendmmsg()'.
+        void _flush_tx_batch(void);
+    };
+
+    typedef buffer::cursor_t                            cursor_t;
+    typedef buffer::static_extent_t                     static_extent_t;
+
+    // Aliases for upper network layer types.
+    //
+    // This permits the user to refer to network layer types easily, (i.e.
+    // 'host_t::ipv4_t::addr_t' to refer to an IPv4 address).
+
+    typedef net::ethernet_t<instance_t, alloc_t>        ethernet_t;
+    typedef host_t::ethernet_t::ipv4_ethernet_t         ipv4_t;
+    typedef host_t::ethernet_t::arp_ethernet_ipv4_t     arp_ipv4_t;
+    typedef host_t::ipv4_t::tcp_ipv4_t                  tcp_t;
+
+    //
+    // Fields
+    //
+
+    // Index of the interface.
+    int                         ifindex;
+
+    // Identifier of the fanout group of the sockets of the workers.
+    int                         fanout_id;
+
+    // Workers instances.
+    vector<instance_t *>        instances;
+
+    // Equals to 'true' while the workers are running.
+    //
+    // Setting this field to false will stop the execution of the workers.
+    bool                        is_running = false;
+
+    net_t<ethernet_t::addr_t>   ether_addr;
+
+    // Maximum packet size, derived from the MTU of the interface. Doesn't
+    // change after initialization.
+    size_t                      max_packet_size;
+
+    // Maximum number of frames a worker receives between two executions of
+    // its timers. Doesn't change after initialization.
+    size_t                      rx_batch_size;
+
+    // Worker which will open the next connection of 'tcp_connect()'.
+    size_t                      next_connect_worker = 0;
+
+    // -------------------------------------------------------------------------
+
+    //
+    // Methods
+    //
+
+    // Opens a socket for each worker on the given interface and allocates the
+    // buffers of the workers.
+    //
+    // Workers are bound to the CPUs 'first_cpu' to 'first_cpu + n_workers - 1'.
+    // Useful when multiple 'host_t' instances are created and that you don't
+    // want them to share the same CPUs.
+    //
+    // 'rx_batch_size' gives the maximum number of frames a worker processes
+    // in a single iteration of its polling loop (see DEFAULT_RX_BATCH_SIZE).
+    //
+    // Requires the CAP_NET_RAW capability.
+    host_t(
+        const char *link_name, net_t<ipv4_t::addr_t> ipv4_addr, int n_workers,
+        int first_cpu = 0,
+        vector<arp_ipv4_t::static_entry_t> static_arp_entries
+            = vector<arp_ipv4_t::static_entry_t>(),
+        size_t rx_batch_size = DEFAULT_RX_BATCH_SIZE
+    );
+
+    // Closes the sockets, and destructs and releases the workers and their
+    // buffers. The workers must have been joined.
+    ~host_t(void);
+
+    // Starts the workers and process any received frame.
+    //
+    // The function immediately returns.
+    void run(void);
+
+    // Stops the execution of working threads.
+    //
+    // This method just sets 'is_running' to 'false'. You should make a call to
+    // 'join()' after to wait for threads to finish.
+    void stop(void);
+
+    // Waits for threads to finish.
+    void join(void);
+
+    // Executes the function on every worker, with the worker's instance as
+    // argument.
+    //
+    // Same semantic as 'mpipe_t::broadcast()'.
+    void broadcast(function<void(instance_t *)> f);
+
+    // Calls 'f(const char *name, uint64_t value)' with every counter, summed
+    // over the workers.
+    //
+    // Can be called by any thread, without locking nor interrupting the
+    // workers. Counters of different workers are read at slightly different
+    // times.
+    template <typename F>
+    void for_each_stat(F f) const;
+
+    //
+    // TCP server sockets.
+    //
+
+    // Starts listening for TCP connections on the given port.
+    //
+    // Can be called while workers are running, in which case the port will be
+    // opened by each worker at the next iteration of its polling loop (see
+    // 'broadcast()').
+    void tcp_listen(
+        tcp_t::port_t tcp, tcp_t::new_conn_callback_t new_conn_callback
+    );
+
+    // Same as the previous 'tcp_listen()' but allows to specify the backlog
+    // and the SYN cookies policy of the port.
+    //
+    // The backlog is per worker.
+    void tcp_listen(
+        tcp_t::port_t tcp, tcp_t::new_conn_callback_t new_conn_callback,
+        tcp_t::listen_options_t options
+    );
+
+    //
+    // TCP client sockets.
+    //
+
+    // Opens a connection to the given remote address and port.
+    //
+    // Same semantic as 'mpipe_t::tcp_connect()'. The fanout program steers
+    // the segments sent to an ephemeral port to the worker which chose it.
+    // Without PACKET_FANOUT_CBPF (Linux 4.2), active connections are only
+    // reliable with a single worker.
+    void tcp_connect(
+        net_t<ipv4_t::addr_t> raddr, tcp_t::port_t rport,
+        tcp_t::new_conn_callback_t new_conn_callback,
+        tcp_t::conn_failed_callback_t connect_failed = nullptr
+    );
+};
+
+inline bool host_t::instance_t::post(function<void()> f)
+{
+    return this->messages.post(move(f));
+}
+
+template <typename F>
+void host_t::instance_t::for_each_stat(F f) const
+{
+    f("host.rx_packets",        this->stats.rx_packets.get());
+    f("host.rx_dropped",        this->stats.rx_dropped.get());
+    f("host.rx_no_buffer",      this->stats.rx_no_buffer.get());
+    f("host.rx_batch",          this->stats.rx_batch.get());
+    f("host.tx_packets",        this->stats.tx_packets.get());
+    f("host.tx_dropped",        this->stats.tx_dropped.get());
+    f("host.tx_calls",          this->stats.tx_calls.get());
+    f("timers.scheduled",       this->stats.timers.get());
+
+    this->ethernet.for_each_stat(f);
+}
+
+template <typename F>
+void host_t::for_each_stat(F f) const
+{
+    // Every worker gives its counters in the same order.
+
+    vector<pair<const char *, uint64_t>> sums;
+
+    for (size_t i = 0; i < this->instances.size(); i++) {
+        size_t j = 0;
+
+        this->instances[i]->for_each_stat(
+        [&sums, &j, i](const char *name, uint64_t value) {
+            if (i == 0)
+                sums.emplace_back(name, value);
+            else
+                sums[j++].second += value;
+        });
+    }
+
+    for (const pair<const char *, uint64_t> &sum : sums)
+        f(sum.first, sum.second);
+}
+
+inline size_t host_t::instance_t::max_packet_size(void)
+{
+    return this->parent->max_packet_size;
+}
+
+inline bool host_t::instance_t::tx_congested(size_t packet_size) const
+{
+    return false;
+}
+
+template <typename packet_writer_t>
+inline void host_t::instance_t::send_packet(
+    size_t packet_size, packet_writer_t packet_writer
+)
+{
+    this->send_packet(packet_size, move(packet_writer), static_extent_t());
+}
+
+template <typename packet_writer_t>
+inline void host_t::instance_t::send_packet(
+    size_t packet_size, packet_writer_t packet_writer, static_extent_t tail
+)
+{
+    assert(packet_size <= this->parent->max_packet_size);
+    assert(tail.size <= packet_size);
+
+    TRACE_SCOPE(TRACE_SEND);
+
+    DRIVER_DEBUG(
+        "Sends a %zu bytes packet (%zu bytes by reference)", packet_size,
+        tail.size
+    );
+
+    if (UNLIKELY(this->tx_batch_count == TX_BATCH_SIZE))
+        this->_flush_tx_batch();
+
+    size_t i = this->tx_batch_count;
+
+    // Number of bytes written by 'packet_writer' in the transmission buffer.
+    size_t buffer_size = packet_size - tail.size;
+
+    char *buffer = this->tx_buffer_mem + i * BUFFER_SIZE;
+
+    // The buffer is reused once the frame has been given to the kernel, the
+    // cursor is thus unmanaged.
+    packet_writer(
+        cursor_t(nullptr, nullptr, buffer, buffer_size, false, this->alloc)
+    );
+
+    struct iovec *iovecs = &this->tx_iovecs[2 * i];
+    iovecs[0].iov_base  = buffer;
+    iovecs[0].iov_len   = buffer_size;
+    iovecs[1].iov_base  = (void *) tail.data;
+    iovecs[1].iov_len   = tail.size;
+
+    this->tx_msgs[i].msg_hdr.msg_iovlen = tail.size > 0 ? 2 : 1;
+
+    this->tx_batch_count++;
+
+    this->stats.tx_packets.inc();
+}
+
+inline void host_t::instance_t::flush(void)
+{
+    if (this->tx_batch_count > 0)
+        this->_flush_tx_batch();
+}
+
+inline host_t::tcp_t::seq_t host_t::instance_t::get_current_tcp_seq(void)
+{
+    // Number of cycles between two increments of the sequence number
+    // (~ 4 µs).
+    static const cpu::cycles_t DELAY = cpu::CYCLES_PER_SECOND * 4 / 1000000;
+
+    return host_t::tcp_t::seq_t((uint32_t) (get_cycle_count() / DELAY));
+}
+
+} } /* namespace rusty::driver */
+
+#endif /* __RUSTY_DRIVER_HOST_HPP__ */
@@ -0,0 +1,88 @@
+//
+// Provides a queue of closures used to execute functions on the event loop of
+// another worker.
+//
+// Copyright 2015 Raphael Javaux <raphaeljavaux@gmail.com>
+// University of Liege.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __RUSTY_DRIVER_MESSAGE_RING_HPP__
+#define __RUSTY_DRIVER_MESSAGE_RING_HPP__
+
+#include <functional>
+#include <utility>              // move()
+
+#include "util/macros.hpp"      // LIKELY()
+#include "util/mpsc_ring.hpp"   // mpsc_ring_t
+
+using namespace std;
+
+namespace rusty {
+namespace driver {
+
+// Queue of closures which are posted by any thread and executed by the single
+// thread which owns the queue.
+//
+// The owner thread calls 'execute()' in its event loop. The data path never
+// takes a lock: posting a closure is a lock-free push, and checking an empty
+// queue is a single read of a cache line owned by the consumer.
+//
+// Closures are stored in 'std::function' objects, which could allocate memory.
+// The queue is meant for control-plane messages, not for per-packet work.
+//
+// 'N' must be a power of two.
+template <size_t N>
+struct message_ring_t {
+    //
+    // Member types
+    //
+
+    typedef function<void()>        message_t;
+
+    //
+    // Fields
+    //
+
+    util::mpsc_ring_t<message_t, N> ring;
+
+    //
+    // Methods
+    //
+
+    // Queues the closure for its execution by the owner of the queue.
+    //
+    // Returns 'false' if the queue is full. Can be called by any thread.
+    inline bool post(message_t message)
+    {
+        return ring.emplace(move(message));
+    }
+
+    // Executes every queued closure, including the ones which are posted while
+    // closures are executed.
+    //
+    // Returns the number of executed closures. Must only be called by the
+    // owner of the queue.
+    inline size_t execute(void)
+    {
+        return ring.drain([](message_t message) {
+            message();
+        });
+    }
+};
+
+} } /* namespace rusty::driver */
+
+#endif /* __RUSTY_DRIVER_MESSAGE_RING_HPP__ */
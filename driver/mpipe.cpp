@@ -21,16 +21,21 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 //
 
-#include <algorithm>            // sort()
+#include <algorithm>            // max(), sort()
+#include <atomic>
+#include <bitset>
 #include <cassert>
+#include <cinttypes>            // PRIu64
 #include <cstdint>
 #include <cstdio>
-#include <cstdlib>
+#include <cstdlib>              // posix_memalign()
 #include <functional>
-#include <memory>               // allocator
+#include <memory>               // allocator, make_shared()
 #include <utility>              // min()
 
 #include <net/ethernet.h>       // struct ether_addr
+#include <netinet/in.h>         // IPPROTO_TCP
+#include <netinet/ip.h>         // IP_OFFMASK
 #include <pthread.h>            // pthread_*
 
 #include <gxio/mpipe.h>         // gxio_mpipe_*
@@ -58,6 +63,23 @@ namespace driver {
 // environment (in network byte order).
 static net_t<mpipe_t::ethernet_t::addr_t> _ether_addr(gxio_mpipe_link_t *link);
 
+// Allocates an eDMA ring and initializes the given equeue wrapper to use it
+// with the given link.
+//
+// Returns the memory allocated for the ring.
+static char *_init_equeue(
+    gxio_mpipe_context_t *context, gxio_mpipe_link_t *link,
+    gxio_mpipe_equeue_t *equeue, unsigned int *edma_ring_id
+);
+
+// Reads the destination port of the TCP segment carried by the given Ethernet
+// frame.
+//
+// Returns 'false' if the frame doesn't start with the header of a TCP segment.
+static bool _tcp_dport(
+    const char *frame, size_t frame_size, net_t<mpipe_t::tcp_t::port_t> *dport
+);
+
 mpipe_t::instance_t::instance_t(alloc_t _alloc)
     : alloc(_alloc), ethernet(_alloc), timers(_alloc)
 {
@@ -72,6 +94,10 @@ void mpipe_t::instance_t::run(void)
     result = tmc_cpus_set_my_cpu(this->cpu_id);
     VERIFY_ERRNO(result, "tmc_cpus_set_my_cpu()");
 
+    #ifdef USE_TRACING
+        util::current_tracer() = &this->tracer;
+    #endif /* USE_TRACING */
+
     #ifdef DEBUG_DATAPLANE
         // Put dataplane tiles in "debug" mode. Interrupts other than page
         // faults will generate a kernel stacktrace.
@@ -79,70 +105,360 @@ void mpipe_t::instance_t::run(void)
         VERIFY_ERRNO(result, "set_dataplane()");
     #endif
 
-    // Polling loop over the packet queue. Tries to executes timers between
-    // polling attempts.
+    // Polling loop over the packet queue. Executes timers and applies the ARP
+    // updates of the other workers between batches of received packets.
+
+    const size_t batch_size = this->parent->rx_batch_size;
+
+    // Packets are only handed off to other workers when their worker can
+    // differ from the one of their NotifRing.
+    const bool is_steering =
+        this->parent->rebalancing || !this->parent->pinned_ports.empty();
+
+    if (this->parent->rebalancing) {
+        this->timers.schedule(REBALANCE_INTERVAL, [this]() {
+            this->_rebalance();
+        });
+    }
 
     while (LIKELY(this->parent->is_running)) {
+        if (UNLIKELY(this->empty_stacks != 0))
+            this->_probe_empty_stacks();
+
         this->timers.tick();
 
-        gxio_mpipe_idesc_t idesc;
+        this->stats.timers.set(this->timers.size());
 
-        result = gxio_mpipe_iqueue_try_get(&this->iqueue, &idesc);
+        this->arp_updates.drain([this](arp_update_t update) {
+            this->ethernet.arp.apply_update(
+                update.ether_addr, update.ipv4_addr
+            );
+        });
 
-        if (UNLIKELY(result == GXIO_MPIPE_ERR_IQUEUE_EMPTY)) // Queue is empty. Retries.
-            continue;
+        this->messages.execute();
 
-        if (gxio_mpipe_iqueue_drop_if_bad(&this->iqueue, &idesc)) {
-            DRIVER_DEBUG("Invalid packet dropped");
+        size_t n_handoffs = this->handoffs.drain(
+        [this](gxio_mpipe_idesc_t idesc) {
+            this->stats.rx_packets.inc();
+            this->stats.buffers[idesc.size].inc();
+
+            this->_receive_packet(&idesc);
+        });
+
+        if (UNLIKELY(n_handoffs > 0))
+            this->ethernet.end_of_batch();
+
+        // Peeks at the descriptors which are available in the queue, without
+        // consuming them. Descriptors are only returned to the queue once the
+        // whole batch has been processed.
+
+        gxio_mpipe_idesc_t *idescs;
+
+        result = gxio_mpipe_iqueue_try_peek(&this->iqueue, &idescs);
+
+        this->rx_load = this->rx_load - (this->rx_load >> RX_LOAD_SHIFT)
+                      + max(result, 0);
+        this->stats.rx_queue_load.set(this->rx_load >> RX_LOAD_SHIFT);
+
+        if (UNLIKELY(result <= 0)) {
+            // Queue is empty. Posts the packets emitted by the timers and the
+            // closures, and retries.
+            this->flush();
             continue;
         }
 
-        // Initializes a buffer cursor which starts at the Ethernet header and
-        // stops at the end of the packet.
-        //
-        // The buffer will be freed when the cursor will be destructed.
-        cursor_t cursor(&this->parent->context, &idesc, true, this->alloc);
-        cursor = cursor.drop(gxio_mpipe_idesc_get_l2_offset(&idesc));
+        TRACE_BEGIN(batch_begin);
+
+        size_t n_idescs = min((size_t) result, batch_size);
+
+        this->stats.rx_queue_depth.set(result);
 
-        tmc_mem_prefetch(cursor.current, cursor.current_size);
+        // Prefetches the buffers of the entire batch before processing the
+        // first packet, so memory accesses of the following packets overlap
+        // with the processing of the previous ones.
 
-        DRIVER_DEBUG("Receives a %zu bytes packet", cursor.size());
+        for (size_t i = 0; i < n_idescs; i++) {
+            gxio_mpipe_idesc_t *idesc = &idescs[i];
 
-        this->ethernet.receive_frame(cursor);
+            tmc_mem_prefetch(
+                gxio_mpipe_idesc_get_l2_start(idesc),
+                gxio_mpipe_idesc_get_l2_length(idesc)
+            );
+        }
+
+        for (size_t i = 0; i < n_idescs; i++) {
+            gxio_mpipe_idesc_t *idesc = &idescs[i];
+
+            if (gxio_mpipe_iqueue_drop_if_bad(&this->iqueue, idesc)) {
+                this->stats.rx_dropped.inc();
+
+                // Buffer error: no buffer was available for the packet.
+                if (idesc->be)
+                    this->stats.rx_no_buffer.inc();
+
+                DRIVER_DEBUG("Invalid packet dropped");
+                continue;
+            }
+
+            if (UNLIKELY(is_steering)) {
+                instance_t *worker = this->_packet_worker(idesc);
+
+                if (worker != this) {
+                    if (LIKELY(worker->handoffs.push(*idesc)))
+                        this->stats.rx_handoffs.inc();
+                    else {
+                        gxio_mpipe_iqueue_drop(&this->iqueue, idesc);
+                        this->stats.rx_dropped.inc();
+
+                        DRIVER_DEBUG(
+                            "Packet dropped (handoff queue of Tile %d is full)",
+                            worker->cpu_id
+                        );
+                    }
+
+                    continue;
+                }
+            }
+
+            this->stats.rx_packets.inc();
+            this->stats.buffers[idesc->size].inc();
+
+            // Starts to load the connection state of the next packet before
+            // processing this one.
+            //
+            // Headers always fit in the first buffer of a packet, as buffers
+            // are at least 128 bytes long.
+            if (i + 1 < n_idescs) {
+                gxio_mpipe_idesc_t *next = &idescs[i + 1];
+
+                this->ethernet.prefetch_frame(
+                    (const char *) gxio_mpipe_idesc_get_l2_start(next),
+                    gxio_mpipe_idesc_get_l2_length(next)
+                );
+            }
+
+            TRACE_END(TRACE_RX_QUEUE, batch_begin);
+
+            TRACE_BEGIN(frame_begin);
+            this->_receive_packet(idesc);
+            TRACE_END(TRACE_RX_FRAME, frame_begin);
+        }
+
+        // Consumes the batch. Releasing the entries returns their NotifRing
+        // and bucket credits to the mPIPE, including these of the dropped and
+        // handed-off descriptors, which are still owned by this queue.
+        gxio_mpipe_iqueue_advance(&this->iqueue, n_idescs);
+        gxio_mpipe_iqueue_release(&this->iqueue, n_idescs);
+
+        // Sends the acknowledgments which have been merged over the batch.
+        this->ethernet.end_of_batch();
+
+        // Posts the packets emitted by the timers and while processing the
+        // batch.
+        this->flush();
     }
 }
 
-void mpipe_t::instance_t::send_packet(
-    size_t packet_size, function<void(cursor_t)> packet_writer
+mpipe_t::instance_t *mpipe_t::instance_t::_packet_worker(
+    gxio_mpipe_idesc_t *idesc
+) const
+{
+    const mpipe_t *parent = this->parent;
+
+    if (!parent->pinned_ports.empty()) {
+        net_t<tcp_t::port_t> dport;
+
+        bool is_tcp = _tcp_dport(
+            (const char *) gxio_mpipe_idesc_get_l2_start(idesc),
+            gxio_mpipe_idesc_get_l2_length(idesc), &dport
+        );
+
+        if (is_tcp) {
+            auto pinned_it = parent->pinned_ports.find(dport);
+
+            if (pinned_it != parent->pinned_ports.end())
+                return parent->instances[pinned_it->second];
+        }
+    }
+
+    size_t bucket = idesc->bucket_id - parent->first_bucket_id;
+    return parent->instances[
+        (*parent->bucket_workers)[bucket].load(memory_order_acquire)
+    ];
+}
+
+void mpipe_t::instance_t::_rebalance(void)
+{
+    mpipe_t *parent = this->parent;
+
+    this->timers.schedule(REBALANCE_INTERVAL, [this]() {
+        this->_rebalance();
+    });
+
+    // Finds the least loaded worker.
+
+    uint64_t load = this->stats.rx_queue_load.get();
+
+    instance_t *target = nullptr;
+    uint64_t target_load = 0;
+
+    for (instance_t *other : parent->instances) {
+        uint64_t other_load = other->stats.rx_queue_load.get();
+
+        if (other != this && (target == nullptr || other_load < target_load)) {
+            target      = other;
+            target_load = other_load;
+        }
+    }
+
+    if (target == nullptr || load < REBALANCE_MIN_DEPTH
+        || load < 2 * target_load)
+        return;
+
+    // Buckets which hold at least one TCB can't be moved. As the worker is
+    // the only one to create TCBs in its buckets, no TCB can be created
+    // between this scan and the moves.
+
+    bitset<N_BUCKETS> used_buckets;
+
+    this->ethernet.ipv4.tcp.for_each_tcb_id(
+    [&used_buckets](const tcp_t::tcb_id_t &tcb_id) {
+        used_buckets.set(bucket_hash_t()(tcb_id) % N_BUCKETS);
+    });
+
+    size_t n_moved = 0;
+
+    for (size_t bucket = 0; bucket < N_BUCKETS; bucket++) {
+        if (n_moved >= REBALANCE_MAX_BUCKETS)
+            break;
+
+        atomic<uint16_t> *bucket_worker = &(*parent->bucket_workers)[bucket];
+
+        if (bucket_worker->load(memory_order_relaxed) != this->worker_id
+            || used_buckets.test(bucket))
+            continue;
+
+        // Packets already queued for the bucket will be handed off.
+        bucket_worker->store(target->worker_id, memory_order_release);
+
+        gxio_mpipe_bucket_info_t bucket_info;
+        bucket_info.word        = 0;
+        bucket_info.group       = parent->notif_group_id;
+        bucket_info.mode        = GXIO_MPIPE_BUCKET_STATIC_FLOW_AFFINITY;
+        bucket_info.notifring   = parent->first_ring_id + target->worker_id;
+
+        int result = gxio_mpipe_init_bucket(
+            &parent->context, parent->first_bucket_id + bucket, bucket_info
+        );
+        VERIFY_GXIO(result, "gxio_mpipe_init_bucket()");
+
+        n_moved++;
+    }
+
+    if (n_moved == 0)
+        return;
+
+    this->stats.buckets_moved.inc(n_moved);
+
+    DRIVER_DEBUG(
+        "Tile %d gives %zu buckets to Tile %d (queue depths: %" PRIu64 " and "
+        "%" PRIu64 ")", this->cpu_id, n_moved, target->cpu_id, load,
+        target_load
+    );
+}
+
+void mpipe_t::instance_t::_queue_packet(
+    const gxio_mpipe_bdesc_t *bdescs, size_t n_bdescs, size_t buffers_size,
+    static_extent_t tail
 )
 {
-    assert(packet_size <= this->parent->max_packet_size);
+    size_t n_tail_edescs =
+        (tail.size + MAX_EDESC_XFER_SIZE - 1) / MAX_EDESC_XFER_SIZE;
+    size_t n_edescs = n_bdescs + n_tail_edescs;
+
+    assert(n_bdescs > 0);
+    assert(n_edescs <= TX_BATCH_SIZE);
+
+    // The descriptors of a frame must occupy contiguous slots of the equeue,
+    // which could be shared with other workers. They are thus always posted
+    // in the same batch.
+
+    if (UNLIKELY(this->tx_batch_count + n_edescs > TX_BATCH_SIZE))
+        this->_flush_tx_batch();
+
+    this->stats.tx_packets.inc();
+
+    // Queues the descriptors. They will be posted with the other descriptors
+    // of the batch. Only the last descriptor of the frame has the 'bound' bit.
+
+    size_t remaining = buffers_size;
+
+    for (size_t i = 0; i < n_bdescs; i++) {
+        size_t buffer_size = gxio_mpipe_buffer_size_enum_to_buffer_size(
+            (gxio_mpipe_buffer_size_enum_t) bdescs[i].size
+        );
 
-    DRIVER_DEBUG("Sends a %zu bytes packet", packet_size);
+        gxio_mpipe_edesc_t edesc = { 0 };
+        edesc.bound     = i + 1 == n_edescs;
+        edesc.hwb       = 1,        // The buffer will be automaticaly freed.
+        edesc.xfer_size = min(remaining, buffer_size);
 
-    // Allocates a buffer and executes the 'packet_writer' on its memory.
-    gxio_mpipe_bdesc_t bdesc = this->parent->_alloc_buffer(packet_size);
+        // Sets 'va', 'stack_idx', 'inst', 'hwb', 'size' and 'c'.
+        gxio_mpipe_edesc_set_bdesc(&edesc, bdescs[i]);
 
-    // Allocates an unmanaged cursor, which will not desallocate the buffer when
-    // destr
-    cursor_t cursor(
-        &this->parent->context, &bdesc, packet_size, false, this->alloc
+        remaining -= edesc.xfer_size;
+
+        this->tx_batch[this->tx_batch_count++] = edesc;
+    }
+
+    assert(remaining == 0);
+
+    // Static memory is never freed by the mPIPE.
+
+    const char *data = tail.data;
+    remaining        = tail.size;
+
+    for (size_t i = 0; i < n_tail_edescs; i++) {
+        gxio_mpipe_edesc_t edesc = { 0 };
+        edesc.bound     = n_bdescs + i + 1 == n_edescs;
+        edesc.hwb       = 0;
+        edesc.xfer_size = min(remaining, MAX_EDESC_XFER_SIZE);
+        edesc.va        = (uintptr_t) data;
+        edesc.stack_idx = this->parent->static_stack_id;
+        edesc.c         = MPIPE_EDMA_DESC_WORD1__C_VAL_UNCHAINED;
+
+        data      += edesc.xfer_size;
+        remaining -= edesc.xfer_size;
+
+        this->tx_batch[this->tx_batch_count++] = edesc;
+    }
+}
+
+void mpipe_t::instance_t::_flush_tx_batch(void)
+{
+    assert(this->tx_batch_count > 0);
+
+    TRACE_SCOPE(TRACE_TX_FLUSH);
+
+    DRIVER_DEBUG("Posts %zu egress descriptors", this->tx_batch_count);
+
+    // Reserves the slots for the entire batch at once. Waits for the mPIPE if
+    // not enough slots are available.
+    int64_t slot = gxio_mpipe_equeue_reserve(
+        this->equeue, this->tx_batch_count
     );
-    packet_writer(cursor);
+    VERIFY_GXIO(slot, "gxio_mpipe_equeue_reserve()");
 
-    // Creates the egress descriptor.
+    // Makes the content of the buffers visible to the mPIPE before posting
+    // the descriptors. A single fence is required for the whole batch.
+    tmc_mem_fence();
 
-    gxio_mpipe_edesc_t edesc = { 0 };
-    edesc.bound     = 1;            // Last and single descriptor for the trame.
-    edesc.hwb       = 1,            // The buffer will be automaticaly freed.
-    edesc.xfer_size = packet_size;
+    for (size_t i = 0; i < this->tx_batch_count; i++)
+        gxio_mpipe_equeue_put_at(this->equeue, this->tx_batch[i], slot + i);
 
-    // Sets 'va', 'stack_idx', 'inst', 'hwb', 'size' and 'c'.
-    gxio_mpipe_edesc_set_bdesc(&edesc, bdesc); 
+    this->stats.tx_descriptors.inc(this->tx_batch_count);
 
-    // NOTE: if multiple packets are to be sent, reserve() + put_at() with a
-    // single memory barrier should be more efficient.
-    gxio_mpipe_equeue_put(&this->parent->equeue, edesc);
+    this->tx_batch_count = 0;
 }
 
 // We use multiple NotigRings linked to the same NotifGroup to enable some
@@ -152,11 +468,14 @@ void mpipe_t::instance_t::send_packet(
 mpipe_t::mpipe_t(
     const char *link_name, net_t<ipv4_t::addr_t> ipv4_addr, int n_workers,
     int first_dataplane_cpu,
-    vector<arp_ipv4_t::static_entry_t> static_arp4_entries
-) : instances(n_workers)
+    vector<arp_ipv4_t::static_entry_t> static_arp4_entries,
+    size_t rx_batch_size, vector<buffer_stack_info_t> buffer_stacks_info
+) : instances(n_workers), bucket_workers(make_shared<bucket_workers_t>()),
+    rx_batch_size(rx_batch_size)
 {
     assert(n_workers > 0);
     assert((unsigned int) n_workers <= N_BUCKETS);
+    assert(rx_batch_size > 0 && rx_batch_size <= IQUEUE_ENTRIES);
 
     int result;
 
@@ -219,15 +538,25 @@ mpipe_t::mpipe_t(
             #ifdef USE_TILE_ALLOCATOR
                 // Allocates the instance on its dedicated CPU.
                 tile_allocator_t<instance_t> alloc(cpu_id);
+
+                this->instances[i] = alloc.allocate(1);
             #else
-                // Uses the standard allocator.
+                // Uses the standard allocator. 'allocator<instance_t>' doesn't
+                // honor the cache line alignment of the instance before C++17.
                 allocator<instance_t> alloc;
-            #endif /* USE_TILE_ALLOCATOR */
 
-            this->instances[i] = alloc.allocate(1);
+                result = posix_memalign(
+                    (void **) &this->instances[i], alignof (instance_t),
+                    sizeof (instance_t)
+                );
+                if (result != 0)
+                    DRIVER_DIE("Unable to allocate the instance");
+            #endif /* USE_TILE_ALLOCATOR */
 
-            // Constructs the instance and gives the allocator.
-            new (this->instances[i]) instance_t(alloc);
+            // Constructs the instance and gives the allocator. With
+            // USE_SLAB_ALLOCATOR, the slabs will also be homed on the worker's
+            // CPU.
+            new (this->instances[i]) instance_t(alloc_t(alloc));
 
             this->instances[i]->cpu_id = cpu_id;
         }
@@ -247,7 +576,7 @@ mpipe_t::mpipe_t(
 
         result = gxio_mpipe_alloc_notif_rings(context, n_workers, 0, 0);
         VERIFY_GXIO(result, "gxio_mpipe_alloc_notif_rings()");
-        unsigned int first_ring_id = result;
+        this->first_ring_id = result;
 
         tmc_alloc_t alloc = TMC_ALLOC_INIT;
 
@@ -262,7 +591,7 @@ mpipe_t::mpipe_t(
         for (int i = 0; i < n_workers; i++) {
             instance_t *instance = this->instances[i];
 
-            unsigned int ring_id = first_ring_id + i;
+            unsigned int ring_id = this->first_ring_id + i;
 
             // Allocates a NotifRing for each worker.
             //
@@ -314,93 +643,72 @@ mpipe_t::mpipe_t(
         // NotifRing to the group.
 
         result = gxio_mpipe_init_notif_group_and_buckets(
-            context, this->notif_group_id, first_ring_id,
+            context, this->notif_group_id, this->first_ring_id,
             n_workers /* ring count */, this->first_bucket_id, N_BUCKETS,
             // Load-balancing mode: packets of a same flow go to the same
             // bucket.
             GXIO_MPIPE_BUCKET_STATIC_FLOW_AFFINITY
         );
         VERIFY_GXIO(result, "gxio_mpipe_init_notif_group_and_buckets()");
+
+        // Buckets are assigned to the NotifRings in turn.
+        for (size_t i = 0; i < N_BUCKETS; i++)
+            (*this->bucket_workers)[i].store(i % n_workers);
     }
 
     //
     // Egress queue.
     //
-    // Initializes a single eDMA ring with its equeue wrapper.
+    // Initializes a single eDMA ring with its equeue wrapper, or an eDMA ring
+    // for each worker if MPIPE_WORKER_EQUEUES is defined.
     //
 
-    {
-        // Allocates a single eDMA ring ID. Multiple eDMA rings could be used
-        // concurrently on the same context/link.
-        result = gxio_mpipe_alloc_edma_rings(context, 1 /* count */, 0, 0);
-        VERIFY_GXIO(result, "gxio_mpipe_alloc_edma_rings");
-        this->edma_ring_id = result;
-
-        size_t ring_size = EQUEUE_ENTRIES * sizeof(gxio_mpipe_edesc_t);
-
-        // The eDMA ring must be 1 KB aligned and must reside on a single
-        // physically contiguous memory. So we allocate a page sufficiently
-        // large to hold it.
-        // As only the mPIPE hardware and no Tile will read from this memory,
-        // and as memory-write are non-blocking in this case, we can benefit
-        // from an hash-for-home cache policy.
-        // NOTE: test the impact on this policy on performances.
-        tmc_alloc_t alloc = TMC_ALLOC_INIT;
-        tmc_alloc_set_home(&alloc, TMC_ALLOC_HOME_HASH);
-
-        // Sets page_size >= ring_size.
-        if (tmc_alloc_set_pagesize(&alloc, ring_size) == NULL)
-            DRIVER_DIE("tmc_alloc_set_pagesize()");
-
-        assert(tmc_alloc_get_pagesize(&alloc) >= ring_size);
-
-        DRIVER_DEBUG(
-            "Allocating %zu bytes for the eDMA ring on a %zu bytes page",
-            ring_size, tmc_alloc_get_pagesize(&alloc)
+    #ifdef MPIPE_WORKER_EQUEUES
+        for (instance_t *instance : this->instances) {
+            instance->edma_ring_mem = _init_equeue(
+                context, &this->link, &instance->worker_equeue,
+                &instance->edma_ring_id
+            );
+            instance->equeue = &instance->worker_equeue;
+        }
+    #else
+        this->edma_ring_mem = _init_equeue(
+            context, &this->link, &this->equeue, &this->edma_ring_id
         );
 
-        this->edma_ring_mem = (char *) tmc_alloc_map(&alloc, ring_size);
-        if (this->edma_ring_mem == NULL)
-            DRIVER_DIE("tmc_alloc_map()");
-
-        // ring is 1 KB aligned.
-        assert(((intptr_t) this->edma_ring_mem & 0x3FF) == 0);
-
-        // Initializes an equeue which uses the eDMA ring memory and the channel
-        // associated with the context's link.
-
-        int channel = gxio_mpipe_link_channel(&this->link);
-
-        result = gxio_mpipe_equeue_init(
-            &this->equeue, context, this->edma_ring_id,
-            channel, this->edma_ring_mem, ring_size, 0
-        );
-        VERIFY_GXIO(result, "gxio_gxio_equeue_init()");
-    }
+        for (instance_t *instance : this->instances)
+            instance->equeue = &this->equeue;
+    #endif /* MPIPE_WORKER_EQUEUES */
 
     //
     // Buffer stacks and buffers
     //
     // Initializes a buffer stack and a set of buffers for each non-empty stack
-    // in BUFFERS_STACKS.
+    // in 'buffer_stacks_info'.
     //
 
     {
         // Counts the number of non-empty buffer stacks.
         int n_stacks = 0;
-        for (const buffer_stack_info_t& stack_info : BUFFERS_STACKS) {
+        for (const buffer_stack_info_t& stack_info : buffer_stacks_info) {
             if (stack_info.count > 0)
                 n_stacks++;
         }
 
-        result = gxio_mpipe_alloc_buffer_stacks(context, n_stacks, 0, 0);
+        // One stack is used for static memory. 'empty_stacks' has a bit per
+        // stack.
+        if (n_stacks == 0 || n_stacks > 31)
+            DRIVER_DIE("Between 1 and 31 non-empty buffer stacks are required");
+
+        // Allocates an additional stack for static memory.
+        result = gxio_mpipe_alloc_buffer_stacks(context, n_stacks + 1, 0, 0);
         VERIFY_GXIO(result, "gxio_mpipe_alloc_buffer_stacks()");
         unsigned int stack_id = result;
 
         this->buffer_stacks.reserve(n_stacks);
 
         // Allocates, initializes and registers the memory for each stacks.
-        for (const buffer_stack_info_t& stack_info : BUFFERS_STACKS) {
+        for (const buffer_stack_info_t& stack_info : buffer_stacks_info) {
             // Skips unused buffer types.
             if (stack_info.count <= 0)
                 continue;
@@ -501,7 +809,7 @@ mpipe_t::mpipe_t(
             // Registers the stack resources in the environment.
 
             buffer_stack_t buffer_stack = {
-                &stack_info, stack_id, buffer_size,
+                stack_info, stack_id, buffer_size,
                 mem, mem + stack_size, total_size
             };
 
@@ -510,22 +818,63 @@ mpipe_t::mpipe_t(
             stack_id++;
         }
 
+        // Initializes the stack used to register static memory.
+        //
+        // The stack never contains any buffer. It's only used for its TLB
+        // entries (see 'register_static_mem()').
+
+        {
+            this->static_stack_mem_size = max(
+                gxio_mpipe_calc_buffer_stack_bytes(1), (size_t) 64 * 1024
+            );
+
+            tmc_alloc_t alloc = TMC_ALLOC_INIT;
+            if (tmc_alloc_set_pagesize(&alloc, 64 * 1024) == NULL)
+                DRIVER_DIE("tmc_alloc_set_pagesize()");
+
+            this->static_stack_mem = (char *) tmc_alloc_map(
+                &alloc, this->static_stack_mem_size
+            );
+            if (this->static_stack_mem == NULL)
+                DRIVER_DIE("tmc_alloc_map()");
+
+            result = gxio_mpipe_init_buffer_stack(
+                context, stack_id, GXIO_MPIPE_BUFFER_SIZE_128,
+                this->static_stack_mem, this->static_stack_mem_size, 0
+            );
+            VERIFY_GXIO(result, "gxio_mpipe_init_buffer_stack()");
+
+            this->static_stack_id = stack_id;
+        }
+
         // Sorts 'this->buffer_stacks' by increasing buffer sizes.
 
         sort(
             this->buffer_stacks.begin(), this->buffer_stacks.end(),
             [](const buffer_stack_t& a, const buffer_stack_t& b) {
-                return a.info->size < b.info->size;
+                return a.info.size < b.info.size;
             }
         );
 
         max_packet_size = this->buffer_stacks.back().buffer_size;
 
-        #ifndef MPIPE_JUMBO_FRAMES
+        #ifdef MPIPE_JUMBO_FRAMES
+            #ifdef MPIPE_CHAINED_BUFFERS
+                // Frames larger than the largest buffer are gathered from
+                // several buffers.
+                max_packet_size = JUMBO_FRAME_SIZE;
+            #else
+                max_packet_size = min(JUMBO_FRAME_SIZE, max_packet_size);
+            #endif /* MPIPE_CHAINED_BUFFERS */
+
             gxio_mpipe_link_set_attr(&link, GXIO_MPIPE_LINK_RECEIVE_JUMBO, 1);
 
-            gxio_mpipe_equeue_set_snf_size(&this->equeue, max_packet_size);
-        #else 
+            for (instance_t *instance : this->instances) {
+                gxio_mpipe_equeue_set_snf_size(
+                    instance->equeue, max_packet_size
+                );
+            }
+        #else
             max_packet_size = min((size_t) 1500, max_packet_size);
         #endif /* MPIPE_JUMBO_FRAMES */
 
@@ -561,12 +910,61 @@ mpipe_t::mpipe_t(
     {
         this->ether_addr = _ether_addr(&this->link);
 
-        for (instance_t *instance : this->instances) {
-            instance->parent = this;
+        for (int i = 0; i < n_workers; i++) {
+            instance_t *instance = this->instances[i];
+
+            instance->parent    = this;
+            instance->worker_id = i;
             instance->ethernet.init(
                 instance, &instance->timers, this->ether_addr, ipv4_addr,
                 static_arp4_entries
             );
+
+            // The buckets of the handshakes answered with SYN cookies can be
+            // given to another worker (see 'set_rebalancing()').
+            if (i > 0) {
+                instance->ethernet.ipv4.tcp.share_syn_cookies(
+                    this->instances[0]->ethernet.ipv4.tcp
+                );
+            }
+
+            // Active connections only use the local ports for which the load
+            // balancer delivers the segments of the remote to this worker.
+            //
+            // Predicting the bucket requires the classifier to hash flows with
+            // 'bucket_hash_t'. Otherwise 'tcp_connect()' is only available
+            // with a single worker.
+            #ifdef TCP_FLOW_HASH
+                instance->ethernet.ipv4.tcp.set_ephemeral_ports(
+                    tcp_t::DEFAULT_EPHEMERAL_FIRST,
+                    tcp_t::DEFAULT_EPHEMERAL_LAST,
+                    [this, i](tcp_t::tcb_id_t tcb_id) {
+                        size_t bucket = bucket_hash_t()(tcb_id) % N_BUCKETS;
+                        return (*this->bucket_workers)[bucket].load(
+                            memory_order_acquire
+                        ) == i;
+                    }
+                );
+            #endif /* TCP_FLOW_HASH */
+
+            // Replicates the mappings learned by the worker to the ARP caches
+            // of the other workers.
+            instance->ethernet.arp.update_handler = [this, instance](
+                net_t<ethernet_t::addr_t> ether_addr,
+                net_t<ipv4_t::addr_t> ipv4_addr
+            ) {
+                for (instance_t *other : this->instances) {
+                    if (other == instance)
+                        continue;
+
+                    if (!other->arp_updates.push({ ether_addr, ipv4_addr })) {
+                        DRIVER_DEBUG(
+                            "ARP update dropped (queue of Tile %d is full)",
+                            other->cpu_id
+                        );
+                    }
+                }
+            };
         }
     }
 }
@@ -592,8 +990,16 @@ mpipe_t::~mpipe_t(void)
     }
 
     size_t edma_ring_size = EQUEUE_ENTRIES * sizeof(gxio_mpipe_edesc_t);
-    result = tmc_alloc_unmap(this->edma_ring_mem, edma_ring_size);
-    VERIFY_ERRNO(result, "tmc_alloc_unmap()");
+
+    #ifdef MPIPE_WORKER_EQUEUES
+        for (instance_t *instance : this->instances) {
+            result = tmc_alloc_unmap(instance->edma_ring_mem, edma_ring_size);
+            VERIFY_ERRNO(result, "tmc_alloc_unmap()");
+        }
+    #else
+        result = tmc_alloc_unmap(this->edma_ring_mem, edma_ring_size);
+        VERIFY_ERRNO(result, "tmc_alloc_unmap()");
+    #endif /* MPIPE_WORKER_EQUEUES */
 
     // Releases buffers memory
 
@@ -601,6 +1007,11 @@ mpipe_t::~mpipe_t(void)
         result = tmc_alloc_unmap(buffer_stack.mem, buffer_stack.mem_size);
         VERIFY_ERRNO(result, "tmc_alloc_unmap()");
     }
+
+    result = tmc_alloc_unmap(
+        this->static_stack_mem, this->static_stack_mem_size
+    );
+    VERIFY_ERRNO(result, "tmc_alloc_unmap()");
 }
 
 // Wrapper over 'instance_t::run()' for 'pthread_create()'.
@@ -638,43 +1049,367 @@ void mpipe_t::join(void)
         pthread_join(instance->thread, nullptr);
 }
 
+void mpipe_t::broadcast(function<void(instance_t *)> f)
+{
+    for (instance_t *instance : this->instances) {
+        if (!this->is_running) {
+            f(instance);
+            continue;
+        }
+
+        function<void()> message = [f, instance]() { f(instance); };
+
+        while (!instance->post(message))
+            ; // The worker's queue is full. Retries.
+    }
+}
+
 // Replicates the call to every worker TCP stack.
-//
-// FIXME: Is not thread-safe, could not be called while the instances are
-// running.
 void mpipe_t::tcp_listen(
     tcp_t::port_t port, tcp_t::new_conn_callback_t new_conn_callback
 )
 {
-    assert(!this->is_running); // FIXME: not thread-safe.
+    this->tcp_listen(port, new_conn_callback, tcp_t::listen_options_t());
+}
+
+void mpipe_t::tcp_listen(
+    tcp_t::port_t port, tcp_t::new_conn_callback_t new_conn_callback,
+    tcp_t::listen_options_t options
+)
+{
+    auto pinned_it = this->pinned_ports.find(port);
 
-    for (instance_t *instance : this->instances)
-        instance->ethernet.ipv4.tcp.listen(port, new_conn_callback);
+    if (pinned_it != this->pinned_ports.end()) {
+        instance_t *instance = this->instances[pinned_it->second];
+
+        this->_execute_on(instance,
+        [instance, port, new_conn_callback, options]() {
+            instance->ethernet.ipv4.tcp.listen(
+                port, new_conn_callback, options
+            );
+        });
+        return;
+    }
+
+    this->broadcast([port, new_conn_callback, options](instance_t *instance) {
+        instance->ethernet.ipv4.tcp.listen(port, new_conn_callback, options);
+    });
 }
 
+void mpipe_t::set_rebalancing(bool enabled)
+{
+    assert(!this->is_running);
+
+    #ifndef TCP_FLOW_HASH
+        if (enabled) {
+            DRIVER_DIE(
+                "Rebalancing requires the classifier to hash flows with "
+                "'bucket_hash_t' (TCP_FLOW_HASH)"
+            );
+        }
+    #endif /* TCP_FLOW_HASH */
+
+    this->rebalancing = enabled;
+}
 
-gxio_mpipe_bdesc_t mpipe_t::_alloc_buffer(size_t size)
+void mpipe_t::tcp_pin_port(tcp_t::port_t port, int worker_id)
 {
-    // Finds the first buffer size large enough to hold the requested buffer.
-    for (const buffer_stack_t &stack : this->buffer_stacks) {
-        if (stack.buffer_size >= size) {
-            gxio_mpipe_bdesc_t bdesc = gxio_mpipe_pop_buffer_bdesc(
-                &this->context, stack.id
+    assert(!this->is_running);
+    assert(worker_id >= 0 && (size_t) worker_id < this->instances.size());
+
+    this->pinned_ports[port] = worker_id;
+}
+
+vector<buffer_stack_info_t> mpipe_t::default_buffer_stacks(void)
+{
+    return vector<buffer_stack_info_t>(
+        DEFAULT_BUFFERS_STACKS.begin(), DEFAULT_BUFFERS_STACKS.end()
+    );
+}
+
+mpipe_t::buffers_mix_t mpipe_t::buffers_mix(void) const
+{
+    buffers_mix_t mix;
+    mix.fill(0);
+
+    for (const instance_t *instance : this->instances) {
+        for (size_t i = 0; i < N_BUFFER_SIZES; i++)
+            mix[i] += instance->stats.buffers[i].get();
+    }
+
+    return mix;
+}
+
+vector<buffer_stack_info_t> mpipe_t::buffer_stacks_for_mix(
+    const buffers_mix_t &mix, size_t mem_size
+)
+{
+    gxio_mpipe_buffer_size_enum_t largest = DEFAULT_BUFFERS_STACKS.back().size;
+
+    // Bytes used by the observed buffers. Gives a weight of one buffer to the
+    // largest size if it has not been used.
+
+    double used_size = 0;
+
+    for (size_t i = 0; i < N_BUFFER_SIZES; i++) {
+        gxio_mpipe_buffer_size_enum_t size = (gxio_mpipe_buffer_size_enum_t) i;
+        uint64_t n = (size == largest) ? max(mix[i], (uint64_t) 1) : mix[i];
+
+        used_size += n * gxio_mpipe_buffer_size_enum_to_buffer_size(size);
+    }
+
+    // Scales the observed numbers of buffers so that the stacks fill the
+    // requested memory.
+
+    double scale = mem_size / used_size;
+
+    vector<buffer_stack_info_t> stacks;
+
+    for (size_t i = 0; i < N_BUFFER_SIZES; i++) {
+        gxio_mpipe_buffer_size_enum_t size = (gxio_mpipe_buffer_size_enum_t) i;
+
+        if (mix[i] == 0 && size != largest)
+            continue;
+
+        unsigned long count = max(
+            (unsigned long) (mix[i] * scale), MIN_STACK_BUFFERS
+        );
+
+        DRIVER_DEBUG(
+            "Sizes the stack of %zu bytes buffers to %lu buffers",
+            gxio_mpipe_buffer_size_enum_to_buffer_size(size), count
+        );
+
+        stacks.emplace_back(size, count);
+    }
+
+    return stacks;
+}
+
+// Posts the connection to the workers in turn.
+void mpipe_t::tcp_connect(
+    net_t<ipv4_t::addr_t> raddr, tcp_t::port_t rport,
+    tcp_t::new_conn_callback_t new_conn_callback,
+    tcp_t::conn_failed_callback_t connect_failed
+)
+{
+    #ifndef TCP_FLOW_HASH
+        if (this->instances.size() > 1) {
+            DRIVER_DIE(
+                "Connections opened by several workers require the classifier "
+                "to hash flows with 'bucket_hash_t' (TCP_FLOW_HASH)"
             );
+        }
+    #endif /* TCP_FLOW_HASH */
+
+    instance_t *instance = this->instances[this->next_connect_worker];
+
+    this->next_connect_worker =
+        (this->next_connect_worker + 1) % this->instances.size();
+
+    this->_execute_on(
+        instance, [instance, raddr, rport, new_conn_callback, connect_failed]()
+        {
+            tcp_t *tcp = &instance->ethernet.ipv4.tcp;
+
+            bool opened = tcp->connect(raddr, rport, new_conn_callback);
 
-            if (UNLIKELY(bdesc.c == MPIPE_EDMA_DESC_WORD1__C_VAL_INVALID)) {
-                DRIVER_DIE(
-                    "Invalid buffer descriptor (size %zu). "
-                    "Maybe you should allocate more buffers.", stack.buffer_size
+            if (!opened && connect_failed)
+                connect_failed();
+        }
+    );
+}
+
+void mpipe_t::_execute_on(instance_t *instance, function<void()> f)
+{
+    if (!this->is_running) {
+        f();
+        return;
+    }
+
+    while (!instance->post(f))
+        ; // The worker's queue is full. Retries.
+}
+
+mpipe_t::static_mem_t mpipe_t::alloc_static_mem(size_t size)
+{
+    // mPIPE pages must be at least 64 KB. As they will be registered in a
+    // single buffer stack, the memory can't use more than 16 pages.
+    tmc_alloc_t alloc = TMC_ALLOC_INIT;
+    tmc_alloc_set_home(&alloc, TMC_ALLOC_HOME_HASH);
+
+    size_t min_page_size = max((size + 15) / 16, (size_t) 64 * 1024);
+
+    if (tmc_alloc_set_pagesize(&alloc, min_page_size) == NULL)
+        DRIVER_DIE("tmc_alloc_set_pagesize()");
+
+    size_t page_size = tmc_alloc_get_pagesize(&alloc);
+
+    // Rounds up to a whole number of pages.
+    size_t mem_size = (max(size, (size_t) 1) + page_size - 1)
+                    / page_size * page_size;
+
+    char *mem = (char *) tmc_alloc_map(&alloc, mem_size);
+    if (mem == NULL)
+        DRIVER_DIE("tmc_alloc_map()");
+
+    DRIVER_DEBUG(
+        "Allocated %zu bytes of static memory on %zu x %zu bytes page(s)",
+        size, mem_size / page_size, page_size
+    );
+
+    return { mem, mem_size, page_size };
+}
+
+void mpipe_t::register_static_mem(const static_mem_t &static_mem)
+{
+    if (this->is_running)
+        DRIVER_DIE("Static memory must be registered before running the link");
+
+    for (
+        char *p = static_mem.mem;
+        p < static_mem.mem + static_mem.size;
+        p += static_mem.page_size
+    ) {
+        int result = gxio_mpipe_register_page(
+            &this->context, this->static_stack_id, p, static_mem.page_size, 0
+        );
+        VERIFY_GXIO(result, "gxio_mpipe_register_page()");
+    }
+}
+
+gxio_mpipe_bdesc_t mpipe_t::instance_t::_alloc_buffer(size_t size)
+{
+    const vector<buffer_stack_t> &stacks = this->parent->buffer_stacks;
+
+    // 'send_packet()' gathers several buffers for larger packets.
+    assert(size <= stacks.back().buffer_size);
+
+    bool fallback = false;
+
+    // Finds the first buffer size large enough to hold the requested buffer.
+    // Tries the next larger stacks if the stack is empty.
+    for (size_t i = 0; i < stacks.size(); i++) {
+        const buffer_stack_t &stack = stacks[i];
+
+        if (stack.buffer_size < size)
+            continue;
+
+        gxio_mpipe_bdesc_t bdesc = gxio_mpipe_pop_buffer_bdesc(
+            &this->parent->context, stack.id
+        );
+
+        if (UNLIKELY(bdesc.c == MPIPE_EDMA_DESC_WORD1__C_VAL_INVALID)) {
+            if (!(this->empty_stacks & (1 << i))) {
+                DRIVER_DEBUG(
+                    "The stack of %zu bytes buffers is empty", stack.buffer_size
                 );
             }
 
-            return bdesc;
+            this->empty_stacks |= 1 << i;
+            fallback = true;
+            continue;
         }
+
+        this->empty_stacks &= ~(1 << i);
+
+        if (UNLIKELY(fallback))
+            this->stats.tx_buffer_fallbacks.inc();
+
+        this->stats.buffers[stack.info.size].inc();
+
+        return bdesc;
+    }
+
+    // As the largest stack can hold the buffer, every large enough stack is
+    // empty.
+    assert(fallback);
+
+    gxio_mpipe_bdesc_t invalid = { 0 };
+    invalid.c = MPIPE_EDMA_DESC_WORD1__C_VAL_INVALID;
+    return invalid;
+}
+
+void mpipe_t::instance_t::_probe_empty_stacks(void)
+{
+    const vector<buffer_stack_t> &stacks = this->parent->buffer_stacks;
+
+    for (size_t i = 0; i < stacks.size(); i++) {
+        if (!(this->empty_stacks & (1 << i)))
+            continue;
+
+        gxio_mpipe_bdesc_t bdesc = gxio_mpipe_pop_buffer_bdesc(
+            &this->parent->context, stacks[i].id
+        );
+
+        if (bdesc.c == MPIPE_EDMA_DESC_WORD1__C_VAL_INVALID)
+            continue;
+
+        gxio_mpipe_push_buffer_bdesc(&this->parent->context, bdesc);
+
+        this->empty_stacks &= ~(1 << i);
+
+        DRIVER_DEBUG(
+            "The stack of %zu bytes buffers is no longer empty",
+            stacks[i].buffer_size
+        );
     }
+}
+
+static char *_init_equeue(
+    gxio_mpipe_context_t *context, gxio_mpipe_link_t *link,
+    gxio_mpipe_equeue_t *equeue, unsigned int *edma_ring_id
+)
+{
+    int result;
 
-    // TODO: build a chained buffer if possible.
-    DRIVER_DIE("No buffer is sufficiently large to hold the requested size.");
+    // Allocates a single eDMA ring ID. Multiple eDMA rings could be used
+    // concurrently on the same context/link.
+    result = gxio_mpipe_alloc_edma_rings(context, 1 /* count */, 0, 0);
+    VERIFY_GXIO(result, "gxio_mpipe_alloc_edma_rings");
+    *edma_ring_id = result;
+
+    size_t ring_size = EQUEUE_ENTRIES * sizeof(gxio_mpipe_edesc_t);
+
+    // The eDMA ring must be 1 KB aligned and must reside on a single
+    // physically contiguous memory. So we allocate a page sufficiently
+    // large to hold it.
+    // As only the mPIPE hardware and no Tile will read from this memory,
+    // and as memory-write are non-blocking in this case, we can benefit
+    // from an hash-for-home cache policy.
+    // NOTE: test the impact on this policy on performances.
+    tmc_alloc_t alloc = TMC_ALLOC_INIT;
+    tmc_alloc_set_home(&alloc, TMC_ALLOC_HOME_HASH);
+
+    // Sets page_size >= ring_size.
+    if (tmc_alloc_set_pagesize(&alloc, ring_size) == NULL)
+        DRIVER_DIE("tmc_alloc_set_pagesize()");
+
+    assert(tmc_alloc_get_pagesize(&alloc) >= ring_size);
+
+    DRIVER_DEBUG(
+        "Allocating %zu bytes for the eDMA ring on a %zu bytes page",
+        ring_size, tmc_alloc_get_pagesize(&alloc)
+    );
+
+    char *edma_ring_mem = (char *) tmc_alloc_map(&alloc, ring_size);
+    if (edma_ring_mem == NULL)
+        DRIVER_DIE("tmc_alloc_map()");
+
+    // ring is 1 KB aligned.
+    assert(((intptr_t) edma_ring_mem & 0x3FF) == 0);
+
+    // Initializes an equeue which uses the eDMA ring memory and the channel
+    // associated with the context's link.
+
+    int channel = gxio_mpipe_link_channel(link);
+
+    result = gxio_mpipe_equeue_init(
+        equeue, context, *edma_ring_id, channel, edma_ring_mem, ring_size, 0
+    );
+    VERIFY_GXIO(result, "gxio_gxio_equeue_init()");
+
+    return edma_ring_mem;
 }
 
 static net_t<mpipe_t::ethernet_t::addr_t> _ether_addr(gxio_mpipe_link_t *link)
@@ -697,4 +1432,37 @@ static net_t<mpipe_t::ethernet_t::addr_t> _ether_addr(gxio_mpipe_link_t *link)
     return addr;
 }
 
+static bool _tcp_dport(
+    const char *frame, size_t frame_size, net_t<mpipe_t::tcp_t::port_t> *dport
+)
+{
+    typedef mpipe_t::ethernet_t::header_t   ethernet_header_t;
+    typedef mpipe_t::ipv4_t::header_t       ipv4_header_t;
+    typedef mpipe_t::tcp_t::header_t        tcp_header_t;
+
+    if (frame_size < sizeof (ethernet_header_t) + sizeof (ipv4_header_t))
+        return false;
+
+    const ethernet_header_t *ether_hdr = (const ethernet_header_t *) frame;
+
+    if (ether_hdr->type != ETHERTYPE_IP_NET)
+        return false;
+
+    const ipv4_header_t *ip_hdr =
+        (const ipv4_header_t *) (frame + sizeof (ethernet_header_t));
+
+    // Fragments other than the first one don't have a TCP header.
+    if (ip_hdr->protocol != IPPROTO_TCP
+        || (ip_hdr->frag_off.host() & IP_OFFMASK) > 0)
+        return false;
+
+    size_t tcp_offset = sizeof (ethernet_header_t) + ip_hdr->ihl * 4;
+
+    if (frame_size < tcp_offset + sizeof (tcp_header_t))
+        return false;
+
+    *dport = ((const tcp_header_t *) (frame + tcp_offset))->dport;
+    return true;
+}
+
 } } /* namespace rusty::driver */
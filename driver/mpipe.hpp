@@ -25,18 +25,30 @@
 #define __RUSTY_DRIVER_MPIPE_HPP__
 
 #include <array>
+#include <atomic>
+#include <cassert>
 #include <vector>
-#include <memory>               // allocator
+#include <memory>               // allocator, shared_ptr
+#include <type_traits>          // is_same
+#include <unordered_map>
+#include <utility>              // move()
 
-#include <arch/cycle.h>         // get_cycle_count()
 #include <gxio/mpipe.h>         // gxio_mpipe_*, GXIO_MPIPE_*
 
 #include "driver/allocator.hpp" // tile_allocator_t
+#include "driver/slab_allocator.hpp" // slab_allocator_t
 #include "driver/clock.hpp"     // cpu_clock_t
+#include "driver/driver.hpp"    // DRIVER_DEBUG()
+#include "driver/message_ring.hpp" // message_ring_t
 #include "driver/buffer.hpp"    // cursor_t
-#include "driver/timer.hpp"     // timer_manager_t
+#include "driver/timer.hpp"     // cpu_timer_manager_t
+#include "driver/timer_wheel.hpp" // wheel_timer_manager_t
 #include "net/endian.hpp"       // net_t
 #include "net/ethernet.hpp"     // ethernet_t
+#include "util/cycle.hpp"       // get_cycle_count()
+#include "util/mpsc_ring.hpp"   // mpsc_ring_t
+#include "util/stats.hpp"       // counter_t, CACHE_LINE_SIZE
+#include "util/trace.hpp"       // tracer_t, TRACE_SCOPE()
 
 using namespace std;
 
@@ -67,15 +79,98 @@ static const unsigned int IQUEUE_ENTRIES    = GXIO_MPIPE_IQUEUE_ENTRY_512;
 // Could be 512, 2K, 8K or 64K.
 static const unsigned int EQUEUE_ENTRIES    = GXIO_MPIPE_EQUEUE_ENTRY_2K;
 
+// Maximum number of egress packet descriptors a worker accumulates before
+// posting them to its equeue.
+//
+// Egress descriptors are anyway posted at the end of every batch of received
+// packets.
+//
+// Must be lower than EQUEUE_ENTRIES.
+static const size_t       TX_BATCH_SIZE     = 64;
+
+// Default maximum number of ingress packet descriptors a worker processes in
+// a single iteration of its polling loop.
+//
+// Larger batches amortize timers and queue polling over more packets, but
+// delay the processing of the first packets of the batch.
+//
+// Must be lower or equal to IQUEUE_ENTRIES. Can be changed for every 'mpipe_t'
+// instance.
+static const size_t       DEFAULT_RX_BATCH_SIZE = 16;
+
+// Maximum size of a transmitted Ethernet frame (without the CRC) when
+// MPIPE_JUMBO_FRAMES is defined.
+//
+// Frames larger than the largest buffer are written in several buffers which
+// are transmitted with a gather list. This requires MPIPE_CHAINED_BUFFERS.
+static const size_t       JUMBO_FRAME_SIZE  = 9014;
+
+// Number of ARP cache updates which can be waiting to be applied by a worker.
+//
+// Updates learned by a worker while the queue of another worker is full are
+// not replicated to this worker, which will resolve the address itself if
+// required.
+//
+// Must be a power of 2.
+static const size_t       ARP_UPDATES_RING_SIZE = 256;
+
+// Number of closures which can be waiting to be executed by a worker (see
+// 'mpipe_t::instance_t::post()').
+//
+// Must be a power of 2.
+static const size_t       MESSAGE_RING_SIZE = 64;
+
+// Number of received packets which can be waiting to be handed off to a worker
+// by the other workers (see 'mpipe_t::tcp_pin_port()' and
+// 'mpipe_t::set_rebalancing()').
+//
+// Packets handed off while the queue of their worker is full are dropped.
+//
+// Must be a power of 2.
+static const size_t       HANDOFF_RING_SIZE = 256;
+
+// Delay in microseconds between two evaluations of the load of a worker, when
+// buckets are rebalanced (see 'mpipe_t::set_rebalancing()').
+static const uint64_t     REBALANCE_INTERVAL = 100000; // 100 ms
+
+// A worker gives some of its idle buckets to the least loaded worker when the
+// average depth of its ingress queue is at least REBALANCE_MIN_DEPTH
+// descriptors, and at least twice the one of the least loaded worker.
+static const uint64_t     REBALANCE_MIN_DEPTH = 32;
+
+// Maximum number of buckets a worker gives at each evaluation.
+static const size_t       REBALANCE_MAX_BUCKETS = 16;
+
+// The average depth of an ingress queue is an exponential moving average over
+// the iterations of the polling loop, with a weight of 1 / 2^RX_LOAD_SHIFT for
+// the last iteration.
+static const unsigned int RX_LOAD_SHIFT     = 4;
+
+// Maximum number of packet buffers which can be gathered in a single frame.
+static const size_t       MAX_PACKET_BUFFERS = 8;
+
+// Maximum number of bytes which can be transferred by a single egress
+// descriptor (the 'xfer_size' field is 14 bits wide).
+static const size_t       MAX_EDESC_XFER_SIZE = 16383;
+
 // mPIPE buffer stacks.
 //
 // Gives the number of buffers and the buffer sizes for each buffer stack.
 //
-// mPIPE only allows 32 buffer stacks to be used at the same time.
+// mPIPE only allows 32 buffer stacks to be used at the same time, one of them
+// is used to register the static memory.
 //
-// NOTE: Knowing the average and standard deviation of received/emitted packets
-// and the optimal cache usage, the most efficient buffer sizes could be
-// computed.
+// DEFAULT_BUFFERS_STACKS is used unless other stacks are given to 'mpipe_t()'.
+// 'mpipe_t::buffer_stacks_for_mix()' sizes the stacks from the buffers used by
+// a previous execution.
+
+// Number of buffer sizes supported by the mPIPE
+// ('gxio_mpipe_buffer_size_enum_t' values).
+static const size_t       N_BUFFER_SIZES    = 8;
+
+// Minimum number of buffers in a stack sized by
+// 'mpipe_t::buffer_stacks_for_mix()'.
+static const unsigned long MIN_STACK_BUFFERS = 256;
 
 struct buffer_stack_info_t {
     // Could be 128, 256, 512, 1024, 1664, 4096, 10368 or 16384 bytes.
@@ -89,9 +184,9 @@ struct buffer_stack_info_t {
 };
 
 #ifdef MPIPE_JUMBO_FRAMES
-    static const array<buffer_stack_info_t, 8> BUFFERS_STACKS {
+    static const array<buffer_stack_info_t, 8> DEFAULT_BUFFERS_STACKS {
 #else
-    static const array<buffer_stack_info_t, 5> BUFFERS_STACKS {
+    static const array<buffer_stack_info_t, 5> DEFAULT_BUFFERS_STACKS {
 #endif /* MPIPE_JUMBO_FRAMES */
     buffer_stack_info_t(GXIO_MPIPE_BUFFER_SIZE_128,   8192), // ~ 1 MB
     buffer_stack_info_t(GXIO_MPIPE_BUFFER_SIZE_256,   1024), // ~ 256 KB
@@ -124,17 +219,23 @@ struct mpipe_t {
     // Member types
     //
 
-    #ifdef USE_TILE_ALLOCATOR
+    #if defined(USE_SLAB_ALLOCATOR)
+        // Allocates small objects from slabs which are obtained from the
+        // Tile's allocator (if USE_TILE_ALLOCATOR is defined) or from the
+        // standard allocator.
+        typedef slab_allocator_t<char *>                    alloc_t;
+    #elif defined(USE_TILE_ALLOCATOR)
         typedef tile_allocator_t<char *>                    alloc_t;
     #else
         // Uses the standard allocator.
         typedef allocator<char *>                           alloc_t;
-    #endif /* USE_TILE_ALLOCATOR */
+    #endif
 
     // Each worker thread will be given an mPIPE instance.
     //
     // Each instance contains its own ingress queue. A unique egress queue is
-    // however shared between all threads.
+    // however shared between all threads, unless MPIPE_WORKER_EQUEUES is
+    // defined.
     struct instance_t {
         //
         // Member types
@@ -146,7 +247,64 @@ struct mpipe_t {
         // from and write to memory in mPIPE buffers.
         typedef buffer::cursor_t                cursor_t;
 
-        typedef cpu_timer_manager_t<alloc_t>    timer_manager_t;
+        // Static memory which is transmitted by reference by 'send_packet()'.
+        typedef buffer::static_extent_t         static_extent_t;
+
+        // Upper layers (ARP, TCP) use the timer manager of the physical
+        // layer.
+        #ifdef USE_TIMER_WHEEL
+            typedef wheel_timer_manager_t<alloc_t>  timer_manager_t;
+        #else
+            typedef cpu_timer_manager_t<alloc_t>    timer_manager_t;
+        #endif /* USE_TIMER_WHEEL */
+
+        // Mapping learned by the ARP environment of another worker.
+        struct arp_update_t {
+            typedef net::ethernet_t<instance_t, alloc_t> ethernet_t;
+
+            net_t<ethernet_t::addr_t>                   ether_addr;
+            net_t<ethernet_t::ipv4_ethernet_t::addr_t>  ipv4_addr;
+        };
+
+        // Counters of the worker (see 'for_each_stat()').
+        struct alignas(util::CACHE_LINE_SIZE) stats_t {
+            util::counter_t                     rx_packets;
+
+            // Packets dropped by the driver as they were invalid, including
+            // the ones dropped by the mPIPE as their buffer stack was
+            // exhausted.
+            util::counter_t                     rx_dropped;
+            util::counter_t                     rx_no_buffer;
+
+            // Descriptors which were waiting in the ingress queue at the
+            // beginning of the last batch, and their moving average (see
+            // RX_LOAD_SHIFT).
+            util::counter_t                     rx_queue_depth;
+            util::counter_t                     rx_queue_load;
+
+            // Received packets given to the worker which must process them,
+            // and buckets given to less loaded workers (see
+            // 'mpipe_t::set_rebalancing()').
+            util::counter_t                     rx_handoffs;
+            util::counter_t                     buckets_moved;
+
+            util::counter_t                     tx_packets;
+            util::counter_t                     tx_descriptors;
+
+            // Transmitted packets written in a larger buffer than required,
+            // as the stack of the required size was empty (low watermark),
+            // and packets dropped as every large enough stack was empty.
+            util::counter_t                     tx_buffer_fallbacks;
+            util::counter_t                     tx_no_buffer;
+
+            // Received and transmitted packet buffers, by buffer size (see
+            // 'mpipe_t::buffers_mix()').
+            array<util::counter_t, N_BUFFER_SIZES> buffers;
+
+            // Timers scheduled at the end of the last iteration of the polling
+            // loop.
+            util::counter_t                     timers;
+        };
 
         //
         // Fields
@@ -160,15 +318,65 @@ struct mpipe_t {
         // Dataplane Tile dedicated to the execution of this worker.
         int                                     cpu_id;
 
+        // Index of the worker in 'parent->instances'. The worker receives the
+        // packets of the NotifRing 'parent->first_ring_id + worker_id'.
+        int                                     worker_id;
+
         // Ingres queue.
         gxio_mpipe_iqueue_t                     iqueue;
         char                                    *notif_ring_mem;
 
+        // Moving average of the depth of the ingress queue, multiplied by
+        // 2^RX_LOAD_SHIFT.
+        uint64_t                                rx_load = 0;
+
+        // Egress queue used by the worker. Points to 'parent->equeue' or to
+        // 'worker_equeue'.
+        gxio_mpipe_equeue_t                     *equeue;
+
+        #ifdef MPIPE_WORKER_EQUEUES
+            // Egress queue dedicated to this worker.
+            gxio_mpipe_equeue_t                 worker_equeue;
+            unsigned int                        edma_ring_id;
+            char                                *edma_ring_mem;
+        #endif /* MPIPE_WORKER_EQUEUES */
+
+        // Egress descriptors which have not yet been posted to 'equeue'.
+        array<gxio_mpipe_edesc_t, TX_BATCH_SIZE> tx_batch;
+        size_t                                  tx_batch_count = 0;
+
+        // Bit 'i' is set when the 'i'th stack of 'parent->buffer_stacks' was
+        // empty the last time the worker allocated a buffer from it. Cleared
+        // by '_probe_empty_stacks()' once buffers have been returned to the
+        // stack.
+        uint32_t                                empty_stacks = 0;
+
         // Upper Ethernet data-link layer.
         net::ethernet_t<instance_t, alloc_t>    ethernet;
 
         timer_manager_t                         timers;
 
+        // Each worker has its own ARP cache. Mappings learned from received
+        // ARP messages are pushed to the 'arp_updates' queue of every other
+        // worker, which applies them in its polling loop.
+        util::mpsc_ring_t<arp_update_t, ARP_UPDATES_RING_SIZE> arp_updates;
+
+        // Closures posted by other threads, executed by the polling loop.
+        message_ring_t<MESSAGE_RING_SIZE>       messages;
+
+        // Packets received by other workers which must be processed by this
+        // worker. The descriptors are copied, the buffers are freed by this
+        // worker.
+        util::mpsc_ring_t<gxio_mpipe_idesc_t, HANDOFF_RING_SIZE> handoffs;
+
+        stats_t                                 stats;
+
+        #ifdef USE_TRACING
+            // Latencies of the processing stages of the worker. Disabled
+            // until 'tracer.enabled' is set.
+            util::tracer_t                      tracer;
+        #endif /* USE_TRACING */
+
         //
         // Methods
         //
@@ -178,18 +386,73 @@ struct mpipe_t {
         // Starts the n workers threads. The function immediatly returns.
         //
         // Forwards any received packet to the upper (Ethernet) data-link layer.
+        //
+        // Packets are processed by batches of at most 'parent->rx_batch_size'
+        // descriptors. Timers, ARP updates from other workers and posted
+        // closures are executed once per batch.
         void run(void);
 
+        // Queues the closure for its execution by the polling loop of the
+        // worker, between two batches of received packets.
+        //
+        // The closure is executed by the worker's thread and can thus access
+        // its network stack. Returns 'false' if the worker's queue is full
+        // (see MESSAGE_RING_SIZE). Can be called by any thread.
+        inline bool post(function<void()> f);
+
+        // Calls 'f(const char *name, uint64_t value)' with every counter of
+        // the worker and of its network stack.
+        //
+        // Can be called by any thread, while the worker is running.
+        template <typename F>
+        void for_each_stat(F f) const;
+
         // Sends a packet of the given size on the interface by calling the
         // 'packet_writer' with a cursor corresponding to a buffer allocated
         // memory.
-        void send_packet(
-            size_t packet_size, function<void(cursor_t)> packet_writer
+        //
+        // The packet is not immediately given to the mPIPE but is queued until
+        // the next call to 'flush()'.
+        //
+        // 'packet_writer' is any callable accepting a 'cursor_t'. It is called
+        // before the function returns.
+        template <typename packet_writer_t>
+        inline void send_packet(
+            size_t packet_size, packet_writer_t packet_writer
         );
 
+        // Same as the previous 'send_packet()' but the last 'tail.size' bytes
+        // of the packet are directly transmitted from the given static memory,
+        // without being copied. The cursor given to 'packet_writer' only
+        // references the first 'packet_size - tail.size' bytes.
+        //
+        // 'tail' must be in a memory registered with
+        // 'mpipe_t::register_static_mem()'.
+        template <typename packet_writer_t>
+        inline void send_packet(
+            size_t packet_size, packet_writer_t packet_writer,
+            static_extent_t tail
+        );
+
+        // Posts the queued egress descriptors to the equeue.
+        //
+        // Automatically called by 'run()' after each batch of received
+        // packets, and by 'send_packet()' when 'tx_batch' is full.
+        inline void flush(void);
+
         // Maximum packet size. Doesn't change after initialization.
         inline size_t max_packet_size(void);
 
+        // Returns 'true' if the stack of the buffers which hold packets of
+        // 'packet_size' bytes was found empty by the last allocation the
+        // worker made from it, and still was at the last iteration of the
+        // polling loop.
+        //
+        // Upper layers then defer the transmissions of this size which can
+        // wait, so that the larger buffers are kept for the acknowledgments
+        // and for the received packets.
+        inline bool tx_congested(size_t packet_size) const;
+
         //
         // Static methods
         //
@@ -200,12 +463,56 @@ struct mpipe_t {
         get_current_tcp_seq(void);
 
     private:
+        // Gives the received packet to the upper Ethernet layer.
+        //
+        // The buffer is freed once processed.
+        inline void _receive_packet(gxio_mpipe_idesc_t *idesc);
+
+        // Returns the worker which must process the received packet: the
+        // worker to which its local TCP port is pinned, or the worker which
+        // owns its bucket.
+        instance_t *_packet_worker(gxio_mpipe_idesc_t *idesc) const;
+
+        // Gives idle buckets to the least loaded worker if this worker is
+        // overloaded (see 'mpipe_t::set_rebalancing()'), and schedules the next
+        // evaluation.
+        void _rebalance(void);
+
         // Allocates a buffer from the smallest stack able to hold the requested
-        // size.
+        // size, or from the next larger stacks if it's empty.
+        //
+        // 'size' must not be larger than the largest buffer size.
+        //
+        // Returns an invalid descriptor ('c' equals to
+        // 'MPIPE_EDMA_DESC_WORD1__C_VAL_INVALID') if every large enough stack
+        // is empty.
         gxio_mpipe_bdesc_t _alloc_buffer(size_t size);
+
+        // Clears the bits of 'empty_stacks' of the stacks which hold buffers
+        // again.
+        //
+        // The mPIPE returns the buffers of transmitted and of released packets
+        // to their stack without notifying the worker, so each empty stack is
+        // polled by trying to allocate one of its buffers.
+        void _probe_empty_stacks(void);
+
+        // Queues the egress descriptors of the buffers which have been written
+        // by 'send_packet()', followed by the descriptors of the static tail of
+        // the packet.
+        //
+        // 'buffers_size' is the number of bytes written in the buffers.
+        void _queue_packet(
+            const gxio_mpipe_bdesc_t *bdescs, size_t n_bdescs,
+            size_t buffers_size, static_extent_t tail
+        );
+
+        // Reserves a set of slots in the equeue and posts the descriptors of
+        // 'tx_batch'.
+        void _flush_tx_batch(void);
     };
 
     typedef buffer::cursor_t                            cursor_t;
+    typedef buffer::static_extent_t                     static_extent_t;
 
     // Aliases for upper network layer types.
     //
@@ -217,9 +524,29 @@ struct mpipe_t {
     typedef mpipe_t::ethernet_t::arp_ethernet_ipv4_t    arp_ipv4_t;
     typedef mpipe_t::ipv4_t::tcp_ipv4_t                 tcp_t;
 
+    // Hash with which the classifier distributes the TCP flows in the buckets
+    // of the load balancer.
+    //
+    // The workers predict the bucket of a connection with this hash to choose
+    // the local ports of active connections and to rebalance the buckets.
+    // Defining TCP_FLOW_HASH states that the classifier uses the same
+    // function, which is then also the hash of the TCB tables.
+    typedef net::tcp_flow_hash_t<ipv4_t::addr_t, tcp_t::port_t> bucket_hash_t;
+
+    #ifdef TCP_FLOW_HASH
+        static_assert(
+            is_same<tcp_t::tcbs_hash_t, bucket_hash_t>::value,
+            "TCB tables must be hashed by the function of the classifier"
+        );
+    #endif /* TCP_FLOW_HASH */
+
+    // Number of buffers used by the workers for each buffer size (see
+    // 'buffers_mix()').
+    typedef array<uint64_t, N_BUFFER_SIZES>             buffers_mix_t;
+
     // Allocated resources for a buffer stack.
     struct buffer_stack_t {
-        const buffer_stack_info_t   *info;
+        buffer_stack_info_t         info;
         unsigned int                id;
 
         // Result of 'gxio_mpipe_buffer_size_enum_to_buffer_size(info->size)'.
@@ -234,6 +561,20 @@ struct mpipe_t {
         size_t                      mem_size;
     };
 
+    // Memory which can be transmitted by reference (see 'static_extent_t').
+    //
+    // Allocated with 'alloc_static_mem()'. Must be registered to an 'mpipe_t'
+    // instance with 'register_static_mem()' before being transmitted on its
+    // link.
+    struct static_mem_t {
+        char                        *mem;
+        size_t                      size;
+
+        // The memory is made of 'size / page_size' (rounded up) contiguous
+        // pages.
+        size_t                      page_size;
+    };
+
     //
     // Fields
     //
@@ -251,8 +592,25 @@ struct mpipe_t {
     // Ingres queues
     unsigned int                notif_group_id; // Load balancer group.
     unsigned int                first_bucket_id;
+    unsigned int                first_ring_id;
 
-    // Egress queue
+    // Worker which receives the packets of each bucket.
+    //
+    // Buckets are initially assigned to the workers in turn. An entry is only
+    // modified by the worker which owns the bucket, when it gives it to
+    // another worker.
+    typedef array<atomic<uint16_t>, N_BUCKETS> bucket_workers_t;
+    shared_ptr<bucket_workers_t> bucket_workers;
+
+    // Enables the rebalancing of the buckets (see 'set_rebalancing()').
+    bool                        rebalancing = false;
+
+    // Local TCP ports which are handled by a single worker, and the indexes
+    // of the workers (see 'tcp_pin_port()').
+    unordered_map<net_t<tcp_t::port_t>, int> pinned_ports;
+
+    // Egress queue shared by all workers. Not initialized when
+    // MPIPE_WORKER_EQUEUES is defined.
     gxio_mpipe_equeue_t         equeue;
     unsigned int                edma_ring_id;
     char                        *edma_ring_mem;
@@ -260,6 +618,12 @@ struct mpipe_t {
     // Buffers and their stacks. Stacks are sorted by increasing buffer sizes.
     vector<buffer_stack_t>      buffer_stacks;
 
+    // Empty buffer stack in which the pages of the static memory are
+    // registered. Egress descriptors of static tails use this stack index.
+    unsigned int                static_stack_id;
+    char                        *static_stack_mem;
+    size_t                      static_stack_mem_size;
+
     // Rules
     gxio_mpipe_rules_t          rules;
 
@@ -274,6 +638,13 @@ struct mpipe_t {
     // Maximum packet size. Doesn't change after initialization.
     size_t                      max_packet_size;
 
+    // Maximum number of packet descriptors a worker processes between two
+    // executions of its timers. Doesn't change after initialization.
+    size_t                      rx_batch_size;
+
+    // Worker which will open the next connection of 'tcp_connect()'.
+    size_t                      next_connect_worker = 0;
+
     // -------------------------------------------------------------------------
 
     //
@@ -289,11 +660,19 @@ struct mpipe_t {
     // 'first_dataplane_cpu' specifies the number of the first dataplane Tile
     // that can be used. Useful when multiple 'mpipe_t' instances are created
     // and that you don't want them to share the same dataplane Tiles.
+    //
+    // 'rx_batch_size' gives the maximum number of packets a worker processes
+    // in a single iteration of its polling loop (see DEFAULT_RX_BATCH_SIZE).
+    //
+    // 'buffer_stacks_info' gives the size and the number of buffers of each
+    // buffer stack (see DEFAULT_BUFFERS_STACKS and 'buffer_stacks_for_mix()').
     mpipe_t(
         const char *link_name, net_t<ipv4_t::addr_t> ipv4_addr, int n_workers,
         int first_dataplane_cpu = 0,
         vector<arp_ipv4_t::static_entry_t> static_arp_entries
-            = vector<arp_ipv4_t::static_entry_t>()
+            = vector<arp_ipv4_t::static_entry_t>(),
+        size_t rx_batch_size = DEFAULT_RX_BATCH_SIZE,
+        vector<buffer_stack_info_t> buffer_stacks_info = default_buffer_stacks()
     );
 
     // Releases mPIPE resources referenced by current mPIPE environment.
@@ -313,6 +692,83 @@ struct mpipe_t {
     // Waits for threads to finish.
     void join(void);
 
+    // Executes the function on every worker, with the worker's instance as
+    // argument.
+    //
+    // When the workers are running, the function is posted to every worker
+    // (see 'instance_t::post()') and the method returns without waiting for
+    // its executions. Waits for some room in the queue of a worker if it's
+    // full. Should not be called by a worker, as two workers broadcasting to
+    // each other could wait for each other's queue.
+    //
+    // When the workers are not running, the function is directly executed on
+    // every instance by the calling thread.
+    void broadcast(function<void(instance_t *)> f);
+
+    // Calls 'f(const char *name, uint64_t value)' with every counter, summed
+    // over the workers.
+    //
+    // Can be called by any thread, without locking nor interrupting the
+    // workers. Counters of different workers are read at slightly different
+    // times.
+    template <typename F>
+    void for_each_stat(F f) const;
+
+    //
+    // Buffer stacks.
+    //
+
+    // Returns DEFAULT_BUFFERS_STACKS.
+    static vector<buffer_stack_info_t> default_buffer_stacks(void);
+
+    // Returns the number of packet buffers of each size which have been
+    // received or transmitted by the workers, since the driver started.
+    //
+    // Can be called by any thread.
+    buffers_mix_t buffers_mix(void) const;
+
+    // Sizes a set of buffer stacks which uses about 'mem_size' bytes from the
+    // number of buffers of each size used by a previous execution (see
+    // 'buffers_mix()').
+    //
+    // The number of buffers of each size is proportional to its usage, with
+    // at least MIN_STACK_BUFFERS buffers. The stacks always include the
+    // largest buffer size of DEFAULT_BUFFERS_STACKS, so that the maximum
+    // packet size doesn't depend on the mix.
+    static vector<buffer_stack_info_t> buffer_stacks_for_mix(
+        const buffers_mix_t &mix, size_t mem_size
+    );
+
+    //
+    // Load balancing.
+    //
+
+    // Enables or disables the rebalancing of the buckets of the load balancer.
+    //
+    // When enabled, each worker periodically compares the average depth of its
+    // ingress queue with the ones of the other workers (see
+    // REBALANCE_INTERVAL). An overloaded worker gives its buckets which hold no
+    // TCB to the least loaded worker. Connections are thus never migrated: new
+    // connections of these buckets are received by the other worker. Packets
+    // queued before a bucket moved are handed off to its new worker.
+    //
+    // Finding the buckets which hold no TCB requires the classifier to hash
+    // flows with 'bucket_hash_t'. Dies if TCP_FLOW_HASH is not defined, as a
+    // bucket could be moved with its connections otherwise.
+    //
+    // Must be called before 'run()'.
+    void set_rebalancing(bool enabled);
+
+    // Makes a single worker process the TCP segments received on the given
+    // local port. Segments received by the other workers are handed off to it.
+    //
+    // 'tcp_listen()' then only opens the port on this worker. Useful to
+    // dedicate some Tiles to a service.
+    //
+    // Must be called before 'run()' and before the port is opened. The port
+    // must not be in the range of the local ports of 'tcp_connect()'.
+    void tcp_pin_port(tcp_t::port_t port, int worker_id);
+
     //
     // TCP server sockets.
     //
@@ -322,21 +778,80 @@ struct mpipe_t {
     // If the port was already in the listen state, replaces the previous
     // callback function.
     //
-    // FIXME: the function is not thread safe. DON'T call it when workers are
-    // concurrently running.
+    // Can be called while workers are running, in which case the port will be
+    // opened by each worker at the next iteration of its polling loop (see
+    // 'broadcast()'). A pinned port is only opened by its worker (see
+    // 'tcp_pin_port()').
     void tcp_listen(
         tcp_t::port_t tcp, tcp_t::new_conn_callback_t new_conn_callback
     );
 
+    // Same as the previous 'tcp_listen()' but allows to specify the backlog
+    // and the SYN cookies policy of the port.
+    //
+    // The backlog is per worker.
+    void tcp_listen(
+        tcp_t::port_t tcp, tcp_t::new_conn_callback_t new_conn_callback,
+        tcp_t::listen_options_t options
+    );
+
+    //
+    // TCP client sockets.
+    //
+
+    // Opens a connection to the given remote address and port (see
+    // 'tcp_t::connect()').
+    //
+    // Connections are opened by the workers in turn, at the next iteration of
+    // their polling loop when they are running (see 'broadcast()'). Each
+    // worker chooses local ports for which the load balancer delivers the
+    // segments of the remote to itself, which requires the classifier to hash
+    // flows with 'bucket_hash_t'. Without TCP_FLOW_HASH, the driver dies if it
+    // has more than one worker. Workers can open their own connections by
+    // directly calling 'tcp_t::connect()' under the same condition.
+    //
+    // 'connect_failed' is called by the worker, in place of
+    // 'new_conn_callback', if the worker has no free local port for this
+    // remote.
+    //
+    // Should not be called by a worker.
+    void tcp_connect(
+        net_t<ipv4_t::addr_t> raddr, tcp_t::port_t rport,
+        tcp_t::new_conn_callback_t new_conn_callback,
+        tcp_t::conn_failed_callback_t connect_failed = nullptr
+    );
+
+    //
+    // Static memory.
+    //
+
+    // Allocates memory which can be transmitted without being copied into
+    // packet buffers, once registered with 'register_static_mem()'.
+    //
+    // The memory is never released. As a buffer stack can only register 16
+    // pages, the page size depends on the requested size.
+    static static_mem_t alloc_static_mem(size_t size);
+
+    // Registers the pages of the static memory into the mPIPE's TLB, so that
+    // it can be referenced by egress descriptors of this link.
+    //
+    // The same static memory can be registered to several 'mpipe_t'
+    // instances. Dies if the mPIPE's TLB has no more free entries.
+    //
+    // Must be called before 'run()', as the TLB can't be modified while the
+    // workers are transmitting. Dies if the link is already running.
+    void register_static_mem(const static_mem_t &static_mem);
+
     //
     // TCP client/connected sockets.
     //
 
 
 private:
-    // Allocates a buffer from the smallest stack able to hold the requested
-    // size.
-    gxio_mpipe_bdesc_t _alloc_buffer(size_t size);
+    // Executes the closure on the given worker, at the next iteration of its
+    // polling loop if the workers are running (see 'instance_t::post()'), or
+    // directly if they are not.
+    void _execute_on(instance_t *instance, function<void()> f);
 
     // Sends a packet of the given size on the interface by calling the
     // 'packet_writer' with a cursor corresponding to a buffer allocated
@@ -346,11 +861,196 @@ private:
     );
 };
 
+inline bool mpipe_t::instance_t::post(function<void()> f)
+{
+    return this->messages.post(move(f));
+}
+
+inline void mpipe_t::instance_t::_receive_packet(gxio_mpipe_idesc_t *idesc)
+{
+    // Initializes a buffer cursor which starts at the Ethernet header and
+    // stops at the end of the packet.
+    //
+    // The buffer will be freed when the cursor will be destructed.
+    cursor_t cursor(&this->parent->context, idesc, true, this->alloc);
+    cursor = cursor.drop(gxio_mpipe_idesc_get_l2_offset(idesc));
+
+    DRIVER_DEBUG("Receives a %zu bytes packet", cursor.size());
+
+    this->ethernet.receive_frame(cursor);
+}
+
+template <typename F>
+void mpipe_t::instance_t::for_each_stat(F f) const
+{
+    f("mpipe.rx_packets",       this->stats.rx_packets.get());
+    f("mpipe.rx_dropped",       this->stats.rx_dropped.get());
+    f("mpipe.rx_no_buffer",     this->stats.rx_no_buffer.get());
+    f("mpipe.rx_queue_depth",   this->stats.rx_queue_depth.get());
+    f("mpipe.rx_queue_load",    this->stats.rx_queue_load.get());
+    f("mpipe.rx_handoffs",      this->stats.rx_handoffs.get());
+    f("mpipe.buckets_moved",    this->stats.buckets_moved.get());
+    f("mpipe.tx_packets",       this->stats.tx_packets.get());
+    f("mpipe.tx_descriptors",   this->stats.tx_descriptors.get());
+    f("mpipe.tx_buffer_fallbacks", this->stats.tx_buffer_fallbacks.get());
+    f("mpipe.tx_no_buffer",     this->stats.tx_no_buffer.get());
+
+    static const char *BUFFERS_NAMES[N_BUFFER_SIZES] = {
+        "mpipe.buffers_128", "mpipe.buffers_256", "mpipe.buffers_512",
+        "mpipe.buffers_1024", "mpipe.buffers_1664", "mpipe.buffers_4096",
+        "mpipe.buffers_10368", "mpipe.buffers_16384"
+    };
+
+    for (size_t i = 0; i < N_BUFFER_SIZES; i++)
+        f(BUFFERS_NAMES[i],     this->stats.buffers[i].get());
+    f("timers.scheduled",       this->stats.timers.get());
+
+    this->ethernet.for_each_stat(f);
+}
+
+template <typename F>
+void mpipe_t::for_each_stat(F f) const
+{
+    // Every worker gives its counters in the same order.
+
+    vector<pair<const char *, uint64_t>> sums;
+
+    for (size_t i = 0; i < this->instances.size(); i++) {
+        size_t j = 0;
+
+        this->instances[i]->for_each_stat(
+        [&sums, &j, i](const char *name, uint64_t value) {
+            if (i == 0)
+                sums.emplace_back(name, value);
+            else
+                sums[j++].second += value;
+        });
+    }
+
+    for (const pair<const char *, uint64_t> &sum : sums)
+        f(sum.first, sum.second);
+}
+
 inline size_t mpipe_t::instance_t::max_packet_size(void)
 {
     return this->parent->max_packet_size;
 }
 
+inline bool mpipe_t::instance_t::tx_congested(size_t packet_size) const
+{
+    if (LIKELY(this->empty_stacks == 0))
+        return false;
+
+    // The stack 'send_packet()' would first allocate from. Larger packets are
+    // written in buffers of the largest size.
+
+    const vector<buffer_stack_t> &stacks = this->parent->buffer_stacks;
+
+    size_t i = 0;
+    while (i + 1 < stacks.size() && stacks[i].buffer_size < packet_size)
+        i++;
+
+    return this->empty_stacks & (1 << i);
+}
+
+template <typename packet_writer_t>
+inline void mpipe_t::instance_t::send_packet(
+    size_t packet_size, packet_writer_t packet_writer
+)
+{
+    this->send_packet(packet_size, move(packet_writer), static_extent_t());
+}
+
+template <typename packet_writer_t>
+inline void mpipe_t::instance_t::send_packet(
+    size_t packet_size, packet_writer_t packet_writer, static_extent_t tail
+)
+{
+    assert(packet_size <= this->parent->max_packet_size);
+    assert(tail.size <= packet_size);
+
+    TRACE_SCOPE(TRACE_SEND);
+
+    DRIVER_DEBUG(
+        "Sends a %zu bytes packet (%zu bytes by reference)", packet_size,
+        tail.size
+    );
+
+    // Number of bytes written by 'packet_writer' in the packet buffers.
+    size_t buffers_size = packet_size - tail.size;
+
+    size_t max_buffer_size = this->parent->buffer_stacks.back().buffer_size;
+
+    if (LIKELY(buffers_size <= max_buffer_size)) {
+        // Allocates a buffer and executes the 'packet_writer' on its memory.
+        gxio_mpipe_bdesc_t bdesc = this->_alloc_buffer(buffers_size);
+
+        if (UNLIKELY(bdesc.c == MPIPE_EDMA_DESC_WORD1__C_VAL_INVALID)) {
+            // Drops the packet. TCP will retransmit it.
+            this->stats.tx_no_buffer.inc();
+            DRIVER_DEBUG("Packet dropped (no buffer available)");
+            return;
+        }
+
+        // Allocates an unmanaged cursor, which will not desallocate the buffer
+        // when destructed.
+        cursor_t cursor(
+            &this->parent->context, &bdesc, buffers_size, false, this->alloc
+        );
+        packet_writer(cursor);
+
+        this->_queue_packet(&bdesc, 1, buffers_size, tail);
+    } else {
+        #ifdef MPIPE_CHAINED_BUFFERS
+            // Writes the packet in several buffers of the largest size, which
+            // will be gathered by the mPIPE.
+
+            size_t n_bdescs =
+                (buffers_size + max_buffer_size - 1) / max_buffer_size;
+            assert(n_bdescs <= MAX_PACKET_BUFFERS);
+
+            gxio_mpipe_bdesc_t bdescs[MAX_PACKET_BUFFERS];
+            for (size_t i = 0; i < n_bdescs; i++) {
+                bdescs[i] = this->_alloc_buffer(max_buffer_size);
+
+                if (UNLIKELY(
+                    bdescs[i].c == MPIPE_EDMA_DESC_WORD1__C_VAL_INVALID
+                )) {
+                    // Returns the already allocated buffers and drops the
+                    // packet.
+                    for (size_t j = 0; j < i; j++) {
+                        gxio_mpipe_push_buffer_bdesc(
+                            &this->parent->context, bdescs[j]
+                        );
+                    }
+
+                    this->stats.tx_no_buffer.inc();
+                    DRIVER_DEBUG("Packet dropped (no buffer available)");
+                    return;
+                }
+            }
+
+            cursor_t cursor(
+                &this->parent->context, bdescs, n_bdescs, buffers_size, false,
+                this->alloc
+            );
+            packet_writer(cursor);
+
+            this->_queue_packet(bdescs, n_bdescs, buffers_size, tail);
+        #else
+            DRIVER_DIE(
+                "No buffer is sufficiently large to hold the requested size."
+            );
+        #endif /* MPIPE_CHAINED_BUFFERS */
+    }
+}
+
+inline void mpipe_t::instance_t::flush(void)
+{
+    if (this->tx_batch_count > 0)
+        this->_flush_tx_batch();
+}
+
 inline mpipe_t::tcp_t::seq_t mpipe_t::instance_t::get_current_tcp_seq(void)
 {
     // Number of cycles between two increments of the sequence number
@@ -0,0 +1,46 @@
+//
+// Selects the driver of the architecture the network stack is compiled for:
+// the mPIPE driver on the TILE-Gx, the host driver (see 'driver/host.hpp') on
+// other architectures.
+//
+// Applications which don't use features specific to the mPIPE (such as
+// 'mpipe_t::alloc_static_mem()') can be written over 'platform_driver_t'.
+//
+// Copyright 2015 Raphael Javaux <raphaeljavaux@gmail.com>
+// University of Liege.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __RUSTY_DRIVER_PLATFORM_HPP__
+#define __RUSTY_DRIVER_PLATFORM_HPP__
+
+#ifdef __tilegx__
+    #include "driver/mpipe.hpp" // mpipe_t
+#else
+    #include "driver/host.hpp"  // host_t
+#endif /* __tilegx__ */
+
+namespace rusty {
+namespace driver {
+
+#ifdef __tilegx__
+    typedef mpipe_t                         platform_driver_t;
+#else
+    typedef host_t                          platform_driver_t;
+#endif /* __tilegx__ */
+
+} } /* namespace rusty::driver */
+
+#endif /* __RUSTY_DRIVER_PLATFORM_HPP__ */
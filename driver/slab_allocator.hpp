@@ -0,0 +1,311 @@
+//
+// Allocator which serves small objects from per-size free lists.
+//
+// Copyright 2015 Raphael Javaux <raphaeljavaux@gmail.com>
+// University of Liege.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __RUSTY_DRIVER_SLAB_ALLOCATOR_HPP__
+#define __RUSTY_DRIVER_SLAB_ALLOCATOR_HPP__
+
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <memory>               // allocator, allocate_shared, shared_ptr
+#include <utility>              // forward
+#include <vector>
+
+#include "driver/driver.hpp"
+#include "util/macros.hpp"      // LIKELY(), UNLIKELY()
+
+#ifdef USE_TILE_ALLOCATOR
+    #include "driver/allocator.hpp" // tile_allocator_t
+#endif /* USE_TILE_ALLOCATOR */
+
+using namespace std;
+
+namespace rusty {
+namespace driver {
+
+// Memory shared by a 'slab_allocator_t' and all of its copies.
+//
+// Objects are grouped in size classes. Each size classe has a free list of
+// objects which is refilled by carving slabs of SLAB_SIZE bytes allocated with
+// the parent allocator. Slabs are only released to the parent allocator when
+// the pools are destructed.
+//
+// Size classes are multiples of 16 bytes up to 256 bytes and multiples of 256
+// bytes up to MAX_OBJECT_SIZE. Larger requests are directly forwarded to the
+// parent allocator.
+//
+// Pools are *not* thread-safe: they are intended to be used by a single worker
+// thread.
+template <typename parent_alloc_t>
+struct slab_pools_t {
+    //
+    // Parameters
+    //
+
+    static constexpr size_t SMALL_CLASS_SIZE    = 16;
+    static constexpr size_t SMALL_CLASSES_MAX   = 256;
+
+    static constexpr size_t LARGE_CLASS_SIZE    = 256;
+
+    static constexpr size_t MAX_OBJECT_SIZE     = 4096;
+
+    static constexpr size_t N_CLASSES =
+          SMALL_CLASSES_MAX / SMALL_CLASS_SIZE
+        + (MAX_OBJECT_SIZE - SMALL_CLASSES_MAX) / LARGE_CLASS_SIZE;
+
+    // Size of the memory blocks requested to the parent allocator.
+    static constexpr size_t SLAB_SIZE           = 64 * 1024;
+
+    //
+    // Member types
+    //
+
+    typedef typename parent_alloc_t::template rebind<char>::other
+                                                        raw_alloc_t;
+    typedef typename parent_alloc_t::template rebind<char *>::other
+                                                        slabs_alloc_t;
+
+    // Available objects are linked through their first bytes.
+    struct free_object_t {
+        free_object_t   *next;
+    };
+
+    //
+    // Fields
+    //
+
+    raw_alloc_t                         parent;
+
+    array<free_object_t *, N_CLASSES>   free_lists;
+
+    vector<char *, slabs_alloc_t>       slabs;
+
+    //
+    // Methods
+    //
+
+    slab_pools_t(parent_alloc_t _parent)
+        : parent(_parent), slabs(_parent)
+    {
+        free_lists.fill(nullptr);
+    }
+
+    ~slab_pools_t(void)
+    {
+        for (char *slab : slabs)
+            parent.deallocate(slab, SLAB_SIZE);
+    }
+
+    // Returns the index of the size class able to hold objects of the given
+    // size.
+    static inline size_t size_class(size_t size)
+    {
+        assert(size > 0 && size <= MAX_OBJECT_SIZE);
+
+        if (size <= SMALL_CLASSES_MAX)
+            return (size - 1) / SMALL_CLASS_SIZE;
+        else {
+            return  SMALL_CLASSES_MAX / SMALL_CLASS_SIZE
+                  + (size - SMALL_CLASSES_MAX - 1) / LARGE_CLASS_SIZE;
+        }
+    }
+
+    // Returns the size of the objects of the given class.
+    static inline size_t class_size(size_t size_class)
+    {
+        static constexpr size_t N_SMALL_CLASSES =
+            SMALL_CLASSES_MAX / SMALL_CLASS_SIZE;
+
+        if (size_class < N_SMALL_CLASSES)
+            return (size_class + 1) * SMALL_CLASS_SIZE;
+        else {
+            return  SMALL_CLASSES_MAX
+                  + (size_class - N_SMALL_CLASSES + 1) * LARGE_CLASS_SIZE;
+        }
+    }
+
+    inline void *allocate(size_t size)
+    {
+        if (UNLIKELY(size > MAX_OBJECT_SIZE))
+            return parent.allocate(size);
+
+        size_t i = size_class(size);
+
+        if (UNLIKELY(free_lists[i] == nullptr))
+            _refill(i);
+
+        free_object_t *object = free_lists[i];
+        free_lists[i] = object->next;
+
+        return object;
+    }
+
+    inline void deallocate(void *ptr, size_t size)
+    {
+        if (UNLIKELY(size > MAX_OBJECT_SIZE)) {
+            parent.deallocate((char *) ptr, size);
+            return;
+        }
+
+        size_t i = size_class(size);
+
+        free_object_t *object = (free_object_t *) ptr;
+        object->next = free_lists[i];
+        free_lists[i] = object;
+    }
+
+private:
+    // Allocates a new slab and splits it in free objects of the given size
+    // class.
+    void _refill(size_t size_class)
+    {
+        char *slab = parent.allocate(SLAB_SIZE);
+        if (UNLIKELY(slab == nullptr))
+            DRIVER_DIE("Unable to allocate a new slab");
+
+        slabs.push_back(slab);
+
+        size_t object_size = class_size(size_class);
+
+        for (
+            char *p = slab;
+            p + object_size <= slab + SLAB_SIZE;
+            p += object_size
+        ) {
+            free_object_t *object = (free_object_t *) p;
+            object->next = free_lists[size_class];
+            free_lists[size_class] = object;
+        }
+    }
+};
+
+// STL allocator which uses a set of 'slab_pools_t' to allocate objects.
+//
+// Allocating and freeing a small object only costs a few instructions and
+// never calls the parent allocator once the pools are warm. Using a
+// 'tile_allocator_t' homed on a worker's Tile as the parent allocator makes
+// all the objects to be cached on this Tile.
+//
+// The allocator and its copies must only be used by a single thread.
+//
+// Every allocated data will be freed when the object and all of its copies
+// (and rebinds) will be destucted.
+template <
+    typename T,
+    #ifdef USE_TILE_ALLOCATOR
+        typename parent_alloc_t = tile_allocator_t<char>
+    #else
+        typename parent_alloc_t = allocator<char>
+    #endif /* USE_TILE_ALLOCATOR */
+>
+struct slab_allocator_t {
+    //
+    // Member types
+    //
+
+    typedef T           value_type;
+    typedef T*          pointer;
+    typedef const T*    const_pointer;
+    typedef T&          reference;
+    typedef const T&    const_reference;
+    typedef size_t      size_type;
+
+    template<class U>
+    struct rebind {
+        typedef slab_allocator_t<U, parent_alloc_t> other;
+    };
+
+    typedef slab_pools_t<parent_alloc_t> pools_t;
+
+    //
+    // Member fields
+    //
+
+    shared_ptr<pools_t> pools;
+
+    //
+    // Methods
+    //
+
+    // Creates an allocator which gets its slabs from the given allocator.
+    //
+    // The pools are allocated with the parent allocator.
+    inline slab_allocator_t(parent_alloc_t parent = parent_alloc_t())
+        : pools(allocate_shared<pools_t>(parent, parent))
+    {
+    }
+
+    template <typename U>
+    inline slab_allocator_t(const slab_allocator_t<U, parent_alloc_t>& other)
+        : pools(other.pools)
+    {
+    }
+
+    //
+    // Allocator methods and operators.
+    //
+
+    inline T* address(T& obj)
+    {
+        return &obj;
+    }
+
+    inline T* allocate(size_t length)
+    {
+        return (T*) pools->allocate(length * sizeof (T));
+    }
+
+    inline void deallocate(T* ptr, size_t length)
+    {
+        pools->deallocate(ptr, length * sizeof (T));
+    }
+
+    template <typename U, typename ... Args>
+    void construct(U* p, Args&&... args)
+    {
+        new (p) U(forward<Args>(args) ...);
+    }
+
+    template <typename U>
+    void destroy(U* p)
+    {
+        p->~U();
+    }
+
+    friend inline bool operator==(
+        const slab_allocator_t<T, parent_alloc_t>& a,
+        const slab_allocator_t<T, parent_alloc_t>& b
+    )
+    {
+        return a.pools == b.pools;
+    }
+
+    friend inline bool operator!=(
+        const slab_allocator_t<T, parent_alloc_t>& a,
+        const slab_allocator_t<T, parent_alloc_t>& b
+    )
+    {
+        return !(a == b);
+    }
+};
+
+} } /* namespace rusty::driver */
+
+#endif /* __RUSTY_DRIVER_SLAB_ALLOCATOR_HPP__ */
@@ -0,0 +1,224 @@
+//
+// Control-plane thread which exports the counters of mPIPE instances over UDP.
+//
+// Copyright 2015 Raphael Javaux <raphaeljavaux@gmail.com>
+// University of Liege.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#include <cerrno>
+#include <cinttypes>            // PRIu64
+#include <cstdint>
+#include <cstdio>               // fopen(), snprintf()
+#include <cstdlib>              // strtoul()
+#include <cstring>              // memset(), strchr(), strcmp(), strncmp(),
+                                // strstr()
+#include <string>               // string, to_string()
+#include <utility>              // move(), pair
+#include <vector>
+
+#include <arpa/inet.h>          // htons(), htonl()
+#include <netinet/in.h>         // in_addr_t, sockaddr_in
+#include <pthread.h>            // pthread_*
+#include <sys/socket.h>         // socket(), bind(), recvfrom(), sendto()
+
+#include "driver/driver.hpp"    // DRIVER_DEBUG(), VERIFY_ERRNO, VERIFY_PTHREAD
+#include "driver/platform.hpp"  // platform_driver_t
+
+#include "driver/stats_server.hpp"
+
+using namespace std;
+
+namespace rusty {
+namespace driver {
+
+// Maximum payload of an UDP datagram. Longer answers are truncated.
+static constexpr size_t MAX_ANSWER_SIZE = 65507;
+
+// Longer requests are truncated.
+static constexpr size_t MAX_REQUEST_SIZE = 256;
+
+stats_server_t::stats_server_t(
+    vector<const platform_driver_t *> _instances, in_addr_t addr,
+    uint16_t port, string _trace_dir
+) : instances(move(_instances)), trace_dir(move(_trace_dir))
+{
+    int result;
+
+    this->sock = socket(AF_INET, SOCK_DGRAM, 0);
+    VERIFY_ERRNO(this->sock, "socket()");
+
+    struct sockaddr_in sock_addr;
+    memset(&sock_addr, 0, sizeof (sock_addr));
+    sock_addr.sin_family        = AF_INET;
+    sock_addr.sin_addr.s_addr   = htonl(addr);
+    sock_addr.sin_port          = htons(port);
+
+    result = bind(
+        this->sock, (struct sockaddr *) &sock_addr, sizeof (sock_addr)
+    );
+    VERIFY_ERRNO(result, "bind()");
+
+    result = pthread_create(
+        &this->thread, nullptr, stats_server_t::_runner, this
+    );
+    VERIFY_PTHREAD(result, "pthread_create()");
+
+    DRIVER_DEBUG("Exports the statistics on UDP port %" PRIu16, port);
+}
+
+void stats_server_t::_serve(void)
+{
+    vector<char> answer(MAX_ANSWER_SIZE);
+
+    for (;;) {
+        char request[MAX_REQUEST_SIZE + 1];
+
+        struct sockaddr_in client;
+        socklen_t client_len = sizeof (client);
+
+        ssize_t received = recvfrom(
+            this->sock, request, MAX_REQUEST_SIZE, 0,
+            (struct sockaddr *) &client, &client_len
+        );
+
+        if (received < 0) {
+            if (errno != EINTR)
+                DRIVER_DEBUG("recvfrom() failed (errno: %d)", errno);
+            continue;
+        }
+
+        request[received] = '\0';
+
+        size_t answer_size;
+
+        #ifdef USE_TRACING
+            if (strncmp(request, "trace", 5) == 0) {
+                answer_size = this->_handle_trace_request(
+                    request, answer.data(), answer.size()
+                );
+            } else
+        #endif /* USE_TRACING */
+                answer_size = this->_write_stats(answer.data(), answer.size());
+
+        sendto(
+            this->sock, answer.data(), answer_size, 0,
+            (struct sockaddr *) &client, client_len
+        );
+    }
+}
+
+size_t stats_server_t::_write_stats(char *buffer, size_t size) const
+{
+    // Sums the counters of the instances. Every instance gives its counters in
+    // the same order.
+
+    vector<pair<const char *, uint64_t>> sums;
+
+    for (size_t i = 0; i < this->instances.size(); i++) {
+        size_t j = 0;
+
+        this->instances[i]->for_each_stat(
+        [&sums, &j, i](const char *name, uint64_t value) {
+            if (i == 0)
+                sums.emplace_back(name, value);
+            else
+                sums[j++].second += value;
+        });
+    }
+
+    size_t written = 0;
+
+    for (const pair<const char *, uint64_t> &sum : sums) {
+        int n = snprintf(
+            buffer + written, size - written, "%s %" PRIu64 "\n", sum.first,
+            sum.second
+        );
+
+        if (n < 0 || written + n >= size)
+            break; // Truncated.
+
+        written += n;
+    }
+
+    return written;
+}
+
+#ifdef USE_TRACING
+    size_t stats_server_t::_handle_trace_request(
+        const char *request, char *buffer, size_t size
+    )
+    {
+        char command[16], arg[MAX_REQUEST_SIZE];
+
+        int n_args = sscanf(request, "trace %15s %255s", command, arg);
+
+        if (n_args < 1)
+            return snprintf(buffer, size, "invalid trace request\n");
+
+        // Lists the tracers of every worker.
+        vector<util::tracer_t *> tracers;
+        for (const platform_driver_t *driver : this->instances) {
+            for (platform_driver_t::instance_t *instance : driver->instances)
+                tracers.push_back(&instance->tracer);
+        }
+
+        bool is_on = strcmp(command, "on") == 0;
+
+        if (is_on || strcmp(command, "off") == 0) {
+            if (n_args < 2) {
+                for (util::tracer_t *tracer : tracers)
+                    tracer->enabled.store(is_on, memory_order_relaxed);
+            } else {
+                size_t worker = strtoul(arg, nullptr, 10);
+
+                if (worker >= tracers.size())
+                    return snprintf(buffer, size, "invalid worker\n");
+
+                tracers[worker]->enabled.store(is_on, memory_order_relaxed);
+            }
+
+            return snprintf(buffer, size, "ok\n");
+        } else if (strcmp(command, "dump") == 0 && n_args == 2) {
+            // Requests are not authenticated. Dumps are only written in the
+            // trace directory.
+            if (strchr(arg, '/') != nullptr || strstr(arg, "..") != nullptr)
+                return snprintf(buffer, size, "invalid dump name\n");
+
+            for (size_t i = 0; i < tracers.size(); i++) {
+                string path =
+                    this->trace_dir + '/' + string(arg) + '.' + to_string(i);
+
+                FILE *file = fopen(path.c_str(), "w");
+                if (file == nullptr)
+                    return snprintf(buffer, size, "unable to open %s\n", arg);
+
+                tracers[i]->dump(file);
+                fclose(file);
+            }
+
+            return snprintf(buffer, size, "ok\n");
+        } else
+            return snprintf(buffer, size, "invalid trace request\n");
+    }
+#endif /* USE_TRACING */
+
+void *stats_server_t::_runner(void *server)
+{
+    ((stats_server_t *) server)->_serve();
+    return nullptr;
+}
+
+} } /* namespace rusty::driver */
@@ -0,0 +1,111 @@
+//
+// Control-plane thread which exports the counters of driver instances over
+// UDP.
+//
+// Copyright 2015 Raphael Javaux <raphaeljavaux@gmail.com>
+// University of Liege.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __RUSTY_DRIVER_STATS_SERVER_HPP__
+#define __RUSTY_DRIVER_STATS_SERVER_HPP__
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <netinet/in.h>         // in_addr_t
+#include <pthread.h>            // pthread_t
+
+#include "driver/platform.hpp"  // platform_driver_t
+
+using namespace std;
+
+namespace rusty {
+namespace driver {
+
+// Answers every datagram received on its UDP port with the counters of the
+// driver instances (see 'mpipe_t::for_each_stat()'), summed over every
+// instance, one "<name> <value>" line per counter. E.g.:
+//
+//      echo | nc -u -w 1 <host> <port>
+//
+// The server runs in its own thread and uses the sockets of the Linux network
+// stack. It must thus be reached through an interface which is not driven by
+// a driver instance. It never interrupts nor locks the workers. Requests are
+// not authenticated: the server should be bound to the loopback interface or
+// to a management network.
+//
+// When compiled with USE_TRACING, the following requests control the tracers
+// of the workers (see 'util/trace.hpp'):
+//
+// - "trace on [<worker>]" and "trace off [<worker>]" enable or disable tracing
+//   on every worker, or on a single one. Workers are numbered from zero, over
+//   every instance ;
+// - "trace dump <name>" writes the histograms and the events of every worker to
+//   '<trace_dir>/<name>.<worker>'. Names containing '/' or '..' are rejected.
+struct stats_server_t {
+    //
+    // Fields
+    //
+
+    vector<const platform_driver_t *> instances;
+
+    // Directory in which "trace dump" requests write their files.
+    string                      trace_dir;
+
+    int                         sock;
+
+    pthread_t                   thread;
+
+    //
+    // Methods
+    //
+
+    // Binds the UDP port on the given address (in host byte order) and starts
+    // the thread. The function immediately returns.
+    //
+    // The instances must not be destroyed while the server is running.
+    stats_server_t(
+        vector<const platform_driver_t *> _instances, in_addr_t addr,
+        uint16_t port, string _trace_dir
+    );
+
+    stats_server_t(const stats_server_t &other) = delete;
+
+private:
+
+    // Receives requests and answers them. Never returns.
+    void _serve(void);
+
+    // Writes the counters of the instances into the buffer, and returns their
+    // size.
+    size_t _write_stats(char *buffer, size_t size) const;
+
+    #ifdef USE_TRACING
+        // Executes a "trace ..." request and writes its result into the
+        // buffer. Returns the size of the result.
+        size_t _handle_trace_request(
+            const char *request, char *buffer, size_t size
+        );
+    #endif /* USE_TRACING */
+
+    // Wrapper over '_serve()' for 'pthread_create()'.
+    static void *_runner(void *server);
+};
+
+} } /* namespace rusty::driver */
+
+#endif /* __RUSTY_DRIVER_STATS_SERVER_HPP__ */
@@ -26,10 +26,9 @@
 #include <unordered_map>
 #include <utility>              // move()
 
-#include <arch/cycle.h>         // get_cycle_count()
-
 #include "driver/cpu.hpp"       // cycles_t, CYCLES_PER_SECOND
 #include "driver/driver.hpp"    // DRIVER_DEBUG()
+#include "util/cycle.hpp"       // get_cycle_count()
 #include "util/macros.hpp"      // UNLIKELY()
 
 #include "driver/timer.hpp"
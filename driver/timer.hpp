@@ -102,6 +102,12 @@ struct cpu_timer_manager_t {
     // found.
     bool remove(timer_id_t timer_id);
 
+    // Returns the number of scheduled timers.
+    inline size_t size(void) const
+    {
+        return timers.size();
+    }
+
 private:
     // Sames as 'schedule' but doesn't produce a log message.
     timer_id_t _insert(cpu_clock_t::interval_t delay, function<void()> f);
@@ -0,0 +1,532 @@
+//
+// Provides a timer manager which uses a hierarchical timing wheel indexed by
+// the CPU's cycle counter to trigger timers.
+//
+// Copyright 2015 Raphael Javaux <raphaeljavaux@gmail.com>
+// University of Liege.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __RUSTY_DRIVER_TIMER_WHEEL_HPP__
+#define __RUSTY_DRIVER_TIMER_WHEEL_HPP__
+
+#include <cassert>
+#include <cinttypes>        // PRIu64
+#include <cstdint>
+#include <functional>       // function
+#include <memory>           // allocator
+#include <utility>          // move()
+#include <vector>
+
+#include "driver/clock.hpp" // cpu_clock_t
+#include "driver/driver.hpp"// DRIVER_DEBUG()
+#include "util/macros.hpp"  // LIKELY(), UNLIKELY()
+
+using namespace std;
+
+namespace rusty {
+namespace driver {
+
+// Manages timers using a hierarchical timing wheel.
+//
+// Time is divided in ticks of 2^TICK_SHIFT CPU cycles. The wheel is made of
+// N_LEVELS levels of N_SLOTS slots. A slot of the level 'l' contains the
+// timers which will expire in the next N_SLOTS^(l + 1) ticks. Timers are moved
+// to lower levels ("cascaded") as the time advances. Scheduling, rescheduling
+// and removing a timer are O(1) operations, and don't allocate any memory once
+// the pool of timer nodes is large enough.
+//
+// Timers are executed on the first 'tick()' call which has been made after
+// their expiration, rounded-up to the next tick (i.e. they can be delayed by at
+// most one tick, ~ 14 µs).
+//
+// Timer identifiers are stable: 'reschedule()' returns the identifier it has
+// been given. Removing or rescheduling an already expired timer is safe.
+//
+// Provides the same interface as 'cpu_timer_manager_t'.
+//
+// The manager is *not* thread-safe. Users must avoid concurrent calls to
+// 'tick()', 'schedule()' and 'remove()'. Calling 'schedule()' or 'remove()'
+// within a timer should be safe.
+template <typename alloc_t = allocator<char *>>
+struct wheel_timer_manager_t {
+    //
+    // Parameters
+    //
+
+    // Duration of a tick, as a power of two of CPU cycles (2^14 cycles is
+    // ~ 14 µs at 1.2 GHz).
+    static constexpr unsigned int   TICK_SHIFT  = 14;
+
+    static constexpr unsigned int   LEVEL_BITS  = 8;
+    static constexpr unsigned int   N_SLOTS     = 1 << LEVEL_BITS;
+    static constexpr uint64_t       SLOT_MASK   = N_SLOTS - 1;
+
+    // With 4 levels of 256 slots, the wheel covers 2^32 ticks (~ 16 hours).
+    // Timers that expire later are assigned to the last level and are cascaded
+    // again until they fit.
+    static constexpr unsigned int   N_LEVELS    = 4;
+
+    // Number of timer nodes which are allocated at once when the pool is
+    // empty.
+    static constexpr size_t         NODES_PER_CHUNK = 256;
+
+    //
+    // Member types
+    //
+
+    // Links of the intrusive doubly-linked lists used in the slots.
+    struct link_t {
+        link_t      *prev;
+        link_t      *next;
+
+        inline void init(void)
+        {
+            prev = next = this;
+        }
+
+        inline bool empty(void) const
+        {
+            return next == this;
+        }
+
+        // Inserts the 'link' after the current one.
+        inline void push(link_t *link)
+        {
+            link->prev = this;
+            link->next = next;
+            next->prev = link;
+            next = link;
+        }
+
+        // Removes the current link from the list it is in.
+        inline void unlink(void)
+        {
+            prev->next = next;
+            next->prev = prev;
+        }
+
+        // Moves all the links of the current list to 'other', which must be
+        // initialized. The current list becomes empty.
+        inline void move_to(link_t *other)
+        {
+            assert(other->empty());
+
+            if (empty())
+                return;
+
+            other->next = next;
+            other->prev = prev;
+            next->prev = other;
+            prev->next = other;
+
+            init();
+        }
+    };
+
+    struct node_t : link_t {
+        // Expiration tick.
+        uint64_t            expire;
+
+        // Incremented each time the node is released. Used to detect expired
+        // or removed timers.
+        uint32_t            generation;
+
+        bool                is_scheduled;
+
+        // Level of the wheel the node is in.
+        uint8_t             level;
+
+        function<void()>    f;
+    };
+
+    // Nodes are never released to the allocator before the destruction of
+    // the manager, which makes it safe to dereference the node of an expired
+    // timer identifier.
+    struct timer_id_t {
+        node_t      *node;
+        uint32_t    generation;
+
+        inline timer_id_t(void) : node(nullptr), generation(0)
+        {
+        }
+
+        inline timer_id_t(node_t *_node)
+            : node(_node), generation(_node->generation)
+        {
+        }
+    };
+
+    typedef typename alloc_t::template rebind<node_t>::other    node_alloc_t;
+    typedef typename alloc_t::template rebind<node_t *>::other  chunks_alloc_t;
+
+    //
+    // Fields
+    //
+
+    node_alloc_t                        node_alloc;
+
+    // Chunks of nodes allocated with 'node_alloc'.
+    vector<node_t *, chunks_alloc_t>    chunks;
+
+    // Singly-linked list of available nodes (uses 'node_t::next').
+    node_t                              *free_nodes;
+
+    link_t                              slots[N_LEVELS][N_SLOTS];
+
+    // Last tick which has been processed.
+    uint64_t                            current;
+
+    // Number of scheduled timers.
+    size_t                              n_timers;
+
+    // Number of timers in each level. Used to skip the ticks during which no
+    // timer can expire.
+    size_t                              n_level_timers[N_LEVELS];
+
+    //
+    // Methods
+    //
+
+    wheel_timer_manager_t(alloc_t _alloc = alloc_t());
+
+    ~wheel_timer_manager_t(void);
+
+    // Executes expired timers. This method should be called periodically.
+    void tick(void);
+
+    // Registers a timer. The timer will only be executed once.
+    timer_id_t schedule(cpu_clock_t::interval_t delay, function<void()> f);
+
+    // Reschedules the given timer with a new delay. Returns the same
+    // 'timer_id'.
+    timer_id_t reschedule(
+        timer_id_t timer_id, cpu_clock_t::interval_t new_delay
+    );
+
+    // Unschedules a timer by the identifier that has been returned by the
+    // 'schedule()' call.
+    //
+    // Returns 'true' if the timer has been removed, 'false' if it was not
+    // found.
+    bool remove(timer_id_t timer_id);
+
+    // Returns the number of scheduled timers.
+    inline size_t size(void) const
+    {
+        return n_timers;
+    }
+
+private:
+    // Returns the tick on which a timer with the given delay expires.
+    inline uint64_t _expire_tick(cpu_clock_t::interval_t delay) const;
+
+    // Inserts the node in the slot corresponding to its expiration tick,
+    // relative to 'current'.
+    void _place(node_t *node);
+
+    // Removes the node from the slot it is in.
+    inline void _unlink(node_t *node);
+
+    // Moves the timers of the higher levels which will expire during the
+    // next N_SLOTS ticks to the lower levels.
+    void _cascade(void);
+
+    // Returns 'true' if the identifier refers to a scheduled timer.
+    inline bool _is_scheduled(timer_id_t timer_id) const;
+
+    // Takes a node from the pool. Allocates a new chunk of nodes if the pool
+    // is empty.
+    node_t *_alloc_node(void);
+
+    // Returns the node to the pool.
+    void _free_node(node_t *node);
+};
+
+template <typename alloc_t>
+wheel_timer_manager_t<alloc_t>::wheel_timer_manager_t(alloc_t _alloc)
+    : node_alloc(_alloc), chunks(_alloc), free_nodes(nullptr),
+      current(cpu_clock_t::time_t::now().cycles >> TICK_SHIFT), n_timers(0)
+{
+    for (unsigned int level = 0; level < N_LEVELS; level++) {
+        for (link_t &slot : slots[level])
+            slot.init();
+
+        n_level_timers[level] = 0;
+    }
+}
+
+template <typename alloc_t>
+wheel_timer_manager_t<alloc_t>::~wheel_timer_manager_t(void)
+{
+    for (node_t *chunk : chunks) {
+        for (size_t i = 0; i < NODES_PER_CHUNK; i++)
+            node_alloc.destroy(&chunk[i]);
+
+        node_alloc.deallocate(chunk, NODES_PER_CHUNK);
+    }
+}
+
+template <typename alloc_t>
+void wheel_timer_manager_t<alloc_t>::tick(void)
+{
+    uint64_t target = cpu_clock_t::time_t::now().cycles >> TICK_SHIFT;
+
+    if (LIKELY(n_timers == 0)) {
+        current = target;
+        return;
+    }
+
+    while (current < target) {
+        if (n_level_timers[0] == 0) {
+            // No timer can expire before the next cascade of the lowest
+            // non-empty level. Directly jumps to the tick preceding it.
+
+            unsigned int level = 1;
+            while (level < N_LEVELS - 1 && n_level_timers[level] == 0)
+                level++;
+
+            uint64_t skip_to = current
+                             | (((uint64_t) 1 << (LEVEL_BITS * level)) - 1);
+
+            if (skip_to >= target) {
+                current = target;
+                break;
+            }
+
+            current = skip_to;
+        }
+
+        current++;
+
+        if (UNLIKELY((current & SLOT_MASK) == 0))
+            _cascade();
+
+        link_t *slot = &slots[0][current & SLOT_MASK];
+
+        if (LIKELY(slot->empty()))
+            continue;
+
+        // Detaches the slot before executing the timers as some callbacks
+        // could make calls to 'schedule()' or 'remove()'. Removing a timer of
+        // the detached list is safe as its node is unlinked from it.
+
+        link_t expired;
+        expired.init();
+        slot->move_to(&expired);
+
+        while (!expired.empty()) {
+            node_t *node = static_cast<node_t *>(expired.next);
+
+            assert(node->expire == current);
+
+            DRIVER_DEBUG("Executes timer %p", node);
+
+            function<void()> f = move(node->f);
+
+            _unlink(node);
+            _free_node(node);
+
+            f(); // Could modify the content of 'expired'.
+        }
+    }
+}
+
+template <typename alloc_t>
+typename wheel_timer_manager_t<alloc_t>::timer_id_t
+wheel_timer_manager_t<alloc_t>::schedule(
+    cpu_clock_t::interval_t delay, function<void()> f
+)
+{
+    node_t *node = _alloc_node();
+
+    node->expire        = _expire_tick(delay);
+    node->is_scheduled  = true;
+    node->f             = move(f);
+
+    _place(node);
+    n_timers++;
+
+    DRIVER_DEBUG(
+        "Schedules timer %p with a %" PRIu64 " µs delay", node,
+        delay.microsec()
+    );
+
+    return timer_id_t(node);
+}
+
+template <typename alloc_t>
+typename wheel_timer_manager_t<alloc_t>::timer_id_t
+wheel_timer_manager_t<alloc_t>::reschedule(
+    timer_id_t timer_id, cpu_clock_t::interval_t new_delay
+)
+{
+    assert(_is_scheduled(timer_id));
+
+    node_t *node = timer_id.node;
+
+    _unlink(node);
+    node->expire = _expire_tick(new_delay);
+    _place(node);
+
+    DRIVER_DEBUG(
+        "Reschedules timer %p with a %" PRIu64 " µs delay", node,
+        new_delay.microsec()
+    );
+
+    return timer_id;
+}
+
+template <typename alloc_t>
+bool wheel_timer_manager_t<alloc_t>::remove(timer_id_t timer_id)
+{
+    DRIVER_DEBUG("Unschedules timer %p", timer_id.node);
+
+    if (!_is_scheduled(timer_id))
+        return false;
+
+    node_t *node = timer_id.node;
+
+    _unlink(node);
+    _free_node(node);
+
+    return true;
+}
+
+template <typename alloc_t>
+inline uint64_t wheel_timer_manager_t<alloc_t>::_expire_tick(
+    cpu_clock_t::interval_t delay
+) const
+{
+    static const uint64_t TICK_CYCLES = (uint64_t) 1 << TICK_SHIFT;
+
+    cpu_clock_t::time_t expire = cpu_clock_t::time_t::now() + delay;
+
+    // Rounds up to never execute a timer before its expiration. The current
+    // tick has already been processed, the timer can't expire before the next
+    // one.
+    uint64_t expire_tick = (expire.cycles + TICK_CYCLES - 1) >> TICK_SHIFT;
+    return max(expire_tick, current + 1);
+}
+
+template <typename alloc_t>
+void wheel_timer_manager_t<alloc_t>::_place(node_t *node)
+{
+    assert(node->expire >= current);
+
+    uint64_t delta = node->expire - current;
+
+    unsigned int level = 0;
+    while (
+        level < N_LEVELS - 1 && delta >= (uint64_t) 1 << (LEVEL_BITS * (level + 1))
+    )
+        level++;
+
+    uint64_t slot = (node->expire >> (LEVEL_BITS * level)) & SLOT_MASK;
+
+    slots[level][slot].push(node);
+
+    node->level = level;
+    n_level_timers[level]++;
+}
+
+template <typename alloc_t>
+inline void wheel_timer_manager_t<alloc_t>::_unlink(node_t *node)
+{
+    node->unlink();
+    n_level_timers[node->level]--;
+}
+
+template <typename alloc_t>
+void wheel_timer_manager_t<alloc_t>::_cascade(void)
+{
+    // Finds the highest level which must be cascaded. Cascades higher levels
+    // first as their timers could be moved in slots of lower levels which
+    // also need to be cascaded during this tick.
+
+    unsigned int top_level = 1;
+    while (
+        top_level < N_LEVELS - 1
+        && ((current >> (LEVEL_BITS * top_level)) & SLOT_MASK) == 0
+    )
+        top_level++;
+
+    for (unsigned int level = top_level; level > 0; level--) {
+        uint64_t slot = (current >> (LEVEL_BITS * level)) & SLOT_MASK;
+
+        link_t nodes;
+        nodes.init();
+        slots[level][slot].move_to(&nodes);
+
+        while (!nodes.empty()) {
+            node_t *node = static_cast<node_t *>(nodes.next);
+            _unlink(node);
+            _place(node);
+        }
+    }
+}
+
+template <typename alloc_t>
+inline bool wheel_timer_manager_t<alloc_t>::_is_scheduled(
+    timer_id_t timer_id
+) const
+{
+    return timer_id.node != nullptr
+        && timer_id.node->is_scheduled
+        && timer_id.node->generation == timer_id.generation;
+}
+
+template <typename alloc_t>
+typename wheel_timer_manager_t<alloc_t>::node_t *
+wheel_timer_manager_t<alloc_t>::_alloc_node(void)
+{
+    if (UNLIKELY(free_nodes == nullptr)) {
+        node_t *chunk = node_alloc.allocate(NODES_PER_CHUNK);
+        chunks.push_back(chunk);
+
+        for (size_t i = 0; i < NODES_PER_CHUNK; i++) {
+            node_alloc.construct(&chunk[i]);
+            chunk[i].generation     = 0;
+            chunk[i].is_scheduled   = false;
+
+            chunk[i].next = free_nodes;
+            free_nodes = &chunk[i];
+        }
+    }
+
+    node_t *node = free_nodes;
+    free_nodes = static_cast<node_t *>(node->next);
+
+    return node;
+}
+
+template <typename alloc_t>
+void wheel_timer_manager_t<alloc_t>::_free_node(node_t *node)
+{
+    assert(node->is_scheduled);
+
+    node->is_scheduled = false;
+    node->generation++;
+    node->f = nullptr; // Releases the resources of the callback.
+
+    node->next = free_nodes;
+    free_nodes = node;
+
+    n_timers--;
+}
+
+} } /* namespace rusty::driver */
+
+#endif /* __RUSTY_DRIVER_TIMER_WHEEL_HPP__ */
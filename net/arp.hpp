@@ -114,13 +114,22 @@ struct arp_t {
     // Callback used in the call of 'with_data_link_addr()'.
     typedef function<void(const net_t<data_link_addr_t> *)> callback_t;
 
+    // Function called when a mapping is learned from a received ARP message.
+    typedef function<void(net_t<data_link_addr_t>, net_t<proto_addr_t>)>
+                                                    update_handler_t;
+
     struct pending_entry_t {
         vector<callback_t, alloc_t> callbacks;
 
-        // Timer which triggers the expiration of resolution.
+        // Timer which triggers the retransmission of the request or the
+        // expiration of the resolution.
         timer_id_t                  timer;
 
-        pending_entry_t(alloc_t _alloc = alloc_t()) : callbacks(_alloc)
+        // Number of requests broadcasted for this address.
+        size_t                      n_requests;
+
+        pending_entry_t(alloc_t _alloc = alloc_t())
+            : callbacks(_alloc), n_requests(1)
         {
         }
     };
@@ -143,9 +152,20 @@ struct arp_t {
     // Delay in microseconds (10^-6) before an ARP table entry will be removed.
     static const typename clock_t::interval_t   ENTRY_TIMEOUT;
 
-    // Delay in microseconds (10^-6) to wait for an ARP resolution response.
+    // Delay in microseconds (10^-6) to wait for an ARP resolution response
+    // before retransmitting the request.
     static const typename clock_t::interval_t   REQUEST_TIMEOUT;
 
+    // Number of requests broadcasted for an address before it's considered as
+    // unreachable.
+    static constexpr size_t                     MAX_REQUESTS            = 5;
+
+    // Maximum number of callbacks waiting for the resolution of a single
+    // address.
+    //
+    // Bounds the memory used by the packets which wait for a resolution.
+    static constexpr size_t                     MAX_PENDING_CALLBACKS   = 64;
+
     //
     // Fields
     //
@@ -178,6 +198,12 @@ struct arp_t {
     // addresses in 'addrs_cache'.
     pending_reqs_t          pending_reqs;
 
+    // Called when a mapping is added or refreshed by a received ARP message.
+    //
+    // Used by the physical layer to replicate the mapping to the ARP caches of
+    // the other workers, with 'apply_update()'. Can be empty.
+    update_handler_t        update_handler;
+
     //
     // Methods
     //
@@ -305,6 +331,7 @@ struct arp_t {
                 );
 
                 _cache_update(msg->sha, msg->spa);
+                _share_update(msg->sha, msg->spa);
 
                 if (msg->tpa == this->proto->addr) {
                     // Someone is asking for our Ethernet address.
@@ -321,6 +348,7 @@ struct arp_t {
                 );
 
                 _cache_update(msg->sha, msg->spa);
+                _share_update(msg->sha, msg->spa);
             } else
                 IGNORE_MSG("unknown ARP opcode (%hu)", msg->hdr.op.host());
         });
@@ -359,18 +387,32 @@ struct arp_t {
         );
     }
 
+    // Returns 'true' if the data-link address of the given protocol address is
+    // in the cache, i.e. if 'with_data_link_addr()' would immediately execute
+    // its callback.
+    inline bool has_data_link_addr(net_t<proto_addr_t> proto_addr) const
+    {
+        return this->addrs_cache.find(proto_addr) != this->addrs_cache.end();
+    }
+
     // Executes the given callback function by giving the data-link address
     // corresponding to the given protocol address address.
     //
     // The callback will receive a 'nullptr' as 'data_link_addr_t' if the
-    // address is unreachable.
+    // address is unreachable (no reply after MAX_REQUESTS requests), or if
+    // there is already MAX_PENDING_CALLBACKS callbacks waiting for the
+    // address.
     //
     // The callback will immediately be executed if the mapping is in the cache
     // (addrs_cache) but could be delayed if an ARP transaction is required.
     //
-    // Returns 'true' if the address was in the ARP cache and the callback has
-    // been executed, or 'false' if the callback execution has been delayed
-    // because of an unknown protocol address.
+    // Returns 'true' if the callback has been executed, or 'false' if the
+    // callback execution has been delayed because of an unknown protocol
+    // address.
+    //
+    // 'callback' is any callable accepting a 'const net_t<data_link_addr_t> *'.
+    // It's only converted to a 'callback_t' (which could allocate memory) when
+    // its execution is delayed.
     //
     // Example with ARP for IPv4 over Ethernet:
     //
@@ -381,21 +423,17 @@ struct arp_t {
     //          );
     //      });
     //
-    bool with_data_link_addr(
-        net_t<proto_addr_t> proto_addr, callback_t callback
-    )
+    //
+    // The ARP environment is only used by the worker which owns it. Each worker
+    // has its own cache, which doesn't require any lock.
+    template <typename F>
+    bool with_data_link_addr(net_t<proto_addr_t> proto_addr, F callback)
     {
-        // NOTE: this procedure should require an exclusive lock for addrs_cache
-        // and pending_reqs in case of multiple threads executing it.
-
-        // lock
-
         auto it_cache = this->addrs_cache.find(proto_addr);
 
-        if (it_cache != this->addrs_cache.end()) {
+        if (LIKELY(it_cache != this->addrs_cache.end())) {
             // Hardware address is cached.
 
-            // unlock
             callback(&it_cache->second.addr);
             return true;
         } else {
@@ -409,11 +447,23 @@ struct arp_t {
                 // The pending request entry already existed. A request has
                 // already been broadcasted for this protocol address.
                 //
-                // Simply adds the callback to the vector.
-
-                it_pending->second.callbacks.push_back(callback);
+                // Simply adds the callback to the vector, if there is still
+                // some room.
+
+                pending_entry_t *entry = &it_pending->second;
+
+                if (
+                    UNLIKELY(entry->callbacks.size() >= MAX_PENDING_CALLBACKS)
+                ) {
+                    ARP_ERROR(
+                        "Too many packets waiting for %s",
+                        proto_t::addr_t::to_alpha(proto_addr)
+                    );
+                    callback(nullptr);
+                    return true;
+                }
 
-                // unlock
+                entry->callbacks.emplace_back(move(callback));
             } else {
                 // No previous pending request entry.
                 //
@@ -428,16 +478,14 @@ struct arp_t {
                 assert(p.second); // Emplace succeed.
                 pending_entry_t *entry = &p.first->second;
 
-                entry->callbacks.push_back(callback);
+                entry->callbacks.emplace_back(move(callback));
 
                 entry->timer = timers->schedule(
                     REQUEST_TIMEOUT, [this, proto_addr]() {
-                        this->_remove_pending_request(proto_addr);
+                        this->_request_timeout(proto_addr);
                     }
                 );
 
-                // unlock
-
                 this->send_message(
                     ARPOP_REQUEST_NET, data_link_t::BROADCAST_ADDR, proto_addr
                 );
@@ -447,6 +495,18 @@ struct arp_t {
         }
     }
 
+    // Adds or refreshes a mapping learned by the ARP environment of another
+    // worker.
+    //
+    // Executes the callbacks waiting for this address, if any. Doesn't call
+    // 'update_handler'.
+    void apply_update(
+        net_t<data_link_addr_t> data_link_addr, net_t<proto_addr_t> proto_addr
+    )
+    {
+        _cache_update(data_link_addr, proto_addr);
+    }
+
 private:
 
     void _insert_static_entries(vector<static_entry_t> static_entries)
@@ -460,15 +520,54 @@ private:
         }
     }
 
-    // Removes a pending entry for the given protocol address.
+    // Retransmits the request for the given protocol address, or removes the
+    // pending entry and executes its callbacks with 'nullptr' once
+    // MAX_REQUESTS requests have been broadcasted.
     //
-    // Doesn't unschedule the timer.
-    void _remove_pending_request(net_t<proto_addr_t> addr)
+    // Called when the timer of the pending entry expires.
+    void _request_timeout(net_t<proto_addr_t> addr)
     {
+        auto it = this->pending_reqs.find(addr);
+        assert(it != this->pending_reqs.end());
+
+        pending_entry_t *entry = &it->second;
+
+        if (entry->n_requests < MAX_REQUESTS) {
+            entry->n_requests++;
+
+            entry->timer = timers->schedule(
+                REQUEST_TIMEOUT, [this, addr]() {
+                    this->_request_timeout(addr);
+                }
+            );
+
+            this->send_message(
+                ARPOP_REQUEST_NET, data_link_t::BROADCAST_ADDR, addr
+            );
+
+            return;
+        }
+
         ARP_DEBUG(
             "Removes pending request for %s", proto_t::addr_t::to_alpha(addr)
         );
-        this->pending_reqs.erase(addr);
+
+        // Callbacks could send new requests for the same address.
+        vector<callback_t, alloc_t> callbacks = move(entry->callbacks);
+        this->pending_reqs.erase(it);
+
+        for (callback_t& callback : callbacks)
+            callback(nullptr);
+    }
+
+    // Gives a mapping learned from a received ARP message to
+    // 'update_handler'.
+    void _share_update(
+        net_t<data_link_addr_t> data_link_addr, net_t<proto_addr_t> proto_addr
+    )
+    {
+        if (update_handler)
+            update_handler(data_link_addr, proto_addr);
     }
 
     // Adds the given protocol to data-link layer address mapping in the cache
@@ -480,11 +579,6 @@ private:
         net_t<data_link_addr_t> data_link_addr, net_t<proto_addr_t> proto_addr
     )
     {
-        // NOTE: this procedure should require an exclusive lock for addrs_cache
-        // and pending_reqs in case of multiple threads executing it.
-
-        // lock
-
         // Schedules a timer to remove the entry after ENTRY_TIMEOUT.
         timer_id_t timer_id = timers->schedule(
             ENTRY_TIMEOUT, [this, proto_addr]()
@@ -519,8 +613,6 @@ private:
 
             timers->remove(inserted_entry->timer);
             inserted_entry->timer = timer_id;
-
-            // unlock
         } else {
             // The address was not in cache. Checks for pending requests.
 
@@ -541,17 +633,15 @@ private:
                 timers->remove(pending_entry->timer);
 
                 // As it's possible that one of these callbacks induce a new
-                // lookup to the ARP cache for the same address, and thus a
-                // deadlock, we must first remove the pending requests entry and
-                // free the lock before calling any callback.
+                // lookup to the ARP cache for the same address, we must first
+                // remove the pending requests entry before calling any
+                // callback.
 
                 vector<callback_t, alloc_t> callbacks = move(
                     pending_entry->callbacks
                 );
                 this->pending_reqs.erase(it);
 
-                // unlock
-
                 ARP_DEBUG(
                     "Executes %d pending callbacks for %s",
                     (int) callbacks.size(),
@@ -562,12 +652,6 @@ private:
 
                 for (callback_t& callback : callbacks)
                     callback(&data_link_addr);
-            } else {
-                // No pending request.
-                //
-                // Occurs when the addres has not been requested.
-
-                // unlock
             }
         }
     }
@@ -623,7 +707,7 @@ arp_t<data_link_t, proto_t, alloc_t>::ENTRY_TIMEOUT(3600L * 1000000L);
 
 template <typename data_link_t, typename proto_t, typename alloc_t>
 const typename arp_t<data_link_t, proto_t, alloc_t>::clock_t::interval_t
-arp_t<data_link_t, proto_t, alloc_t>::REQUEST_TIMEOUT(5L * 1000000L);
+arp_t<data_link_t, proto_t, alloc_t>::REQUEST_TIMEOUT(1L * 1000000L);
 
 } } /* namespace rusty::net */
 
@@ -18,16 +18,32 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 //
 
+#include <algorithm>        // min()
 #include <cassert>
 #include <cstdint>
+#include <cstdio>           // fopen(), fwrite(), rename()
 #include <cstring>
+#include <string>
 
 #include <endian.h>         // __BIG_ENDIAN, __BYTE_ORDER, __LITTLE_ENDIAN
+#include <fcntl.h>          // open()
+#include <sys/mman.h>       // mmap(), munmap()
+#include <sys/stat.h>       // fstat()
+#include <unistd.h>         // close(), unlink()
 
 #include "net/endian.hpp"   // net_t, to_host(), to_network()
 
 #include "net/checksum.hpp"
 
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+    #include <immintrin.h>
+
+    // The AVX2 kernel is selected at runtime, if the CPU supports it.
+    #define _CHECKSUM_AVX2
+#elif defined(__ARM_NEON)
+    #include <arm_neon.h>
+#endif
+
 namespace rusty {
 namespace net {
 
@@ -35,14 +51,726 @@ const partial_sum_t partial_sum_t::ZERO = partial_sum_t();
 
 const checksum_t    checksum_t::ZERO    = checksum_t();
 
-#ifndef NDEBUG
-    // Reference implementation of the ones's complement sum.
-    //
-    // Only used for debugging.
-    static uint16_t _ones_complement_sum_naive(const void *data, size_t size);
-#endif /* NDEBUG */
+// Buffers up to this size (IPv4 and TCP headers, with their options) are summed
+// with the original 32 bits kernel, which has the smallest setup and reduction
+// costs. The 64 bits kernel only becomes faster for larger buffers.
+static constexpr size_t HEADER_MAX_SIZE = 64;
+
+// Buffers smaller than this are summed with the scalar 64 bits kernel, as SIMD
+// kernels only become faster once their setup and reduction costs are
+// amortized.
+static constexpr size_t SIMD_MIN_SIZE = 128;
+
+static uint16_t _ones_complement_sum_32(const void *data, size_t size);
+static uint16_t _ones_complement_sum_64(const void *data, size_t size);
+
+#ifdef __tilegx__
+    static uint16_t _ones_complement_sum_tilegx(const void *data, size_t size);
+#endif /* __tilegx__ */
+
+#ifdef __SSE2__
+    static uint16_t _ones_complement_sum_sse2(const void *data, size_t size);
+#endif /* __SSE2__ */
+
+#ifdef _CHECKSUM_AVX2
+    static uint16_t _ones_complement_sum_avx2(const void *data, size_t size);
+#endif /* _CHECKSUM_AVX2 */
+
+#ifdef __ARM_NEON
+    static uint16_t _ones_complement_sum_neon(const void *data, size_t size);
+#endif /* __ARM_NEON */
+
+#ifdef _CHECKSUM_AVX2
+    // The AVX2 kernel is only used if the CPU supports it. The pointer is
+    // replaced by the selected kernel on the first call.
+
+    static uint16_t _ones_complement_sum_resolve(const void *data, size_t size);
+
+    static uint16_t (*_ones_complement_sum_simd)(const void *, size_t)
+        = _ones_complement_sum_resolve;
+
+    static uint16_t _ones_complement_sum_resolve(const void *data, size_t size)
+    {
+        __builtin_cpu_init();
+
+        if (__builtin_cpu_supports("avx2"))
+            _ones_complement_sum_simd = _ones_complement_sum_avx2;
+        else
+            _ones_complement_sum_simd = _ones_complement_sum_sse2;
+
+        return _ones_complement_sum_simd(data, size);
+    }
+#elif defined(__SSE2__)
+    #define _ones_complement_sum_simd _ones_complement_sum_sse2
+#elif defined(__ARM_NEON)
+    #define _ones_complement_sum_simd _ones_complement_sum_neon
+#else
+    #define _ones_complement_sum_simd _ones_complement_sum_64
+#endif
 
 uint16_t _ones_complement_sum(const void *data, size_t size)
+{
+    assert(data != nullptr);
+
+    uint16_t ret;
+
+    #ifdef __tilegx__
+        // The TILE-Gx kernel does not require any setup and is always faster.
+        ret = _ones_complement_sum_tilegx(data, size);
+    #else
+        if (size <= HEADER_MAX_SIZE)
+            ret = _ones_complement_sum_32(data, size);
+        else if (size < SIMD_MIN_SIZE)
+            ret = _ones_complement_sum_64(data, size);
+        else
+            ret = _ones_complement_sum_simd(data, size);
+    #endif /* __tilegx__ */
+
+    assert(ret == _ones_complement_sum_naive(data, size));
+
+    return ret;
+}
+
+const checksum_kernel_t *_checksum_kernels(void)
+{
+    static const size_t MAX_KERNELS = 8;
+
+    static checksum_kernel_t kernels[MAX_KERNELS];
+
+    static bool initialized = [](void)
+    {
+        size_t i = 0;
+
+        kernels[i++] = { "naive",   _ones_complement_sum_naive };
+        kernels[i++] = { "word32",  _ones_complement_sum_32 };
+        kernels[i++] = { "word64",  _ones_complement_sum_64 };
+
+        #ifdef __tilegx__
+            kernels[i++] = { "tilegx",  _ones_complement_sum_tilegx };
+        #endif /* __tilegx__ */
+
+        #ifdef __SSE2__
+            kernels[i++] = { "sse2",    _ones_complement_sum_sse2 };
+        #endif /* __SSE2__ */
+
+        #ifdef _CHECKSUM_AVX2
+            __builtin_cpu_init();
+
+            if (__builtin_cpu_supports("avx2"))
+                kernels[i++] = { "avx2",    _ones_complement_sum_avx2 };
+        #endif /* _CHECKSUM_AVX2 */
+
+        #ifdef __ARM_NEON
+            kernels[i++] = { "neon",    _ones_complement_sum_neon };
+        #endif /* __ARM_NEON */
+
+        kernels[i++] = { "default", _ones_complement_sum };
+
+        assert(i < MAX_KERNELS);
+        kernels[i] = { nullptr, nullptr };
+
+        return true;
+    }();
+
+    (void) initialized;
+
+    return kernels;
+}
+
+//
+// Kernels
+//
+
+// Adds two 16 bits ones' complement sums.
+static inline uint16_t _ones_complement_add(uint16_t a, uint16_t b)
+{
+    uint32_t sum = (uint32_t) a + (uint32_t) b;
+    return (uint16_t) ((sum >> 16) + (sum & 0xFFFF));
+}
+
+// Folds a 64 bits accumulator of 16 bits words into a 16 bits ones' complement
+// sum.
+static inline uint16_t _fold64(uint64_t sum)
+{
+    sum = (sum >> 32) + (sum & 0xFFFFFFFF);
+
+    do
+        sum = (sum >> 16) + (sum & 0xFFFF);
+    while (sum >> 16);
+
+    return (uint16_t) sum;
+}
+
+// Loads the 64 bits word at the given aligned address, but zeroes the 'before'
+// first bytes and the 'after' last bytes of the word.
+//
+// Used to load the first and the last words of a buffer which is not aligned on
+// 64 bits. This should be safe as memory pages are aligned on 64 bits.
+static inline uint64_t _masked_word64(
+    const uint64_t *word, size_t before, size_t after
+)
+{
+    assert(before < sizeof (uint64_t) && after < sizeof (uint64_t));
+
+    #if __BYTE_ORDER == __LITTLE_ENDIAN
+        uint64_t mask =   (0xFFFFFFFFFFFFFFFF << (before * 8))
+                        & (0xFFFFFFFFFFFFFFFF >> (after * 8));
+    #elif __BYTE_ORDER == __BIG_ENDIAN
+        uint64_t mask =   (0xFFFFFFFFFFFFFFFF >> (before * 8))
+                        & (0xFFFFFFFFFFFFFFFF << (after * 8));
+    #else
+        #error "Please set __BYTE_ORDER in <bits/endian.h>"
+    #endif
+
+    return *word & mask;
+}
+
+// Sums the buffer 64 bits at a time with the given accumulator type, four words
+// per iteration.
+//
+// 'acc_t' must provide 'add(uint64_t)', 'add4(uint64_t, uint64_t, uint64_t,
+// uint64_t)' and 'fold()' which returns the 16 bits ones' complement sum of the
+// accumulated words.
+//
+// Words are loaded from aligned addresses. As with '_ones_complement_sum_32()',
+// the sum must be byte-swapped if the buffer starts on an odd address.
+template <typename acc_t>
+static inline uint16_t _ones_complement_sum_words64(
+    const void *data, size_t size
+)
+{
+    acc_t           acc;
+    const uint64_t  *data64     = (const uint64_t *) ((intptr_t) data & ~0x7);
+    size_t          remaining   = size;
+
+    // Processes the first bytes not aligned on 64 bits.
+    size_t unaligned_offset = (intptr_t) data & 0x7;
+    if (unaligned_offset) {
+        size_t unaligned_bytes  = sizeof (uint64_t) - unaligned_offset,
+               mask_right       = 0;
+
+        if (unaligned_bytes > remaining) {
+            mask_right      = unaligned_bytes - remaining;
+            unaligned_bytes = remaining;
+        }
+
+        acc.add(_masked_word64(data64, unaligned_offset, mask_right));
+        remaining -= unaligned_bytes;
+        data64++;
+    }
+
+    while (remaining >= 4 * sizeof (uint64_t)) {
+        acc.add4(data64[0], data64[1], data64[2], data64[3]);
+        remaining -= 4 * sizeof (uint64_t);
+        data64 += 4;
+    }
+
+    while (remaining >= sizeof (uint64_t)) {
+        acc.add(*data64);
+        remaining -= sizeof (uint64_t);
+        data64++;
+    }
+
+    // Sums the last bytes which could not fully fit a 64 bits integer.
+    if (remaining > 0)
+        acc.add(_masked_word64(data64, 0, sizeof (uint64_t) - remaining));
+
+    uint16_t sum = acc.fold();
+
+    if ((intptr_t) data & 0x1)
+        return _swap_bytes(sum);
+    else
+        return sum;
+}
+
+// Accumulates 64 bits words in four independent 64 bits sums, and counts their
+// carry bits separately.
+//
+// As 2^64 = 1 (mod 2^16 - 1), each carry bit is worth one when folding the sums
+// to 16 bits.
+struct _carry_acc_t {
+    uint64_t    sums[4]     = { 0, 0, 0, 0 };
+    uint64_t    carries[4]  = { 0, 0, 0, 0 };
+
+    inline void add(uint64_t word)
+    {
+        _add(0, word);
+    }
+
+    inline void add4(uint64_t a, uint64_t b, uint64_t c, uint64_t d)
+    {
+        _add(0, a);
+        _add(1, b);
+        _add(2, c);
+        _add(3, d);
+    }
+
+    inline uint16_t fold(void) const
+    {
+        uint64_t sum = 0, carries = 0;
+
+        for (size_t i = 0; i < 4; i++) {
+            sum     += sums[i];
+            carries += (sum < sums[i]) + this->carries[i];
+        }
+
+        sum += carries;
+        sum += sum < carries;
+
+        return _fold64(sum);
+    }
+
+private:
+    inline void _add(size_t i, uint64_t word)
+    {
+        sums[i]     += word;
+        carries[i]  += sums[i] < word;
+    }
+};
+
+static uint16_t _ones_complement_sum_64(const void *data, size_t size)
+{
+    return _ones_complement_sum_words64<_carry_acc_t>(data, size);
+}
+
+#ifdef __tilegx__
+    // Accumulates the four 16 bits words of each 64 bits word with the
+    // 'v2sadau' instruction (sum of the absolute differences of the 16 bits
+    // lanes, here with zero), which never produces any carry bit.
+    struct _v2sadau_acc_t {
+        uint64_t    sums[4]     = { 0, 0, 0, 0 };
+
+        inline void add(uint64_t word)
+        {
+            sums[0] = __insn_v2sadau(sums[0], word, 0);
+        }
+
+        inline void add4(uint64_t a, uint64_t b, uint64_t c, uint64_t d)
+        {
+            sums[0] = __insn_v2sadau(sums[0], a, 0);
+            sums[1] = __insn_v2sadau(sums[1], b, 0);
+            sums[2] = __insn_v2sadau(sums[2], c, 0);
+            sums[3] = __insn_v2sadau(sums[3], d, 0);
+        }
+
+        inline uint16_t fold(void) const
+        {
+            return _fold64(sums[0] + sums[1] + sums[2] + sums[3]);
+        }
+    };
+
+    static uint16_t _ones_complement_sum_tilegx(const void *data, size_t size)
+    {
+        return _ones_complement_sum_words64<_v2sadau_acc_t>(data, size);
+    }
+#endif /* __tilegx__ */
+
+// SIMD kernels use unaligned loads and zero-extend every 32 bits word of a
+// vector into a 64 bits lane, so lanes accumulate carry bits as in
+// '_ones_complement_sum_32()'. They do not overflow for buffers smaller than
+// 4 GB.
+//
+// As they load words from the first byte of the buffer, their sum never needs
+// to be byte-swapped. The last bytes which do not fill a vector are summed with
+// '_ones_complement_sum_64()'. They start at the same byte parity as the buffer
+// so both sums can be added.
+
+#ifdef __SSE2__
+    static uint16_t _ones_complement_sum_sse2(const void *data, size_t size)
+    {
+        const __m128i   zero        = _mm_setzero_si128();
+        __m128i         acc0        = zero,
+                        acc1        = zero;
+
+        const char      *p          = (const char *) data;
+        size_t          remaining   = size;
+
+        while (remaining >= 2 * sizeof (__m128i)) {
+            __m128i a = _mm_loadu_si128((const __m128i *) p),
+                    b = _mm_loadu_si128((const __m128i *) p + 1);
+
+            acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(a, zero));
+            acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(a, zero));
+            acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(b, zero));
+            acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(b, zero));
+
+            remaining -= 2 * sizeof (__m128i);
+            p += 2 * sizeof (__m128i);
+        }
+
+        uint64_t lanes[2];
+        _mm_storeu_si128((__m128i *) lanes, _mm_add_epi64(acc0, acc1));
+
+        return _ones_complement_add(
+            _fold64(lanes[0] + lanes[1]), _ones_complement_sum_64(p, remaining)
+        );
+    }
+#endif /* __SSE2__ */
+
+#ifdef _CHECKSUM_AVX2
+    __attribute__ ((target ("avx2")))
+    static uint16_t _ones_complement_sum_avx2(const void *data, size_t size)
+    {
+        const __m256i   zero        = _mm256_setzero_si256();
+        __m256i         acc0        = zero,
+                        acc1        = zero;
+
+        const char      *p          = (const char *) data;
+        size_t          remaining   = size;
+
+        while (remaining >= 2 * sizeof (__m256i)) {
+            __m256i a = _mm256_loadu_si256((const __m256i *) p),
+                    b = _mm256_loadu_si256((const __m256i *) p + 1);
+
+            acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(a, zero));
+            acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(a, zero));
+            acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(b, zero));
+            acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(b, zero));
+
+            remaining -= 2 * sizeof (__m256i);
+            p += 2 * sizeof (__m256i);
+        }
+
+        uint64_t lanes[4];
+        _mm256_storeu_si256((__m256i *) lanes, _mm256_add_epi64(acc0, acc1));
+
+        // Avoids the penalty of the transition to the non-VEX code which
+        // follows (the compiler does not always insert it).
+        _mm256_zeroupper();
+
+        return _ones_complement_add(
+            _fold64(lanes[0] + lanes[1] + lanes[2] + lanes[3]),
+            _ones_complement_sum_64(p, remaining)
+        );
+    }
+#endif /* _CHECKSUM_AVX2 */
+
+#ifdef __ARM_NEON
+    static uint16_t _ones_complement_sum_neon(const void *data, size_t size)
+    {
+        // 'vpadalq_u32' adds pairs of adjacent 32 bits words to the 64 bits
+        // lanes of the accumulator.
+        uint64x2_t      acc0        = vdupq_n_u64(0),
+                        acc1        = vdupq_n_u64(0);
+
+        const uint8_t   *p          = (const uint8_t *) data;
+        size_t          remaining   = size;
+
+        while (remaining >= 2 * sizeof (uint32x4_t)) {
+            acc0 = vpadalq_u32(acc0, vreinterpretq_u32_u8(vld1q_u8(p)));
+            acc1 = vpadalq_u32(acc1, vreinterpretq_u32_u8(vld1q_u8(p + 16)));
+
+            remaining -= 2 * sizeof (uint32x4_t);
+            p += 2 * sizeof (uint32x4_t);
+        }
+
+        uint64x2_t acc = vaddq_u64(acc0, acc1);
+
+        return _ones_complement_add(
+            _fold64(vgetq_lane_u64(acc, 0) + vgetq_lane_u64(acc, 1)),
+            _ones_complement_sum_64(p, remaining)
+        );
+    }
+#endif /* __ARM_NEON */
+
+//
+// Copy and sum
+//
+
+// Buffers which are not copied and summed by words are copied and summed by
+// blocks of this size, so the summed bytes are still in the L1 cache.
+//
+// Must be even.
+static constexpr size_t COPY_BLOCK_SIZE = 2048;
+
+// Copies and sums the buffer 64 bits at a time, in a single pass.
+//
+// 'dst' and 'src' must have the same alignment on 64 bits.
+template <typename acc_t>
+static inline uint16_t _ones_complement_copy_and_sum_words64(
+    char *dst, const char *src, size_t size
+)
+{
+    assert(((intptr_t) dst & 0x7) == ((intptr_t) src & 0x7));
+
+    acc_t           acc;
+    const uint64_t  *src64      = (const uint64_t *) ((intptr_t) src & ~0x7);
+    size_t          remaining   = size;
+
+    size_t unaligned_offset = (intptr_t) src & 0x7;
+    if (unaligned_offset) {
+        size_t unaligned_bytes  = sizeof (uint64_t) - unaligned_offset,
+               mask_right       = 0;
+
+        if (unaligned_bytes > remaining) {
+            mask_right      = unaligned_bytes - remaining;
+            unaligned_bytes = remaining;
+        }
+
+        acc.add(_masked_word64(src64, unaligned_offset, mask_right));
+        memcpy(dst, src, unaligned_bytes);
+
+        remaining -= unaligned_bytes;
+        dst += unaligned_bytes;
+        src64++;
+    }
+
+    uint64_t *dst64 = (uint64_t *) dst;
+
+    while (remaining >= 4 * sizeof (uint64_t)) {
+        uint64_t a = src64[0], b = src64[1], c = src64[2], d = src64[3];
+
+        dst64[0] = a;
+        dst64[1] = b;
+        dst64[2] = c;
+        dst64[3] = d;
+
+        acc.add4(a, b, c, d);
+
+        remaining -= 4 * sizeof (uint64_t);
+        src64 += 4;
+        dst64 += 4;
+    }
+
+    while (remaining >= sizeof (uint64_t)) {
+        uint64_t word = *src64;
+
+        *dst64 = word;
+        acc.add(word);
+
+        remaining -= sizeof (uint64_t);
+        src64++;
+        dst64++;
+    }
+
+    if (remaining > 0) {
+        acc.add(_masked_word64(src64, 0, sizeof (uint64_t) - remaining));
+        memcpy(dst64, src64, remaining);
+    }
+
+    uint16_t sum = acc.fold();
+
+    if ((intptr_t) src & 0x1)
+        return _swap_bytes(sum);
+    else
+        return sum;
+}
+
+// SIMD kernels copy and sum the buffer in a single pass, with unaligned loads
+// and stores. They accumulate the words as the SIMD sum kernels.
+
+#ifdef __SSE2__
+    static uint16_t _ones_complement_copy_and_sum_sse2(
+        char *dst, const char *src, size_t size
+    )
+    {
+        const __m128i   zero        = _mm_setzero_si128();
+        __m128i         acc0        = zero,
+                        acc1        = zero;
+
+        size_t          remaining   = size;
+
+        while (remaining >= 2 * sizeof (__m128i)) {
+            __m128i a = _mm_loadu_si128((const __m128i *) src),
+                    b = _mm_loadu_si128((const __m128i *) src + 1);
+
+            _mm_storeu_si128((__m128i *) dst, a);
+            _mm_storeu_si128((__m128i *) dst + 1, b);
+
+            acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(a, zero));
+            acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(a, zero));
+            acc0 = _mm_add_epi64(acc0, _mm_unpacklo_epi32(b, zero));
+            acc1 = _mm_add_epi64(acc1, _mm_unpackhi_epi32(b, zero));
+
+            remaining -= 2 * sizeof (__m128i);
+            src += 2 * sizeof (__m128i);
+            dst += 2 * sizeof (__m128i);
+        }
+
+        memcpy(dst, src, remaining);
+
+        uint64_t lanes[2];
+        _mm_storeu_si128((__m128i *) lanes, _mm_add_epi64(acc0, acc1));
+
+        return _ones_complement_add(
+            _fold64(lanes[0] + lanes[1]),
+            _ones_complement_sum_64(src, remaining)
+        );
+    }
+#endif /* __SSE2__ */
+
+#ifdef _CHECKSUM_AVX2
+    __attribute__ ((target ("avx2")))
+    static uint16_t _ones_complement_copy_and_sum_avx2(
+        char *dst, const char *src, size_t size
+    )
+    {
+        const __m256i   zero        = _mm256_setzero_si256();
+        __m256i         acc0        = zero,
+                        acc1        = zero;
+
+        size_t          remaining   = size;
+
+        while (remaining >= 2 * sizeof (__m256i)) {
+            __m256i a = _mm256_loadu_si256((const __m256i *) src),
+                    b = _mm256_loadu_si256((const __m256i *) src + 1);
+
+            _mm256_storeu_si256((__m256i *) dst, a);
+            _mm256_storeu_si256((__m256i *) dst + 1, b);
+
+            acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(a, zero));
+            acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(a, zero));
+            acc0 = _mm256_add_epi64(acc0, _mm256_unpacklo_epi32(b, zero));
+            acc1 = _mm256_add_epi64(acc1, _mm256_unpackhi_epi32(b, zero));
+
+            remaining -= 2 * sizeof (__m256i);
+            src += 2 * sizeof (__m256i);
+            dst += 2 * sizeof (__m256i);
+        }
+
+        uint64_t lanes[4];
+        _mm256_storeu_si256((__m256i *) lanes, _mm256_add_epi64(acc0, acc1));
+
+        _mm256_zeroupper();
+
+        memcpy(dst, src, remaining);
+
+        return _ones_complement_add(
+            _fold64(lanes[0] + lanes[1] + lanes[2] + lanes[3]),
+            _ones_complement_sum_64(src, remaining)
+        );
+    }
+#endif /* _CHECKSUM_AVX2 */
+
+#ifdef __ARM_NEON
+    static uint16_t _ones_complement_copy_and_sum_neon(
+        char *dst, const char *src, size_t size
+    )
+    {
+        uint64x2_t      acc0        = vdupq_n_u64(0),
+                        acc1        = vdupq_n_u64(0);
+
+        size_t          remaining   = size;
+
+        while (remaining >= 2 * sizeof (uint32x4_t)) {
+            uint8x16_t a = vld1q_u8((const uint8_t *) src),
+                       b = vld1q_u8((const uint8_t *) src + 16);
+
+            vst1q_u8((uint8_t *) dst, a);
+            vst1q_u8((uint8_t *) dst + 16, b);
+
+            acc0 = vpadalq_u32(acc0, vreinterpretq_u32_u8(a));
+            acc1 = vpadalq_u32(acc1, vreinterpretq_u32_u8(b));
+
+            remaining -= 2 * sizeof (uint32x4_t);
+            src += 2 * sizeof (uint32x4_t);
+            dst += 2 * sizeof (uint32x4_t);
+        }
+
+        memcpy(dst, src, remaining);
+
+        uint64x2_t acc = vaddq_u64(acc0, acc1);
+
+        return _ones_complement_add(
+            _fold64(vgetq_lane_u64(acc, 0) + vgetq_lane_u64(acc, 1)),
+            _ones_complement_sum_64(src, remaining)
+        );
+    }
+#endif /* __ARM_NEON */
+
+#ifdef _CHECKSUM_AVX2
+    // The AVX2 kernel is selected on the first call, as for
+    // '_ones_complement_sum_simd'.
+
+    static uint16_t _ones_complement_copy_and_sum_resolve(
+        char *dst, const char *src, size_t size
+    );
+
+    static uint16_t (*_ones_complement_copy_and_sum_simd)(
+        char *, const char *, size_t
+    ) = _ones_complement_copy_and_sum_resolve;
+
+    static uint16_t _ones_complement_copy_and_sum_resolve(
+        char *dst, const char *src, size_t size
+    )
+    {
+        __builtin_cpu_init();
+
+        if (__builtin_cpu_supports("avx2")) {
+            _ones_complement_copy_and_sum_simd =
+                _ones_complement_copy_and_sum_avx2;
+        } else {
+            _ones_complement_copy_and_sum_simd =
+                _ones_complement_copy_and_sum_sse2;
+        }
+
+        return _ones_complement_copy_and_sum_simd(dst, src, size);
+    }
+#elif defined(__SSE2__)
+    #define _ones_complement_copy_and_sum_simd                                 \
+        _ones_complement_copy_and_sum_sse2
+#elif defined(__ARM_NEON)
+    #define _ones_complement_copy_and_sum_simd                                 \
+        _ones_complement_copy_and_sum_neon
+#endif
+
+uint16_t _ones_complement_copy_and_sum(
+    void *dst, const void *src, size_t size
+)
+{
+    assert(dst != nullptr && src != nullptr);
+
+    uint16_t ret;
+
+    #ifdef __tilegx__
+        if ((((intptr_t) dst ^ (intptr_t) src) & 0x7) == 0) {
+            ret = _ones_complement_copy_and_sum_words64<_v2sadau_acc_t>(
+                (char *) dst, (const char *) src, size
+            );
+
+            assert(ret == _ones_complement_sum_naive(dst, size));
+
+            return ret;
+        }
+    #elif defined(__SSE2__) || defined(__ARM_NEON)
+        if (size >= SIMD_MIN_SIZE) {
+            ret = _ones_complement_copy_and_sum_simd(
+                (char *) dst, (const char *) src, size
+            );
+
+            assert(ret == _ones_complement_sum_naive(dst, size));
+
+            return ret;
+        }
+    #endif /* __tilegx__ */
+
+    // Words can't be stored as they are loaded, or the buffer is too small for
+    // the SIMD kernels. Sums each copied block of the source while it is still
+    // cached.
+
+    char        *dst_char   = (char *) dst;
+    const char  *src_char   = (const char *) src;
+    size_t      remaining   = size;
+
+    ret = 0;
+    while (remaining > 0) {
+        size_t n = std::min(remaining, COPY_BLOCK_SIZE);
+
+        memcpy(dst_char, src_char, n);
+        ret = _ones_complement_add(ret, _ones_complement_sum(src_char, n));
+
+        dst_char    += n;
+        src_char    += n;
+        remaining   -= n;
+    }
+
+    assert(ret == _ones_complement_sum_naive(dst, size));
+
+    return ret;
+}
+
+// Original kernel, which sums the buffer 32 bits at a time.
+static uint16_t _ones_complement_sum_32(const void *data, size_t size)
 {
     // The 16 bits ones' complement sum is the ones' complement addition of
     // every pair of bytes. If there is an odd number of bytes, then a zero byte
@@ -178,68 +906,52 @@ uint16_t _ones_complement_sum(const void *data, size_t size)
     // [0, a] +' [b, c] +' ... instead of [a, b] +' [c, d] +' ...
     //
     // The correct sum can be obtained by swapping bytes.
-    uint16_t ret;
     if ((intptr_t) data & 0x1)
-        ret = _swap_bytes((uint16_t) sum);
+        return _swap_bytes((uint16_t) sum);
     else
-        ret = (uint16_t) sum;
-
-    assert(ret == _ones_complement_sum_naive(data, size));
-
-    return ret;
+        return (uint16_t) sum;
 }
 
+#ifndef NDEBUG
+    // Returns 'true' if the two sums are equal in ones' complement arithmetic,
+    // in which both 0x0000 and 0xFFFF are zero.
+    static inline bool _equivalent_sums(partial_sum_t a, partial_sum_t b)
+    {
+        return a.odd == b.odd && a.sum % 0xFFFF == b.sum % 0xFFFF;
+    }
+#endif /* NDEBUG */
+
 partial_sum_t precomputed_sums_t::sum(size_t begin, size_t end) const
 {
     assert(begin <= end);
     assert(end <= this->size);
 
-    // If the section starts at an odd index. Removes the odd byte.
-    size_t begin_div2 = begin / 2,
-           end_div2   = end   / 2;
-
-    // Substraction in ones's complement arithmetic is adding the negation.
-    uint32_t sum =   this->table[end_div2]
-                   + ((uint16_t) ~this->table[begin_div2]);
-
-    // Adds the included last byte of the first 16 bits word.
-    if (end & 0x1) {
-        #if __BYTE_ORDER == __LITTLE_ENDIAN
-            sum += ((const char *) this->data)[end - 1];
-        #elif __BYTE_ORDER == __BIG_ENDIAN
-            sum += ((const char *) this->data)[end - 1] << 8;
-        #else
-            #error "Please set __BYTE_ORDER in <bits/endian.h>"
-        #endif
-    }
+    const char *data = (const char *) this->data;
 
-    // Removes the non-included first byte.
-    if (begin & 0x1) {
-        #if __BYTE_ORDER == __LITTLE_ENDIAN
-            sum += (uint16_t) ~((const char *) this->data)[begin - 1];
-        #elif __BYTE_ORDER == __BIG_ENDIAN
-            sum += (uint16_t) ~((const char *) this->data)[begin - 1] << 8;
-        #else
-            #error "Please set __BYTE_ORDER in <bits/endian.h>"
-        #endif
+    // Full blocks of the section.
+    size_t first_block = (begin + BLOCK_SIZE - 1) / BLOCK_SIZE,
+           last_block  = end / BLOCK_SIZE;
 
-        // Removes the carry bit before swapping bytes.
-        do
-            sum = (sum >> 16) + (sum & 0xFFFF);
-        while (sum >> 16);
+    // Sections which don't contain a full block are directly summed.
+    if (first_block >= last_block)
+        return partial_sum_t(data + begin, end - begin);
 
-        sum = (uint32_t) _swap_bytes((uint16_t) sum);
-    }
-
-    do
-        sum = (sum >> 16) + (sum & 0xFFFF);
-    while (sum >> 16);
+    size_t head_end    = first_block * BLOCK_SIZE,
+           tail_begin  = last_block  * BLOCK_SIZE;
 
-    size_t size = end - begin;
+    // Substraction in ones's complement arithmetic is adding the negation.
+    uint32_t blocks_sum =   this->table[last_block]
+                          + ((uint16_t) ~this->table[first_block]);
+    blocks_sum = (blocks_sum >> 16) + (blocks_sum & 0xFFFF);
 
-    partial_sum_t ret = partial_sum_t((uint16_t) sum, size & 0x1);
+    // Blocks have an even size, only the head can change the parity of the
+    // sum.
+    partial_sum_t ret =
+        partial_sum_t(data + begin, head_end - begin)
+            .append(partial_sum_t((uint16_t) blocks_sum, false))
+            .append(partial_sum_t(data + tail_begin, end - tail_begin));
 
-    assert(ret == partial_sum_t((const char *) this->data + begin, size));
+    assert(_equivalent_sums(ret, partial_sum_t(data + begin, end - begin)));
 
     return ret;
 }
@@ -247,64 +959,205 @@ partial_sum_t precomputed_sums_t::sum(size_t begin, size_t end) const
 const uint16_t *
 precomputed_sums_t::_precompute_table(const void *_data, size_t _size)
 {
-    size_t size_table = _size / 2 + 1;
+    size_t size_table = table_size(_size);
 
     uint16_t *table = new uint16_t[size_table];
 
-    // Sums two bytes at a time.
-    const uint16_t *data16 = (const uint16_t *) _data;
+    const char *data = (const char *) _data;
 
     table[0] = 0;
     for (size_t i = 1; i < size_table; i++) {
-        // Sums pair of bytes in a 32 bits integer, so the carry bit will not be
-        // lost.
-        uint32_t sum = (uint32_t) table[i - 1] + (uint32_t) data16[i - 1];
+        table[i] = _ones_complement_add(
+            table[i - 1], _ones_complement_sum(data, BLOCK_SIZE)
+        );
+        data += BLOCK_SIZE;
+    }
+
+    assert(_equivalent_sums(
+        partial_sum_t(table[size_table - 1], false),
+        partial_sum_t(_data, (size_table - 1) * BLOCK_SIZE)
+    ));
+
+    return table;
+}
+
+//
+// Table files
+//
+
+// Header of the files in which tables are saved. Followed by the table.
+struct _table_file_header_t {
+    char        magic[8];
+
+    uint32_t    block_size;
+    uint32_t    reserved;
+
+    uint64_t    data_size;
+    uint64_t    version;
+};
+
+static const char TABLE_FILE_MAGIC[8] = { 'R', 'U', 'S', 'U', 'M', 'S', 0, 1 };
+
+// Maps the table saved in the given file, and sets 'mapping_size' to the size
+// of the mapping.
+//
+// Returns 'nullptr' if the file can't be mapped or if it has not been saved
+// for the same data size, block size and version.
+static const uint16_t *_map_table_file(
+    const char *path, size_t data_size, uint64_t version,
+    size_t size_table, size_t *mapping_size
+)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return nullptr;
+
+    size_t file_size = sizeof (_table_file_header_t)
+                     + size_table * sizeof (uint16_t);
 
-        // Reports the carrybit in the stored 16 bits sum.
-        table[i] = (uint16_t) ((sum >> 16) + (sum & 0xFFFF));
+    struct stat stat_buffer;
+    if (
+           fstat(fd, &stat_buffer) != 0
+        || (size_t) stat_buffer.st_size != file_size
+    ) {
+        close(fd);
+        return nullptr;
     }
 
-    assert(
-           table[size_table - 1]
-        == _ones_complement_sum_naive(_data, _size ^ 0x1)
+    void *mem = mmap(nullptr, file_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (mem == MAP_FAILED)
+        return nullptr;
+
+    const _table_file_header_t *header = (const _table_file_header_t *) mem;
+
+    if (
+           memcmp(header->magic, TABLE_FILE_MAGIC, sizeof (TABLE_FILE_MAGIC))
+        || header->block_size != precomputed_sums_t::BLOCK_SIZE
+        || header->data_size != data_size || header->version != version
+    ) {
+        munmap(mem, file_size);
+        return nullptr;
+    }
+
+    *mapping_size = file_size;
+    return (const uint16_t *) (header + 1);
+}
+
+// Unmaps a table mapped by '_map_table_file()'.
+static void _unmap_table_file(const uint16_t *table, size_t mapping_size)
+{
+    const _table_file_header_t *header =
+        (const _table_file_header_t *) table - 1;
+
+    munmap((void *) header, mapping_size);
+}
+
+// Saves the table in the given file.
+//
+// The table is first written in a temporary file which is then renamed, so a
+// valid table file is never partially overwritten.
+//
+// Returns 'false' on failure.
+static bool _save_table_file(
+    const char *path, size_t data_size, uint64_t version,
+    const uint16_t *table, size_t size_table
+)
+{
+    _table_file_header_t header;
+    memcpy(header.magic, TABLE_FILE_MAGIC, sizeof (TABLE_FILE_MAGIC));
+    header.block_size   = precomputed_sums_t::BLOCK_SIZE;
+    header.reserved     = 0;
+    header.data_size    = data_size;
+    header.version      = version;
+
+    std::string tmp_path = std::string(path) + ".tmp";
+
+    FILE *file = fopen(tmp_path.c_str(), "wb");
+    if (file == nullptr)
+        return false;
+
+    bool success =
+           fwrite(&header, sizeof (header), 1, file) == 1
+        && fwrite(table, sizeof (uint16_t), size_table, file) == size_table;
+
+    success = fclose(file) == 0 && success;
+
+    if (success)
+        success = rename(tmp_path.c_str(), path) == 0;
+
+    if (!success)
+        unlink(tmp_path.c_str());
+
+    return success;
+}
+
+precomputed_sums_t::~precomputed_sums_t(void)
+{
+    if (this->_mapping_size > 0)
+        _unmap_table_file(this->table, this->_mapping_size);
+    else
+        delete[] this->table;
+}
+
+const uint16_t *precomputed_sums_t::_load_or_precompute_table(
+    const void *_data, size_t _size, const char *cache_path, uint64_t version,
+    size_t *mapping_size
+)
+{
+    size_t size_table = table_size(_size);
+
+    const uint16_t *table = _map_table_file(
+        cache_path, _size, version, size_table, mapping_size
     );
 
+    if (table != nullptr) {
+        assert(_equivalent_sums(
+            partial_sum_t(table[size_table - 1], false),
+            partial_sum_t(_data, (size_table - 1) * BLOCK_SIZE)
+        ));
+
+        return table;
+    }
+
+    table = _precompute_table(_data, _size);
+    _save_table_file(cache_path, _size, version, table, size_table);
+
     return table;
 }
 
-#ifndef NDEBUG
-    static uint16_t _ones_complement_sum_naive(const void *data, size_t size)
-    {
-        uint64_t        sum     = 0;
+uint16_t _ones_complement_sum_naive(const void *data, size_t size)
+{
+    uint64_t        sum     = 0;
 
-        // Sums two bytes at a time.
-        const uint16_t  *data16 = (const uint16_t *) data;
+    // Sums two bytes at a time.
+    const uint16_t  *data16 = (const uint16_t *) data;
 
-        while (size > 1) {
-            sum     += *data16;
-            size    -= 2;
-            data16++;
-        }
+    while (size > 1) {
+        sum     += *data16;
+        size    -= 2;
+        data16++;
+    }
 
-        // Adds left-over byte, if any.
-        if (size > 0) {
-            #if __BYTE_ORDER == __LITTLE_ENDIAN
-                uint16_t mask = 0x00FF;
-            #elif __BYTE_ORDER == __BIG_ENDIAN
-                uint16_t mask = 0xFF00;
-            #else
-                #error "Please set __BYTE_ORDER in <bits/endian.h>"
-            #endif
+    // Adds left-over byte, if any.
+    if (size > 0) {
+        #if __BYTE_ORDER == __LITTLE_ENDIAN
+            uint16_t mask = 0x00FF;
+        #elif __BYTE_ORDER == __BIG_ENDIAN
+            uint16_t mask = 0xFF00;
+        #else
+            #error "Please set __BYTE_ORDER in <bits/endian.h>"
+        #endif
 
-            sum += *data16 & mask;
-        }
+        sum += *data16 & mask;
+    }
 
-        // Folds 64-bit sum to 16 bits.
-        while (sum >> 16)
-            sum = (sum >> 16) + (sum & 0xFFFF);
+    // Folds 64-bit sum to 16 bits.
+    while (sum >> 16)
+        sum = (sum >> 16) + (sum & 0xFFFF);
 
-        return (uint16_t) sum;
-    }
-#endif /* NDEBUG */
+    return (uint16_t) sum;
+}
 
 } } /* namespace rusty::net */
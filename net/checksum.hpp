@@ -29,8 +29,35 @@ namespace rusty {
 namespace net {
 
 // Computes the 16 bits ones' complement sum of the given buffer.
+//
+// Uses the fastest kernel available on the target and on the current CPU for
+// the given size.
 uint16_t _ones_complement_sum(const void *data, size_t size);
 
+// Copies 'size' bytes from 'src' to 'dst' and returns their 16 bits ones'
+// complement sum.
+//
+// Bytes are summed as they are copied, instead of being read a second time.
+uint16_t _ones_complement_copy_and_sum(void *dst, const void *src, size_t size);
+
+// Reference implementation of the ones's complement sum.
+//
+// Only used for debugging and benchmarking.
+uint16_t _ones_complement_sum_naive(const void *data, size_t size);
+
+// Implementation of the ones' complement sum.
+struct checksum_kernel_t {
+    const char  *name;
+
+    uint16_t    (*sum)(const void *data, size_t size);
+};
+
+// Returns every kernel which can be executed on the current CPU, including the
+// naive one. The last item of the array has a 'nullptr' name.
+//
+// Used to benchmark kernels against each other.
+const checksum_kernel_t *_checksum_kernels(void);
+
 // Swaps the two bytes of the integer ([a, b] -> [b, a]).
 static inline uint16_t _swap_bytes(uint16_t bytes);
 
@@ -73,6 +100,16 @@ struct partial_sum_t {
         this->odd = (bool) (size & 0x1);
     }
 
+    // Copies the buffer into 'dst' and returns its sum.
+    static inline partial_sum_t copy_and_sum(
+        void *dst, const void *src, size_t size
+    )
+    {
+        return partial_sum_t(
+            _ones_complement_copy_and_sum(dst, src, size), size & 0x1
+        );
+    }
+
     // Computes the sum of a buffer cursor.
     template <typename cursor_t>
     inline partial_sum_t(cursor_t cursor) : partial_sum_t()
@@ -120,14 +157,25 @@ struct partial_sum_t {
 // time the one's complement sum of any subsection of the buffer.
 //
 // It uses internally a kind of summed area table [1] instead of computing the
-// sum for every possible sub-section, giving a O(n) memory space usage (with n
-// being the number of bytes in the original buffer).
+// sum for every possible sub-section. The table only stores the sum at every
+// BLOCK_SIZE bytes boundary. The sums of the blocks which are partially
+// included in a section are computed on the fly. The table thus uses one
+// 16 bits integer per block (3% of the size of the buffer).
+//
+// The table can be saved in a file and mapped in memory when the data is
+// loaded again, instead of being computed.
 //
 // [1] https://en.wikipedia.org/wiki/Summed_area_table
 struct precomputed_sums_t {
+    // Number of bytes summed by each entry of the table.
+    //
+    // Must be even.
+    static constexpr size_t BLOCK_SIZE = 64;
+
     const void      *data;
     const size_t    size;
 
+    // 'table[i]' is the sum of the 'i * BLOCK_SIZE' first bytes of 'data'.
     const uint16_t  *table;
 
     // Given a data buffer and its size, precomputes the one's complement sum
@@ -137,28 +185,75 @@ struct precomputed_sums_t {
     //
     // Complexity: O(_size).
     precomputed_sums_t(const void *_data, size_t _size)
-        : data(_data), size(_size), table(_precompute_table(_data, _size))
+        : data(_data), size(_size), table(_precompute_table(_data, _size)),
+          _mapping_size(0)
     {
     }
 
+    // Same as the previous constructor, but maps the table from the
+    // 'cache_path' file if it has been saved for the same data size and the
+    // same 'version'.
+    //
+    // The version must change whenever the data does. For data read from a
+    // file, the modification time in seconds is not enough, as a file can be
+    // rewritten with the same size within a second: hash it with its
+    // nanoseconds, the inode and the device of the file.
+    //
+    // Otherwise, computes the table and tries to save it to 'cache_path'.
+    // Failing to save it is not an error.
+    //
+    // Complexity: O(1) if the table is loaded, O(_size) otherwise.
+    precomputed_sums_t(
+        const void *_data, size_t _size, const char *cache_path,
+        uint64_t version
+    ) : data(_data), size(_size), _mapping_size(0)
+    {
+        table = _load_or_precompute_table(
+            _data, _size, cache_path, version, &_mapping_size
+        );
+    }
+
+    precomputed_sums_t(const precomputed_sums_t &other) = delete;
+
+    // Releases the table, or unmaps it if it has been mapped from a file.
+    ~precomputed_sums_t(void);
+
     // Returns the partial sum of the data in the buffer which starts at 'begin'
     // (inclusive) and which stops at 'end' (excluded).
+    //
+    // Complexity: O(BLOCK_SIZE).
     partial_sum_t sum(size_t begin, size_t end) const;
 
     inline void prefetch(size_t begin, size_t end) const
     {
-        size_t begin_div2 = begin / 2,
-               end_div2   = end   / 2;
-        __builtin_prefetch(this->table + end_div2);
-        __builtin_prefetch(this->table + begin_div2);
+        __builtin_prefetch(this->table + end / BLOCK_SIZE);
+        __builtin_prefetch(this->table + begin / BLOCK_SIZE);
+    }
+
+    // Returns the number of entries in the table of a buffer of the given size.
+    static inline size_t table_size(size_t data_size)
+    {
+        return data_size / BLOCK_SIZE + 1;
     }
 
 private:
 
+    // Size of the mapping of the file from which the table has been mapped,
+    // or zero if the table has been allocated.
+    size_t          _mapping_size;
+
     // Allocates and computes the one's complement sum table.
     static const uint16_t *_precompute_table(const void *_data, size_t _size);
-};
 
+    // Maps the table saved in 'cache_path' or computes and saves it.
+    //
+    // Sets 'mapping_size' to the size of the mapping if the table has been
+    // mapped.
+    static const uint16_t *_load_or_precompute_table(
+        const void *_data, size_t _size, const char *cache_path,
+        uint64_t version, size_t *mapping_size
+    );
+};
 
 // -----------------------------------------------------------------------------
 
@@ -0,0 +1,327 @@
+//
+// Open-addressing hash table used to store connections.
+//
+// Copyright 2015 Raphael Javaux <raphaeljavaux@gmail.com>
+// University of Liege.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __RUSTY_NET_CONN_TABLE_HPP__
+#define __RUSTY_NET_CONN_TABLE_HPP__
+
+#include <cassert>
+#include <cstdint>
+#include <functional>       // hash
+#include <memory>           // allocator
+#include <utility>          // forward(), swap()
+
+#include "util/macros.hpp"  // LIKELY(), UNLIKELY()
+
+using namespace std;
+
+namespace rusty {
+namespace net {
+
+// Hash table which maps keys to values using open addressing with linear
+// probing and "Robin Hood" insertions.
+//
+// The keys and the 32 less significant bits of their hashes are stored inline
+// in a flat array of slots, so a lookup usually only touches a single cache
+// line before reaching the value. Values are allocated separately and are never
+// moved: pointers to values stay valid until the entry is removed.
+//
+// Values, including the most accessed fields of TCBs, are deliberately not
+// stored in the slots. The TCP layer keeps pointers to its TCBs while it
+// inserts and removes connections, which would move them, and large slots
+// would make probing touch more cache lines. Reaching the value thus costs one
+// more dependent cache miss per lookup.
+//
+// A lookup can be started in advance with 'prefetch()', for example on the
+// next packet of a received batch.
+//
+// Contrary to 'unordered_map', a lookup returns a pointer to the value
+// ('nullptr' if the key doesn't exist).
+template <
+    typename key_t, typename value_t, typename hash_t = hash<key_t>,
+    typename alloc_t = allocator<char *>
+>
+struct conn_table_t {
+    //
+    // Parameters
+    //
+
+    // Must be a power of 2.
+    static constexpr size_t INITIAL_CAPACITY    = 64;
+
+    // The table doubles its capacity when it is filled at more than
+    // MAX_LOAD_FACTOR percent.
+    static constexpr size_t MAX_LOAD_FACTOR     = 80;
+
+    //
+    // Member types
+    //
+
+    struct slot_t {
+        key_t       key;
+
+        uint32_t    hash;
+
+        // Distance (plus one) between the slot and the first slot probed for
+        // the key. Zero if the slot is empty.
+        uint32_t    distance;
+
+        value_t     *value;
+    };
+
+    typedef typename alloc_t::template rebind<slot_t>::other    slot_alloc_t;
+    typedef typename alloc_t::template rebind<value_t>::other   value_alloc_t;
+
+    //
+    // Fields
+    //
+
+    hash_t          hasher;
+
+    slot_alloc_t    slot_alloc;
+    value_alloc_t   value_alloc;
+
+    slot_t          *slots;
+    size_t          capacity;
+
+    // 32 minus the binary logarithm of 'capacity'.
+    unsigned int    shift;
+
+    // Number of stored entries.
+    size_t          count;
+
+    //
+    // Methods
+    //
+
+    conn_table_t(alloc_t _alloc = alloc_t())
+        : slot_alloc(_alloc), value_alloc(_alloc), count(0)
+    {
+        _alloc_slots(INITIAL_CAPACITY);
+    }
+
+    conn_table_t(const conn_table_t &other) = delete;
+
+    ~conn_table_t(void)
+    {
+        for (size_t i = 0; i < capacity; i++) {
+            if (slots[i].distance > 0) {
+                value_alloc.destroy(slots[i].value);
+                value_alloc.deallocate(slots[i].value, 1);
+            }
+        }
+
+        slot_alloc.deallocate(slots, capacity);
+    }
+
+    inline size_t size(void) const
+    {
+        return count;
+    }
+
+    inline bool empty(void) const
+    {
+        return count == 0;
+    }
+
+    inline uint32_t hash(const key_t &key) const
+    {
+        return (uint32_t) hasher(key);
+    }
+
+    // Returns the value associated with the key, or 'nullptr' if the key does
+    // not exist.
+    inline value_t *find(const key_t &key) const
+    {
+        return find(key, hash(key));
+    }
+
+    // Same as 'find(key)', but uses an already computed hash (as given by
+    // 'hash(key)').
+    inline value_t *find(const key_t &key, uint32_t h) const
+    {
+        size_t mask = capacity - 1;
+
+        size_t i = _first_slot(h);
+        for (uint32_t distance = 1; ; distance++) {
+            const slot_t *slot = &slots[i];
+
+            // Robin Hood invariant: the key would have been inserted before a
+            // slot closer to its first slot.
+            if (slot->distance < distance)
+                return nullptr;
+
+            if (slot->hash == h && slot->key == key)
+                return slot->value;
+
+            i = (i + 1) & mask;
+        }
+    }
+
+    // Starts to load the first slot which will be probed when looking for the
+    // key.
+    inline void prefetch(const key_t &key) const
+    {
+        __builtin_prefetch(&slots[_first_slot(hash(key))]);
+    }
+
+    // Inserts a new value, constructed with the given arguments. The key must
+    // not already exist.
+    //
+    // Returns a pointer to the new value.
+    template <typename ... Args>
+    value_t *emplace(const key_t &key, Args&&... args)
+    {
+        assert(find(key) == nullptr);
+
+        if (UNLIKELY((count + 1) * 100 > capacity * MAX_LOAD_FACTOR))
+            _grow();
+
+        value_t *value = value_alloc.allocate(1);
+        value_alloc.construct(value, forward<Args>(args) ...);
+
+        _insert({ key, hash(key), 1, value });
+        count++;
+
+        return value;
+    }
+
+    // Removes and destructs the value associated with the key.
+    //
+    // Returns 'true' if the key has been found.
+    bool erase(const key_t &key)
+    {
+        size_t mask = capacity - 1;
+        uint32_t h = hash(key);
+
+        size_t i = _first_slot(h);
+        for (uint32_t distance = 1; ; distance++) {
+            slot_t *slot = &slots[i];
+
+            if (slot->distance < distance)
+                return false;
+
+            if (slot->hash == h && slot->key == key)
+                break;
+
+            i = (i + 1) & mask;
+        }
+
+        value_alloc.destroy(slots[i].value);
+        value_alloc.deallocate(slots[i].value, 1);
+
+        // Shifts the following entries backward, until an empty slot or an
+        // entry which is in its first slot is found.
+
+        size_t next = (i + 1) & mask;
+        while (slots[next].distance > 1) {
+            slots[i] = slots[next];
+            slots[i].distance--;
+
+            i = next;
+            next = (next + 1) & mask;
+        }
+
+        slots[i].distance = 0;
+        count--;
+
+        return true;
+    }
+
+    // Calls the function with the key and a pointer to the value of every
+    // entry.
+    //
+    // The table must not be modified by the function.
+    template <typename F>
+    void for_each(F f) const
+    {
+        for (size_t i = 0; i < capacity; i++) {
+            if (slots[i].distance > 0)
+                f(slots[i].key, slots[i].value);
+        }
+    }
+
+private:
+    // Returns the index of the first slot to probe for the given hash.
+    //
+    // Uses Fibonacci hashing to spread the bits of the hash.
+    inline size_t _first_slot(uint32_t h) const
+    {
+        return (uint32_t) (h * 2654435769U) >> shift;
+    }
+
+    void _alloc_slots(size_t _capacity)
+    {
+        assert((_capacity & (_capacity - 1)) == 0);
+
+        capacity = _capacity;
+        shift = 32 - __builtin_ctzl(_capacity);
+
+        slots = slot_alloc.allocate(capacity);
+        for (size_t i = 0; i < capacity; i++)
+            slots[i].distance = 0;
+    }
+
+    // Inserts the slot without checking the load factor.
+    void _insert(slot_t entry)
+    {
+        size_t mask = capacity - 1;
+
+        size_t i = _first_slot(entry.hash);
+        for (;;) {
+            slot_t *slot = &slots[i];
+
+            if (slot->distance == 0) {
+                *slot = entry;
+                return;
+            }
+
+            // Takes the slot of entries which are closer to their first slot.
+            if (slot->distance < entry.distance)
+                swap(*slot, entry);
+
+            i = (i + 1) & mask;
+            entry.distance++;
+        }
+    }
+
+    // Doubles the capacity of the table.
+    void _grow(void)
+    {
+        slot_t *old_slots = slots;
+        size_t old_capacity = capacity;
+
+        _alloc_slots(old_capacity * 2);
+
+        for (size_t i = 0; i < old_capacity; i++) {
+            slot_t entry = old_slots[i];
+
+            if (entry.distance > 0) {
+                entry.distance = 1;
+                _insert(entry);
+            }
+        }
+
+        slot_alloc.deallocate(old_slots, old_capacity);
+    }
+};
+
+} } /* namespace rusty::net */
+
+#endif /* __RUSTY_NET_CONN_TABLE_HPP__ */
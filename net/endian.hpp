@@ -239,7 +239,6 @@ namespace std {
 
 using namespace rusty::net;
 
-template <>
 template <typename host_t>
 struct equal_to<net_t<host_t>> {
     inline bool operator()(const net_t<host_t>& a, const net_t<host_t>& b) const
@@ -248,7 +247,6 @@ struct equal_to<net_t<host_t>> {
     }
 };
 
-template <>
 template <typename host_t>
 struct hash<net_t<host_t>> {
     inline size_t operator()(const net_t<host_t> &value) const
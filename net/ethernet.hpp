@@ -62,6 +62,7 @@ struct ethernet_t {
 
     typedef typename phys_t::clock_t            clock_t;
     typedef typename phys_t::cursor_t           cursor_t;
+    typedef typename phys_t::static_extent_t    static_extent_t;
     typedef typename phys_t::timer_manager_t    timer_manager_t;
 
     // Ethernet address.
@@ -238,12 +239,70 @@ struct ethernet_t {
         });
     }
 
+    // Starts to load the state which will be required to process the frame
+    // of the given contiguous bytes (usually the first buffer of a received
+    // packet).
+    //
+    // Does not check the validity of the frame, which must still be processed
+    // with 'receive_frame()'.
+    //
+    // This method is typically called by the physical layer on the next packet
+    // of a received batch, while the current packet is being processed.
+    inline void prefetch_frame(const char *frame, size_t size) const
+    {
+        if (UNLIKELY(size < HEADER_SIZE))
+            return;
+
+        const header_t *hdr = (const header_t *) frame;
+
+        if (LIKELY(hdr->type == ETHERTYPE_IP_NET))
+            ipv4.prefetch_datagram(frame + HEADER_SIZE, size - HEADER_SIZE);
+    }
+
+    // Sends the responses which have been deferred by the upper layers while
+    // processing a batch of received frames, such as TCP acknowledgments.
+    //
+    // This method is typically called by the physical layer once every frame
+    // of a received batch has been given to 'receive_frame()'.
+    inline void end_of_batch(void)
+    {
+        ipv4.end_of_batch();
+    }
+
+    // Calls 'f(const char *name, uint64_t value)' with every counter of the
+    // upper layers.
+    //
+    // See 'ipv4_t::for_each_stat()'.
+    template <typename F>
+    inline void for_each_stat(F f) const
+    {
+        ipv4.for_each_stat(f);
+    }
+
+    // Returns 'true' if the physical layer is short of the transmission
+    // buffers which hold frames with a payload of 'payload_size' bytes.
+    //
+    // Upper layers should then defer the transmissions of this size which can
+    // wait, such as TCP data segments.
+    inline bool tx_congested(size_t payload_size) const
+    {
+        return this->phys->tx_congested(HEADER_SIZE + payload_size);
+    }
+
     // Creates an Ethernet frame with the given destination and Ethernet type,
     // and writes its payload with the given 'payload_writer'. The frame is then
     // transmitted to physical layer.
+    //
+    // 'payload_writer' is any callable accepting a 'cursor_t'. It is executed
+    // before the function returns.
+    //
+    // The last 'tail.size' bytes of the payload are transmitted by reference
+    // from the static memory 'tail' and are not given to 'payload_writer'.
+    template <typename payload_writer_t>
     void send_payload(
         net_t<addr_t> dst, net_t<uint16_t> ether_type,
-        size_t payload_size, function<void(cursor_t)> payload_writer
+        size_t payload_size, payload_writer_t payload_writer,
+        static_extent_t tail = static_extent_t()
     )
     {
         assert(payload_size >= 0 && payload_size <= max_payload_size);
@@ -260,7 +319,7 @@ struct ethernet_t {
         [this, dst, ether_type, &payload_writer](cursor_t cursor) {
             cursor = _write_header(cursor, dst, ether_type);
             payload_writer(cursor);
-        });
+        }, tail);
     }
 
     // Equivalent to 'send_payload()' with 'ether_type' equals to
@@ -268,9 +327,10 @@ struct ethernet_t {
     //
     // This method is typically called by the ARP instance when it wants to send
     // a message.
+    template <typename payload_writer_t>
     inline void send_arp_payload(
         net_t<addr_t> dst, size_t payload_size,
-        function<void(cursor_t)> payload_writer
+        payload_writer_t payload_writer
     )
     {
         send_payload(dst, ETHERTYPE_ARP_NET, payload_size, payload_writer);
@@ -281,12 +341,16 @@ struct ethernet_t {
     //
     // This method is typically called by the IPv4 instance when it wants to
     // send a packet.
+    template <typename payload_writer_t>
     inline void send_ip_payload(
         net_t<addr_t> dst, size_t payload_size,
-        function<void(cursor_t)> payload_writer
+        payload_writer_t payload_writer,
+        static_extent_t tail = static_extent_t()
     )
     {
-        send_payload(dst, ETHERTYPE_IP_NET, payload_size, payload_writer);
+        send_payload(
+            dst, ETHERTYPE_IP_NET, payload_size, payload_writer, tail
+        );
     }
 
 private:
@@ -35,6 +35,7 @@
 #include "net/checksum.hpp"     // checksum_t, partial_sum_t
 #include "net/tcp.hpp"          // tcp_t
 #include "util/macros.hpp"      // RUSTY_*, COLOR_*
+#include "util/stats.hpp"       // counter_t, CACHE_LINE_SIZE
 
 using namespace std;
 
@@ -108,6 +109,7 @@ struct ipv4_t {
 
     typedef typename data_link_t::clock_t           clock_t;
     typedef typename data_link_t::cursor_t          cursor_t;
+    typedef typename data_link_t::static_extent_t   static_extent_t;
     typedef typename data_link_t::timer_manager_t   timer_manager_t;
 
     struct header_t {
@@ -138,6 +140,31 @@ struct ipv4_t {
     // Upper layer protocol type.
     typedef tcp_t<this_t, alloc_t>                  tcp_ipv4_t;
 
+    // Reasons for which a received datagram is ignored.
+    enum ignore_reason_t {
+        IGNORED_TOO_SMALL = 0,
+        IGNORED_VERSION,
+        IGNORED_OPTIONS,
+        IGNORED_LENGTH,
+        IGNORED_FRAGMENTED,
+        IGNORED_RECIPIENT,
+        IGNORED_CHECKSUM,
+        IGNORED_PROTOCOL,
+        N_IGNORE_REASONS
+    };
+
+    // Counters of the instance (see 'for_each_stat()').
+    struct alignas(util::CACHE_LINE_SIZE) stats_t {
+        util::counter_t                 received;
+        util::counter_t                 ignored[N_IGNORE_REASONS];
+
+        util::counter_t                 sent;
+
+        // Datagrams which have not been sent as their destination address
+        // couldn't be resolved.
+        util::counter_t                 unreachable;
+    };
+
     //
     // Static fields
     //
@@ -173,6 +200,8 @@ struct ipv4_t {
     // This counter is incremented by one each time a datagram is sent.
     uint16_t                            current_datagram_id = 0;
 
+    stats_t                             stats;
+
     //
     // Methods
     //
@@ -220,15 +249,19 @@ struct ipv4_t {
     {
         size_t cursor_size = cursor.size();
 
+        this->stats.received.inc();
+
         if (UNLIKELY(cursor_size < HEADER_SIZE)) {
+            this->stats.ignored[IGNORED_TOO_SMALL].inc();
             IPV4_ERROR("Datagram ignored: too small to hold an IPv4 header");
             return;
         }
 
         cursor.template read_with<header_t, void>(
         [this, cursor_size](const header_t *hdr, cursor_t payload) {
-            #define IGNORE_DATAGRAM(WHY, ...)                                  \
+            #define IGNORE_DATAGRAM(REASON, WHY, ...)                          \
                 do {                                                           \
+                    this->stats.ignored[REASON].inc();                         \
                     IPV4_ERROR(                                                \
                         "Datagram from %s ignored: " WHY,                      \
                         addr_t::to_alpha(hdr->saddr), ##__VA_ARGS__            \
@@ -242,19 +275,21 @@ struct ipv4_t {
 
             if (UNLIKELY(hdr->version != IPVERSION)) {
                 IGNORE_DATAGRAM(
+                    IGNORED_VERSION,
                     "invalid IP version (received %u, excpected %u)",
                     (unsigned int) hdr->version, IPVERSION
                 );
             }
 
             if (hdr->ihl != HEADER_LEN)
-                IGNORE_DATAGRAM("options are not supported");
+                IGNORE_DATAGRAM(IGNORED_OPTIONS, "options are not supported");
 
             size_t header_size = hdr->ihl * sizeof (uint32_t),
                    total_size  = hdr->tot_len.host();
 
             if (UNLIKELY(total_size < header_size)) {
                 IGNORE_DATAGRAM(
+                    IGNORED_LENGTH,
                     "total size (%zu) is less than header size (%zu)",
                     total_size, header_size
                 );
@@ -262,6 +297,7 @@ struct ipv4_t {
 
             if (UNLIKELY(cursor_size < total_size)) {
                 IGNORE_DATAGRAM(
+                    IGNORED_LENGTH,
                     "datagram size (%zu) is less than total size (%zu)",
                     total_size, cursor_size
                 );
@@ -272,13 +308,15 @@ struct ipv4_t {
                    frag_off_host & IP_MF            // More fragment.
                 || (frag_off_host & IP_OFFMASK) > 0 // Not the first fragment.
             ))
-                IGNORE_DATAGRAM("fragmented datagrams are not supported");
+                IGNORE_DATAGRAM(
+                    IGNORED_FRAGMENTED, "fragmented datagrams are not supported"
+                );
 
             if (UNLIKELY(hdr->daddr != addr))
-                IGNORE_DATAGRAM("bad recipient");
+                IGNORE_DATAGRAM(IGNORED_RECIPIENT, "bad recipient");
 
             if (UNLIKELY(!checksum_t(hdr, HEADER_SIZE).is_valid()))
-                IGNORE_DATAGRAM("invalid checksum");
+                IGNORE_DATAGRAM(IGNORED_CHECKSUM, "invalid checksum");
 
             //
             // Processes the datagram.
@@ -295,7 +333,8 @@ struct ipv4_t {
                 this->tcp.receive_segment(hdr->saddr, payload);
             } else {
                 IGNORE_DATAGRAM(
-                    "unknown IPv4 protocol (%u)", (unsigned int) hdr->protocol
+                    IGNORED_PROTOCOL, "unknown IPv4 protocol (%u)",
+                    (unsigned int) hdr->protocol
                 );
             }
 
@@ -303,6 +342,76 @@ struct ipv4_t {
         });
     }
 
+    // Starts to load the state which will be required to process the datagram
+    // of the given contiguous bytes.
+    //
+    // See 'ethernet_t::prefetch_frame()'.
+    inline void prefetch_datagram(const char *datagram, size_t size) const
+    {
+        if (UNLIKELY(size < HEADER_SIZE))
+            return;
+
+        const header_t *hdr = (const header_t *) datagram;
+
+        size_t header_size = hdr->ihl * sizeof (uint32_t);
+
+        if (LIKELY(hdr->protocol == IPPROTO_TCP && header_size <= size)) {
+            this->tcp.prefetch_segment(
+                hdr->saddr, datagram + header_size, size - header_size
+            );
+        }
+    }
+
+    // Sends the responses which have been deferred by the upper layers while
+    // processing a batch of received datagrams.
+    //
+    // See 'ethernet_t::end_of_batch()'.
+    inline void end_of_batch(void)
+    {
+        this->tcp.end_of_batch();
+    }
+
+    // Calls 'f(const char *name, uint64_t value)' with every counter of the
+    // instance and of its upper layers.
+    //
+    // Can be called by any thread, while the owner of the instance is running.
+    template <typename F>
+    void for_each_stat(F f) const
+    {
+        static const char *IGNORE_REASON_NAMES[N_IGNORE_REASONS] = {
+            "ipv4.ignored.too_small",   "ipv4.ignored.version",
+            "ipv4.ignored.options",     "ipv4.ignored.length",
+            "ipv4.ignored.fragmented",  "ipv4.ignored.recipient",
+            "ipv4.ignored.checksum",    "ipv4.ignored.protocol"
+        };
+
+        f("ipv4.received", this->stats.received.get());
+
+        for (size_t i = 0; i < N_IGNORE_REASONS; i++)
+            f(IGNORE_REASON_NAMES[i], this->stats.ignored[i].get());
+
+        f("ipv4.sent",          this->stats.sent.get());
+        f("ipv4.unreachable",   this->stats.unreachable.get());
+
+        this->tcp.for_each_stat(f);
+    }
+
+    // Returns 'true' if the physical layer is short of the transmission
+    // buffers which hold datagrams with a payload of 'payload_size' bytes.
+    //
+    // See 'ethernet_t::tx_congested()'.
+    inline bool tx_congested(size_t payload_size) const
+    {
+        return this->data_link->tx_congested(HEADER_SIZE + payload_size);
+    }
+
+    // Returns 'true' if the transmission of a datagram to the given address
+    // would not be delayed by an ARP transaction.
+    inline bool has_data_link_addr(net_t<addr_t> dst) const
+    {
+        return this->arp->has_data_link_addr(dst);
+    }
+
     // Creates and push an IPv4 datagram with its payload to the daya-link layer
     // (L2).
     //
@@ -312,18 +421,30 @@ struct ipv4_t {
     // which could be deallocated before the 'payload_writer' execution.
     //
     // Returns 'true' if the 'payload_writer' execution has not been delayed.
+    //
+    // 'payload_writer' is any callable accepting a 'cursor_t'. It's only
+    // copied into a 'function<>' when its execution is delayed by an ARP
+    // transaction.
+    //
+    // The last 'tail.size' bytes of the payload are transmitted by reference
+    // from the static memory 'tail' and are not given to 'payload_writer'.
+    template <typename payload_writer_t>
     bool send_payload(
         net_t<addr_t> dst, uint8_t protocol,
-        size_t payload_size, function<void(cursor_t)> payload_writer
+        size_t payload_size, payload_writer_t payload_writer,
+        static_extent_t tail = static_extent_t()
     )
     {
         assert(payload_size >= 0 && payload_size <= max_payload_size);
+        assert(tail.size <= payload_size);
 
         return this->arp->with_data_link_addr(
-        dst, [this, dst, protocol, payload_size, payload_writer](
-            const net_t<data_link_addr_t> *data_link_dst
-        ) {
+        dst,
+        [this, dst, protocol, payload_size,
+         payload_writer = move(payload_writer), tail]
+        (const net_t<data_link_addr_t> *data_link_dst) {
             if (data_link_dst == nullptr) {
+                this->stats.unreachable.inc();
                 IPV4_ERROR("Unreachable address: %s", addr_t::to_alpha(dst));
                 return;
             }
@@ -339,15 +460,100 @@ struct ipv4_t {
             uint16_t datagram_id = current_datagram_id++;
             // unlock
 
+            this->stats.sent.inc();
+
             this->data_link->send_ip_payload(
             *data_link_dst, datagram_size,
-            [this, dst, payload_writer, protocol, datagram_size, datagram_id]
+            [this, dst, &payload_writer, protocol, datagram_size, datagram_id]
             (cursor_t cursor) {
                 cursor = _write_header(
                     cursor, datagram_size, datagram_id, protocol, dst
                 );
                 payload_writer(cursor);
-            });
+            }, tail);
+        });
+    }
+
+    // Creates and push several IPv4 datagrams with the same destination and
+    // protocol to the data-link layer (L2).
+    //
+    // The destination address is only translated once, and the header fields
+    // which are shared by the datagrams are only written and summed once.
+    //
+    // 'burst' is any copyable object providing:
+    //
+    // - 'size_t size() const', the number of datagrams ;
+    // - 'size_t payload_size(size_t i) const' ;
+    // - 'static_extent_t tail(size_t i) const' ;
+    // - 'void write(size_t i, cursor_t cursor) const', which writes the payload
+    //   of the 'i'th datagram but its tail.
+    //
+    // As with 'send_payload()', the transmission could be delayed by an ARP
+    // transaction. Returns 'true' if it has not been delayed.
+    template <typename burst_t>
+    bool send_payloads(net_t<addr_t> dst, uint8_t protocol, burst_t burst)
+    {
+        return this->arp->with_data_link_addr(
+        dst, [this, dst, protocol, burst = move(burst)](
+            const net_t<data_link_addr_t> *data_link_dst
+        ) {
+            if (data_link_dst == nullptr) {
+                this->stats.unreachable.inc();
+                IPV4_ERROR("Unreachable address: %s", addr_t::to_alpha(dst));
+                return;
+            }
+
+            // Header without its size, identifier and checksum.
+            header_t      hdr_template;
+            partial_sum_t hdr_template_sum;
+
+            _init_header_template(&hdr_template, protocol, dst);
+            hdr_template_sum = partial_sum_t(&hdr_template, HEADER_SIZE);
+
+            this->stats.sent.inc(burst.size());
+
+            for (size_t i = 0; i < burst.size(); i++) {
+                size_t payload_size = burst.payload_size(i);
+
+                assert(payload_size <= max_payload_size);
+                assert(burst.tail(i).size <= payload_size);
+
+                size_t datagram_size = HEADER_SIZE + payload_size;
+
+                IPV4_DEBUG(
+                    "Sends a %zu bytes IPv4 datagram to %s with protocol "
+                    "%" PRIu16, datagram_size, addr_t::to_alpha(dst), protocol
+                );
+
+                // lock
+                uint16_t datagram_id = current_datagram_id++;
+                // unlock
+
+                this->data_link->send_ip_payload(
+                *data_link_dst, datagram_size,
+                [&burst, i, &hdr_template, hdr_template_sum, datagram_size,
+                 datagram_id]
+                (cursor_t cursor) {
+                    cursor = cursor.template write_with<header_t>(
+                    [&hdr_template, hdr_template_sum, datagram_size,
+                     datagram_id]
+                    (header_t *hdr) {
+                        *hdr         = hdr_template;
+                        hdr->tot_len = datagram_size;
+                        hdr->id      = datagram_id;
+
+                        // 'tot_len' and 'id' are the two 16 bits words
+                        // following the first one.
+                        hdr->check   = checksum_t(
+                            hdr_template_sum.append(
+                                partial_sum_t(&hdr->tot_len, 4)
+                            )
+                        );
+                    });
+
+                    burst.write(i, cursor);
+                }, burst.tail(i));
+            }
         });
     }
 
@@ -355,12 +561,25 @@ struct ipv4_t {
     //
     // This method is typically called by the TCP instance when it wants to
     // send a TCP segment.
-    inline void send_tcp_payload(
+    template <typename payload_writer_t>
+    inline bool send_tcp_payload(
         net_t<addr_t> dst, size_t payload_size,
-        function<void(cursor_t)> payload_writer
+        payload_writer_t payload_writer,
+        static_extent_t tail = static_extent_t()
     )
     {
-        send_payload(dst, IPPROTO_TCP, payload_size, payload_writer);
+        return send_payload(
+            dst, IPPROTO_TCP, payload_size, payload_writer, tail
+        );
+    }
+
+    // Equivalent to 'send_payloads()' with 'protocol' equals to 'IPPROTO_TCP'.
+    //
+    // Called by the TCP instance when it sends a burst of data segments.
+    template <typename burst_t>
+    inline bool send_tcp_payloads(net_t<addr_t> dst, burst_t burst)
+    {
+        return send_payloads(dst, IPPROTO_TCP, move(burst));
     }
 
     //
@@ -412,26 +631,38 @@ private:
         uint8_t protocol, net_t<addr_t> dst
     )
     {
-        static const net_t<uint16_t> FRAG_OFF_NET = IP_DF; // Don't fragment.
-
         return cursor.template write_with<header_t>(
         [this, datagram_size, datagram_id, protocol, dst](header_t *hdr) {
-            hdr->version  = IPVERSION;
-            hdr->ihl      = HEADER_LEN;
-            hdr->tos      = IPTOS_CLASS_DEFAULT;
+            _init_header_template(hdr, protocol, dst);
+
             hdr->tot_len  = datagram_size;
             hdr->id       = datagram_id;
-            hdr->frag_off = FRAG_OFF_NET;
-            hdr->ttl      = IPDEFTTL;
-            hdr->protocol = protocol;
-            hdr->check    = checksum_t::ZERO;
-            hdr->saddr    = this->addr;
-            hdr->daddr    = dst;
 
             hdr->check    = checksum_t(hdr, HEADER_SIZE);
         });
     }
 
+    // Initializes the fields of the header which are the same for every
+    // datagram of a burst. 'tot_len', 'id' and 'check' are set to zero.
+    void _init_header_template(
+        header_t *hdr, uint8_t protocol, net_t<addr_t> dst
+    ) const
+    {
+        static const net_t<uint16_t> FRAG_OFF_NET = IP_DF; // Don't fragment.
+
+        hdr->version  = IPVERSION;
+        hdr->ihl      = HEADER_LEN;
+        hdr->tos      = IPTOS_CLASS_DEFAULT;
+        hdr->tot_len  = 0;
+        hdr->id       = 0;
+        hdr->frag_off = FRAG_OFF_NET;
+        hdr->ttl      = IPDEFTTL;
+        hdr->protocol = protocol;
+        hdr->check    = checksum_t::ZERO;
+        hdr->saddr    = this->addr;
+        hdr->daddr    = dst;
+    }
+
     size_t _max_payload_size(void)
     {
         // IPv4 datagrams can't be larger than 65,535 bytes.
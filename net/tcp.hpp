@@ -21,27 +21,37 @@
 #ifndef __RUSTY_NET_TCP_HPP__
 #define __RUSTY_NET_TCP_HPP__
 
-#include <algorithm>                // min()
+#include <algorithm>                // min(), max()
 #include <array>
 #include <cassert>
 #include <cstdint>
 #include <cstring>
-#include <deque>
 #include <functional>               // equal_to, hash
+#include <iterator>                 // next(), prev()
 #include <map>
 #include <memory>                   // shared_ptr
+#include <random>                   // random_device
 #include <tuple>
 #include <unordered_map>
 #include <utility>                  // pair, swap()
+#include <vector>
 
-#include <netinet/tcp.h>            // TCPOPT_EOL, TCPOPT_NOP, TCPOPT_MAXSEG
+#include <netinet/tcp.h>            // TCPOPT_*, TCPOLEN_*
 
-#include "net/checksum.hpp"         // checksum(), partial_sum_t
+#include "net/checksum.hpp"         // checksum(), partial_sum_t,
+                                    // precomputed_sums_t
+#include "net/conn_table.hpp"       // conn_table_t
 #include "net/endian.hpp"           // net_t, to_host()
+#include "net/tcp_cc.hpp"           // tcp_ack_sample_t, tcp_default_cc_t
+#include "util/inline_ring.hpp"     // inline_ring_t
 #include "util/macros.hpp"          // LIKELY(), UNLIKELY()
+#include "util/stats.hpp"           // counter_t, CACHE_LINE_SIZE
+#include "util/trace.hpp"           // TRACE_*()
 
 using namespace std;
 
+using namespace rusty::util;
+
 namespace rusty {
 namespace net {
 
@@ -82,9 +92,69 @@ struct tcp_tcb_id_t {
     }
 };
 
+// Hashes TCB identifiers with the CRC-32C of the remote address, remote port
+// and local port, as they appear in the segment headers.
+//
+// RSS NICs use the Toeplitz hash instead, but CRC-32C can be computed by
+// programmable flow classifiers such as the one of the mPIPE. When the load
+// balancer of the interface is configured to use the same function, the Tile
+// which receives a connection can be predicted from its identifier.
+//
+// Enabled with the TCP_FLOW_HASH flag. The default 'std::hash<>' instance is
+// cheaper to compute.
+template <typename addr_t, typename port_t>
+struct tcp_flow_hash_t {
+    inline size_t operator()(const tcp_tcb_id_t<addr_t, port_t> &tcb_id) const
+    {
+        uint32_t crc = 0xFFFFFFFF;
+
+        crc = _update(crc, &tcb_id.raddr.net, sizeof (tcb_id.raddr.net));
+        crc = _update(crc, &tcb_id.rport.net, sizeof (tcb_id.rport.net));
+        crc = _update(crc, &tcb_id.lport.net, sizeof (tcb_id.lport.net));
+
+        return ~crc;
+    }
+
+private:
+    static inline uint32_t _update(uint32_t crc, const void *data, size_t size)
+    {
+        static const array<uint32_t, 256> table = _make_table();
+
+        const uint8_t *bytes = (const uint8_t *) data;
+
+        for (size_t i = 0; i < size; i++)
+            crc = table[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+
+        return crc;
+    }
+
+    // Computes the lookup table of the reflected Castagnoli polynomial.
+    static array<uint32_t, 256> _make_table(void)
+    {
+        array<uint32_t, 256> table;
+
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t crc = i;
+
+            for (int j = 0; j < 8; j++)
+                crc = (crc >> 1) ^ (0x82F63B78 & -(crc & 1));
+
+            table[i] = crc;
+        }
+
+        return table;
+    }
+};
+
 // TCP transport layer able to process segment from and to the specified network
 // 'network_var_t' layer.
-template <typename network_var_t, typename alloc_t = allocator<char *>>
+//
+// 'cc_var_t' is the congestion control algorithm of the connections (see
+// 'net/tcp_cc.hpp').
+template <
+    typename network_var_t, typename alloc_t = allocator<char *>,
+    template <typename> class cc_var_t = tcp_default_cc_t
+>
 struct tcp_t {
     //
     // Member types
@@ -96,10 +166,15 @@ struct tcp_t {
 
     typedef typename network_t::clock_t             clock_t;
     typedef typename network_t::cursor_t            cursor_t;
+    typedef typename network_t::static_extent_t     static_extent_t;
     typedef typename network_t::timer_manager_t     timer_manager_t;
     typedef typename timer_manager_t::timer_id_t    timer_id_t;
 
-    typedef tcp_t<network_t, alloc_t>               this_t;
+    typedef tcp_t<network_t, alloc_t, cc_var_t>     this_t;
+
+    // Congestion control algorithm, and measurements given to it on each ACK.
+    typedef cc_var_t<clock_t>                       cc_t;
+    typedef tcp_ack_sample_t<clock_t>               ack_sample_t;
 
     typedef typename network_t::addr_t              addr_t;
     typedef uint16_t                                port_t;
@@ -194,7 +269,9 @@ struct tcp_t {
     // Maximum Segment Size
     typedef uint16_t                                mss_t;
 
-    typedef uint16_t                                win_size_t;
+    // Window size. Windows larger than 65,535 bytes are announced with the
+    // window scale option (RFC 7323).
+    typedef uint32_t                                win_size_t;
 
     // TCP header tags.
     struct flags_t {
@@ -268,23 +345,65 @@ struct tcp_t {
 
         flags_t             flags;
 
-        net_t<win_size_t>   window;
+        net_t<uint16_t>     window;     // Scaled window size.
         checksum_t          check;
         net_t<uint16_t>     urg_ptr;
     } __attribute__ ((__packed__));
 
+    // Block of data received out of order, selectively acknowledged by a SACK
+    // option (RFC 2018).
+    struct sack_block_t {
+        seq_t       begin;  // First sequence number of the block.
+        seq_t       end;    // First sequence number after the block.
+    };
+
+    // Maximum number of blocks in a SACK option. Only 3 blocks fit in a segment
+    // which also carries the timestamps option.
+    static constexpr size_t                         MAX_SACK_BLOCKS = 4;
+
     struct options_t {
         enum mss_option_t : int {
             // Positive value: Option specified MSS.
             NO_MSS_OPTION   = -1
-        } mss;
+        } mss = NO_MSS_OPTION;
+
+        // Window scale option (RFC 7323). Only used in SYN segments.
+        enum wscale_option_t : int {
+            // Positive value: Option specified shift count.
+            NO_WSCALE_OPTION = -1
+        } wscale = NO_WSCALE_OPTION;
 
-        size_t size(void)
+        // SACK-permitted option (RFC 2018). Only used in SYN segments.
+        bool            sack_permitted  = false;
+
+        // Timestamps option (RFC 7323).
+        bool            has_timestamp   = false;
+        uint32_t        ts_val;
+        uint32_t        ts_ecr;
+
+        // SACK option (RFC 2018).
+        size_t          n_sack_blocks   = 0;
+        sack_block_t    sack_blocks[MAX_SACK_BLOCKS];
+
+        // Returns the number of bytes used by the options in the header.
+        //
+        // Each option is padded to a multiple of 4 bytes with NOP options.
+        size_t size(void) const
         {
+            size_t size = 0;
+
             if (mss != NO_MSS_OPTION)
-                return 4;
-            else
-                return 0;
+                size += TCPOLEN_MAXSEG;
+            if (wscale != NO_WSCALE_OPTION)
+                size += TCPOLEN_WINDOW + 1;
+            if (sack_permitted)
+                size += TCPOLEN_SACK_PERMITTED + 2;
+            if (has_timestamp)
+                size += TCPOLEN_TSTAMP_APPA;
+            if (n_sack_blocks > 0)
+                size += 4 + n_sack_blocks * sizeof (sack_block_t);
+
+            return size;
         }
     };
 
@@ -299,17 +418,72 @@ struct tcp_t {
     //
     // The number of bytes to write is given by the cursor size. The function
     // could be called an undefined number of times, with different offsets,
-    // because of packet segmentation and retransmission.
+    // because of packet segmentation and retransmission. It must not call the
+    // methods of the connection.
     typedef function<void(size_t, cursor_t)>            writer_t;
 
     // Same as 'writer_t' but also returns the partial checksum of the written
     // data.
     typedef function<partial_sum_t(size_t, cursor_t)>   writer_sum_t;
 
+    // Returns a 'writer_sum_t' which copies the data starting at 'data'.
+    //
+    // The data is summed while being copied (see 'cursor_t::write_and_sum()')
+    // and must not be modified or released before being acked.
+    static inline writer_sum_t copy_writer(const char *data)
+    {
+        return [data](size_t offset, cursor_t out)
+        {
+            partial_sum_t partial_sum;
+            out.write_and_sum(data + offset, out.size(), &partial_sum);
+            return partial_sum;
+        };
+    }
+
     // Callback given to 'send()' which will be called once all the data
     // provided by the writer has been acked by the remote.
     typedef function<void()>                            acked_callback_t;
 
+    // Data given to 'conn_t::send()' which is transmitted by reference, without
+    // being copied into transmission buffers.
+    //
+    // The data must be in a static memory of the physical layer (see
+    // 'mpipe_t::alloc_static_mem()') and must not be modified or released
+    // before being acked.
+    struct static_data_t {
+        const char                  *data;
+        size_t                      size;
+
+        // Precomputed checksums of 'data'. Checksums are computed when
+        // segments are sent if 'nullptr'.
+        const precomputed_sums_t    *sums;
+
+        // Returns the partial sum of the 'n' bytes starting at 'offset'.
+        inline partial_sum_t sum(size_t offset, size_t n) const
+        {
+            if (sums != nullptr)
+                return sums->sum(offset, offset + n);
+            else
+                return partial_sum_t(data + offset, n);
+        }
+
+        // Copies the data starting at 'offset' into the cursor and returns its
+        // partial sum.
+        inline partial_sum_t write(size_t offset, cursor_t out) const
+        {
+            size_t n = out.size();
+
+            if (sums != nullptr) {
+                out.write(data + offset, n);
+                return sums->sum(offset, offset + n);
+            } else {
+                partial_sum_t partial_sum;
+                out.write_and_sum(data + offset, n, &partial_sum);
+                return partial_sum;
+            }
+        }
+    };
+
     // Datatype used by the application layer to control the connection.
     struct conn_t {
         tcp_t       *tcp_instance;
@@ -342,6 +516,19 @@ struct tcp_t {
             tcp_instance->_send(tcb_id, length, writer, acked);
         }
 
+        // Sends 'length' bytes written by the writer, followed by the static
+        // data.
+        //
+        // Segments which end with some static data reference it directly
+        // instead of copying it.
+        inline void send(
+            size_t length, writer_t writer, static_data_t tail,
+            acked_callback_t acked
+        )
+        {
+            tcp_instance->_send(tcb_id, length, writer, tail, acked);
+        }
+
         // Closes the TCP connection.
         //
         // Once called, no more data could be sent to the remote TCP using
@@ -383,13 +570,104 @@ struct tcp_t {
     // The function is given the identifier of the new established connection.
     typedef function<conn_handlers_t(conn_t)>           new_conn_callback_t;
 
+    // Callback called instead of the 'new_conn_callback_t' when a connection
+    // can't be opened by a driver (see 'connect()').
+    typedef function<void()>                            conn_failed_callback_t;
+
+    // Predicate which decides if a local port can be used by an active
+    // connection (see 'set_ephemeral_ports()').
+    //
+    // The function is given the identifier the new connection would have.
+    typedef function<bool(tcb_id_t)>                    port_filter_t;
+
+    // Defines when SYN cookies are used to respond to incoming connection
+    // requests on a port.
+    //
+    // When a SYN cookie is used, no TCB is created before the remote
+    // acknowledges the SYN-ACK segment. The initial sequence number of the
+    // SYN-ACK segment encodes the MSS of the remote and a keyed hash of the
+    // connection identifier, so the TCB can be rebuilt from the final ACK of
+    // the handshake.
+    //
+    // If the remote uses timestamps, the timestamp of the SYN-ACK segment
+    // also encodes its window scale and SACK-permitted options, which it
+    // echoes in the final ACK. Without timestamps, only the MSS is retained.
+    enum syn_cookies_t {
+        // Never uses SYN cookies. Connection requests are dropped once the
+        // backlog is full.
+        SYN_COOKIES_DISABLED,
+        // Uses SYN cookies once the backlog is full.
+        SYN_COOKIES_ON_OVERFLOW,
+        // Always uses SYN cookies. The backlog will never be filled.
+        SYN_COOKIES_ALWAYS
+    };
+
+    // Options given when opening a port in the LISTEN state.
+    struct listen_options_t {
+        // Maximum number of connections in the SYN-RECEIVED state.
+        size_t          backlog     = DEFAULT_BACKLOG;
+
+        syn_cookies_t   syn_cookies = SYN_COOKIES_DISABLED;
+    };
+
+    // Counters of a port in the LISTEN state.
+    struct listen_stats_t {
+        // Connections currently in the SYN-RECEIVED state.
+        size_t          syn_received            = 0;
+
+        // Connection requests which have been dropped as the backlog was full.
+        size_t          backlog_overflows       = 0;
+
+        // SYN-ACK segments sent with a SYN cookie.
+        size_t          syn_cookies_sent        = 0;
+
+        // Final ACKs of a handshake which carried a valid SYN cookie.
+        size_t          syn_cookies_accepted    = 0;
+
+        // ACKs received with no matching TCB nor valid SYN cookie.
+        size_t          syn_cookies_rejected    = 0;
+    };
+
+    // Counters of the instance (see 'for_each_stat()').
+    //
+    // Unlike 'listen_stats_t', they can be read by any thread.
+    struct alignas(util::CACHE_LINE_SIZE) stats_t {
+        util::counter_t         received;
+
+        // Received segments ignored by 'IGNORE_SEGMENT()'.
+        util::counter_t         ignored;
+
+        // Segments sent, including the retransmitted ones.
+        util::counter_t         sent;
+        util::counter_t         retransmitted;
+
+        // Out of order payloads which have been dropped as the out of order
+        // queue of their connection was full.
+        util::counter_t         out_of_order_dropped;
+
+        // Transmissions of data segments which have been deferred or reduced
+        // to a single segment, as the physical layer was short of buffers.
+        util::counter_t         tx_deferred;
+
+        // Number of TCBs (gauge), updated when a TCB is created or destroyed.
+        util::counter_t         active_tcbs;
+    };
+
+    // Port in the LISTEN state.
+    struct listen_t {
+        new_conn_callback_t     new_conn_callback;
+
+        listen_options_t        options;
+
+        listen_stats_t          stats;
+    };
+
     // Types related to the 'listens' hash table.
-    typedef pair<const net_t<port_t>, new_conn_callback_t>
-                                                        listens_pair_t;
+    typedef pair<const net_t<port_t>, listen_t>         listens_pair_t;
     typedef typename alloc_t::template rebind<listens_pair_t>::other
                                                         listens_alloc_t;
     typedef unordered_map<
-                net_t<port_t>, new_conn_callback_t,
+                net_t<port_t>, listen_t,
                 hash<net_t<port_t>>, equal_to<net_t<port_t>>,
                 listens_alloc_t
             >                                           listens_t;
@@ -440,6 +718,15 @@ struct tcp_t {
             return (state_t) ((int) a | (int) b);
         }
 
+        // 'true' if the connection has been created by a listening port and
+        // is counted in its backlog (i.e. if our SYN has not been acknowledged
+        // yet).
+        bool                                    in_backlog = false;
+
+        // Number of times the SYN or the SYN-ACK segment has been
+        // retransmitted.
+        unsigned int                            syn_retries = 0;
+
         //
         // Sliding windows
         //
@@ -459,6 +746,19 @@ struct tcp_t {
                                 // segment has been sent. Could be lesser than
                                 // 'next'.
 
+            // Shift count of the windows we announce (RFC 7323). Zero if the
+            // remote doesn't support window scaling.
+            uint8_t     scale   = 0;
+
+            // Returns the value of the window field of the segments we send.
+            //
+            // Windows of SYN segments are never scaled.
+            inline uint16_t advertised(bool syn = false) const
+            {
+                win_size_t window = syn ? size : size >> scale;
+                return (uint16_t) min(window, (win_size_t) UINT16_MAX);
+            }
+
             // Returns 'true' if the given sequence number is inside this
             // receiver window (next <= seq < next + size).
             inline bool in_window(seq_t seq) const
@@ -510,23 +810,20 @@ struct tcp_t {
                                 // used to update 'rwnd'.
             seq_t       wl2;    // Received acknowledgment number of the last
                                 // segment used to update 'rwnd'.
-            win_size_t  cwnd;   // Congestion window size.
 
-            // Slow Start threshold.
-            //
-            // The Slow Start algorithm is used when 'cwnd' < 'ssthresh'.
-            // The Congestion Avoidance algorithm is used otherwise.
-            //
-            // RFC 5681 page 5 specifies that 'ssthresh' should be set to an
-            // arbitrary high value.
-            win_size_t  ssthresh = UINT16_MAX;
+            // Congestion control. Gives the congestion window ('cc.cwnd').
+            cc_t        cc;
+
+            // Shift count of the windows announced by the remote (RFC 7323).
+            // Zero if window scaling is not used.
+            uint8_t     scale   = 0;
 
             // Effective size of the window.
             //
             // When duplicates segments are received, the congestion window is
             // virtually inflated so TCP still emits segments.
             //
-            // Always equals to 'min(rwnd, cwnd + dupacks * mss)'.
+            // Always equals to 'min(rwnd, cc.cwnd + dupacks * mss)'.
             win_size_t  size;
 
             seq_t       unack;  // First sent but unacknowledged byte.
@@ -541,7 +838,7 @@ struct tcp_t {
             // Currently received duplicate ACKs segments.
             int         dupacks = 0;
 
-            // Initializes 'rwnd', 'wl1', 'wl2', 'cwnd', 'size' and 'mss' from a
+            // Initializes 'rwnd', 'wl1', 'wl2', 'cc', 'size' and 'mss' from a
             // received SYN segment (with 'irs' being the Initial Received
             // Sequence number).
             //
@@ -564,7 +861,15 @@ struct tcp_t {
                 // driver can send.
                 mss  = min(mss, tcp->mss);
 
-                this->reset_cwnd();
+                cc.init(mss, clock_t::time_t::now());
+                _update_size();
+            }
+
+            // Returns the size in bytes of a window announced by the remote in
+            // a non-SYN segment.
+            inline win_size_t unscale(uint16_t window) const
+            {
+                return (win_size_t) window << scale;
             }
 
             // Returns 'true' if the given sequence number is inside this
@@ -612,69 +917,42 @@ struct tcp_t {
             // if 'wl1 < seq || (wl1 == seq && wl2 <= ack)' (this prevents old
             // segments to update the window).
             //
-            // Returns 'true' if the window has been updated.
+            // Returns 'true' if the advertised window changed. Segments which
+            // only move 'wl1' and 'wl2' can still be duplicate ACKs (RFC 5681,
+            // page 4).
             bool update_rwnd(
                 seq_t seq, seq_t ack, win_size_t received_size
             )
             {
                 if (wl1 < seq || (wl1 == seq && wl2 <= ack)) {
+                    bool changed = rwnd != received_size;
+
                     rwnd = received_size;
                     _update_size();
                     wl1  = seq;
                     wl2  = ack;
 
-                    return true;
+                    return changed;
                 } else
                     return false;
             }
 
-            // Returns 'true' if the transmission window is currently in the
-            // slow start congestion control algorithm.
-            //
-            // RFC 5681 states that the slow start algorithm should be used when
-            // 'cwnd' < 'ssthresh'.
-            inline bool in_slow_start(void) const
-            {
-                return cwnd < ssthresh;
-            }
-
-            // Resets the congestion window to its initial value.
-            //
-            // This usually occurs when the retransmission timer is trigerred
-            // and that the connection must use the slow start algorithm again.
-            void reset_cwnd(void)
+            // Updates the congestion window on the reception of an ACK which
+            // acknowledges new data.
+            void update_cwnd(const ack_sample_t &sample)
             {
-                // RFC 5681 page 5 tells TCP implementations to use the
-                // following initial congestion window values as upper bound.
-                if (mss <= 1095)
-                    cwnd = 4 * mss;
-                else if (mss <= 2190)
-                    cwnd = 3 * mss;
-                else
-                    cwnd = 2 * mss;
-
+                cc.on_ack(sample, mss);
                 _update_size();
             }
 
-            void update_cwnd(size_t bytes_acked)
+            // Updates the congestion window after a retransmission timeout.
+            void timeout(void)
             {
-                if (in_slow_start()) {
-                    // Increases the congestion window by the number of bytes
-                    // acked, as stated in RFC 5681 page 6.
-                    cwnd += min(bytes_acked, (size_t) mss);
-                } else { // In congestion avoidance.
-                    // Increases the congestion window by one sender MSS per RTT
-                    // using the approximation equation specified in RFC 5681
-                    // page 7.
-                    cwnd += max(
-                        size_t(1), ((size_t) mss * (size_t) mss) / cwnd
-                    );
-                }
-
+                cc.on_timeout(in_flight(), mss, clock_t::time_t::now());
                 _update_size();
             }
 
-            // Updates the window size (by mutating the 'dupacks', 'cwnd' and
+            // Updates the window size (by mutating the 'dupacks', 'cc' and
             // 'size' field to account the reception of a duplicate ack.
             void receive_duplicate_ack(void)
             {
@@ -682,43 +960,237 @@ struct tcp_t {
 
                 if (dupacks == 3) {
                     // We received a third duplicate ACK.
-                    //
-                    // We must set 'ssthresh' using the equation at RFC 5681
-                    // page 7 and updates the congestion window as specified on
-                    // page 9.
-
-                    cwnd = ssthresh = max(in_flight() / 2, (size_t) (2 * mss));
+                    cc.on_loss(in_flight(), mss, clock_t::time_t::now());
                 }
 
                 _update_size();
             }
 
+            // Returns the rate at which segments should be transmitted, in
+            // bytes per second. Zero if transmissions are not paced.
+            inline uint64_t pacing_rate(void) const
+            {
+                return cc.pacing_rate();
+            }
+
         private:
-            // Recomputes 'size' from 'rwnd', 'cwnd' and 'dupacks'.
+            // Recomputes 'size' from 'rwnd', 'cc.cwnd' and 'dupacks'.
             inline void _update_size(void)
             {
-                size = min(rwnd, (win_size_t) (cwnd + dupacks * mss));
+                size = min(rwnd, (win_size_t) (cc.cwnd + dupacks * mss));
             }
         } tx_window;
 
+        //
+        // Options negotiated during the handshake
+        //
+
+        // 'true' if both ends sent the SACK-permitted option (RFC 2018).
+        bool                                    sack_permitted = false;
+
+        // 'true' if both ends sent the timestamps option (RFC 7323). Every
+        // segment then carries a timestamps option.
+        bool                                    timestamps = false;
+
+        // Timestamp of the remote which is echoed in the segments we send
+        // ('TS.Recent' in RFC 7323).
+        uint32_t                                ts_recent = 0;
+
+        //
+        // Loss recovery
+        //
+
+        // First sequence number after the highest data which has been
+        // selectively acknowledged by the remote. Not larger than
+        // 'tx_window.unack' when nothing is SACKed.
+        seq_t                                   sack_high;
+
+        // Set when a third duplicate ACK is received on a connection which
+        // uses SACK. Holes in the SACKed data are retransmitted until
+        // 'recovery_point' is acknowledged (RFC 6675).
+        bool                                    in_recovery = false;
+        seq_t                                   recovery_point;
+
         //
         // Receiving queue
         //
 
-        // Contains a segment's payload (without TCP headers) which has been
-        // delivered out of order.
+        // Contains segment payloads (without TCP headers) which have not been
+        // delivered to the application layer nor acknowledged because they
+        // have been received out of order.
+        //
+        // Payloads are grouped in intervals of contiguous data, sorted by
+        // sequence number. Each interval is a SACK block. Overlapping bytes are
+        // only stored once.
         //
-        // The 'seq_t' key gives the segment number of the first byte of the 
-        // cursor.
-        struct out_of_order_segment_t {
-            seq_t       seq;
-            cursor_t    payload;
+        // Inserting a payload and removing the first interval run in O(log n),
+        // where 'n' is the number of holes in the received data.
+        struct out_of_order_t {
+            //
+            // Member types
+            //
+
+            // Payloads of an interval, in sequence order. A payload starts
+            // where the previous one ends.
+            typedef inline_ring_t<cursor_t, 4, alloc_t> payloads_t;
+
+            struct interval_t {
+                seq_t       end;        // First sequence number after the
+                                        // interval.
+                payloads_t  payloads;
+            };
+
+            // Intervals are indexed by their first sequence number.
+            //
+            // Sequence numbers are compared modulo 2^32 (see 'seq_t'), which
+            // is a total order as all the intervals are inside the receiver
+            // window.
+            typedef pair<const seq_t, interval_t>           intervals_pair_t;
+            typedef typename alloc_t::template rebind<intervals_pair_t>::other
+                                                            intervals_alloc_t;
+            typedef map<seq_t, interval_t, less<seq_t>, intervals_alloc_t>
+                                                            intervals_t;
+
+            //
+            // Fields
+            //
+
+            intervals_t intervals;
+
+            // Number of stored bytes.
+            size_t      size    = 0;
+
+            // First sequence number of the most recently inserted payload.
+            seq_t       last;
+
+            alloc_t     alloc;
+
+            //
+            // Methods
+            //
+
+            out_of_order_t(alloc_t _alloc = alloc_t())
+                : intervals(less<seq_t>(), _alloc), alloc(_alloc)
+            {
+            }
+
+            inline bool empty(void) const
+            {
+                return intervals.empty();
+            }
+
+            // Stores the payload starting at the given sequence number, and
+            // merges it with its neighbouring intervals.
+            //
+            // Returns 'false' if the payload has not been stored because the
+            // queue would contain more than 'max_size' bytes.
+            bool insert(seq_t seq, cursor_t payload, size_t max_size)
+            {
+                size_t  payload_size    = payload.size();
+                seq_t   end             = seq + seq_t(payload_size);
+
+                assert(payload_size > 0);
+
+                // Finds the first interval which overlaps or touches the
+                // payload.
+                auto it = intervals.upper_bound(seq);
+                if (it != intervals.begin()) {
+                    auto prev = std::prev(it);
+                    if (prev->second.end >= seq)
+                        it = prev;
+                }
+
+                if (
+                       it != intervals.end()
+                    && it->first <= seq && it->second.end >= end
+                ) {
+                    // Duplicate of stored data.
+                    last = seq;
+                    return true;
+                }
+
+                if (UNLIKELY(size + payload_size > max_size))
+                    return false;
+
+                last = seq;
+
+                // Fast path: the payload directly follows an interval and
+                // doesn't reach the next one.
+                if (it != intervals.end() && it->second.end == seq) {
+                    auto next = std::next(it);
+                    if (next == intervals.end() || next->first > end) {
+                        it->second.payloads.push_back(payload);
+                        it->second.end = end;
+                        size += payload_size;
+                        return true;
+                    }
+                }
+
+                // Merges the payload and every interval it overlaps or touches
+                // into a single interval. Only the bytes of the payload which
+                // fill the gaps between these intervals are kept.
+
+                seq_t       begin = seq;
+                interval_t  merged { seq, payloads_t(alloc) };
+
+                // Adds the bytes of the payload in [merged.end, until[.
+                auto add_payload = [this, &merged, seq, &payload](seq_t until) {
+                    if (until <= merged.end)
+                        return;
+
+                    size_t offset = (merged.end - seq).value,
+                           length = (until - merged.end).value;
+
+                    merged.payloads.push_back(
+                        payload.drop(offset).take(length)
+                    );
+                    merged.end = until;
+                    size += length;
+                };
+
+                while (it != intervals.end() && it->first <= end) {
+                    if (it->first < begin) {
+                        // The first interval starts before the payload.
+                        begin      = it->first;
+                        merged.end = it->first;
+                    }
+
+                    add_payload(it->first);
+
+                    for (cursor_t &interval_payload : it->second.payloads)
+                        merged.payloads.push_back(move(interval_payload));
+                    merged.end = it->second.end;
+
+                    it = intervals.erase(it);
+                }
+
+                add_payload(end);
+
+                intervals.emplace(begin, move(merged));
+
+                return true;
+            }
+
+            // Removes and returns the first interval.
+            //
+            // 'begin' is set to the first sequence number of the interval.
+            interval_t pop_front(seq_t *begin)
+            {
+                assert(!empty());
+
+                auto first = intervals.begin();
+
+                *begin = first->first;
+                interval_t interval = move(first->second);
+                size -= (interval.end - *begin).value;
+
+                intervals.erase(first);
+
+                return interval;
+            }
         };
 
-        // Contains segment payloads which have not been delivered to the
-        // application layer nor acknowledged because they have been delivered
-        // out of order.
-        vector<out_of_order_segment_t, alloc_t>         out_of_order;
+        out_of_order_t                                  out_of_order;
 
         //
         // Transmission queues
@@ -736,34 +1208,106 @@ struct tcp_t {
         // sequence number of the preceding entry ('seq' of the N-th entry is
         // equal to 'seq + size' of the N-1-th entry).
 
+        // Number of entries which are stored inside the TCB by each
+        // transmission queue and by the transmission history.
+        //
+        // Large enough for a short HTTP exchange.
+        static constexpr size_t TX_QUEUE_INLINE_ENTRIES     = 2;
+        static constexpr size_t TX_HISTORY_INLINE_ENTRIES   = 4;
+
         // A queue entry contains a function able to write data from 'begin'
         // (included) to 'end' (excluded). The 'acked' function is called once
         // the whole entry has been transmitted and acknowledged.
+        //
+        // The last 'tail.size' bytes of the entry are not written by the
+        // function but are static data.
         struct tx_queue_entry_t {
             seq_t                               begin;
             seq_t                               end;
 
             // Function provided by the user to write data into transmission
             // buffers.
-            writer_sum_t                        writer;
+            //
+            // Only one of the two writers is set, depending on the 'send()'
+            // method used by the application.
+            writer_t                            writer;
+            writer_sum_t                        writer_sum;
+
+            static_data_t                       tail = { nullptr, 0, nullptr };
 
             // Function which is called once all the data provided by the writer
             // has been acked by the remote.
             acked_callback_t                    acked;
+
+            // Number of bytes written by the writer.
+            inline size_t head_size(void) const
+            {
+                return (end - begin).value - tail.size;
+            }
+
+            // Writes the data starting at 'offset' into the cursor, and returns
+            // its partial checksum.
+            //
+            // Static data is copied.
+            inline partial_sum_t write(size_t offset, cursor_t out) const
+            {
+                if (LIKELY(tail.size == 0))
+                    return write_head(offset, out);
+
+                size_t head = head_size();
+                partial_sum_t partial_sum = partial_sum_t::ZERO;
+
+                if (offset < head) {
+                    size_t n = min(out.size(), head - offset);
+                    partial_sum = write_head(offset, out.take(n));
+                    out = out.drop(n);
+                    offset = head;
+                }
+
+                if (!out.empty()) {
+                    partial_sum = partial_sum.append(
+                        tail.write(offset - head, out)
+                    );
+                }
+
+                return partial_sum;
+            }
+
+            // Calls the writer of the application.
+            inline partial_sum_t write_head(size_t offset, cursor_t out) const
+            {
+                if (writer_sum)
+                    return writer_sum(offset, out);
+                else {
+                    writer(offset, out);
+                    return partial_sum_t(out);
+                }
+            }
         };
 
+        // Queues and the transmission history store their first entries
+        // inside the TCB. Memory is only allocated when an application queues
+        // more entries or when more segments are in flight.
+        typedef inline_ring_t<tx_queue_entry_t, TX_QUEUE_INLINE_ENTRIES, alloc_t>
+                                                tx_queue_t;
+
         // Contains entries which have been entirely sent but which have not
         // been entirely acknowledged yet.
         //
         // Entries will be removed once they have been fully acknowledged.
-        deque<tx_queue_entry_t, alloc_t>        tx_queue_sent_unack;
+        tx_queue_t                              tx_queue_sent_unack;
 
         // Contains entries which are pending to be sent.
         //
         // The first entry of this queue may be partially sent. Once an entry
         // has been fully transmitted, it is moved into the
         // 'tx_queue_sent_unack' queue.
-        deque<tx_queue_entry_t, alloc_t>        tx_queue_not_sent;
+        tx_queue_t                              tx_queue_not_sent;
+
+        // 'true' if the connection has been closed by the application while
+        // 'tx_queue_not_sent' was not empty. The FIN control bit is then sent
+        // with the last byte of the queue by '_respond_with_data_segments()'.
+        bool                                    fin_pending = false;
 
         // History entry of a transmitted segments.
         //
@@ -778,22 +1322,56 @@ struct tcp_t {
             // when estimating the Round Trip Time.
             bool                        retransmitted = false;
 
-            tx_history_entry_t(seq_t _end)
-                : end(_end), tx_time(clock_t::time_t::now())
+            // 'true' if selectively acknowledged by the remote.
+            bool                        sacked = false;
+
+            // 'true' if retransmitted as a hole in the SACKed data during the
+            // current recovery.
+            bool                        hole_retransmitted = false;
+
+            // Values of 'tcb_t::delivered' and 'tcb_t::delivered_time' when
+            // the segment was sent. Used to measure the delivery rate.
+            uint64_t                    delivered;
+            typename clock_t::time_t    delivered_time;
+
+            // 'true' if the segment was sent while the connection was
+            // application-limited.
+            bool                        is_app_limited;
+
+            tx_history_entry_t(
+                seq_t _end, typename clock_t::time_t now, uint64_t _delivered,
+                typename clock_t::time_t _delivered_time, bool _is_app_limited
+            )
+                : end(_end), tx_time(now), delivered(_delivered),
+                  delivered_time(_delivered_time),
+                  is_app_limited(_is_app_limited)
             {
             }
         };
 
         // History of unacknowledged segments. Entries are kept sorted in
         // ascending order.
-        deque<tx_history_entry_t, alloc_t>  tx_history;
+        //
+        // Also used as the SACK scoreboard. A segment starts at the end of the
+        // previous entry, or at 'tx_window.unack' for the first one.
+        inline_ring_t<tx_history_entry_t, TX_HISTORY_INLINE_ENTRIES, alloc_t>
+                                            tx_history;
+
+        // Number of bytes acknowledged since the beginning of the connection,
+        // and when the last of them has been acknowledged.
+        uint64_t                            delivered = 0;
+        typename clock_t::time_t            delivered_time;
+
+        // When not zero, the transmission is limited by the application rather
+        // than by the network, until 'delivered' exceeds this value.
+        uint64_t                            app_limited = 0;
 
         // Data used by TCP to compute the Retransmission Time Out (RTO) by
         // estimating the round trip time to the remote TCP.
         struct rtt_t {
             // Factor stated by RFC 6298 page 3.
-            static constexpr double ALPHA   = 1 / 8;
-            static constexpr double BETA    = 1 / 4;
+            static constexpr double ALPHA   = 1.0 / 8;
+            static constexpr double BETA    = 1.0 / 4;
 
             // Retranmission TimeOut. Based on the RTT.
             typename clock_t::interval_t        rto;
@@ -811,43 +1389,28 @@ struct tcp_t {
             {
             }
 
-            // Updates the estimated RTT using the observed RTT of the incoming
-            // acknowledgment segment and the transmission history.
+            // Updates the RTO with a RTT measurement.
             //
             // Uses the method in RFC 6298 page 3.
-            void update_rtt(tcb_t *tcb, seq_t ack)
+            void update_rtt(typename clock_t::interval_t rtt)
             {
-                typename clock_t::time_t now = clock_t::time_t::now();
-
-                while (!tcb->tx_history.empty()) {
-                    const tx_history_entry_t *entry = &tcb->tx_history.front();
-
-                    if (entry->end > ack)
-                        break;
-
-                    // Measured RTT.
-                    typename clock_t::interval_t rtt = now - entry->tx_time;
-
-                    tcb->tx_history.pop_front();
-
-                    if (!entry->retransmitted)
-                        continue;
-
-                    if (first) {
-                        // First measurement.
-                        srtt    = rtt;
-                        rttvar  = rtt * 0.5;
-                        first   = false;
-                    } else {
-                        // Subsequent measurements.
-                        rttvar  = rttvar * (1 - BETA) + (srtt - rtt) * BETA;
-                        srtt    = srtt * (1 - ALPHA) + rtt * ALPHA;
-                    }
+                if (first) {
+                    // First measurement.
+                    srtt    = rtt;
+                    rttvar  = rtt * 0.5;
+                    first   = false;
+                } else {
+                    // Subsequent measurements.
+                    typename clock_t::interval_t delta =
+                        srtt < rtt ? rtt - srtt : srtt - rtt;
 
-                    // RTO can not be less than one second.
-                    static const typename clock_t::interval_t ONE_SEC(1000000);
-                    rto = min(ONE_SEC, srtt + rttvar * 4);
+                    rttvar  = rttvar * (1 - BETA) + delta * BETA;
+                    srtt    = srtt * (1 - ALPHA) + rtt * ALPHA;
                 }
+
+                // RTO can not be less than one second.
+                static const typename clock_t::interval_t ONE_SEC(1000000);
+                rto = max(ONE_SEC, srtt + rttvar * 4);
             }
         } rtt;
 
@@ -859,6 +1422,40 @@ struct tcp_t {
         timer_id_t                              timer;
         bool                                    has_timer;
 
+        #ifdef TCP_LAZY_TIMERS
+            // Time at which the retransmission timer should expire.
+            //
+            // Acknowledgments only move this deadline forward instead of
+            // rescheduling the timer. The timer checks the deadline when it
+            // fires and re-queues itself if it has been moved.
+            typename clock_t::time_t            rtx_deadline;
+
+            // Time at which the scheduled retransmission timer expires.
+            typename clock_t::time_t            rtx_timer_expire;
+        #endif /* TCP_LAZY_TIMERS */
+
+        #ifdef TCP_PACING
+            // Timer which resumes the transmission of a paced connection once
+            // its previous burst has been sent at the pacing rate.
+            //
+            // If 'has_pacing_timer' is false, contains an undefined value.
+            timer_id_t                          pacing_timer;
+            bool                                has_pacing_timer = false;
+        #endif /* TCP_PACING */
+
+        // Delayed acknowledgments (RFC 1122 page 96).
+        //
+        // 'ack_queued' is 'true' if the connection is in the 'ack_queue' of
+        // the TCP instance, and will be acknowledged at the end of the batch
+        // of received segments.
+        //
+        // 'ack_timer' sends the acknowledgment of data which has not been
+        // acknowledged after DELAYED_ACK_TIMEOUT. If 'has_ack_timer' is
+        // false, contains an undefined value.
+        bool                                    ack_queued      = false;
+        timer_id_t                              ack_timer;
+        bool                                    has_ack_timer   = false;
+
         // Functions provided by the application layer to manage connection
         // events.
         conn_handlers_t                         conn_handlers;
@@ -874,31 +1471,131 @@ struct tcp_t {
             return this->state & states;
         }
 
-        // Updates the tranmission queue with the received ack segment.
-        void update_tx_queues(seq_t ack)
+        // Adds a transmitted segment to the transmission history.
+        void push_history(seq_t end)
         {
-            // Removes transmission queue entries which have been acknowledged.
-            while (!tx_queue_sent_unack.empty()) {
-                const auto *entry = &tx_queue_sent_unack.front();
+            typename clock_t::time_t now = clock_t::time_t::now();
 
-                if (entry->end <= ack) {
-                    entry->acked();
-                    tx_queue_sent_unack.pop_front();
-                } else
-                    break;
-            }
+            // The delivery rate is measured from the transmission of the first
+            // segment when nothing was in flight.
+            if (tx_history.empty())
+                delivered_time = now;
+
+            tx_history.emplace_back(
+                end, now, delivered, delivered_time, app_limited > 0
+            );
+        }
+
+        // Marks the connection as application-limited if all the queued data
+        // has been sent while the window could carry more.
+        void check_app_limited(void)
+        {
+            if (tx_queue_not_sent.empty() && tx_window.can_transmit()) {
+                app_limited = max<uint64_t>(
+                    delivered + tx_window.in_flight(), 1
+                );
+            }
+        }
+
+        // Removes the segments acknowledged by 'ack' from the transmission
+        // history, and measures the RTT and the delivery rate of the most
+        // recent of them.
+        //
+        // The RTT of a retransmitted segment is not measured (Karn's
+        // algorithm).
+        void acknowledge_history(
+            seq_t ack, size_t bytes_acked, ack_sample_t *sample
+        )
+        {
+            typename clock_t::time_t now = clock_t::time_t::now();
+
+            delivered       += bytes_acked;
+
+            if (app_limited > 0 && delivered > app_limited)
+                app_limited = 0;
+
+            sample->now             = now;
+            sample->bytes_acked     = bytes_acked;
+            sample->delivered       = delivered;
+            sample->prior_delivered = delivered;
+
+            bool acked = false;
+            tx_history_entry_t last(
+                ack, now, delivered, delivered_time, false
+            );
+
+            while (!tx_history.empty() && tx_history.front().end <= ack) {
+                last  = tx_history.front();
+                acked = true;
+                tx_history.pop_front();
+            }
+
+            if (acked) {
+                if (!last.retransmitted) {
+                    sample->has_rtt = true;
+                    sample->rtt     = now - last.tx_time;
+                }
+
+                sample->prior_delivered = last.delivered;
+                sample->is_app_limited  = last.is_app_limited;
+
+                uint64_t elapsed = (now - last.delivered_time).microsec();
+                if (elapsed > 0) {
+                    sample->delivery_rate =
+                        (delivered - last.delivered) * 1000000 / elapsed;
+                }
+            }
+
+            delivered_time = now;
+        }
+
+        // Updates the tranmission queue with the received ack segment.
+        void update_tx_queues(seq_t ack)
+        {
+            // Removes transmission queue entries which have been acknowledged.
+            while (!tx_queue_sent_unack.empty()) {
+                const auto *entry = &tx_queue_sent_unack.front();
+
+                if (entry->end <= ack) {
+                    entry->acked();
+                    tx_queue_sent_unack.pop_front();
+                } else
+                    break;
+            }
+        }
+    };
+
+    // Connections to acknowledge at the end of the batch of received segments.
+    typedef typename alloc_t::template rebind<tcb_id_t>::other
+                                                        ack_queue_alloc_t;
+    typedef vector<tcb_id_t, ack_queue_alloc_t>         ack_queue_t;
+
+    // References to the transmission queue entries sent by data segments.
+    typedef const typename tcb_t::tx_queue_entry_t *    to_send_entry_t;
+    typedef typename alloc_t::template rebind<to_send_entry_t>::other
+                                                        to_send_alloc_t;
+    typedef vector<to_send_entry_t, to_send_alloc_t>    to_send_vec_t;
+
+    // Copies of the entries sent by data segments whose transmission is delayed
+    // by the network layer (see '_to_send_refs()').
+    struct to_send_copy_t {
+        vector<typename tcb_t::tx_queue_entry_t, alloc_t>   entries;
+        to_send_vec_t                                       refs;
+
+        to_send_copy_t(alloc_t alloc) : entries(alloc), refs(alloc)
+        {
         }
     };
 
     // Types related to the 'tcbs' hash table.
-    typedef pair<const tcb_id_t, tcb_t>                 tcbs_pair_t;
-    typedef typename alloc_t::template rebind<tcbs_pair_t>::other
-                                                        tcbs_alloc_t;
-    typedef unordered_map<
-                tcb_id_t, tcb_t,
-                hash<tcb_id_t>, equal_to<tcb_id_t>,
-                tcbs_alloc_t
-            >                                           tcbs_t;
+    #ifdef TCP_FLOW_HASH
+        typedef tcp_flow_hash_t<addr_t, port_t>         tcbs_hash_t;
+    #else
+        typedef hash<tcb_id_t>                          tcbs_hash_t;
+    #endif /* TCP_FLOW_HASH */
+
+    typedef conn_table_t<tcb_id_t, tcb_t, tcbs_hash_t, alloc_t>
+                                                        tcbs_t;
     //
     // Static fields
     //
@@ -907,23 +1604,89 @@ struct tcp_t {
 
     static const     options_t                  EMPTY_OPTIONS;
 
-    // Initial size of the receiver (local) window in bytes.
+    // Size of the receiver (local) window in bytes when the remote doesn't
+    // support window scaling.
     //
     // 29,200 bytes is the default value on Linux with 10 Gbps links.
     static constexpr win_size_t                 INITIAL_WND_SIZE = 29200;
 
+    // Maximum number of out of order bytes which will be retained by a
+    // connection before starting to drop segments.
+    //
+    // Each stored payload holds an mPIPE buffer. The limit prevents a few
+    // lossy connections from draining the buffer stacks of the worker.
+    static constexpr size_t                     MAX_OUT_OF_ORDER_SIZE =
+                                                    256 * 1024;
+
+    // Size of the receiver window and shift count announced when the remote
+    // supports window scaling.
+    //
+    // Received data is directly delivered to the application. The window only
+    // bounds the data the remote can send in a round trip, and thus the out of
+    // order data that must be retained after a loss. It is clamped to
+    // MAX_OUT_OF_ORDER_SIZE so that no segment of the window is dropped by the
+    // reassembly. 256 KB fill a 10 Gbps link up to a RTT of 200 us.
+    static constexpr win_size_t                 SCALED_WND_SIZE =
+                                                    MAX_OUT_OF_ORDER_SIZE;
+    static constexpr uint8_t                    WND_SCALE       = 7;
+
+    static_assert(
+        (SCALED_WND_SIZE >> WND_SCALE) <= UINT16_MAX,
+        "SCALED_WND_SIZE can't be announced with WND_SCALE"
+    );
+
+    static_assert(
+        INITIAL_WND_SIZE <= MAX_OUT_OF_ORDER_SIZE,
+        "INITIAL_WND_SIZE exceeds what the reassembly retains"
+    );
+
     // Delay in which a connection stays in the TIME-WAIT state before being
     // removed ("2MSL" timeout).
     static const typename clock_t::interval_t   FIN_TIMEOUT;
 
-    // Maximum number of out of order segments which will be retained before
-    // starting to drop them.
-    //
-    // NOTE: current implementation is not efficient (quadradic against the
-    // number of out of order segments), but shouldn't be an issue as storing a
-    // large a number of out of order segments is not appealing (Linux use 3 as
-    // default value).
-    static constexpr size_t                     MAX_OUT_OF_ORDER_SEGS = 3;
+    // Maximum delay before acknowledging received data, unless a second full
+    // sized segment is received (RFC 1122 requires less than 500 ms).
+    static const typename clock_t::interval_t   DELAYED_ACK_TIMEOUT;
+
+    // Maximum number of data segments which are given at once to the network
+    // layer. Larger transmissions are sent in several bursts.
+    static constexpr size_t                     MAX_BURST_SEGS = 16;
+
+    #ifdef TCP_PACING
+        // Pacing rate of the congestion control algorithms which don't pace
+        // their transmissions, in percents of 'cwnd / srtt', during and after
+        // Slow Start (same ratios as Linux).
+        static constexpr uint64_t               PACING_SS_RATIO = 200;
+        static constexpr uint64_t               PACING_CA_RATIO = 120;
+
+        // Paced connections transmit bursts of this length, in microseconds,
+        // and of at least two segments.
+        static constexpr uint64_t               PACING_QUANTUM  = 1000;
+    #endif /* TCP_PACING */
+
+    // Default maximum number of connections in the SYN-RECEIVED state for
+    // a listening port.
+    static constexpr size_t                     DEFAULT_BACKLOG = 128;
+
+    // Number of times a SYN-ACK segment is retransmitted before the connection
+    // in the SYN-RECEIVED state is reset (Linux uses 5).
+    static constexpr unsigned int               MAX_SYN_ACK_RETRIES = 5;
+
+    // Number of times a SYN segment is retransmitted before the connection in
+    // the SYN-SENT state is reset (Linux uses 6).
+    static constexpr unsigned int               MAX_SYN_RETRIES = 6;
+
+    // Default range of the local ports used by active connections (IANA
+    // dynamic ports).
+    static constexpr port_t                     DEFAULT_EPHEMERAL_FIRST = 49152;
+    static constexpr port_t                     DEFAULT_EPHEMERAL_LAST  = 65535;
+
+    // Delay in microseconds between two increments of the counter encoded in
+    // SYN cookies.
+    static constexpr uint64_t                   SYN_COOKIE_PERIOD = 64000000;
+
+    // Number of counter increments after which a SYN cookie expires.
+    static constexpr uint32_t                   SYN_COOKIE_MAX_AGE = 2;
 
     //
     // Fields
@@ -940,16 +1703,42 @@ struct tcp_t {
     // connections.
     //
     // Each open port maps to a callback function provided by the application to
-    // handle new connections.
+    // handle new connections, and to its backlog.
     listens_t       listens;
 
     // TCP Control Blocks for active connections.
     tcbs_t          tcbs;
 
+    // Local ports which can be used by 'connect()', the predicate they must
+    // satisfy, and the next port to try.
+    port_t          ephemeral_first = DEFAULT_EPHEMERAL_FIRST;
+    port_t          ephemeral_last  = DEFAULT_EPHEMERAL_LAST;
+    port_filter_t   port_filter;
+    port_t          ephemeral_next  = DEFAULT_EPHEMERAL_FIRST;
+
+    // Connections which received segments that must be acknowledged at the end
+    // of the current batch. Merges the acknowledgments of the segments of a
+    // connection received in the same batch.
+    ack_queue_t     ack_queue;
+
+    // References to the entries sent by the last data segments. Reused by each
+    // transmission (see '_to_send_refs()').
+    to_send_vec_t   to_send;
+
+    stats_t         stats;
+
     // Maximum segment size (TCP segment payload, without headers but with
     // options) that this TCP instance can emit.
     mss_t           mss;
 
+    // Key of the hash encoded in SYN cookies, and time from which the counter
+    // of SYN cookies starts.
+    uint64_t                    syn_cookie_secret;
+    typename clock_t::time_t    syn_cookie_epoch;
+
+    // Time from which the values of the timestamps option are counted.
+    typename clock_t::time_t    ts_epoch;
+
     //
     // Methods
     //
@@ -960,7 +1749,10 @@ struct tcp_t {
     tcp_t(alloc_t _alloc = alloc_t())
       : alloc(_alloc),
         listens(0, hash<net_t<port_t>>(), equal_to<net_t<port_t>>(), _alloc),
-        tcbs(0, hash<tcb_id_t>(), equal_to<tcb_id_t>(), _alloc)
+        tcbs(_alloc), ack_queue(_alloc), to_send(_alloc),
+        syn_cookie_secret(_random_secret()),
+        syn_cookie_epoch(clock_t::time_t::now()),
+        ts_epoch(syn_cookie_epoch)
     {
     }
 
@@ -973,8 +1765,11 @@ struct tcp_t {
         alloc_t _alloc = alloc_t()
     ) : network(_network), timers(_timers), alloc(_alloc),
         listens(0, hash<net_t<port_t>>(), equal_to<net_t<port_t>>(), _alloc),
-        tcbs(0, hash<tcb_id_t>(), equal_to<tcb_t>(), _alloc),
-        mss(_network->max_payload_size - HEADER_SIZE)
+        tcbs(_alloc), ack_queue(_alloc), to_send(_alloc),
+        mss(_network->max_payload_size - HEADER_SIZE),
+        syn_cookie_secret(_random_secret()),
+        syn_cookie_epoch(clock_t::time_t::now()),
+        ts_epoch(syn_cookie_epoch)
     {
     }
 
@@ -988,6 +1783,7 @@ struct tcp_t {
 
     #define IGNORE_SEGMENT(WHY, ...)                                           \
         do {                                                                   \
+            this->stats.ignored.inc();                                         \
             TCP_ERROR(                                                         \
                 "Segment from %s:%" PRIu16 " ignored: " WHY,                   \
                 network_t::addr_t::to_alpha(tcb_id.raddr),                     \
@@ -1020,9 +1816,14 @@ struct tcp_t {
     // Usually called by the network layer.
     void receive_segment(net_t<addr_t> saddr, cursor_t cursor)
     {
+        TRACE_SCOPE(TRACE_TCP);
+
         size_t seg_size = cursor.size();
 
+        this->stats.received.inc();
+
         if (UNLIKELY(seg_size < HEADER_SIZE)) {
+            this->stats.ignored.inc();
             TCP_ERROR("Segment ignored: too small to hold a TCP header");
             return;
         }
@@ -1088,9 +1889,9 @@ struct tcp_t {
 
             TCP_TCB_DEBUG("Segment received");
 
-            auto tcb_it = this->tcbs.find(tcb_id);
+            tcb_t *tcb = this->tcbs.find(tcb_id);
 
-            if (tcb_it == this->tcbs.end()) {
+            if (tcb == nullptr) {
                 // No existing TCB for the connection.
 
                 auto listen_it = this->listens.find(hdr->dport);
@@ -1102,18 +1903,64 @@ struct tcp_t {
                 } else
                     this->_handle_closed_state(saddr, hdr, payload);
             } else {
-                tcb_t *tcb = &tcb_it->second;
-
                 if (tcb->in_state(tcb_t::SYN_SENT)) {
                     this->_handle_syn_sent_state(
                         hdr, options, payload, tcb_id, tcb
                     );
-                } else
-                    this->_handle_other_states(hdr, payload, tcb_id, tcb);
+                } else {
+                    this->_handle_other_states(
+                        hdr, options, payload, tcb_id, tcb
+                    );
+                }
             }
         });
     }
 
+    // Starts to load the slot of the connection table which will be probed
+    // when processing the segment of the given contiguous bytes.
+    //
+    // See 'ethernet_t::prefetch_frame()'.
+    inline void prefetch_segment(
+        net_t<addr_t> saddr, const char *segment, size_t size
+    ) const
+    {
+        if (UNLIKELY(size < HEADER_SIZE))
+            return;
+
+        const header_t *hdr = (const header_t *) segment;
+
+        tcb_id_t tcb_id = { saddr, hdr->sport, hdr->dport };
+        this->tcbs.prefetch(tcb_id);
+    }
+
+    // Sends the acknowledgments which have been deferred while processing the
+    // last batch of received segments.
+    //
+    // Connections which have already acknowledged their received data, by
+    // sending data segments, are skipped.
+    //
+    // See 'ethernet_t::end_of_batch()'.
+    void end_of_batch(void)
+    {
+        if (LIKELY(this->ack_queue.empty()))
+            return;
+
+        for (tcb_id_t tcb_id : this->ack_queue) {
+            tcb_t *tcb = this->tcbs.find(tcb_id);
+
+            // The connection could have been closed during the batch.
+            if (tcb == nullptr || !tcb->ack_queued)
+                continue;
+
+            tcb->ack_queued = false;
+
+            if (tcb->rx_window.acked < tcb->rx_window.next)
+                this->_respond_with_ack_segment(tcb_id, tcb);
+        }
+
+        this->ack_queue.clear();
+    }
+
     #define TCP_TCB_STATE_CHANGE(FROM, TO)                                     \
         TCP_TCB_DEBUG("State changed (" FROM " -> " TO ")");
 
@@ -1125,11 +1972,18 @@ struct tcp_t {
     //
     // If the port was already in the listen state, replaces the previous
     // callback function.
-    void listen(port_t port, new_conn_callback_t new_conn_callback)
+    void listen(
+        port_t port, new_conn_callback_t new_conn_callback,
+        listen_options_t options
+    )
     {
         assert(this->listens.find(port) == this->listens.end());
 
-        this->listens.emplace(port, new_conn_callback);
+        listen_t listen;
+        listen.new_conn_callback    = new_conn_callback;
+        listen.options              = options;
+
+        this->listens.emplace(port, listen);
 
         TCP_DEBUG(
             "State change for local port %" PRIu16 ": from CLOSED to LISTEN",
@@ -1137,10 +1991,284 @@ struct tcp_t {
         );
     }
 
+    // Starts listening for TCP connections on the given port with the default
+    // backlog and without SYN cookies.
+    inline void listen(port_t port, new_conn_callback_t new_conn_callback)
+    {
+        this->listen(port, new_conn_callback, listen_options_t());
+    }
+
+    // Returns the counters of a port in the LISTEN state.
+    listen_stats_t listen_stats(port_t port) const
+    {
+        auto listen_it = this->listens.find(port);
+        assert(listen_it != this->listens.end());
+
+        return listen_it->second.stats;
+    }
+
+    // Calls 'f(tcb_id_t)' with the identifier of every connection which has a
+    // TCB, including connections which are being opened or closed.
+    //
+    // Drivers use it to know which flows are handled by this instance.
+    template <typename F>
+    void for_each_tcb_id(F f) const
+    {
+        this->tcbs.for_each([&f](const tcb_id_t &tcb_id, const tcb_t *) {
+            f(tcb_id);
+        });
+    }
+
+    // Uses the key and the epoch of the SYN cookies of the given instance, and
+    // its epoch of timestamps.
+    //
+    // The acknowledgment of a SYN cookie can be received by another instance
+    // than the one which sent the cookie, when the driver moves flows between
+    // instances. Instances which share their keys validate the cookies of each
+    // other.
+    //
+    // Must be called before any segment is received.
+    void share_syn_cookies(const this_t &other)
+    {
+        this->syn_cookie_secret = other.syn_cookie_secret;
+        this->syn_cookie_epoch  = other.syn_cookie_epoch;
+        this->ts_epoch          = other.ts_epoch;
+    }
+
+    //
+    // Client sockets.
+    //
+
+    // Sets the range of local ports used by 'connect()'.
+    //
+    // If a filter is given, a port is only used if the filter accepts the
+    // identifier of the new connection. Drivers use it to choose ports for
+    // which the segments sent by the remote will be received by this instance.
+    void set_ephemeral_ports(
+        port_t first, port_t last, port_filter_t filter = port_filter_t()
+    )
+    {
+        assert(first <= last);
+
+        this->ephemeral_first   = first;
+        this->ephemeral_last    = last;
+        this->port_filter       = filter;
+        this->ephemeral_next    = first;
+    }
+
+    // Opens a connection to the given remote address and port.
+    //
+    // The callback is immediately called with the new connection, which is in
+    // the SYN-SENT state, and returns its handlers. Data sent before the
+    // connection is established is transmitted once the remote acknowledges
+    // our SYN segment. The 'reset' handler is called if the remote refuses
+    // the connection or never responds.
+    //
+    // Returns 'false', without calling the callback, if no local port is
+    // available for this remote.
+    bool connect(
+        net_t<addr_t> raddr, port_t rport, new_conn_callback_t new_conn_callback
+    )
+    {
+        tcb_id_t tcb_id;
+        tcb_id.raddr = raddr;
+        tcb_id.rport = rport;
+
+        if (UNLIKELY(!this->_ephemeral_port(&tcb_id))) {
+            TCP_ERROR(
+                "No free local port to connect to %s:%" PRIu16,
+                network_t::addr_t::to_alpha(raddr), rport
+            );
+            return false;
+        }
+
+        TCP_TCB_STATE_CHANGE("CLOSED", "SYN-SENT");
+
+        seq_t iss = _get_current_tcp_seq(); // Initial Sender Sequence number.
+
+        tcb_t *tcb = this->tcbs.emplace(tcb_id, this->alloc);
+        this->stats.active_tcbs.set(this->tcbs.size());
+
+        tcb->state = tcb_t::SYN_SENT;
+
+        tcb->tx_window.unack = iss;
+        tcb->tx_window.next  = iss + seq_t(1);
+
+        // The window of the SYN segment is never scaled. The final window is
+        // set by '_init_options()' from the options of the SYN-ACK segment.
+        tcb->rx_window.size  = INITIAL_WND_SIZE;
+        tcb->rx_window.scale = WND_SCALE;
+
+        this->_send_syn_segment(tcb_id, tcb);
+
+        this->_schedule_retransmission_timer(tcb_id, tcb);
+
+        conn_t conn = { this, tcb_id };
+        conn_handlers_t conn_handlers = new_conn_callback(conn);
+
+        // The callback could have closed the connection.
+        tcb = this->tcbs.find(tcb_id);
+        if (tcb != nullptr)
+            tcb->conn_handlers = conn_handlers;
+
+        return true;
+    }
+
+    // Calls 'f(const char *name, uint64_t value)' with every counter of the
+    // instance.
+    //
+    // Can be called by any thread, while the owner of the instance is running.
+    template <typename F>
+    void for_each_stat(F f) const
+    {
+        f("tcp.received",               this->stats.received.get());
+        f("tcp.ignored",                this->stats.ignored.get());
+        f("tcp.sent",                   this->stats.sent.get());
+        f("tcp.retransmitted",          this->stats.retransmitted.get());
+        f("tcp.out_of_order_dropped",   this->stats.out_of_order_dropped.get());
+        f("tcp.tx_deferred",            this->stats.tx_deferred.get());
+        f("tcp.active_tcbs",            this->stats.active_tcbs.get());
+    }
+
 private:
 
-    // Vector type used in the call to '_send_data_segment()'.
-    typedef vector<typename tcb_t::tx_queue_entry_t, alloc_t>   to_send_vec_t;
+    // Data segments of a connection which are given at once to the network
+    // layer by '_respond_with_data_segments()'.
+    //
+    // The segments only differ by their sequence number, their FIN control bit
+    // and their payload. The other header fields and the options are written
+    // and summed once in templates. Each segment then only sums its sequence
+    // number, its size and its payload.
+    //
+    // Implements the interface required by 'network_t::send_tcp_payloads()'.
+    struct _data_burst_t {
+        struct segment_t {
+            seq_t                                   seq;
+            size_t                                  payload_size;
+
+            // Entries of 'to_send' which are (partially) sent in the segment.
+            typename to_send_vec_t::const_iterator  begin;
+            typename to_send_vec_t::const_iterator  end;
+
+            // Static data which is sent by reference at the end of the
+            // segment.
+            static_extent_t                         tail;
+            partial_sum_t                           tail_sum;
+
+            bool                                    has_fin;
+        };
+
+        // Header with a zero sequence number and checksum, and sums of this
+        // header with the ACK and with the FIN and ACK control bits.
+        header_t                    hdr;
+        partial_sum_t               ack_hdr_sum;
+        partial_sum_t               fin_ack_hdr_sum;
+
+        // Options cannot be larger than 40 bytes.
+        char                        options[40];
+        size_t                      options_size;
+        partial_sum_t               options_sum;
+
+        // Sum of the pseudo header with a zero segment size.
+        partial_sum_t               pseudo_hdr_sum;
+
+        // Owns the entries referenced by the segments if the transmission is
+        // delayed.
+        shared_ptr<to_send_copy_t>  to_send_copy;
+
+        segment_t                   segments[MAX_BURST_SEGS];
+        size_t                      n_segments  = 0;
+
+        inline size_t size(void) const
+        {
+            return n_segments;
+        }
+
+        inline size_t payload_size(size_t i) const
+        {
+            return HEADER_SIZE + options_size + segments[i].payload_size;
+        }
+
+        inline static_extent_t tail(size_t i) const
+        {
+            return segments[i].tail;
+        }
+
+        // Writes the 'i'th segment, without its tail.
+        void write(size_t i, cursor_t cursor) const
+        {
+            const segment_t &seg = segments[i];
+
+            cursor_t hdr_cursor = cursor;
+
+            cursor = cursor.drop(HEADER_SIZE);
+            if (options_size > 0)
+                cursor = cursor.write(options, options_size);
+
+            partial_sum_t payload_sum = _write_entries(
+                seg.begin, seg.end, seg.seq, cursor
+            ).append(seg.tail_sum);
+
+            net_t<seq_t>      seq(seg.seq);
+            net_t<seg_size_t> seg_size((seg_size_t) payload_size(i));
+
+            // Every part is made of 16 bits words, their sums can be appended
+            // in any order.
+            partial_sum_t partial_sum =
+                (seg.has_fin ? fin_ack_hdr_sum : ack_hdr_sum)
+                    .append(partial_sum_t(&seq, sizeof (seq)))
+                    .append(pseudo_hdr_sum)
+                    .append(partial_sum_t(&seg_size, sizeof (seg_size)))
+                    .append(options_sum)
+                    .append(payload_sum);
+
+            hdr_cursor.template write_with<header_t>(
+            [this, &seg, seq, partial_sum](header_t *seg_hdr) {
+                *seg_hdr       = hdr;
+                seg_hdr->seq   = seq;
+
+                if (seg.has_fin)
+                    seg_hdr->flags = _FIN_ACK_FLAGS;
+
+                seg_hdr->check = checksum_t(partial_sum);
+            });
+        }
+    };
+
+    // Reference to a burst given to 'network_t::send_tcp_payloads()'.
+    //
+    // Bursts are built in 'data_burst', which is reused by every transmission,
+    // and are given by reference to the network layer. A burst whose
+    // transmission is delayed by the network layer is allocated, and is owned
+    // by its reference.
+    struct _data_burst_ref_t {
+        const _data_burst_t         *burst;
+        shared_ptr<_data_burst_t>   owner;
+
+        inline size_t size(void) const
+        {
+            return burst->size();
+        }
+
+        inline size_t payload_size(size_t i) const
+        {
+            return burst->payload_size(i);
+        }
+
+        inline static_extent_t tail(size_t i) const
+        {
+            return burst->tail(i);
+        }
+
+        inline void write(size_t i, cursor_t cursor) const
+        {
+            burst->write(i, cursor);
+        }
+    };
+
+    // Burst in which '_respond_with_data_segments()' writes the segments it
+    // sends.
+    _data_burst_t   data_burst;
 
     //
     // Connected sockets.
@@ -1153,10 +2281,8 @@ private:
     // for this connection).
     inline bool _can_send(tcb_id_t tcb_id)
     {
-        auto tcb_it = this->tcbs.find(tcb_id);
-        assert(tcb_it != this->tcbs.end());
-
-        tcb_t *tcb = &tcb_it->second;
+        tcb_t *tcb = this->tcbs.find(tcb_id);
+        assert(tcb != nullptr);
 
         return tcb->in_state(
             tcb_t::SYN_RECEIVED | tcb_t::SYN_SENT | tcb_t::ESTABLISHED |
@@ -1172,14 +2298,11 @@ private:
         acked_callback_t acked_callback
     )
     {
-        writer_sum_t writer_sum =
-            [writer](size_t size, cursor_t out)
-            {
-                writer(size, out);
-                return partial_sum_t(out);
-            };
+        typename tcb_t::tx_queue_entry_t entry;
+        entry.writer = move(writer);
+        entry.acked  = move(acked_callback);
 
-        this->_send(tcb_id, length, writer_sum, acked_callback);
+        this->_send_entry(tcb_id, length, &entry);
     }
 
     // Same as the previous 'send()' but uses a writer which also computes the
@@ -1190,14 +2313,43 @@ private:
         tcb_id_t tcb_id, size_t length, writer_sum_t writer,
         acked_callback_t acked_callback
     )
+    {
+        typename tcb_t::tx_queue_entry_t entry;
+        entry.writer_sum = move(writer);
+        entry.acked      = move(acked_callback);
+
+        this->_send_entry(tcb_id, length, &entry);
+    }
+
+    // Same as the first 'send()' but sends the static data after the data
+    // written by the writer.
+    //
+    // See 'conn_t::send()'.
+    void _send(
+        tcb_id_t tcb_id, size_t length, writer_t writer, static_data_t tail,
+        acked_callback_t acked_callback
+    )
+    {
+        typename tcb_t::tx_queue_entry_t entry;
+        entry.writer = move(writer);
+        entry.tail   = tail;
+        entry.acked  = move(acked_callback);
+
+        this->_send_entry(tcb_id, length + tail.size, &entry);
+    }
+
+    // Queues and sends the data of the given transmission queue entry. The
+    // 'begin' and 'end' fields of the entry are set by the method.
+    void _send_entry(
+        tcb_id_t tcb_id, size_t length,
+        typename tcb_t::tx_queue_entry_t *entry_ptr
+    )
     {
         // The connection has not been already closed by the application layer.
         assert(this->_can_send(tcb_id));
 
-        auto tcb_it = this->tcbs.find(tcb_id);
-        assert(tcb_it != this->tcbs.end());
-
-        tcb_t *tcb = &tcb_it->second;
+        tcb_t *tcb = this->tcbs.find(tcb_id);
+        assert(tcb != nullptr);
 
         if (length <= 0)
             return;
@@ -1205,17 +2357,34 @@ private:
         // First sequence number that is outside of the transmission window.
         seq_t end_of_win = tcb->tx_window.end();
 
-        typename tcb_t::tx_queue_entry_t entry;
-        entry.writer = writer;
-        entry.acked  = acked_callback;
+        typename tcb_t::tx_queue_entry_t &entry = *entry_ptr;
+
+        // Paced connections only transmit with
+        // '_respond_with_data_segments()'.
+        bool is_paced = false;
+
+        #ifdef TCP_PACING
+            is_paced =    tcb->has_pacing_timer
+                       || this->_pacing_rate(tcb) > 0;
+        #endif /* TCP_PACING */
+
+        // Data is only transmitted by '_respond_with_data_segments()' while
+        // the physical layer is short of buffers for full segments.
+        bool is_congested = UNLIKELY(this->_tx_congested(tcb));
 
         if (
                tcb->in_state(tcb_t::SYN_RECEIVED | tcb_t::SYN_SENT)
-            || end_of_win <= tcb->tx_window.next
+            || end_of_win <= tcb->tx_window.next || is_paced || is_congested
+            || !tcb->tx_queue_not_sent.empty()
         ) {
             // If not in a transmitting state, or if the transmission window has
             // no free sequence number, just en-queues the transmission of the
             // data.
+            //
+            // The data is also queued after the entries which have not been
+            // sent yet. These entries can have become ready when an
+            // acknowledgment is processed, before the application sends new
+            // data from the payload of the same segment.
 
             if (tcb->tx_queue_not_sent.empty())
                 entry.begin = tcb->tx_window.next;
@@ -1224,6 +2393,9 @@ private:
 
             entry.end = entry.begin + seq_t(length);
             tcb->tx_queue_not_sent.push_back(entry);
+
+            if (!tcb->in_state(tcb_t::SYN_RECEIVED | tcb_t::SYN_SENT))
+                this->_respond_with_data_segments(tcb_id, tcb);
         } else {
             // Transmits some data immediately.
 
@@ -1261,10 +2433,33 @@ private:
                 assert(payload_size <= tcb->tx_window.mss);
                 assert(payload_size <= tcb->tx_window.ready());
 
-                function<partial_sum_t(cursor_t)> payload_writer =
-                    [writer, offset](cursor_t cursor)
+                // Static data at the end of the segment is sent by reference.
+                static_extent_t tail;
+                partial_sum_t   tail_sum = partial_sum_t::ZERO;
+                this->_segment_tail(
+                    entry, offset, payload_size, &tail, &tail_sum
+                );
+
+                // Only copies the writer of the application. The copy is
+                // required as the segment could be delayed by the network
+                // layer.
+                auto payload_writer =
+                    [writer = entry.writer, writer_sum = entry.writer_sum,
+                     offset, tail_sum]
+                    (cursor_t cursor)
                     {
-                        return writer(offset, cursor);
+                        partial_sum_t partial_sum = partial_sum_t::ZERO;
+
+                        if (cursor.empty())
+                            ;
+                        else if (writer_sum)
+                            partial_sum = writer_sum(offset, cursor);
+                        else {
+                            writer(offset, cursor);
+                            partial_sum = partial_sum_t(cursor);
+                        }
+
+                        return partial_sum.append(tail_sum);
                     };
 
                 TCP_TCB_DEBUG(
@@ -1276,19 +2471,20 @@ private:
 
                 this->_send_ack_segment(
                     tcb_id, tcb, tcb->tx_window.next, tcb->rx_window.next,
-                    payload_writer, payload_size
+                    move(payload_writer), payload_size, tail
                 );
 
                 // Updates the transmission windows.
                 tcb->tx_window.next += (seq_t) payload_size;
 
                 // Updates the transmission history.
-                typename tcb_t::tx_history_entry_t segment(tcb->tx_window.next);
-                tcb->tx_history.push_back(segment);
+                tcb->push_history(tcb->tx_window.next);
             } while (end_of_transmission > tcb->tx_window.next);
 
             tcb->rx_window.acked = tcb->rx_window.next;
 
+            tcb->check_app_limited();
+
             if (!tcb->has_timer)
                 this->_schedule_retransmission_timer(tcb_id, tcb);
         }
@@ -1299,10 +2495,8 @@ private:
     // See 'conn_t::close()'.
     void _close(tcb_id_t tcb_id)
     {
-        auto tcb_it = this->tcbs.find(tcb_id);
-        assert(tcb_it != this->tcbs.end());
-
-        tcb_t *tcb = &tcb_it->second;
+        tcb_t *tcb = this->tcbs.find(tcb_id);
+        assert(tcb != nullptr);
 
         // The connection has already been closed by the application layer.
         if (tcb->in_state(
@@ -1312,7 +2506,10 @@ private:
             return;
 
         if (tcb->in_state(tcb_t::SYN_SENT)) {
-            tcb->conn_handlers.close();
+            // The handlers are not assigned yet if the connection is closed
+            // by the callback given to 'connect()'.
+            if (tcb->conn_handlers.close)
+                tcb->conn_handlers.close();
             return this->_destroy_tcb(tcb_id);
         }
 
@@ -1333,8 +2530,12 @@ private:
 
             if (!tcb->has_timer)
                 this->_schedule_retransmission_timer(tcb_id, tcb);
-        } else
-            assert(!tcb->tx_window.can_transmit());
+        } else {
+            // The queued data could be held back by the transmission window,
+            // the pacing timer or the physical layer. The FIN will follow
+            // its last byte.
+            tcb->fin_pending = true;
+        }
 
         switch (tcb->state) {
         case tcb_t::SYN_RECEIVED:
@@ -1381,14 +2582,34 @@ private:
 
     void _handle_listen_state(
         const header_t *hdr, tcb_id_t tcb_id, options_t options,
-        cursor_t payload, const new_conn_callback_t *new_conn_callback
+        cursor_t payload, listen_t *listen
     )
     {
         if (UNLIKELY(hdr->flags.rst)) {
             // Ignore RST segments.
             IGNORE_SEGMENT("RST segment received while in LISTEN state");
         } else if (UNLIKELY(hdr->flags.ack)) {
-            // There is nothing to be acknowledged in the LISTEN state.
+            // There is nothing to be acknowledged in the LISTEN state, unless
+            // the segment completes a handshake started with a SYN cookie.
+
+            if (
+                   listen->options.syn_cookies != SYN_COOKIES_DISABLED
+                && !hdr->flags.syn
+            ) {
+                seq_t iss = hdr->ack.host() - seq_t(1);
+                seq_t irs = hdr->seq.host() - seq_t(1);
+
+                mss_t mss;
+                if (LIKELY(this->_check_syn_cookie(tcb_id, irs, iss, &mss))) {
+                    listen->stats.syn_cookies_accepted++;
+                    return this->_accept_syn_cookie(
+                        hdr, tcb_id, options, payload, listen, irs, iss, mss
+                    );
+                }
+
+                listen->stats.syn_cookies_rejected++;
+            }
+
             return this->_respond_with_rst_segment(tcb_id.raddr, hdr, payload);
         } else if (LIKELY(hdr->flags.syn)) {
             // SYN segment.
@@ -1396,6 +2617,27 @@ private:
             // Creates the TCB in the SYN-RECEIVED state and responds to the
             // segment with a SYN-ACK segment. Notifies the application of the
             // new connection.
+            //
+            // Responds with a SYN cookie instead, without creating any TCB,
+            // if the backlog is full and SYN cookies are enabled.
+
+            seq_t irs = hdr->seq.host();        // Initial Receiver Sequence
+                                                // number.
+
+            bool backlog_full =
+                listen->stats.syn_received >= listen->options.backlog;
+
+            if (
+                   listen->options.syn_cookies == SYN_COOKIES_ALWAYS
+                || (   backlog_full
+                    && listen->options.syn_cookies == SYN_COOKIES_ON_OVERFLOW)
+            ) {
+                listen->stats.syn_cookies_sent++;
+                return this->_respond_with_syn_cookie(tcb_id, irs, options);
+            } else if (UNLIKELY(backlog_full)) {
+                listen->stats.backlog_overflows++;
+                IGNORE_SEGMENT("backlog is full");
+            }
 
             TCP_TCB_STATE_CHANGE("LISTEN", "SYN-RECEIVED");
 
@@ -1403,28 +2645,26 @@ private:
             // Creates an initializes the TCB.
             //
 
-            seq_t irs = hdr->seq.host();        // Initial Receiver Sequence
-                                                // number.
             seq_t iss = _get_current_tcp_seq(); // Initial Sender Sequence
                                                 // number.
 
-            auto p = this->tcbs.emplace(
-                piecewise_construct, forward_as_tuple(tcb_id),
-                forward_as_tuple(this->alloc)
-            );
-            assert(p.second); // Emplace succeed.
-            tcb_t *tcb = &p.first->second;
+            tcb_t *tcb = this->tcbs.emplace(tcb_id, this->alloc);
+            this->stats.active_tcbs.set(this->tcbs.size());
 
             tcb->state = tcb_t::SYN_RECEIVED;
 
+            tcb->in_backlog = true;
+            listen->stats.syn_received++;
+
             tcb->rx_window.next = irs + seq_t(1);
-            tcb->rx_window.size = INITIAL_WND_SIZE;
             tcb->rx_window.acked = tcb->rx_window.next;
 
             tcb->tx_window.unack = iss;
             tcb->tx_window.next  = iss + seq_t(1);
             tcb->tx_window.init_from_syn(this, hdr, irs, options);
 
+            this->_init_options(tcb, options);
+
             //
             // Sends the SYN-ACK segment.
             //
@@ -1433,40 +2673,201 @@ private:
 
             this->_schedule_retransmission_timer(tcb_id, tcb);
 
-            //
-            // Notifies the application.
-            //
-
-            // Copies the callback before calling it as it could be removed
-            // while being called.
-            new_conn_callback_t callback = *new_conn_callback;
-            conn_t conn = { this, tcb_id };
-            conn_handlers_t conn_handlers = callback(conn);
-
-            // As the new connection callback could have initiated a new
-            // connection, and subsequently modified the 'tcbs' map, the 'tcb'
-            // pointer is now potentially invalidated and must be reacquired
-            // before assigning it the 'conn_handler'.
-
-            auto tcb_it = this->tcbs.find(tcb_id);
-
-            // The TCB should always exist, even if the callback decided to
-            // close the connection, in which case it moved into the FIN-WAIT-1
-            // state.
-            assert(tcb_it != this->tcbs.end());
-
-            tcb = &tcb_it->second;
-            tcb->conn_handlers = conn_handlers;
+            this->_notify_new_conn(tcb_id, listen);
         } else {
             // Any other segment is not valid and should be ignored.
             IGNORE_SEGMENT("invalid segment");
         }
     }
 
+    // Calls the new connection callback of the listening port and assigns the
+    // returned handlers to the TCB.
+    void _notify_new_conn(tcb_id_t tcb_id, const listen_t *listen)
+    {
+        // Copies the callback before calling it as it could be removed
+        // while being called.
+        new_conn_callback_t callback = listen->new_conn_callback;
+        conn_t conn = { this, tcb_id };
+        conn_handlers_t conn_handlers = callback(conn);
+
+        // The callback could have closed the connection, and the 'tcb' pointer
+        // must be reacquired before assigning it the 'conn_handler'.
+
+        tcb_t *tcb = this->tcbs.find(tcb_id);
+
+        // The TCB should always exist, even if the callback decided to close
+        // the connection, in which case it moved into the FIN-WAIT-1 state.
+        assert(tcb != nullptr);
+
+        tcb->conn_handlers = conn_handlers;
+    }
+
+    // Responds to a SYN segment with a SYN-ACK segment which carries a SYN
+    // cookie as sequence number.
+    //
+    // No TCB is created. The window scale and SACK-permitted options are only
+    // announced if the SYN segment carries the timestamps option, in which
+    // they are encoded (see '_syn_cookie_timestamp()').
+    void _respond_with_syn_cookie(
+        tcb_id_t tcb_id, seq_t irs, options_t options
+    )
+    {
+        mss_t mss =   options.mss != options_t::NO_MSS_OPTION
+                    ? options.mss : (mss_t) 536;
+        mss = min(mss, this->mss);
+
+        seq_t iss = this->_make_syn_cookie(tcb_id, irs, mss);
+
+        TCP_TCB_DEBUG("Responds with a SYN cookie (%u)", iss.value);
+
+        options_t syn_ack_options;
+        syn_ack_options.mss = (typename options_t::mss_option_t) this->mss;
+
+        if (options.has_timestamp) {
+            if (options.wscale != options_t::NO_WSCALE_OPTION) {
+                syn_ack_options.wscale =
+                    (typename options_t::wscale_option_t) WND_SCALE;
+            }
+
+            syn_ack_options.sack_permitted = options.sack_permitted;
+
+            syn_ack_options.has_timestamp = true;
+            syn_ack_options.ts_val        =
+                this->_syn_cookie_timestamp(options);
+            syn_ack_options.ts_ecr        = options.ts_val;
+        }
+
+        this->_send_segment(
+            tcb_id, iss, irs + seq_t(1), _SYN_ACK_FLAGS, INITIAL_WND_SIZE,
+            syn_ack_options
+        );
+    }
+
+    // Creates the TCB of a connection which has been acknowledged with a valid
+    // SYN cookie, and processes the received ACK segment.
+    //
+    // The options of the SYN segment are restored from the echoed timestamp,
+    // if any. Otherwise, the connection only uses the encoded MSS.
+    void _accept_syn_cookie(
+        const header_t *hdr, tcb_id_t tcb_id, options_t ack_options,
+        cursor_t payload, const listen_t *listen, seq_t irs, seq_t iss,
+        mss_t mss
+    )
+    {
+        TCP_TCB_STATE_CHANGE("LISTEN", "SYN-RECEIVED");
+
+        // Rebuilds the TCB as if it had been created when the SYN segment had
+        // been received. The received segment will then move it into the
+        // ESTABLISHED state.
+
+        tcb_t *tcb = this->tcbs.emplace(tcb_id, this->alloc);
+        this->stats.active_tcbs.set(this->tcbs.size());
+
+        tcb->state = tcb_t::SYN_RECEIVED;
+
+        tcb->rx_window.next = irs + seq_t(1);
+        tcb->rx_window.acked = tcb->rx_window.next;
+
+        tcb->tx_window.unack = iss;
+        tcb->tx_window.next  = iss + seq_t(1);
+
+        options_t options;
+        options.mss = (typename options_t::mss_option_t) mss;
+
+        if (ack_options.has_timestamp) {
+            _syn_cookie_options(ack_options.ts_ecr, &options);
+
+            options.has_timestamp = true;
+            options.ts_val        = ack_options.ts_val;
+
+            // The echoed timestamp is older than the SYN-ACK segment, and
+            // would overstate the RTT.
+            ack_options.ts_ecr = 0;
+        }
+
+        tcb->tx_window.init_from_syn(this, hdr, irs, options);
+
+        this->_init_options(tcb, options);
+
+        this->_notify_new_conn(tcb_id, listen);
+
+        tcb = this->tcbs.find(tcb_id);
+        assert(tcb != nullptr);
+
+        this->_handle_other_states(hdr, ack_options, payload, tcb_id, tcb);
+    }
+
+    // Initializes the receiver window and the options used by the connection
+    // from the options of the received SYN segment.
+    //
+    // Must be called after 'tx_window_t::init_from_syn()'.
+    void _init_options(tcb_t *tcb, options_t options)
+    {
+        if (options.wscale != options_t::NO_WSCALE_OPTION) {
+            // RFC 7323 limits the shift count to 14.
+            tcb->tx_window.scale = (uint8_t) min((int) options.wscale, 14);
+            tcb->rx_window.scale = WND_SCALE;
+            tcb->rx_window.size  = SCALED_WND_SIZE;
+        } else {
+            tcb->tx_window.scale = 0;
+            tcb->rx_window.scale = 0;
+            tcb->rx_window.size  = INITIAL_WND_SIZE;
+        }
+
+        tcb->sack_permitted = options.sack_permitted;
+        tcb->sack_high      = tcb->tx_window.unack;
+
+        tcb->timestamps     = options.has_timestamp;
+
+        if (tcb->timestamps) {
+            tcb->ts_recent = options.ts_val;
+
+            // The timestamps option of data segments is taken from the
+            // remote's MSS.
+            if (tcb->tx_window.mss > TCPOLEN_TSTAMP_APPA)
+                tcb->tx_window.mss -= TCPOLEN_TSTAMP_APPA;
+        }
+    }
+
     //
     // SYN-SENT
     //
 
+    // Chooses the local port of a new active connection and writes it in the
+    // given identifier, which must have its remote address and port set.
+    //
+    // Ports are tried in turn from the one following the last chosen. Skips
+    // the ports in the LISTEN state, the ports already used with the same
+    // remote, and the ports rejected by the filter. Returns 'false' if every
+    // port of the range has been rejected.
+    bool _ephemeral_port(tcb_id_t *tcb_id)
+    {
+        size_t n_ports =
+            (size_t) this->ephemeral_last - this->ephemeral_first + 1;
+
+        for (size_t i = 0; i < n_ports; i++) {
+            port_t port = this->ephemeral_next;
+
+            if (port == this->ephemeral_last)
+                this->ephemeral_next = this->ephemeral_first;
+            else
+                this->ephemeral_next = port + 1;
+
+            tcb_id->lport = port;
+
+            if (
+                   this->listens.find(tcb_id->lport) != this->listens.end()
+                || this->tcbs.find(*tcb_id) != nullptr
+                || (this->port_filter && !this->port_filter(*tcb_id))
+            )
+                continue;
+
+            return true;
+        }
+
+        return false;
+    }
+
     void _handle_syn_sent_state(
         const header_t *hdr, options_t options, cursor_t payload,
         tcb_id_t tcb_id, tcb_t *tcb
@@ -1487,13 +2888,10 @@ private:
                 // The segment doesn't not acknowledge something we sent,
                 // probably a segment from an older connection.
 
-                IGNORE_SEGMENT("unexpected ack number");
+                if (!hdr->flags.rst)
+                    this->_respond_with_rst_segment(tcb_id.raddr, hdr, payload);
 
-                if (!hdr->flags.rst) {
-                    return this->_respond_with_rst_segment(
-                        tcb_id.raddr, hdr, payload
-                    );
-                }
+                IGNORE_SEGMENT("unexpected ack number");
             } else if (UNLIKELY(hdr->flags.rst))
                 this->_reset_tcb(tcb_id, tcb);
             else if (LIKELY(hdr->flags.syn)) {
@@ -1507,9 +2905,17 @@ private:
                 seq_t irs = hdr->seq.host(); // Initial Receiver Sequence
                                              // number.
 
-                tcb->rx_window.next = irs + seq_t(1);
+                tcb->rx_window.next  = irs + seq_t(1);
+                tcb->rx_window.acked = irs;
+
+                // Our SYN has been acknowledged.
+                tcb->tx_window.unack = ack;
 
                 tcb->tx_window.init_from_syn(this, hdr, irs, options);
+                this->_init_options(tcb, options);
+
+                if (tcb->has_timer)
+                    this->_unschedule_timer(tcb);
 
                 size_t payload_size = payload.size();
                 if (payload_size > 0) {
@@ -1548,11 +2954,15 @@ private:
                 seq_t irs = hdr->seq.host(); // Initial Receiver Sequence
                                              // number.
 
-                tcb->rx_window.next = irs + 1;
+                tcb->rx_window.next  = irs + 1;
+                tcb->rx_window.acked = tcb->rx_window.next;
 
                 tcb->tx_window.init_from_syn(this, hdr, irs, options);
+                this->_init_options(tcb, options);
 
-                return this->_respond_with_ack_segment(tcb_id, tcb);
+                return this->_send_syn_ack_segment(
+                    tcb_id, tcb, tcb->tx_window.unack, tcb->rx_window.next
+                );
             } else
                 IGNORE_SEGMENT("no SYN nor RST control bit");
         }
@@ -1579,13 +2989,26 @@ private:
     //
 
     void _handle_other_states(
-        const header_t *hdr, cursor_t payload, tcb_id_t tcb_id, tcb_t *tcb
+        const header_t *hdr, const options_t &options, cursor_t payload,
+        tcb_id_t tcb_id, tcb_t *tcb
     )
     {
         // Implemented as specified in RFC 793 page 69 to 76.
 
         seq_t seq = hdr->seq.host();
 
+        bool has_timestamp = tcb->timestamps && options.has_timestamp;
+
+        // Rejects old duplicates with an older timestamp than the last
+        // recorded one (PAWS, RFC 7323 page 19).
+        if (
+               UNLIKELY(has_timestamp && !hdr->flags.rst)
+            && (int32_t) (options.ts_val - tcb->ts_recent) < 0
+        ) {
+            this->_respond_with_ack_segment(tcb_id, tcb);
+            IGNORE_SEGMENT("old timestamp");
+        }
+
         // Checks that the segment contains data which is in the receiving
         // window.
         if (UNLIKELY(!tcb->rx_window.acceptable_seg(seq, payload.size()))) {
@@ -1597,6 +3020,10 @@ private:
             IGNORE_SEGMENT("unexpected sequence number (duplicate ?)");
         }
 
+        // Records the timestamp to echo (RFC 7323 page 16).
+        if (has_timestamp && seq <= tcb->rx_window.acked)
+            tcb->ts_recent = options.ts_val;
+
         if (UNLIKELY(hdr->flags.rst))
             return this->_reset_tcb(tcb_id, tcb);
 
@@ -1623,6 +3050,11 @@ private:
         seq_t ack = hdr->ack.host();
         bool acceptable_ack = tcb->tx_window.acceptable_ack(ack);
 
+        // Our SYN has been acknowledged, the connection leaves the backlog of
+        // its listening port.
+        if (UNLIKELY(tcb->in_backlog) && acceptable_ack)
+            this->_leave_backlog(tcb_id, tcb);
+
         if (tcb->in_state(tcb_t::SYN_RECEIVED)) {
             if (LIKELY(acceptable_ack)) {
                 // Our SYN has been acknowledged, moves into the ESTABLISHED
@@ -1645,6 +3077,11 @@ private:
             tcb_t::ESTABLISHED | tcb_t::FIN_WAIT_1 | tcb_t::FIN_WAIT_2 |
             tcb_t::CLOSE_WAIT | tcb_t::CLOSING | tcb_t::LAST_ACK
         )) {
+            if (tcb->sack_permitted && options.n_sack_blocks > 0)
+                this->_update_scoreboard(tcb, options);
+
+            win_size_t window = tcb->tx_window.unscale(hdr->window.host());
+
             if (LIKELY(acceptable_ack)) {
                 // The segment acknowledges something new.
 
@@ -1656,13 +3093,48 @@ private:
                 // Cancels any duplicate ACKs that have been received.
                 tcb->tx_window.dupacks = 0;
 
-                tcb->tx_window.update_rwnd(seq, ack, hdr->window.host());
-                tcb->tx_window.update_cwnd(bytes_acked);
+                tcb->tx_window.update_rwnd(seq, ack, window);
+
+                ack_sample_t sample;
+                tcb->acknowledge_history(ack, bytes_acked, &sample);
+                sample.in_flight = tcb->tx_window.in_flight();
+
+                // The echoed timestamp also measures the RTT of retransmitted
+                // segments (RFC 7323 page 12), which the history doesn't.
+                //
+                // Timestamps are in milliseconds and are only used when there
+                // is no sample from the history, as they would round the RTT
+                // of local networks down to zero.
+                int32_t ts_rtt = this->_timestamp() - options.ts_ecr;
+
+                if (
+                       !sample.has_rtt && has_timestamp && options.ts_ecr != 0
+                    && ts_rtt > 0
+                ) {
+                    sample.has_rtt  = true;
+                    sample.rtt      =
+                        typename clock_t::interval_t((uint64_t) ts_rtt * 1000);
+                }
+
+                if (sample.has_rtt)
+                    tcb->rtt.update_rtt(sample.rtt);
 
-                tcb->rtt.update_rtt(tcb, ack);
+                tcb->tx_window.update_cwnd(sample);
 
                 tcb->update_tx_queues(ack);
 
+                if (tcb->sack_high < ack)
+                    tcb->sack_high = ack;
+
+                if (UNLIKELY(tcb->in_recovery)) {
+                    if (ack >= tcb->recovery_point)
+                        tcb->in_recovery = false;
+                    else {
+                        // Partial acknowledgment. Retransmits the next holes.
+                        this->_retransmit_holes(tcb_id, tcb);
+                    }
+                }
+
                 if (tcb->tx_window.in_flight() > 0) {
                     // There is some pending data.
                     // Restarts the the retransmission timer.
@@ -1685,9 +3157,7 @@ private:
                 //
                 // See RFC 5681, page 44.
 
-                bool updated = tcb->tx_window.update_rwnd(
-                    seq, ack, hdr->window.host()
-                );
+                bool updated = tcb->tx_window.update_rwnd(seq, ack, window);
 
                 if (
                        !updated && payload.empty() && !hdr->flags.fin
@@ -1699,9 +3169,19 @@ private:
                         TCP_TCB_ERROR("Third duplicate ack");
 
                         // Restarts the retransmission timer.
-                        this->_reschedule_timer(tcb, tcb->rtt.rto);
-
-                        this->_retransmit(tcb_id, tcb);
+                        this->_reschedule_retransmission_timer(tcb);
+
+                        if (tcb->sack_permitted) {
+                            // Retransmits the holes in the SACKed data instead
+                            // of the oldest segment only.
+                            tcb->in_recovery    = true;
+                            tcb->recovery_point = tcb->tx_window.next;
+                            this->_retransmit_holes(tcb_id, tcb, true);
+                        } else
+                            this->_retransmit(tcb_id, tcb);
+                    } else if (tcb->in_recovery) {
+                        // New SACK blocks could have revealed new holes.
+                        this->_retransmit_holes(tcb_id, tcb);
                     }
                 }
             }
@@ -1711,7 +3191,7 @@ private:
             if (
                    tcb->in_state(tcb_t::FIN_WAIT_1)
                 && ack == tcb->tx_window.next
-                && tcb->tx_queue_not_sent.empty()
+                && !tcb->fin_pending
             ) {
                 TCP_TCB_STATE_CHANGE("FIN-WAIT-1", "FIN-WAIT-2");
                 tcb->state = tcb_t::FIN_WAIT_2;
@@ -1730,7 +3210,7 @@ private:
         } else if (
                tcb->in_state(tcb_t::LAST_ACK)
             && ack == tcb->tx_window.next
-            && tcb->tx_queue_not_sent.empty()
+            && !tcb->fin_pending
         ) {
             // When in the LAST-ACK state, if our FIN is now acknowledged,
             // delete the TCB and return.
@@ -1746,18 +3226,36 @@ private:
         // Processes the segment text and updates the reception window.
         //
 
+        // Segments which fill a hole or which are received out of order must
+        // be acknowledged immediately (RFC 5681 page 9).
+        bool had_out_of_order   = !tcb->out_of_order.empty();
+        bool is_out_of_order    = false;
+
         if (
             tcb->in_state(
                 tcb_t::ESTABLISHED | tcb_t::FIN_WAIT_1 | tcb_t::FIN_WAIT_2
             ) && !payload.empty()
-        )
+        ) {
+            is_out_of_order = !tcb->rx_window.contains_next(
+                seq, payload.size()
+            );
+
             this->_handle_payload(seq, payload, tcb);
+        }
 
         //
         // Processes the FIN control bit and acknowledges the received segment.
         //
+        // The FIN is only processed once every byte that precedes it has been
+        // received. An out of order FIN is ignored and will be retransmitted
+        // by the remote. Retransmitted FINs are accepted in TIME-WAIT.
+        //
+
+        bool fin_in_order =
+               tcb->in_state(tcb_t::TIME_WAIT)
+            || seq + seq_t(payload.size()) == tcb->rx_window.next;
 
-        if (hdr->flags.fin) {
+        if (hdr->flags.fin && fin_in_order) {
             switch (tcb->state) {
             case tcb_t::ESTABLISHED:
                 ++tcb->rx_window.next;
@@ -1773,7 +3271,7 @@ private:
                 // We would already be in the FIN-WAIT-2 if our FIN was acked,
                 // because of the previous ACK processing.
 
-                if (tcb->tx_queue_not_sent.empty()) {
+                if (!tcb->fin_pending) {
                     // The only way to reach this stage is by not having
                     // received an acknowledgment for the FIN segment we sent,
                     // otherwise we would already be in the FIN-WAIT-2 state.
@@ -1840,9 +3338,39 @@ private:
         // Checks that there is still something to acknowledge (data segments
         // contains an acknowledgement number).
         //
+        // Out of order segments are immediately answered with a duplicate ACK,
+        // which carries the SACK blocks, as the remote counts them to detect
+        // losses. Other acknowledgments are delayed.
+        //
 
-        if (tcb->rx_window.acked < tcb->rx_window.next)
+        if (UNLIKELY(is_out_of_order))
             this->_respond_with_ack_segment(tcb_id, tcb);
+        else if (tcb->rx_window.acked < tcb->rx_window.next) {
+            this->_delay_ack(
+                tcb_id, tcb, hdr->flags.fin || had_out_of_order
+            );
+        }
+    }
+
+    // Delays the acknowledgment of the received data and/or FIN control bit.
+    //
+    // The acknowledgment is deferred to the end of the batch of received
+    // segments if 'immediate' is 'true' or if at least two full sized segments
+    // are not acknowledged (RFC 1122 page 96). Otherwise it is sent by the
+    // delayed ACK timer, unless data segments are sent before.
+    void _delay_ack(tcb_id_t tcb_id, tcb_t *tcb, bool immediate)
+    {
+        assert(tcb->rx_window.acked < tcb->rx_window.next);
+
+        size_t not_acked = (tcb->rx_window.next - tcb->rx_window.acked).value;
+
+        if (immediate || not_acked >= 2 * (size_t) tcb->tx_window.mss) {
+            if (!tcb->ack_queued) {
+                tcb->ack_queued = true;
+                this->ack_queue.push_back(tcb_id);
+            }
+        } else if (!tcb->has_ack_timer)
+            this->_schedule_ack_timer(tcb_id, tcb);
     }
 
     // Retransmits the oldest unacked segment.
@@ -1854,19 +3382,25 @@ private:
         if (tcb->in_state(tcb_t::SYN_SENT)) {
             TCP_TCB_DEBUG("Retransmits a SYN segment");
 
-            this->_send_syn_ack_segment(
-                tcb_id, tcb, tcb->tx_window.unack, tcb->rx_window.next
-            );
+            this->stats.retransmitted.inc();
+
+            this->_send_syn_segment(tcb_id, tcb);
         } else if (tcb->in_state(tcb_t::SYN_RECEIVED)) {
             TCP_TCB_DEBUG("Retransmits a SYN/ACK segment");
 
-            // TODO: sends a SYN segment.
+            this->stats.retransmitted.inc();
+
+            this->_send_syn_ack_segment(
+                tcb_id, tcb, tcb->tx_window.unack, tcb->rx_window.next
+            );
         } else if (
             tcb->in_state(tcb_t::FIN_WAIT_1 | tcb_t::CLOSING | tcb_t::LAST_ACK)
             && tcb->tx_history.empty()
         ) {
             TCP_TCB_DEBUG("Retransmits a FIN segment");
 
+            this->stats.retransmitted.inc();
+
             this->_send_fin_ack_segment(
                 tcb_id, tcb, tcb->tx_window.next, tcb->rx_window.next
             );
@@ -1877,79 +3411,218 @@ private:
                 &tcb->tx_history.front();
             segment->retransmitted = true;
 
-            seq_t seq       = tcb->tx_window.unack,
-                  end_seq   = segment->end;
+            this->_retransmit_range(
+                tcb_id, tcb, tcb->tx_window.unack, segment->end
+            );
+        }
+    }
 
-            assert(end_seq <= tcb->tx_window.next);
+    // Retransmits the segments which are before the highest SACKed data and
+    // which have not been selectively acknowledged, unless they have already
+    // been retransmitted during the current recovery (RFC 6675).
+    //
+    // Holes are only retransmitted while the congestion window exceeds the
+    // data in the network (see '_pipe()') by a full segment. The remaining
+    // holes are retransmitted by the next ACKs. The first hole is always
+    // retransmitted when entering the recovery (RFC 6675 page 9).
+    //
+    // Retransmits the oldest unacked segment if nothing has been SACKed.
+    void _retransmit_holes(
+        tcb_id_t tcb_id, tcb_t *tcb, bool entering_recovery = false
+    )
+    {
+        if (tcb->tx_history.empty())
+            return this->_retransmit(tcb_id, tcb);
 
-            // Counts the number of entries in the transmission queues that will
-            // be transmitted in this segment. Does this before to only perform
-            // a single dynamic allocation of the 'to_send' vector.
+        size_t pipe     = this->_pipe(tcb);
+        size_t cwnd     = tcb->tx_window.cc.cwnd;
+        bool   forced   = entering_recovery;
 
-            size_t n_unack_entries     = 0,
-                   n_not_sent_entries  = 0;
-            for (
-                auto it = tcb->tx_queue_sent_unack.begin();
-                ;
-                ++it
-            ) {
-                if (it == tcb->tx_queue_sent_unack.end()) {
-                    // We reached the end of the unacked transmission queue.
-                    // The last entry should be partially transmitted and still
-                    // in the 'tx_queue_not_sent' queue.
-                    assert(!tcb->tx_queue_not_sent.empty());
-                    assert(tcb->tx_queue_not_sent.front().end >= end_seq);
+        seq_t begin = tcb->tx_window.unack;
+
+        for (size_t i = 0; i < tcb->tx_history.size(); i++) {
+            typename tcb_t::tx_history_entry_t *segment = &tcb->tx_history[i];
 
-                    n_not_sent_entries = 1;
+            if (i > 0 && begin >= tcb->sack_high)
+                break;
 
+            if (!segment->sacked && !segment->hole_retransmitted) {
+                if (!forced && pipe + tcb->tx_window.mss > cwnd)
                     break;
-                }
 
-                // Paranoia checks.
-                assert(it->end > it->begin);
-                assert(it->end > seq);
+                forced = false;
 
-                ++n_unack_entries;
+                TCP_TCB_DEBUG(
+                    "Retransmits a hole (<SEQ=%u> to <SEQ=%u>)", begin.value,
+                    segment->end.value
+                );
 
-                if (it->end >= end_seq)
-                    break;
+                segment->retransmitted      = true;
+                segment->hole_retransmitted = true;
+
+                this->_retransmit_range(tcb_id, tcb, begin, segment->end);
+
+                pipe += (segment->end - begin).value;
             }
 
-            size_t n_entries = n_unack_entries + n_not_sent_entries;
-            assert(n_entries > 0);
-            assert(n_not_sent_entries == 0 || n_not_sent_entries == 1);
+            begin = segment->end;
+        }
+    }
 
-            // Allocates and copies the entries to transmit in the 'to_send'
-            // vector.
+    // Estimates the number of bytes which are still in the network ('pipe',
+    // RFC 6675 page 5).
+    //
+    // The segments which precede the highest SACKed data and which have not
+    // been SACKed are presumed lost, as by '_retransmit_holes()'. They only
+    // count once retransmitted.
+    size_t _pipe(const tcb_t *tcb) const
+    {
+        size_t pipe = 0;
 
-            auto to_send = allocate_shared<to_send_vec_t>(
-                this->alloc, n_entries, this->alloc
-            );
+        seq_t begin = tcb->tx_window.unack;
 
-            copy(
-                tcb->tx_queue_sent_unack.begin(),
-                tcb->tx_queue_sent_unack.begin() + n_unack_entries,
-                to_send->begin()
-            );
+        for (size_t i = 0; i < tcb->tx_history.size(); i++) {
+            const typename tcb_t::tx_history_entry_t *segment =
+                &tcb->tx_history[i];
 
-            copy(
-                tcb->tx_queue_not_sent.begin(),
-                tcb->tx_queue_not_sent.begin() + n_not_sent_entries,
-                to_send->begin() + n_unack_entries
-            );
+            bool is_lost = i == 0 || begin < tcb->sack_high;
 
-            // Sends the segment.
+            if (
+                   !segment->sacked
+                && (!is_lost || segment->hole_retransmitted)
+            )
+                pipe += (segment->end - begin).value;
 
-            size_t payload_size = (end_seq - seq).value;
-            bool has_fin =    tcb->in_state(tcb_t::FIN_WAIT_1 | tcb_t::LAST_ACK)
-                           && tcb->tx_queue_not_sent.empty()
-                           && tcb->tx_queue_sent_unack.back().end == end_seq;
+            begin = segment->end;
+        }
 
-            this->_send_data_segment(
-                tcb_id, tcb, seq, to_send, to_send->begin(), to_send->end(),
-                payload_size, has_fin
-            );
+        return pipe;
+    }
+
+    // Retransmits the unacked data from 'seq' (included) to 'end_seq'
+    // (excluded) in a single segment.
+    void _retransmit_range(
+        tcb_id_t tcb_id, tcb_t *tcb, seq_t seq, seq_t end_seq
+    )
+    {
+        assert(seq < end_seq);
+        assert(end_seq <= tcb->tx_window.next);
+
+        this->stats.retransmitted.inc();
+
+        // Skips the entries which are before the segment.
+
+        auto first = tcb->tx_queue_sent_unack.begin();
+        while (first != tcb->tx_queue_sent_unack.end() && first->end <= seq)
+            ++first;
+
+        // References the entries of the transmission queues that will be
+        // transmitted in this segment.
+
+        this->to_send.clear();
+
+        for (auto it = first; ; ++it) {
+            if (it == tcb->tx_queue_sent_unack.end()) {
+                // We reached the end of the unacked transmission queue.
+                // The last entry should be partially transmitted and still
+                // in the 'tx_queue_not_sent' queue.
+                assert(!tcb->tx_queue_not_sent.empty());
+                assert(tcb->tx_queue_not_sent.front().end >= end_seq);
+
+                this->to_send.push_back(&tcb->tx_queue_not_sent.front());
+
+                break;
+            }
+
+            // Paranoia checks.
+            assert(it->end > it->begin);
+            assert(it->end > seq);
+
+            this->to_send.push_back(&*it);
+
+            if (it->end >= end_seq)
+                break;
+        }
+
+        shared_ptr<to_send_copy_t> to_send_copy;
+        const to_send_vec_t *to_send =
+            this->_to_send_refs(tcb_id.raddr, &to_send_copy);
+
+        // Sends the segment.
+
+        size_t payload_size = (end_seq - seq).value;
+        bool has_fin =    tcb->in_state(
+                              tcb_t::FIN_WAIT_1 | tcb_t::CLOSING |
+                              tcb_t::LAST_ACK
+                          )
+                       && !tcb->fin_pending
+                       && !tcb->tx_queue_sent_unack.empty()
+                       && tcb->tx_queue_sent_unack.back().end == end_seq;
+
+        this->_send_data_segment(
+            tcb_id, tcb, seq, move(to_send_copy), to_send->begin(),
+            to_send->end(), payload_size, has_fin
+        );
+    }
+
+    // Marks the segments of the transmission history which are entirely
+    // covered by the SACK blocks of the received segment (RFC 2018).
+    void _update_scoreboard(tcb_t *tcb, const options_t &options)
+    {
+        auto &history = tcb->tx_history;
+
+        for (size_t i = 0; i < options.n_sack_blocks; i++) {
+            const sack_block_t &block = options.sack_blocks[i];
+
+            // Ignores invalid blocks and blocks which have been acknowledged.
+            if (
+                   UNLIKELY(block.end <= block.begin)
+                || block.end <= tcb->tx_window.unack
+                || UNLIKELY(block.end > tcb->tx_window.next)
+            )
+                continue;
+
+            if (block.end > tcb->sack_high)
+                tcb->sack_high = block.end;
+
+            // Finds the first segment which ends after the beginning of the
+            // block.
+            size_t first = 0, last = history.size();
+            while (first < last) {
+                size_t middle = (first + last) / 2;
+
+                if (history[middle].end <= block.begin)
+                    first = middle + 1;
+                else
+                    last = middle;
+            }
+
+            for (
+                size_t j = first;
+                j < history.size() && history[j].end <= block.end;
+                j++
+            ) {
+                seq_t begin = j > 0 ? history[j - 1].end : tcb->tx_window.unack;
+
+                if (begin >= block.begin)
+                    history[j].sacked = true;
+            }
+        }
+    }
+
+    // Forgets the SACKed segments and ends the current recovery.
+    //
+    // Called on a retransmission timeout, as the remote could have discarded
+    // the data it SACKed (RFC 2018 page 10).
+    void _reset_scoreboard(tcb_t *tcb)
+    {
+        for (auto &segment : tcb->tx_history) {
+            segment.sacked              = false;
+            segment.hole_retransmitted  = false;
         }
+
+        tcb->sack_high   = tcb->tx_window.unack;
+        tcb->in_recovery = false;
     }
 
     #undef IGNORE_SEGMENT
@@ -1963,12 +3636,10 @@ private:
     // Destroys resources allocated to a TCP connection.
     void _destroy_tcb(tcb_id_t tcb_id)
     {
-        auto it = this->tcbs.find(tcb_id);
-        assert(it != this->tcbs.end());
+        tcb_t *tcb = this->tcbs.find(tcb_id);
+        assert(tcb != nullptr);
 
-        // TODO: reuse the 'tcbs' iterator to remove the TCB.
-
-        this->_destroy_tcb(tcb_id, &it->second);
+        this->_destroy_tcb(tcb_id, tcb);
     }
 
     // Destroys resources allocated to a TCP connection.
@@ -2004,10 +3675,37 @@ private:
             break;
         };
 
+        if (tcb->in_backlog)
+            this->_leave_backlog(tcb_id, tcb);
+
         if (tcb->has_timer)
             this->timers->remove(tcb->timer);
 
+        #ifdef TCP_PACING
+            if (tcb->has_pacing_timer)
+                this->timers->remove(tcb->pacing_timer);
+        #endif /* TCP_PACING */
+
+        if (tcb->has_ack_timer)
+            this->timers->remove(tcb->ack_timer);
+
         this->tcbs.erase(tcb_id);
+        this->stats.active_tcbs.set(this->tcbs.size());
+    }
+
+    // Removes the connection from the backlog of its listening port.
+    void _leave_backlog(tcb_id_t tcb_id, tcb_t *tcb)
+    {
+        assert(tcb->in_backlog);
+
+        auto listen_it = this->listens.find(tcb_id.lport);
+        assert(listen_it != this->listens.end());
+
+        listen_stats_t *stats = &listen_it->second.stats;
+        assert(stats->syn_received > 0);
+        stats->syn_received--;
+
+        tcb->in_backlog = false;
     }
 
     // Destroys resources allocated to a TCP connection and signal
@@ -2020,9 +3718,10 @@ private:
         )) {
             tcb->conn_handlers.reset();
 
-            // Reloads the TCB has it could have been reallocated while calling
+            // Reloads the TCB as it could have been destroyed while calling
             // the handler.
-            tcb = &this->tcbs.find(tcb_id)->second;
+            tcb = this->tcbs.find(tcb_id);
+            assert(tcb != nullptr);
         }
 
         this->_destroy_tcb(tcb_id, tcb);
@@ -2064,65 +3763,234 @@ private:
 
     void _schedule_retransmission_timer(tcb_id_t tcb_id, tcb_t *tcb)
     {
-        this->_replace_timer(
-            tcb, tcb->rtt.rto,
-            [this, tcb_id]()
-            {
-                // Reloads the TCB has it could have been reallocated.
-                auto it = this->tcbs.find(tcb_id);
-                assert(it != this->tcbs.end());
-
-                tcb_t *tcb = &it->second;
-
-                TCP_TCB_DEBUG("Retransmission timeout");
-
-                // RFC 5681 page 5: reuses the slow start algorithm.
-                tcb->tx_window.reset_cwnd();
-
-                // RFC 6298 page 5: doubles the timeout delay after a timeout.
-                tcb->rtt.rto *= 2;
-
-                this->_schedule_retransmission_timer(tcb_id, tcb);
+        #ifdef TCP_LAZY_TIMERS
+            tcb->rtx_deadline = clock_t::time_t::now() + tcb->rtt.rto;
+        #endif /* TCP_LAZY_TIMERS */
 
-                // RFC 6298 page 5: retransmits the oldest unacked segment.
-                this->_retransmit(tcb_id, tcb);
-            }
-        );
+        this->_arm_retransmission_timer(tcb_id, tcb, tcb->rtt.rto);
     }
 
+    // Restarts the retransmission timer.
+    //
+    // If TCP_LAZY_TIMERS is defined, only moves the deadline of the timer
+    // forward. As the RTO rarely decreases, the timer will generally be
+    // executed before the new deadline and will then re-queue itself. The
+    // timer is only rescheduled when the new deadline precedes its
+    // expiration, such as when the RTO drops after a backed off timeout.
     void _reschedule_retransmission_timer(tcb_t *tcb)
     {
-        this->_reschedule_timer(tcb, tcb->rtt.rto);
+        #ifdef TCP_LAZY_TIMERS
+            assert(tcb->has_timer);
+            tcb->rtx_deadline = clock_t::time_t::now() + tcb->rtt.rto;
+
+            if (
+                less<typename clock_t::time_t>()(
+                    tcb->rtx_deadline, tcb->rtx_timer_expire
+                )
+            ) {
+                this->_reschedule_timer(tcb, tcb->rtt.rto);
+                tcb->rtx_timer_expire = tcb->rtx_deadline;
+            }
+        #else
+            this->_reschedule_timer(tcb, tcb->rtt.rto);
+        #endif /* TCP_LAZY_TIMERS */
     }
 
-    // Schedules the last timeout used to close a TCP connection, while in the
-    // TIME-WAIT state.
-    void _schedule_fin_timeout(tcb_id_t tcb_id, tcb_t *tcb)
+    // Schedules the retransmission timer to expire after the given delay.
+    void _arm_retransmission_timer(
+        tcb_id_t tcb_id, tcb_t *tcb, typename clock_t::interval_t delay
+    )
     {
+        #ifdef TCP_LAZY_TIMERS
+            tcb->rtx_timer_expire = clock_t::time_t::now() + delay;
+        #endif /* TCP_LAZY_TIMERS */
+
         this->_replace_timer(
-            tcb, FIN_TIMEOUT,
+            tcb, delay,
             [this, tcb_id]()
             {
-                // Reloads the TCB has it could have been reallocated.
-                auto it = this->tcbs.find(tcb_id);
-                assert(it != this->tcbs.end());
+                // Reloads the TCB from its identifier.
+                tcb_t *tcb = this->tcbs.find(tcb_id);
+                assert(tcb != nullptr);
 
-                this->_destroy_tcb(tcb_id, &it->second);
+                this->_retransmission_timeout(tcb_id, tcb);
             }
         );
     }
 
-    // Restarts the FIN timeout. The last scheduled timer for this TCB must be
-    // a FIN timeout.
-    void _reschedule_fin_timeout(tcb_t *tcb)
+    // Called when the retransmission timer expires.
+    void _retransmission_timeout(tcb_id_t tcb_id, tcb_t *tcb)
     {
-        this->_reschedule_timer(tcb, FIN_TIMEOUT);
-    }
+        #ifdef TCP_LAZY_TIMERS
+            typename clock_t::time_t now = clock_t::time_t::now();
+
+            if (less<typename clock_t::time_t>()(now, tcb->rtx_deadline)) {
+                // The deadline has been moved since the timer has been
+                // scheduled. Waits for the remaining delay.
+                this->_arm_retransmission_timer(
+                    tcb_id, tcb, tcb->rtx_deadline - now
+                );
+                return;
+            }
+        #endif /* TCP_LAZY_TIMERS */
 
-    // -------------------------------------------------------------------------
+        TCP_TCB_DEBUG("Retransmission timeout");
 
-    //
-    // Handle payload in segments
+        if (
+               tcb->in_state(tcb_t::SYN_RECEIVED)
+            && ++tcb->syn_retries > MAX_SYN_ACK_RETRIES
+        ) {
+            // The remote never acknowledged our SYN. Releases the TCB so it
+            // doesn't hold a place in the backlog forever.
+            TCP_TCB_ERROR("SYN-ACK segment never acknowledged");
+            return this->_reset_tcb(tcb_id, tcb);
+        }
+
+        if (
+               tcb->in_state(tcb_t::SYN_SENT)
+            && ++tcb->syn_retries > MAX_SYN_RETRIES
+        ) {
+            // The remote is unreachable or ignores our connection request.
+            TCP_TCB_ERROR("SYN segment never acknowledged");
+            return this->_reset_tcb(tcb_id, tcb);
+        }
+
+        // RFC 5681 page 8: reduces the congestion window.
+        tcb->tx_window.timeout();
+
+        if (tcb->sack_permitted)
+            this->_reset_scoreboard(tcb);
+
+        // RFC 6298 page 5: doubles the timeout delay after a timeout.
+        tcb->rtt.rto *= 2;
+
+        this->_schedule_retransmission_timer(tcb_id, tcb);
+
+        // RFC 6298 page 5: retransmits the oldest unacked segment.
+        this->_retransmit(tcb_id, tcb);
+    }
+
+    // Schedules the last timeout used to close a TCP connection, while in the
+    // TIME-WAIT state.
+    void _schedule_fin_timeout(tcb_id_t tcb_id, tcb_t *tcb)
+    {
+        this->_replace_timer(
+            tcb, FIN_TIMEOUT,
+            [this, tcb_id]()
+            {
+                // Reloads the TCB from its identifier.
+                tcb_t *tcb = this->tcbs.find(tcb_id);
+                assert(tcb != nullptr);
+
+                this->_destroy_tcb(tcb_id, tcb);
+            }
+        );
+    }
+
+    // Restarts the FIN timeout. The last scheduled timer for this TCB must be
+    // a FIN timeout.
+    void _reschedule_fin_timeout(tcb_t *tcb)
+    {
+        this->_reschedule_timer(tcb, FIN_TIMEOUT);
+    }
+
+    // Schedules the delayed ACK timer, which acknowledges the received data if
+    // it has not been acknowledged in DELAYED_ACK_TIMEOUT.
+    void _schedule_ack_timer(tcb_id_t tcb_id, tcb_t *tcb)
+    {
+        assert(!tcb->has_ack_timer);
+
+        tcb->has_ack_timer = true;
+        tcb->ack_timer = this->timers->schedule(
+            DELAYED_ACK_TIMEOUT,
+            [this, tcb_id]()
+            {
+                // Reloads the TCB from its identifier.
+                tcb_t *tcb = this->tcbs.find(tcb_id);
+                assert(tcb != nullptr);
+
+                tcb->has_ack_timer = false;
+
+                if (tcb->rx_window.acked < tcb->rx_window.next) {
+                    TCP_TCB_DEBUG("Delayed ACK timeout");
+                    this->_respond_with_ack_segment(tcb_id, tcb);
+                }
+            }
+        );
+    }
+
+    #ifdef TCP_PACING
+        // Returns the rate at which the connection transmits, in bytes per
+        // second, or zero if its transmissions are not (yet) paced.
+        //
+        // Uses the rate given by the congestion control algorithm. Otherwise
+        // spreads the congestion window over the smoothed RTT, once the RTT
+        // has been measured.
+        uint64_t _pacing_rate(const tcb_t *tcb) const
+        {
+            uint64_t rate = tcb->tx_window.pacing_rate();
+
+            if (rate > 0 || tcb->rtt.first)
+                return rate;
+
+            const auto &cc = tcb->tx_window.cc;
+
+            uint64_t srtt  = max(tcb->rtt.srtt.microsec(), (uint64_t) 1),
+                     ratio =   cc.in_slow_start()
+                             ? PACING_SS_RATIO : PACING_CA_RATIO;
+
+            return (uint64_t) cc.cwnd * 1000000 / srtt * ratio / 100;
+        }
+
+        // Returns the number of bytes a paced connection transmits in a
+        // burst.
+        size_t _pacing_quantum(const tcb_t *tcb, uint64_t rate) const
+        {
+            return max(
+                (size_t) (rate * PACING_QUANTUM / 1000000),
+                (size_t) (2 * tcb->tx_window.mss)
+            );
+        }
+
+        // Schedules the transmission of the next burst of a paced connection,
+        // once the 'sent' bytes of the previous burst would have been
+        // transmitted at 'rate' bytes per second.
+        void _schedule_pacing_timer(
+            tcb_id_t tcb_id, tcb_t *tcb, size_t sent, uint64_t rate
+        )
+        {
+            assert(!tcb->has_pacing_timer);
+            assert(rate > 0);
+
+            typename clock_t::interval_t delay(
+                (uint64_t) sent * 1000000 / rate
+            );
+
+            tcb->has_pacing_timer = true;
+            tcb->pacing_timer = this->timers->schedule(
+                delay,
+                [this, tcb_id]()
+                {
+                    // Reloads the TCB from its identifier.
+                    tcb_t *tcb = this->tcbs.find(tcb_id);
+                    assert(tcb != nullptr);
+
+                    tcb->has_pacing_timer = false;
+
+                    if (tcb->in_state(
+                        tcb_t::ESTABLISHED | tcb_t::FIN_WAIT_1 |
+                        tcb_t::CLOSE_WAIT | tcb_t::LAST_ACK
+                    ))
+                        this->_respond_with_data_segments(tcb_id, tcb);
+                }
+            );
+        }
+    #endif /* TCP_PACING */
+
+    // -------------------------------------------------------------------------
+
+    //
+    // Handle payload in segments
     //
 
     // Delivers the given payload to the application if delivered in order,
@@ -2165,56 +4033,49 @@ private:
 
     // Stores the segment's payload in the out of order database (if possible).
     //
-    // The payload is expected to be non empty.
+    // The payload is expected to be non empty. The payload's buffers are
+    // released if the payload is not stored.
     void _handle_out_of_order_payload(seq_t seq, cursor_t payload, tcb_t *tcb)
     {
         assert(!payload.empty());
 
-        if (tcb->out_of_order.size() < MAX_OUT_OF_ORDER_SEGS) {
-            typename tcb_t::out_of_order_segment_t seg { seq, payload };
-            tcb->out_of_order.push_back(seg);
+        if (
+            UNLIKELY(!tcb->out_of_order.insert(
+                seq, payload, MAX_OUT_OF_ORDER_SIZE
+            ))
+        ) {
+            this->stats.out_of_order_dropped.inc();
+            TCP_DEBUG("Out of order queue full. Drops <SEQ=%u>", seq.value);
         }
-
-        // TODO: free the segment if not inserted.
     }
 
-    // Checks for and processes any out of order segment which can now be
+    // Checks for and processes any out of order payloads which can now be
     // received.
     //
-    // Updates the receiver sliding window for any delivered segment.
+    // Updates the receiver sliding window for any delivered payload.
     void _check_out_of_order_payloads(tcb_t *tcb)
     {
-        auto it = tcb->out_of_order.begin();
-
-        while (it != tcb->out_of_order.end()) {
-            size_t payload_size = it->payload.size();
-
-            if (tcb->rx_window.contains_next(it->seq, payload_size)) {
-                // Segment is now in order.
-
-                this->_deliver_to_app_layer(
-                    it->seq, it->payload, payload_size, tcb
-                );
-
-                // Removes the segment from the 'out_of_order' vector.
-                swap(*it, tcb->out_of_order.back());
-                tcb->out_of_order.pop_back();
-
-                // TODO: free the segment.
+        while (
+               !tcb->out_of_order.empty()
+            && tcb->out_of_order.intervals.begin()->first
+               <= tcb->rx_window.next
+        ) {
+            seq_t seq;
+            auto interval = tcb->out_of_order.pop_front(&seq);
 
-                // Retries for others segments.
-                return this->_check_out_of_order_payloads(tcb);
-            } else if (!tcb->rx_window.acceptable_seg(it->seq, payload_size)) {
-                // Segment is now out of the window.
+            for (cursor_t &payload : interval.payloads) {
+                size_t payload_size = payload.size();
 
-                // TODO: free the segment.
+                // Skips the payloads which have already been delivered by an
+                // overlapping in order segment.
+                if (tcb->rx_window.contains_next(seq, payload_size)) {
+                    this->_deliver_to_app_layer(
+                        seq, payload, payload_size, tcb
+                    );
+                }
 
-                // Removes the segment from the 'out_of_order' vector and
-                // continues if there is other segments in the vector.
-                swap(*it, tcb->out_of_order.back());
-                tcb->out_of_order.pop_back();
-            } else
-                ++it;
+                seq += seq_t(payload_size);
+            }
         }
     }
 
@@ -2237,9 +4098,13 @@ private:
         payload = payload.drop(payload_offset.value)
                          .take(tcb->rx_window.size);
 
-        tcb->rx_window.next += seq_t(payload_size);
+        // Only the delivered bytes are acknowledged. A payload which
+        // overlaps previously received data is shorter than 'payload_size'.
+        tcb->rx_window.next += seq_t(payload.size());
 
+        TRACE_BEGIN(app_begin);
         tcb->conn_handlers.new_data(payload);
+        TRACE_END(TRACE_APP, app_begin);
     }
 
     // -------------------------------------------------------------------------
@@ -2251,13 +4116,54 @@ private:
     // Sends a SYN/ACK segment.
     //
     // <SEQ=seq><ACK=ack><CTL=SYN,ACK>
+    //
+    // Only announces the options which have been received in the SYN segment.
     void _send_syn_ack_segment(
         tcb_id_t tcb_id, const tcb_t *tcb, net_t<seq_t> seq, net_t<seq_t> ack
     )
     {
-        options_t options = { (typename options_t::mss_option_t) this->mss };
+        options_t options;
+        options.mss = (typename options_t::mss_option_t) this->mss;
+
+        if (tcb->rx_window.scale > 0) {
+            options.wscale = (typename options_t::wscale_option_t)
+                             tcb->rx_window.scale;
+        }
+
+        options.sack_permitted = tcb->sack_permitted;
+
+        if (tcb->timestamps) {
+            options.has_timestamp = true;
+            options.ts_val        = this->_timestamp();
+            options.ts_ecr        = tcb->ts_recent;
+        }
+
+        this->_send_segment(
+            tcb_id, seq, ack, _SYN_ACK_FLAGS, tcb->rx_window.advertised(true),
+            options
+        );
+    }
+
+    // Sends a SYN segment to open an active connection.
+    //
+    // <SEQ=unack><CTL=SYN>
+    //
+    // Announces every option supported by the instance.
+    void _send_syn_segment(tcb_id_t tcb_id, const tcb_t *tcb)
+    {
+        options_t options;
+        options.mss = (typename options_t::mss_option_t) this->mss;
+        options.wscale = (typename options_t::wscale_option_t)
+                         tcb->rx_window.scale;
+        options.sack_permitted = true;
+
+        options.has_timestamp = true;
+        options.ts_val        = this->_timestamp();
+        options.ts_ecr        = 0;
+
         this->_send_segment(
-            tcb_id, seq, ack, _SYN_ACK_FLAGS, tcb->rx_window.size, options
+            tcb_id, tcb->tx_window.unack, seq_t(0), _SYN_FLAGS,
+            tcb->rx_window.advertised(true), options
         );
     }
 
@@ -2269,50 +4175,128 @@ private:
     )
     {
         this->_send_segment(
-            tcb_id, seq, ack, _FIN_ACK_FLAGS, tcb->rx_window.size, EMPTY_OPTIONS
+            tcb_id, seq, ack, _FIN_ACK_FLAGS, tcb->rx_window.advertised(),
+            this->_segment_options(tcb, false)
         );
     }
 
     // Sends a FIN/ACK segment with a payload.
     //
     // <SEQ=seq><ACK=ack><CTL=FIN,ACK><payload>
+    template <typename payload_writer_t>
     inline void _send_fin_ack_segment(
         tcb_id_t tcb_id, const tcb_t *tcb, net_t<seq_t> seq, net_t<seq_t> ack,
-        function<partial_sum_t(cursor_t)> payload_writer, size_t payload_size
+        payload_writer_t payload_writer, size_t payload_size,
+        static_extent_t tail = static_extent_t()
     )
     {
         this->_send_segment(
-            tcb_id, seq, ack, _FIN_ACK_FLAGS, tcb->rx_window.size,
-            EMPTY_OPTIONS, payload_writer, payload_size
+            tcb_id, seq, ack, _FIN_ACK_FLAGS, tcb->rx_window.advertised(),
+            this->_segment_options(tcb, false), move(payload_writer),
+            payload_size, tail
         );
     }
 
     // Sends an ACK segment with a payload.
     //
     // <SEQ=seq><ACK=ack><CTL=ACK><payload>
+    template <typename payload_writer_t>
     inline void _send_ack_segment(
         tcb_id_t tcb_id, const tcb_t *tcb, net_t<seq_t> seq, net_t<seq_t> ack,
-        function<partial_sum_t(cursor_t)> payload_writer, size_t payload_size
+        payload_writer_t payload_writer, size_t payload_size,
+        static_extent_t tail = static_extent_t()
     )
     {
         this->_send_segment(
-            tcb_id, seq, ack, _ACK_FLAGS, tcb->rx_window.size, EMPTY_OPTIONS,
-            payload_writer, payload_size
+            tcb_id, seq, ack, _ACK_FLAGS, tcb->rx_window.advertised(),
+            this->_segment_options(tcb, false), move(payload_writer),
+            payload_size, tail
         );
     }
 
     // Sends an ack segment without a payload.
     //
+    // The segment carries the SACK blocks of the out of order data.
+    //
     // <SEQ=seq><ACK=ack><CTL=ACK>
     void _send_ack_segment(
         tcb_id_t tcb_id, const tcb_t *tcb, net_t<seq_t> seq, net_t<seq_t> ack
     )
     {
         this->_send_segment(
-            tcb_id, seq, ack, _ACK_FLAGS, tcb->rx_window.size, EMPTY_OPTIONS
+            tcb_id, seq, ack, _ACK_FLAGS, tcb->rx_window.advertised(),
+            this->_segment_options(tcb, true)
         );
     }
 
+    // Returns the options of a non-SYN segment of the connection.
+    //
+    // SACK blocks are only added if 'with_sack' is 'true', as there is no room
+    // for them in full sized data segments.
+    options_t _segment_options(const tcb_t *tcb, bool with_sack) const
+    {
+        options_t options;
+
+        if (tcb->timestamps) {
+            options.has_timestamp = true;
+            options.ts_val        = this->_timestamp();
+            options.ts_ecr        = tcb->ts_recent;
+        }
+
+        if (with_sack && tcb->sack_permitted && !tcb->out_of_order.empty()) {
+            size_t max_blocks =   options.has_timestamp
+                                ? MAX_SACK_BLOCKS - 1 : MAX_SACK_BLOCKS;
+
+            const auto &intervals = tcb->out_of_order.intervals;
+
+            // RFC 2018 requires the first block to contain the most recently
+            // received segment. The other blocks are the highest intervals.
+            //
+            // The most recent segment could have been delivered since, if it
+            // filled the front of the queue. It is then below every interval.
+
+            auto recent = intervals.upper_bound(tcb->out_of_order.last);
+            bool has_recent = recent != intervals.begin();
+
+            if (has_recent) {
+                --recent;
+
+                options.sack_blocks[options.n_sack_blocks++] = {
+                    recent->first, recent->second.end
+                };
+            }
+
+            for (
+                auto it = intervals.rbegin();
+                it != intervals.rend() && options.n_sack_blocks < max_blocks;
+                ++it
+            ) {
+                if (has_recent && it->first == recent->first)
+                    continue;
+
+                options.sack_blocks[options.n_sack_blocks++] = {
+                    it->first, it->second.end
+                };
+            }
+        }
+
+        return options;
+    }
+
+    // Returns the current value of the clock of the timestamps option, in
+    // milliseconds.
+    //
+    // Derived from the elapsed cycles, as '_syn_cookie_counter()'.
+    inline uint32_t _timestamp(void) const
+    {
+        static const typename clock_t::interval_t millisec(1000);
+
+        typename clock_t::interval_t elapsed =
+            clock_t::time_t::now() - this->ts_epoch;
+
+        return (uint32_t) (elapsed.cycles / millisec.cycles);
+    }
+
     // Responds to the received segment by acknowledging the most recently
     // received byte.
     //
@@ -2334,6 +4318,13 @@ private:
         tcb->rx_window.acked = tcb->rx_window.next;
     }
 
+    // Returns 'true' if the physical layer is short of the buffers which hold
+    // the full-sized data segments of the connection.
+    inline bool _tx_congested(const tcb_t *tcb) const
+    {
+        return this->network->tx_congested(HEADER_SIZE + tcb->tx_window.mss);
+    }
+
     // Responds to the received segment by sending pending data (if any). Does
     // nothing of the transmission queue is empty or if the transmission window
     // has no free sequence number.
@@ -2342,7 +4333,12 @@ private:
     // CLOSE-WAIT or LAST-ACK).
     //
     // Can sent multiple data segments if permitted by the transmission window
-    // and will update the transmission window and transmission queue.
+    // and will update the transmission window and transmission queue. The
+    // segments are given to the network layer by bursts which share their
+    // header templates (see '_data_burst_t').
+    //
+    // If TCP_PACING is defined, only sends a pacing quantum and schedules the
+    // transmission of the remaining data with the pacing timer.
     //
     // If the connection is in the FIN-WAIT-1 or LAST_ACK state, the FIN
     // control bit will be set in the segment holding the last data byte.
@@ -2360,60 +4356,96 @@ private:
         if (tcb->tx_queue_not_sent.empty())
             return;
 
+        #ifdef TCP_PACING
+            // The pacing timer will resume the transmission.
+            if (tcb->has_pacing_timer)
+                return;
+        #endif /* TCP_PACING */
+
         // First sequence number that is outside of the transmission window.
         seq_t end_of_win = tcb->tx_window.end();
 
+        #ifdef TCP_PACING
+            uint64_t pacing_rate = this->_pacing_rate(tcb);
+
+            if (pacing_rate > 0) {
+                // Only sends a pacing quantum.
+                seq_t end_of_quantum =
+                      tcb->tx_window.next
+                    + (seq_t) this->_pacing_quantum(tcb, pacing_rate);
+
+                end_of_win = min(end_of_win, end_of_quantum);
+            }
+        #endif /* TCP_PACING */
+
+        if (UNLIKELY(this->_tx_congested(tcb))) {
+            // The physical layer is short of buffers. Waits for the data in
+            // flight to be acknowledged, or sends a single segment so that its
+            // acknowledgment resumes the transmission.
+            //
+            // The ACKs of the data in flight call this method again, and the
+            // retransmission timer recovers them if they are lost. The
+            // deferred data and any pending FIN are then sent.
+
+            this->stats.tx_deferred.inc();
+
+            if (tcb->tx_window.in_flight() > 0) {
+                if (!tcb->has_timer)
+                    this->_schedule_retransmission_timer(tcb_id, tcb);
+                return;
+            }
+
+            end_of_win = min(
+                end_of_win, tcb->tx_window.next + (seq_t) tcb->tx_window.mss
+            );
+        }
+
         if (end_of_win <= tcb->tx_window.next)
             return;
 
         //
-        // Copies the entries of the transmission queue that will be delivered
-        // as the transmission queue could be reallocated when the transmission
-        // occurs, and moves entirely transmitted entries to the
-        // 'tx_queue_sent_unack' queue.
+        // Moves the entries that will be entirely transmitted to the
+        // 'tx_queue_sent_unack' queue, and then references the entries that
+        // will be delivered, as moving an entry could reallocate the queue.
         //
 
-        shared_ptr<vector<typename tcb_t::tx_queue_entry_t, alloc_t>> to_send;
+        size_t n_moved = 0;
+        while (
+               !tcb->tx_queue_not_sent.empty()
+            && tcb->tx_queue_not_sent.front().end <= end_of_win
+        ) {
+            auto &entry = tcb->tx_queue_not_sent.front();
 
-        {
-            // Counts the number of entries in the transmission window that will
-            // be delivered.
-            int n_entries = 0;
-            for (
-                auto it = tcb->tx_queue_not_sent.begin();
-                it != tcb->tx_queue_not_sent.end() && end_of_win > it->begin;
-                ++it
-            ) {
-                // Paranoia checks.
-                assert(it->end > it->begin);
-                assert(it->end > tcb->tx_window.next);
-                ++n_entries;
-            }
+            // Paranoia checks.
+            assert(entry.end > entry.begin);
+            assert(entry.end > tcb->tx_window.next);
 
-            assert(n_entries > 0);
+            tcb->tx_queue_sent_unack.emplace_back(move(entry));
+            tcb->tx_queue_not_sent.pop_front();
+            ++n_moved;
+        }
 
-            to_send = allocate_shared<to_send_vec_t>(
-                this->alloc, n_entries, this->alloc
-            );
+        this->to_send.clear();
 
-            // Copies entries and moves entries that will be fully delivered to
-            // the 'tx_queue_sent_unack' queue.
-            for (int i = 0; i < n_entries; ++i) {
-                const auto &entry = tcb->tx_queue_not_sent.front();
+        for (
+            size_t i = tcb->tx_queue_sent_unack.size() - n_moved;
+            i < tcb->tx_queue_sent_unack.size();
+            ++i
+        )
+            this->to_send.push_back(&tcb->tx_queue_sent_unack[i]);
 
-                (*to_send)[i] = entry;
+        // The last entry could be partially delivered.
+        if (
+               !tcb->tx_queue_not_sent.empty()
+            && end_of_win > tcb->tx_queue_not_sent.front().begin
+        )
+            this->to_send.push_back(&tcb->tx_queue_not_sent.front());
 
-                if (entry.end <= end_of_win) {
-                    // Copies entries that will be entirely transmitted.
-                    tcb->tx_queue_sent_unack.push_back(entry);
-                    tcb->tx_queue_not_sent.pop_front();
-                } else {
-                    // Must be the last entry.
-                    assert(i + 1 == n_entries);
-                    break;
-                }
-            }
-        }
+        assert(!this->to_send.empty());
+
+        shared_ptr<to_send_copy_t> to_send_copy;
+        const to_send_vec_t *to_send =
+            this->_to_send_refs(tcb_id.raddr, &to_send_copy);
 
         //
         // Sends the pending entries in one or more data segments.
@@ -2421,116 +4453,224 @@ private:
 
         // First sequence number which is outside of the transmission window or
         // not in the data to transmit.
-        seq_t end_of_transmission = min(end_of_win, to_send->back().end);
+        seq_t end_of_transmission = min(end_of_win, to_send->back()->end);
 
         assert(end_of_transmission > tcb->tx_window.next);
 
+        #ifdef TCP_PACING
+            seq_t start_of_transmission = tcb->tx_window.next;
+        #endif /* TCP_PACING */
+
+        // The FIN control bit is sent with the last byte of the transmission
+        // queue.
+        bool is_closing = tcb->fin_pending && tcb->tx_queue_not_sent.empty();
+
         auto to_send_it = to_send->begin();
 
         do {
-            // First sequence number that can't be send in this segment or
-            // which is not in the data to send.
-            seq_t end_of_seg = min(
-                end_of_transmission,
-                tcb->tx_window.next + (seq_t) tcb->tx_window.mss
-            );
+            // Segments are given to the network layer by bursts of at most
+            // MAX_BURST_SEGS segments. Only bursts which are delayed with their
+            // copied entries are allocated.
+            _data_burst_t               *burst = &this->data_burst;
+            shared_ptr<_data_burst_t>   delayed_burst;
+
+            if (UNLIKELY(to_send_copy != nullptr)) {
+                delayed_burst = allocate_shared<_data_burst_t>(this->alloc);
+                burst = delayed_burst.get();
+            }
+
+            this->_init_data_burst(tcb_id, tcb, to_send_copy, burst);
+
+            do {
+                // First sequence number that can't be send in this segment or
+                // which is not in the data to send.
+                seq_t end_of_seg = min(
+                    end_of_transmission,
+                    tcb->tx_window.next + (seq_t) tcb->tx_window.mss
+                );
 
-            size_t payload_size = (end_of_seg - tcb->tx_window.next).value;
-            assert(payload_size > 0);
-            assert(payload_size <= tcb->tx_window.mss);
-            assert(payload_size <= tcb->tx_window.ready());
+                size_t payload_size = (end_of_seg - tcb->tx_window.next).value;
+                assert(payload_size > 0);
+                assert(payload_size <= tcb->tx_window.mss);
+                assert(payload_size <= tcb->tx_window.ready());
 
-            assert(to_send_it != to_send->end());
+                assert(to_send_it != to_send->end());
 
-            // Finds the first entry that will be sent in this segement.
-            for (; to_send_it->end <= tcb->tx_window.next; ++to_send_it)
-                ;
+                // Finds the first entry that will be sent in this segement.
+                for (; (*to_send_it)->end <= tcb->tx_window.next; ++to_send_it)
+                    ;
 
-            // Finds the first entry that will not be sent in this segment.
-            auto to_send_end_it = to_send_it + 1;
-            for (
-                ;
-                   to_send_end_it != to_send->end()
-                && to_send_end_it->end <= end_of_seg;
-                ++to_send_end_it
-            )
-                ;
+                // Finds the first entry that will not be sent in this segment.
+                // The last entry of the segment could be partially sent.
+                auto to_send_end_it = to_send_it + 1;
+                for (
+                    ;
+                       to_send_end_it != to_send->end()
+                    && (*to_send_end_it)->begin < end_of_seg;
+                    ++to_send_end_it
+                )
+                    ;
 
-            bool has_fin =    tcb->in_state(tcb_t::FIN_WAIT_1 | tcb_t::LAST_ACK)
-                           && tcb->tx_queue_not_sent.empty();
+                bool has_fin = is_closing && end_of_seg == to_send->back()->end;
 
-            this->_send_data_segment(
-                tcb_id, tcb, tcb->tx_window.next,/* to_send, n_entries, */
-                to_send, to_send_it, to_send_end_it,
-                payload_size, has_fin
-            );
+                this->_push_data_segment(
+                    tcb_id, tcb, burst, tcb->tx_window.next, to_send_it,
+                    to_send_end_it, payload_size, has_fin
+                );
 
-            // Updates the transmission windows.
+                // Updates the transmission windows.
 
-            tcb->tx_window.next += (seq_t) payload_size;
+                tcb->tx_window.next += (seq_t) payload_size;
 
-            tcb->rx_window.acked = tcb->rx_window.next;
+                tcb->rx_window.acked = tcb->rx_window.next;
 
-            // Updates the transmission history.
-            typename tcb_t::tx_history_entry_t segment(tcb->tx_window.next);
-            tcb->tx_history.push_back(segment);
+                // Updates the transmission history.
+                tcb->push_history(tcb->tx_window.next);
+
+                if (has_fin) {
+                    ++tcb->tx_window.next; // Transmitted FIN control bit.
+                    tcb->fin_pending = false;
+                }
+            } while (
+                   end_of_transmission > tcb->tx_window.next
+                && burst->size() < MAX_BURST_SEGS
+            );
 
-            if (has_fin)
-                ++tcb->tx_window.next; // Transmitted FIN control bit.
+            this->stats.sent.inc(burst->size());
+            this->network->send_tcp_payloads(
+                tcb_id.raddr, _data_burst_ref_t { burst, move(delayed_burst) }
+            );
         } while (end_of_transmission > tcb->tx_window.next);
 
+        tcb->check_app_limited();
+
         if (!tcb->has_timer)
             this->_schedule_retransmission_timer(tcb_id, tcb);
+
+        #ifdef TCP_PACING
+            if (pacing_rate > 0 && !tcb->tx_queue_not_sent.empty()) {
+                size_t sent = (tcb->tx_window.next - start_of_transmission)
+                              .value;
+                this->_schedule_pacing_timer(tcb_id, tcb, sent, pacing_rate);
+            }
+        #endif /* TCP_PACING */
     }
 
-    // Emits a segment to the remote TCP with data contained in the given
-    // queue entries, and the FIN control bit if 'has_fin' is 'true'.
+    // Initializes the header and options templates of a burst of data
+    // segments.
     //
-    // The method will free the 'to_send' vector once the data will be
-    // transmitted.
+    // <ACK=RCV.NXT><CTL=ACK>
+    void _init_data_burst(
+        tcb_id_t tcb_id, const tcb_t *tcb,
+        shared_ptr<to_send_copy_t> to_send_copy, _data_burst_t *burst
+    ) const
+    {
+        burst->to_send_copy = move(to_send_copy);
+        burst->n_segments   = 0;
+
+        options_t options = this->_segment_options(tcb, false);
+
+        burst->options_size = options.size();
+        _write_options(burst->options, options);
+        burst->options_sum = partial_sum_t(burst->options, burst->options_size);
+
+        header_t *hdr = &burst->hdr;
+
+        hdr->sport   = tcb_id.lport;
+        hdr->dport   = tcb_id.rport;
+        hdr->seq.net = 0;
+        hdr->ack     = tcb->rx_window.next;
+        hdr->res     = 0;
+        hdr->doff    = (HEADER_SIZE + burst->options_size) / sizeof (uint32_t);
+        hdr->window  = tcb->rx_window.advertised();
+        hdr->check   = checksum_t::ZERO;
+        hdr->urg_ptr = 0;
+
+        hdr->flags              = _FIN_ACK_FLAGS;
+        burst->fin_ack_hdr_sum  = partial_sum_t(hdr, HEADER_SIZE);
+
+        hdr->flags              = _ACK_FLAGS;
+        burst->ack_hdr_sum      = partial_sum_t(hdr, HEADER_SIZE);
+
+        burst->pseudo_hdr_sum = network_t::tcp_pseudo_header_sum(
+            this->network->addr, tcb_id.raddr, net_t<seg_size_t>(0)
+        );
+    }
+
+    // Adds a data segment with the data contained in the given queue entries,
+    // and the FIN control bit if 'has_fin' is 'true', to the burst.
     //
     // <SEQ=seq><ACK=RCV.NXT><CTL=ACK><payload>.
-    void _send_data_segment(
-        tcb_id_t tcb_id, const tcb_t *tcb, seq_t seq,
-        shared_ptr<to_send_vec_t> to_send,
+    void _push_data_segment(
+        tcb_id_t tcb_id, const tcb_t *tcb, _data_burst_t *burst, seq_t seq,
         typename to_send_vec_t::const_iterator begin,
         typename to_send_vec_t::const_iterator end,
         size_t payload_size, bool has_fin
     )
     {
         assert(begin != end);
+        assert(burst->size() < MAX_BURST_SEGS);
 
-        // Creates a function which writes the content of multiple transmission
-        // queue entries into a single network buffer.
-        function<partial_sum_t(cursor_t)> payload_writer =
-            [this, start_seq = seq, to_send, begin, end](cursor_t cursor)
-            {
-                assert(to_send->size() > 0);
-
-                seq_t         seq = start_seq;
-                partial_sum_t partial_sum = partial_sum_t::ZERO;
+        if (has_fin) {
+            TCP_TCB_DEBUG(
+                "Responds with FIN/ACK data segment "
+                "(<SEQ=%u><ACK=%u><CTL=FIN,ACK><%zu bytes payload>)",
+                seq.value, tcb->rx_window.next.value, payload_size
+            );
+        } else {
+            TCP_TCB_DEBUG(
+                "Responds with data segment "
+                "(<SEQ=%u><ACK=%u><CTL=ACK><%zu bytes payload>)",
+                seq.value, tcb->rx_window.next.value, payload_size
+            );
+        }
 
-                for (auto it = begin; it != end; ++it) {
-                    const auto &entry = *it;
+        typename _data_burst_t::segment_t *seg =
+            &burst->segments[burst->n_segments++];
 
-                    assert(!cursor.empty());
-                    assert(entry.begin <= seq);
-                    assert(entry.end > seq);
+        seg->seq            = seq;
+        seg->payload_size   = payload_size;
+        seg->begin          = begin;
+        seg->end            = end;
+        seg->tail           = static_extent_t();
+        seg->tail_sum       = partial_sum_t::ZERO;
+        seg->has_fin        = has_fin;
 
-                    size_t offset = (seq - entry.begin).value,
-                           length = (entry.end - seq).value;
+        this->_segment_tail(
+            **(end - 1), seq, payload_size, &seg->tail, &seg->tail_sum
+        );
+    }
 
-                    partial_sum = partial_sum.append(
-                        entry.writer(offset, cursor.take(length))
-                    );
-                    cursor = cursor.drop(length);
+    // Emits a segment to the remote TCP with data contained in the given
+    // queue entries, and the FIN control bit if 'has_fin' is 'true'.
+    //
+    // 'to_send_copy' owns the entries if the transmission is delayed (see
+    // '_to_send_refs()').
+    //
+    // <SEQ=seq><ACK=RCV.NXT><CTL=ACK><payload>.
+    void _send_data_segment(
+        tcb_id_t tcb_id, const tcb_t *tcb, seq_t seq,
+        shared_ptr<to_send_copy_t> to_send_copy,
+        typename to_send_vec_t::const_iterator begin,
+        typename to_send_vec_t::const_iterator end,
+        size_t payload_size, bool has_fin
+    )
+    {
+        assert(begin != end);
 
-                    seq = entry.end;
-                }
+        // Static data at the end of the last entry is sent by reference.
+        static_extent_t tail;
+        partial_sum_t   tail_sum = partial_sum_t::ZERO;
 
-                assert(cursor.empty());
+        this->_segment_tail(**(end - 1), seq, payload_size, &tail, &tail_sum);
 
-                return partial_sum;
+        // Creates a function which writes the content of multiple transmission
+        // queue entries into a single network buffer.
+        auto payload_writer =
+            [seq, to_send_copy = move(to_send_copy), begin, end, tail_sum]
+            (cursor_t cursor)
+            {
+                return _write_entries(begin, end, seq, cursor).append(tail_sum);
             };
 
         if (has_fin) {
@@ -2541,8 +4681,8 @@ private:
             );
 
             this->_send_fin_ack_segment(
-                tcb_id, tcb, seq, tcb->rx_window.next, payload_writer,
-                payload_size
+                tcb_id, tcb, seq, tcb->rx_window.next, move(payload_writer),
+                payload_size, tail
             );
         } else {
             TCP_TCB_DEBUG(
@@ -2552,10 +4692,118 @@ private:
             );
 
             this->_send_ack_segment(
-                tcb_id, tcb, seq, tcb->rx_window.next, payload_writer,
-                payload_size
+                tcb_id, tcb, seq, tcb->rx_window.next, move(payload_writer),
+                payload_size, tail
+            );
+        }
+    }
+
+    // Returns the references to the entries of 'to_send' that the data
+    // segments sent to 'raddr' will write.
+    //
+    // The segments are written before the transmission methods return, and
+    // read the entries in the transmission queues, unless the network layer
+    // delays the transmission because the data-link address of the remote is
+    // not cached. The queues could then be modified before the segments are
+    // written. The entries are copied into '*copy', which must be kept by the
+    // delayed segments.
+    const to_send_vec_t *_to_send_refs(
+        net_t<addr_t> raddr, shared_ptr<to_send_copy_t> *copy
+    )
+    {
+        if (LIKELY(this->network->has_data_link_addr(raddr)))
+            return &this->to_send;
+
+        *copy = allocate_shared<to_send_copy_t>(this->alloc, this->alloc);
+
+        auto &entries = (*copy)->entries;
+        auto &refs    = (*copy)->refs;
+
+        entries.reserve(this->to_send.size());
+        for (to_send_entry_t entry : this->to_send)
+            entries.push_back(*entry);
+
+        refs.reserve(entries.size());
+        for (const auto &entry : entries)
+            refs.push_back(&entry);
+
+        return &refs;
+    }
+
+    // Writes the content of the given transmission queue entries, starting at
+    // 'seq', into the cursor.
+    //
+    // The cursor doesn't include the static data of the last entry which is
+    // sent by reference. Returns the partial sum of the written data.
+    static partial_sum_t _write_entries(
+        typename to_send_vec_t::const_iterator begin,
+        typename to_send_vec_t::const_iterator end,
+        seq_t seq, cursor_t cursor
+    )
+    {
+        partial_sum_t partial_sum = partial_sum_t::ZERO;
+
+        for (auto it = begin; it != end; ++it) {
+            const auto &entry = **it;
+
+            // The cursor could be empty if the last entry is sent by
+            // reference.
+            assert(!cursor.empty() || it + 1 == end);
+            assert(entry.begin <= seq);
+            assert(entry.end > seq);
+
+            size_t offset = (seq - entry.begin).value,
+                   length = (entry.end - seq).value;
+
+            partial_sum = partial_sum.append(
+                entry.write(offset, cursor.take(length))
             );
+            cursor = cursor.drop(length);
+
+            seq = entry.end;
         }
+
+        assert(cursor.empty());
+
+        return partial_sum;
+    }
+
+    // Computes the static data which is sent by reference at the end of a
+    // segment which starts at 'seq', carries 'payload_size' bytes and ends
+    // with data of the 'last' entry.
+    static void _segment_tail(
+        const typename tcb_t::tx_queue_entry_t &last, seq_t seq,
+        size_t payload_size, static_extent_t *tail, partial_sum_t *tail_sum
+    )
+    {
+        size_t offset = seq > last.begin ? (seq - last.begin).value : 0,
+               length = (seq + seq_t(payload_size) - last.begin).value
+                        - offset;
+
+        _segment_tail(last, offset, length, tail, tail_sum);
+    }
+
+    // Computes the static data which is sent by reference at the end of a
+    // segment which contains the 'length' bytes starting at 'offset' of the
+    // entry.
+    //
+    // Leaves 'tail' and 'tail_sum' unchanged if the segment ends with data
+    // which is written by the entry's writer.
+    static void _segment_tail(
+        const typename tcb_t::tx_queue_entry_t &entry, size_t offset,
+        size_t length, static_extent_t *tail, partial_sum_t *tail_sum
+    )
+    {
+        size_t head = entry.head_size();
+
+        if (LIKELY(entry.tail.size == 0) || offset + length <= head)
+            return;
+
+        size_t tail_offset = max(offset, head) - head,
+               tail_length = offset + length - head - tail_offset;
+
+        *tail     = static_extent_t(entry.tail.data + tail_offset, tail_length);
+        *tail_sum = entry.tail.sum(tail_offset, tail_length);
     }
 
     // Responds to a received segment (and its payload) with a RST segment.
@@ -2608,11 +4856,22 @@ private:
     }
 
     // Pushes the given segment with its payload to the network layer.
+    //
+    // 'payload_writer' is any callable which accepts a 'cursor_t' and returns
+    // the 'partial_sum_t' of the written data. It's moved down to the physical
+    // layer without being converted into a 'function<>', unless the network
+    // layer needs to delay the transmission.
+    //
+    // The last 'tail.size' bytes of the payload are transmitted by reference.
+    // The cursor given to 'payload_writer' doesn't include them, but the
+    // returned partial sum must.
+    template <typename payload_writer_t>
     void _send_segment(
         net_t<port_t> sport, net_t<addr_t> daddr, net_t<port_t> dport,
         net_t<seq_t> seq, net_t<seq_t> ack, flags_t flags,
-        net_t<win_size_t> window, options_t options,
-        function<partial_sum_t(cursor_t)> payload_writer, size_t payload_size
+        net_t<uint16_t> window, options_t options,
+        payload_writer_t payload_writer, size_t payload_size,
+        static_extent_t tail = static_extent_t()
     )
     {
         net_t<addr_t> saddr = this->network->addr;
@@ -2626,10 +4885,12 @@ private:
                 saddr, daddr, net_t<seg_size_t>(seg_size)
             );
 
+        this->stats.sent.inc();
+
         this->network->send_tcp_payload(
         daddr, seg_size,
-        [sport, daddr, dport, seq, ack, flags, window, options, payload_writer,
-         pseudo_hdr_sum]
+        [sport, daddr, dport, seq, ack, flags, window, options,
+         payload_writer = move(payload_writer), pseudo_hdr_sum]
         (cursor_t cursor) {
             // Delays the writing of the headers as the sum of the payload and
             // options is not yet known.
@@ -2649,19 +4910,21 @@ private:
                 hdr_cursor, sport, dport, seq, ack, flags, window, options_size,
                 partial_sum
             );
-        });
+        }, tail);
     }
 
     // Pushes the given segment with its payload to the network layer.
+    template <typename payload_writer_t>
     inline void _send_segment(
         tcb_id_t tcb_id, net_t<seq_t> seq, net_t<seq_t> ack, flags_t flags,
-        net_t<win_size_t> window, options_t options,
-        function<partial_sum_t(cursor_t)> payload_writer, size_t payload_size
+        net_t<uint16_t> window, options_t options,
+        payload_writer_t payload_writer, size_t payload_size,
+        static_extent_t tail = static_extent_t()
     )
     {
         this->_send_segment(
             tcb_id.lport, tcb_id.raddr, tcb_id.rport, seq, ack, flags, window,
-            options, payload_writer, payload_size
+            options, move(payload_writer), payload_size, tail
         );
     }
 
@@ -2669,7 +4932,7 @@ private:
     inline void _send_segment(
         net_t<port_t> sport, net_t<addr_t> daddr, net_t<port_t> dport,
         net_t<seq_t> seq, net_t<seq_t> ack, flags_t flags,
-        net_t<win_size_t> window, options_t options
+        net_t<uint16_t> window, options_t options
     )
     {
         this->_send_segment(
@@ -2681,7 +4944,7 @@ private:
     // Pushes the given segment with an empty payload to the network layer.
     inline void _send_segment(
         tcb_id_t tcb_id, net_t<seq_t> seq, net_t<seq_t> ack, flags_t flags,
-        net_t<win_size_t> window, options_t options
+        net_t<uint16_t> window, options_t options
     )
     {
         this->_send_segment(
@@ -2696,7 +4959,7 @@ private:
     static cursor_t _write_header(
         cursor_t cursor, net_t<port_t> sport, net_t<port_t> dport,
         net_t<seq_t> seq, net_t<seq_t> ack, flags_t flags,
-        net_t<win_size_t> window, size_t options_size, partial_sum_t partial_sum
+        net_t<uint16_t> window, size_t options_size, partial_sum_t partial_sum
     );
 
     #undef TCP_TCB_STATE_CHANGE
@@ -2705,6 +4968,160 @@ private:
 
     // -------------------------------------------------------------------------
 
+    //
+    // SYN cookies
+    //
+    // A SYN cookie is a 32 bits initial sequence number made of:
+    // - a 5 bits counter incremented every SYN_COOKIE_PERIOD microseconds ;
+    // - a 3 bits index in the table of MSS values given by '_syn_cookie_mss()';
+    // - a 24 bits keyed hash of the connection identifier, of the initial
+    //   sequence number of the remote, of the counter and of the MSS index.
+    //
+    // When the SYN segment carries the timestamps option, the 5 low bits of
+    // the timestamp of the SYN-ACK segment, echoed by the remote, encode the
+    // other options of the SYN segment:
+    // - the 4 bits shift count of the window scale option of the remote, or
+    //   SYN_COOKIE_NO_WSCALE ;
+    // - a bit set if the remote sent the SACK-permitted option.
+    //
+
+    // Encoded shift count when the SYN segment has no window scale option.
+    static constexpr uint32_t SYN_COOKIE_NO_WSCALE = 0xF;
+
+    // Bits of the SYN-ACK timestamp which encode the options.
+    static constexpr uint32_t SYN_COOKIE_TS_MASK = 0x1F;
+
+    // Returns the MSS value corresponding to an index encoded in a SYN cookie.
+    static inline mss_t _syn_cookie_mss(uint32_t index)
+    {
+        static const mss_t TABLE[8] = {
+            536, 1024, 1220, 1400, 1440, 1460, 4312, 8960
+        };
+
+        return TABLE[index];
+    }
+
+    // Returns the current value of the SYN cookie counter.
+    //
+    // The counter is derived from the elapsed cycles, as their conversion to
+    // microseconds overflows after a few hours.
+    inline uint32_t _syn_cookie_counter(void) const
+    {
+        static const typename clock_t::interval_t period(SYN_COOKIE_PERIOD);
+
+        typename clock_t::interval_t elapsed =
+            clock_t::time_t::now() - this->syn_cookie_epoch;
+
+        return (uint32_t) ((elapsed.cycles / period.cycles) & 0x1F);
+    }
+
+    // Returns the 24 bits hash of a SYN cookie.
+    inline uint32_t _syn_cookie_hash(
+        tcb_id_t tcb_id, seq_t irs, uint32_t counter, uint32_t mss_index
+    ) const
+    {
+        uint64_t h = (uint64_t) hash<tcb_id_t>()(tcb_id);
+
+        h  = _mix64(h ^ this->syn_cookie_secret);
+        h ^= ((uint64_t) irs.value << 8) | (counter << 3) | mss_index;
+        h  = _mix64(h ^ this->syn_cookie_secret);
+
+        return (uint32_t) h & 0xFFFFFF;
+    }
+
+    // Finalizer of MurmurHash3.
+    static inline uint64_t _mix64(uint64_t h)
+    {
+        h ^= h >> 33;
+        h *= 0xFF51AFD7ED558CCDULL;
+        h ^= h >> 33;
+        h *= 0xC4CEB9FE1A85EC53ULL;
+        h ^= h >> 33;
+
+        return h;
+    }
+
+    // Returns the SYN cookie used to respond to a SYN segment. 'mss' is the
+    // maximum segment size which has been negotiated with the remote. The
+    // encoded MSS could be smaller.
+    seq_t _make_syn_cookie(tcb_id_t tcb_id, seq_t irs, mss_t mss) const
+    {
+        uint32_t mss_index = 7;
+        while (mss_index > 0 && _syn_cookie_mss(mss_index) > mss)
+            mss_index--;
+
+        uint32_t counter = this->_syn_cookie_counter();
+        uint32_t hash = this->_syn_cookie_hash(tcb_id, irs, counter, mss_index);
+
+        return seq_t((counter << 27) | (mss_index << 24) | hash);
+    }
+
+    // Returns 'true' if 'iss' is a valid and not expired SYN cookie for the
+    // given connection. Sets 'mss' to the encoded MSS value.
+    bool _check_syn_cookie(
+        tcb_id_t tcb_id, seq_t irs, seq_t iss, mss_t *mss
+    ) const
+    {
+        uint32_t counter    = iss.value >> 27;
+        uint32_t mss_index  = (iss.value >> 24) & 0x7;
+        uint32_t hash       = iss.value & 0xFFFFFF;
+
+        uint32_t age = (this->_syn_cookie_counter() - counter) & 0x1F;
+        if (age > SYN_COOKIE_MAX_AGE)
+            return false;
+
+        if (hash != this->_syn_cookie_hash(tcb_id, irs, counter, mss_index))
+            return false;
+
+        *mss = min(_syn_cookie_mss(mss_index), this->mss);
+        return true;
+    }
+
+    // Returns the timestamp of the SYN-ACK segment of a SYN cookie, which
+    // encodes the options of the SYN segment.
+    //
+    // The timestamp is never later than the current one, so that the
+    // timestamps of the connection never go backward.
+    uint32_t _syn_cookie_timestamp(const options_t &syn_options) const
+    {
+        uint32_t bits = SYN_COOKIE_NO_WSCALE;
+        if (syn_options.wscale != options_t::NO_WSCALE_OPTION)
+            bits = (uint32_t) min((int) syn_options.wscale, 14);
+
+        if (syn_options.sack_permitted)
+            bits |= 0x10;
+
+        uint32_t ts = this->_timestamp();
+
+        if ((ts & SYN_COOKIE_TS_MASK) < bits)
+            ts -= SYN_COOKIE_TS_MASK + 1;
+
+        return (ts & ~SYN_COOKIE_TS_MASK) | bits;
+    }
+
+    // Sets the window scale and SACK-permitted options encoded in the echoed
+    // timestamp of a SYN cookie.
+    static void _syn_cookie_options(uint32_t ts_ecr, options_t *options)
+    {
+        uint32_t wscale = ts_ecr & 0xF;
+
+        if (wscale != SYN_COOKIE_NO_WSCALE) {
+            options->wscale =
+                (typename options_t::wscale_option_t) min(wscale, 14U);
+        }
+
+        options->sack_permitted = ts_ecr & 0x10;
+    }
+
+    // Returns a random key for the hash of SYN cookies.
+    static uint64_t _random_secret(void)
+    {
+        random_device rd;
+        return ((uint64_t) rd() << 32) | rd();
+    }
+
+    // -------------------------------------------------------------------------
+
     //
     // TCP options
     //
@@ -2731,6 +5148,9 @@ private:
         cursor_t cursor, options_t options
     );
 
+    // Writes the 'options.size()' bytes of the TCP options into the buffer.
+    static void _write_options(char *data, const options_t &options);
+
     static inline seq_t _get_current_tcp_seq(void);
 
     // -------------------------------------------------------------------------
@@ -2740,48 +5160,77 @@ private:
 // Initializes static fields and methods.
 //
 
-template <typename network_t, typename alloc_t>
-const typename tcp_t<network_t, alloc_t>::options_t
-tcp_t<network_t, alloc_t>::EMPTY_OPTIONS = {
-    tcp_t<network_t, alloc_t>::options_t::NO_MSS_OPTION
-};
-
-template <typename network_t, typename alloc_t>
-const typename tcp_t<network_t, alloc_t>::clock_t::interval_t
-// tcp_t<network_t, alloc_t>::FIN_TIMEOUT(60 * 1000000);    // 60 seconds
-tcp_t<network_t, alloc_t>::FIN_TIMEOUT(0);                  // Disabled
+template <
+    typename network_t, typename alloc_t, template <typename> class cc_var_t
+>
+const typename tcp_t<network_t, alloc_t, cc_var_t>::options_t
+tcp_t<network_t, alloc_t, cc_var_t>::EMPTY_OPTIONS =
+    typename tcp_t<network_t, alloc_t, cc_var_t>::options_t();
+
+template <
+    typename network_t, typename alloc_t, template <typename> class cc_var_t
+>
+const typename tcp_t<network_t, alloc_t, cc_var_t>::clock_t::interval_t
+// tcp_t<network_t, alloc_t, cc_var_t>::FIN_TIMEOUT(60 * 1000000); // 60 seconds
+tcp_t<network_t, alloc_t, cc_var_t>::FIN_TIMEOUT(0);               // Disabled
+
+template <
+    typename network_t, typename alloc_t, template <typename> class cc_var_t
+>
+const typename tcp_t<network_t, alloc_t, cc_var_t>::clock_t::interval_t
+tcp_t<network_t, alloc_t, cc_var_t>::DELAYED_ACK_TIMEOUT(40 * 1000); // 40 ms
 
 // Initializes common flags.
 
-template <typename network_t, typename alloc_t>
-const typename tcp_t<network_t, alloc_t>::flags_t
-tcp_t<network_t, alloc_t>::_SYN_FLAGS(0, 0, 0, 0, 1 /* SYN */, 0);
-
-template <typename network_t, typename alloc_t>
-const typename tcp_t<network_t, alloc_t>::flags_t
-tcp_t<network_t, alloc_t>::_SYN_ACK_FLAGS(0, 1 /* ACK */, 0, 0, 1 /* SYN */, 0);
-
-template <typename network_t, typename alloc_t>
-const typename tcp_t<network_t, alloc_t>::flags_t
-tcp_t<network_t, alloc_t>::_FIN_ACK_FLAGS(0, 1 /* ACK */, 0, 0, 0, 1 /* FIN */);
-
-template <typename network_t, typename alloc_t>
-const typename tcp_t<network_t, alloc_t>::flags_t
-tcp_t<network_t, alloc_t>::_ACK_FLAGS(0, 1 /* ACK */, 0, 0, 0, 0);
-
-template <typename network_t, typename alloc_t>
-const typename tcp_t<network_t, alloc_t>::flags_t
-tcp_t<network_t, alloc_t>::_RST_FLAGS(0, 0, 0, 1 /* RST */, 0, 0);
-
-template <typename network_t, typename alloc_t>
-const typename tcp_t<network_t, alloc_t>::flags_t
-tcp_t<network_t, alloc_t>::_RST_ACK_FLAGS(0, 1 /* ACK */, 0, 1 /* RST */, 0, 0);
+template <
+    typename network_t, typename alloc_t, template <typename> class cc_var_t
+>
+const typename tcp_t<network_t, alloc_t, cc_var_t>::flags_t
+tcp_t<network_t, alloc_t, cc_var_t>::_SYN_FLAGS(0, 0, 0, 0, 1 /* SYN */, 0);
+
+template <
+    typename network_t, typename alloc_t, template <typename> class cc_var_t
+>
+const typename tcp_t<network_t, alloc_t, cc_var_t>::flags_t
+tcp_t<network_t, alloc_t, cc_var_t>::_SYN_ACK_FLAGS(
+    0, 1 /* ACK */, 0, 0, 1 /* SYN */, 0
+);
+
+template <
+    typename network_t, typename alloc_t, template <typename> class cc_var_t
+>
+const typename tcp_t<network_t, alloc_t, cc_var_t>::flags_t
+tcp_t<network_t, alloc_t, cc_var_t>::_FIN_ACK_FLAGS(
+    0, 1 /* ACK */, 0, 0, 0, 1 /* FIN */
+);
+
+template <
+    typename network_t, typename alloc_t, template <typename> class cc_var_t
+>
+const typename tcp_t<network_t, alloc_t, cc_var_t>::flags_t
+tcp_t<network_t, alloc_t, cc_var_t>::_ACK_FLAGS(0, 1 /* ACK */, 0, 0, 0, 0);
+
+template <
+    typename network_t, typename alloc_t, template <typename> class cc_var_t
+>
+const typename tcp_t<network_t, alloc_t, cc_var_t>::flags_t
+tcp_t<network_t, alloc_t, cc_var_t>::_RST_FLAGS(0, 0, 0, 1 /* RST */, 0, 0);
+
+template <
+    typename network_t, typename alloc_t, template <typename> class cc_var_t
+>
+const typename tcp_t<network_t, alloc_t, cc_var_t>::flags_t
+tcp_t<network_t, alloc_t, cc_var_t>::_RST_ACK_FLAGS(
+    0, 1 /* ACK */, 0, 1 /* RST */, 0, 0
+);
 
 // Defines static methods.
 
-template <typename network_t, typename alloc_t>
-typename tcp_t<network_t, alloc_t>::cursor_t
-tcp_t<network_t, alloc_t>::_write_header(
+template <
+    typename network_t, typename alloc_t, template <typename> class cc_var_t
+>
+typename tcp_t<network_t, alloc_t, cc_var_t>::cursor_t
+tcp_t<network_t, alloc_t, cc_var_t>::_write_header(
     cursor_t cursor, net_t<port_t> sport, net_t<port_t> dport,
     net_t<seq_t> seq, net_t<seq_t> ack, flags_t flags, net_t<uint16_t> window,
     size_t options_size, partial_sum_t partial_sum
@@ -2807,14 +5256,15 @@ tcp_t<network_t, alloc_t>::_write_header(
     });
 }
 
-template <typename network_t, typename alloc_t>
-typename tcp_t<network_t, alloc_t>::options_t
-tcp_t<network_t, alloc_t>::_parse_options(
+template <
+    typename network_t, typename alloc_t, template <typename> class cc_var_t
+>
+typename tcp_t<network_t, alloc_t, cc_var_t>::options_t
+tcp_t<network_t, alloc_t, cc_var_t>::_parse_options(
     const header_t *hdr, cursor_t *payload, _parse_options_status_t *status
 )
 {
     options_t options;
-    options.mss = options_t::NO_MSS_OPTION;
 
     *status = OPTIONS_SUCCESS;
 
@@ -2844,7 +5294,10 @@ tcp_t<network_t, alloc_t>::_parse_options(
 
             // Maximum segment size option
             case TCPOPT_MAXSEG:
-                if (UNLIKELY(
+                if (UNLIKELY(data + 2 > end)) {
+                    *status = MALFORMED_OPTIONS;
+                    goto stop_parsing;
+                } else if (UNLIKELY(
                         data[1] != 4 || !flags.syn
                     || options.mss != options_t::NO_MSS_OPTION
                 )) {
@@ -2862,11 +5315,114 @@ tcp_t<network_t, alloc_t>::_parse_options(
                     continue;
                 }
 
+            // Window scale option (RFC 7323)
+            case TCPOPT_WINDOW:
+                if (UNLIKELY(
+                       data + TCPOLEN_WINDOW > end
+                    || data[1] != TCPOLEN_WINDOW
+                )) {
+                    *status = MALFORMED_OPTIONS;
+                    goto stop_parsing;
+                }
+
+                // RFC 7323 page 10: the option must be ignored when received
+                // in a non-SYN segment.
+                if (flags.syn) {
+                    // RFC 7323 page 9: shift counts larger than 14 are
+                    // replaced by 14.
+                    uint8_t shift = min<uint8_t>(data[2], 14);
+                    options.wscale =
+                        (typename options_t::wscale_option_t) shift;
+                }
+
+                data += TCPOLEN_WINDOW;
+                continue;
+
+            // SACK-permitted option (RFC 2018)
+            case TCPOPT_SACK_PERMITTED:
+                if (UNLIKELY(
+                       data + TCPOLEN_SACK_PERMITTED > end
+                    || data[1] != TCPOLEN_SACK_PERMITTED
+                )) {
+                    *status = MALFORMED_OPTIONS;
+                    goto stop_parsing;
+                }
+
+                if (flags.syn)
+                    options.sack_permitted = true;
+
+                data += TCPOLEN_SACK_PERMITTED;
+                continue;
+
+            // Timestamps option (RFC 7323)
+            case TCPOPT_TIMESTAMP:
+                if (UNLIKELY(
+                       data + TCPOLEN_TIMESTAMP > end
+                    || data[1] != TCPOLEN_TIMESTAMP
+                )) {
+                    *status = MALFORMED_OPTIONS;
+                    goto stop_parsing;
+                } else {
+                    // Options are not aligned.
+                    uint32_t ts_val, ts_ecr;
+                    memcpy(&ts_val, data + 2, sizeof (uint32_t));
+                    memcpy(&ts_ecr, data + 6, sizeof (uint32_t));
+
+                    options.has_timestamp   = true;
+                    options.ts_val          = to_host<uint32_t>(ts_val);
+                    options.ts_ecr          = to_host<uint32_t>(ts_ecr);
+
+                    data += TCPOLEN_TIMESTAMP;
+                    continue;
+                }
+
+            // SACK option (RFC 2018)
+            case TCPOPT_SACK:
+                if (UNLIKELY(data + 2 > end)) {
+                    *status = MALFORMED_OPTIONS;
+                    goto stop_parsing;
+                } else {
+                    uint8_t length = data[1];
+                    if (UNLIKELY(
+                           data + length > end || length < 10
+                        || (length - 2) % 8 != 0
+                    )) {
+                        *status = MALFORMED_OPTIONS;
+                        goto stop_parsing;
+                    }
+
+                    size_t n_blocks = min<size_t>(
+                        (length - 2) / 8, MAX_SACK_BLOCKS
+                    );
+
+                    for (size_t i = 0; i < n_blocks; i++) {
+                        const uint8_t *block = data + 2 + i * 8;
+
+                        uint32_t block_begin, block_end;
+                        memcpy(&block_begin, block,     sizeof (uint32_t));
+                        memcpy(&block_end,   block + 4, sizeof (uint32_t));
+
+                        options.sack_blocks[i].begin =
+                            seq_t(to_host<uint32_t>(block_begin));
+                        options.sack_blocks[i].end =
+                            seq_t(to_host<uint32_t>(block_end));
+                    }
+                    options.n_sack_blocks = n_blocks;
+
+                    data += length;
+                    continue;
+                }
+
             default:
                 TCP_DEBUG("Unknwown option kind: %d. Ignore", kind);
 
                 // TCP options with other than TCPOPT_EOL or TCPOPT_NOP
                 // contain their length in their second byte.
+                if (UNLIKELY(data + 2 > end)) {
+                    *status = MALFORMED_OPTIONS;
+                    goto stop_parsing;
+                }
+
                 uint8_t length = data[1];
                 if (UNLIKELY(data + length > end || length < 2)) {
                     *status = MALFORMED_OPTIONS;
@@ -2885,32 +5441,112 @@ tcp_t<network_t, alloc_t>::_parse_options(
     return options;
 }
 
-template <typename network_t, typename alloc_t>
-tuple<typename tcp_t<network_t, alloc_t>::cursor_t, partial_sum_t, size_t>
-tcp_t<network_t, alloc_t>::_write_options(cursor_t cursor, options_t options)
+template <
+    typename network_t, typename alloc_t, template <typename> class cc_var_t
+>
+tuple<
+    typename tcp_t<network_t, alloc_t, cc_var_t>::cursor_t, partial_sum_t,
+    size_t
+>
+tcp_t<network_t, alloc_t, cc_var_t>::_write_options(
+    cursor_t cursor, options_t options
+)
+{
+    size_t options_size = options.size();
+
+    if (options_size == 0)
+        return make_tuple(cursor, partial_sum_t::ZERO, 0);
+
+    assert(options_size <= 40);
+    assert(options_size % 4 == 0);
+
+    partial_sum_t partial_sum;
+
+    cursor = cursor.write_with(
+    [&options, options_size, &partial_sum](char *data) {
+        _write_options(data, options);
+        partial_sum = partial_sum_t(data, options_size);
+    }, options_size);
+
+    return make_tuple(cursor, partial_sum, options_size);
+}
+
+template <
+    typename network_t, typename alloc_t, template <typename> class cc_var_t
+>
+void tcp_t<network_t, alloc_t, cc_var_t>::_write_options(
+    char *data_char, const options_t &options
+)
 {
+    uint8_t *data = (uint8_t *) data_char;
+
+    // Options are padded with NOP options so that each of them starts on
+    // a 4 bytes boundary. Multi-bytes values are not aligned.
+
     if (options.mss != options_t::NO_MSS_OPTION) {
-        partial_sum_t partial_sum;
+        mss_t mss = to_network<mss_t>(options.mss);
 
-        cursor = cursor.write_with(
-        [options, &partial_sum](char *data_char) {
-            uint8_t *data = (uint8_t *) data_char;
+        data[0] = TCPOPT_MAXSEG;
+        data[1] = TCPOLEN_MAXSEG;
+        memcpy(data + 2, &mss, sizeof (mss));
+        data += TCPOLEN_MAXSEG;
+    }
 
-            data[0]             = TCPOPT_MAXSEG;
-            data[1]             = 4;
-            ((mss_t *) data)[1] = to_network<mss_t>(options.mss);
+    if (options.wscale != options_t::NO_WSCALE_OPTION) {
+        data[0] = TCPOPT_NOP;
+        data[1] = TCPOPT_WINDOW;
+        data[2] = TCPOLEN_WINDOW;
+        data[3] = (uint8_t) options.wscale;
+        data += TCPOLEN_WINDOW + 1;
+    }
 
-            partial_sum = partial_sum_t(data_char, 4);
-        }, 4);
+    if (options.sack_permitted) {
+        data[0] = TCPOPT_NOP;
+        data[1] = TCPOPT_NOP;
+        data[2] = TCPOPT_SACK_PERMITTED;
+        data[3] = TCPOLEN_SACK_PERMITTED;
+        data += TCPOLEN_SACK_PERMITTED + 2;
+    }
 
-        return make_tuple(cursor, partial_sum, 4);
-    } else
-        return make_tuple(cursor, partial_sum_t::ZERO, 0);
+    if (options.has_timestamp) {
+        uint32_t ts_val = to_network<uint32_t>(options.ts_val),
+                 ts_ecr = to_network<uint32_t>(options.ts_ecr);
+
+        data[0] = TCPOPT_NOP;
+        data[1] = TCPOPT_NOP;
+        data[2] = TCPOPT_TIMESTAMP;
+        data[3] = TCPOLEN_TIMESTAMP;
+        memcpy(data + 4, &ts_val, sizeof (ts_val));
+        memcpy(data + 8, &ts_ecr, sizeof (ts_ecr));
+        data += TCPOLEN_TSTAMP_APPA;
+    }
+
+    if (options.n_sack_blocks > 0) {
+        data[0] = TCPOPT_NOP;
+        data[1] = TCPOPT_NOP;
+        data[2] = TCPOPT_SACK;
+        data[3] = 2 + options.n_sack_blocks * sizeof (sack_block_t);
+        data += 4;
+
+        for (size_t i = 0; i < options.n_sack_blocks; i++) {
+            const sack_block_t &block = options.sack_blocks[i];
+            uint32_t begin = to_network<uint32_t>(block.begin.value),
+                     end   = to_network<uint32_t>(block.end.value);
+
+            memcpy(data,     &begin, sizeof (begin));
+            memcpy(data + 4, &end,   sizeof (end));
+            data += sizeof (sack_block_t);
+        }
+    }
+
+    assert(data == (uint8_t *) data_char + options.size());
 }
 
-template <typename network_t, typename alloc_t>
-inline typename tcp_t<network_t, alloc_t>::seq_t
-tcp_t<network_t, alloc_t>::_get_current_tcp_seq(void)
+template <
+    typename network_t, typename alloc_t, template <typename> class cc_var_t
+>
+inline typename tcp_t<network_t, alloc_t, cc_var_t>::seq_t
+tcp_t<network_t, alloc_t, cc_var_t>::_get_current_tcp_seq(void)
 {
     return network_t::data_link_t::phys_t::get_current_tcp_seq();
 }
@@ -2928,18 +5564,29 @@ namespace std {
 
 using namespace rusty::net;
 
-template <>
+// Mixes the fields with the finalizer of MurmurHash3.
+//
+// Hashes of integers are the integers themselves. Connections from a same
+// host, which use consecutive ports, would otherwise be given consecutive
+// hashes and fill neighbouring slots of the connection table.
 template <typename addr_t, typename port_t>
 struct hash<tcp_tcb_id_t<addr_t, port_t>> {
     inline size_t operator()(const tcp_tcb_id_t<addr_t, port_t> &tcb_id) const
     {
-        return   hash<net_t<addr_t>>()(tcb_id.raddr)
-               + hash<net_t<port_t>>()(tcb_id.rport)
-               + hash<net_t<port_t>>()(tcb_id.lport);
+        uint64_t h =   ((uint64_t) hash<net_t<addr_t>>()(tcb_id.raddr) << 32)
+                     ^ ((uint64_t) hash<net_t<port_t>>()(tcb_id.rport) << 16)
+                     ^  (uint64_t) hash<net_t<port_t>>()(tcb_id.lport);
+
+        h ^= h >> 33;
+        h *= 0xFF51AFD7ED558CCDULL;
+        h ^= h >> 33;
+        h *= 0xC4CEB9FE1A85EC53ULL;
+        h ^= h >> 33;
+
+        return (size_t) h;
     }
 };
 
-template <>
 template <typename addr_t, typename port_t>
 struct equal_to<tcp_tcb_id_t<addr_t, port_t>> {
     inline bool operator()(
@@ -0,0 +1,697 @@
+//
+// Congestion control algorithms of the TCP layer.
+//
+// Copyright 2015 Raphael Javaux <raphaeljavaux@gmail.com>
+// University of Liege.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Each algorithm is a class template parametrized by the clock type, used as
+// the 'cc_var_t' template parameter of 'tcp_t'. The TCP layer holds one
+// instance per connection and calls:
+//
+// - 'init(mss, now)' once the MSS of the connection is known ;
+// - 'on_ack(sample, mss)' when an ACK acknowledges new data ;
+// - 'on_loss(in_flight, mss, now)' on the third duplicate ACK ;
+// - 'on_timeout(in_flight, mss, now)' when the retransmission timer fires.
+//
+// 'cwnd' is the congestion window, in bytes. 'pacing_rate()' gives the rate at
+// which segments should be transmitted, in bytes per second, or zero if the
+// algorithm doesn't pace its transmissions. 'in_slow_start()' tells if the
+// window is still growing exponentially.
+//
+
+#ifndef __RUSTY_NET_TCP_CC_HPP__
+#define __RUSTY_NET_TCP_CC_HPP__
+
+#include <algorithm>        // min(), max()
+#include <cmath>            // cbrt()
+#include <cstdint>
+
+#include "util/macros.hpp"  // LIKELY(), UNLIKELY()
+
+using namespace std;
+
+namespace rusty {
+namespace net {
+
+// Measurements of an ACK which acknowledges new data.
+template <typename clock_t>
+struct tcp_ack_sample_t {
+    typename clock_t::time_t        now;
+
+    size_t                          bytes_acked;
+
+    // Number of bytes which are still in flight after the ACK.
+    size_t                          in_flight;
+
+    // RTT of the most recent acknowledged segment, if it has been measured.
+    bool                            has_rtt = false;
+    typename clock_t::interval_t    rtt;
+
+    // Number of bytes delivered to the remote since the beginning of the
+    // connection, including the bytes acknowledged by this ACK, and when the
+    // most recent acknowledged segment was sent.
+    uint64_t                        delivered;
+    uint64_t                        prior_delivered;
+
+    // Estimated delivery rate, in bytes per second. Zero if not measured.
+    uint64_t                        delivery_rate = 0;
+
+    // 'true' if the measured segment was sent while the application didn't
+    // give enough data to fill the window. The delivery rate then
+    // underestimates the bandwidth.
+    bool                            is_app_limited = false;
+};
+
+// Returns the initial congestion window for the given MSS.
+//
+// RFC 5681 page 5 tells TCP implementations to use these values as upper
+// bound.
+static inline uint32_t tcp_initial_window(uint16_t mss)
+{
+    if (mss <= 1095)
+        return 4 * mss;
+    else if (mss <= 2190)
+        return 3 * mss;
+    else
+        return 2 * mss;
+}
+
+//
+// Reno
+//
+
+// Slow start, congestion avoidance and fast recovery as specified in RFC 5681.
+template <typename clock_t>
+struct tcp_reno_cc_t {
+    typedef typename clock_t::time_t    time_t;
+    typedef tcp_ack_sample_t<clock_t>   ack_sample_t;
+
+    // Congestion window size.
+    uint32_t    cwnd;
+
+    // Slow Start threshold.
+    //
+    // The Slow Start algorithm is used when 'cwnd' < 'ssthresh'.
+    // The Congestion Avoidance algorithm is used otherwise.
+    //
+    // RFC 5681 page 5 specifies that 'ssthresh' should be set to an arbitrary
+    // high value.
+    uint32_t    ssthresh = UINT32_MAX;
+
+    inline void init(uint16_t mss, time_t now)
+    {
+        cwnd = tcp_initial_window(mss);
+    }
+
+    // Returns 'true' if the congestion window is currently in the slow start
+    // congestion control algorithm.
+    inline bool in_slow_start(void) const
+    {
+        return cwnd < ssthresh;
+    }
+
+    void on_ack(const ack_sample_t &sample, uint16_t mss)
+    {
+        if (in_slow_start()) {
+            // Increases the congestion window by the number of bytes acked, as
+            // stated in RFC 5681 page 6.
+            cwnd += min(sample.bytes_acked, (size_t) mss);
+        } else { // In congestion avoidance.
+            // Increases the congestion window by one sender MSS per RTT using
+            // the approximation equation specified in RFC 5681 page 7.
+            cwnd += max(size_t(1), ((size_t) mss * (size_t) mss) / cwnd);
+        }
+    }
+
+    // Sets 'ssthresh' using the equation at RFC 5681 page 7 and updates the
+    // congestion window as specified on page 9.
+    //
+    // The window is virtually inflated by the duplicate ACKs (see
+    // 'tx_window_t::size').
+    void on_loss(size_t in_flight, uint16_t mss, time_t now)
+    {
+        cwnd = ssthresh = max(in_flight / 2, (size_t) (2 * mss));
+    }
+
+    // RFC 5681 page 8: reuses the slow start algorithm after having reduced
+    // 'ssthresh'.
+    void on_timeout(size_t in_flight, uint16_t mss, time_t now)
+    {
+        ssthresh = max(in_flight / 2, (size_t) (2 * mss));
+        cwnd     = tcp_initial_window(mss);
+    }
+
+    inline uint64_t pacing_rate(void) const
+    {
+        return 0;
+    }
+};
+
+//
+// CUBIC
+//
+
+// CUBIC congestion control as specified in RFC 8312.
+//
+// After a loss, the window follows a cubic function of the time which quickly
+// comes back to the window of the loss ('w_max'), stays around it, and then
+// probes for more bandwidth. The growth doesn't depend on the RTT, which makes
+// it much faster than Reno on links with a large bandwidth-delay product.
+//
+// Uses the fixed point arithmetic of the Linux implementation. Only the
+// computation of 'k' at the beginning of an epoch requires a floating point
+// operation.
+template <typename clock_t>
+struct tcp_cubic_cc_t {
+    typedef typename clock_t::time_t        time_t;
+    typedef typename clock_t::interval_t    interval_t;
+    typedef tcp_ack_sample_t<clock_t>       ack_sample_t;
+
+    //
+    // Parameters
+    //
+
+    // Multiplicative decrease factor ('beta_cubic'), in 1/1024.
+    static constexpr uint64_t   BETA            = 717;
+
+    // Time unit of the cubic function, in 1/2^TIME_SHIFT seconds.
+    static constexpr uint64_t   TIME_SHIFT      = 10;
+
+    // 'C' constant of RFC 8312 (0.4), scaled so that the cubic function gives
+    // a number of segments when shifted by 'CUBE_SHIFT' bits.
+    static constexpr uint64_t   CUBE_SCALE      = 410;
+    static constexpr uint64_t   CUBE_SHIFT      = 10 + 3 * TIME_SHIFT;
+
+    // Limits the time offset so that its cube doesn't overflow (about two
+    // minutes).
+    static constexpr uint64_t   MAX_OFFSET      = 1 << 17;
+
+    //
+    // Fields
+    //
+
+    uint32_t    cwnd;
+    uint32_t    ssthresh = UINT32_MAX;
+
+    // Window before the last reduction, in bytes.
+    uint32_t    w_max = 0;
+
+    // Time at which the window reaches 'w_max' again, after the beginning of
+    // the epoch (in 1/2^TIME_SHIFT seconds).
+    uint64_t    k = 0;
+
+    // Window which is reached when the cubic function is at its origin ('k').
+    uint32_t    origin;
+
+    // Window that Reno would have, used in the TCP-friendly region.
+    uint32_t    w_est;
+
+    // Beginning of the current congestion avoidance epoch.
+    bool        in_epoch = false;
+    time_t      epoch_start;
+
+    // Smallest measured RTT. The window is computed one RTT ahead.
+    bool        has_min_rtt = false;
+    interval_t  min_rtt;
+
+    //
+    // Methods
+    //
+
+    inline void init(uint16_t mss, time_t now)
+    {
+        cwnd = tcp_initial_window(mss);
+    }
+
+    inline bool in_slow_start(void) const
+    {
+        return cwnd < ssthresh;
+    }
+
+    void on_ack(const ack_sample_t &sample, uint16_t mss)
+    {
+        if (sample.has_rtt && (!has_min_rtt || sample.rtt < min_rtt)) {
+            min_rtt     = sample.rtt;
+            has_min_rtt = true;
+        }
+
+        if (in_slow_start()) {
+            cwnd += min(sample.bytes_acked, (size_t) mss);
+            return;
+        }
+
+        if (!in_epoch)
+            _start_epoch(sample.now, mss);
+
+        // Computes the window one RTT ahead (RFC 8312 page 7).
+
+        interval_t elapsed = sample.now - epoch_start;
+        if (has_min_rtt)
+            elapsed = elapsed + min_rtt;
+
+        uint64_t t = (elapsed.microsec() << TIME_SHIFT) / 1000000;
+
+        uint64_t offset = t < k ? k - t : t - k;
+        offset = min(offset, (uint64_t) MAX_OFFSET);
+
+        uint64_t delta = ((CUBE_SCALE * offset * offset * offset) >> CUBE_SHIFT)
+                       * mss;
+
+        uint64_t target;
+        if (t < k)
+            target = origin > delta ? origin - delta : 0;
+        else
+            target = origin + delta;
+
+        // TCP-friendly region (RFC 8312 page 8). Reno would grow by
+        // '3 * (1 - beta) / (1 + beta)' segments per RTT.
+        w_est += (uint64_t) sample.bytes_acked * mss * 3 * (1024 - BETA)
+               / ((1024 + BETA) * cwnd);
+        target = max(target, (uint64_t) w_est);
+
+        // Never grows the window by more than half in a RTT (RFC 9438).
+        target = min(target, (uint64_t) cwnd * 3 / 2);
+
+        if (target > cwnd) {
+            cwnd += max(
+                (uint64_t) 1, (target - cwnd) * sample.bytes_acked / cwnd
+            );
+        } else {
+            // Slowly probes in the plateau around 'w_max'.
+            cwnd += max(
+                (uint64_t) 1, (uint64_t) sample.bytes_acked * mss / (100 * cwnd)
+            );
+        }
+    }
+
+    void on_loss(size_t in_flight, uint16_t mss, time_t now)
+    {
+        _reduce(mss);
+        cwnd = ssthresh;
+    }
+
+    void on_timeout(size_t in_flight, uint16_t mss, time_t now)
+    {
+        _reduce(mss);
+        cwnd = tcp_initial_window(mss);
+    }
+
+    inline uint64_t pacing_rate(void) const
+    {
+        return 0;
+    }
+
+private:
+    // Memorizes the window of the loss and reduces 'ssthresh'.
+    //
+    // With fast convergence, 'w_max' is further reduced if the loss happens
+    // before the previous 'w_max' is reached, releasing bandwidth for new
+    // flows (RFC 8312 page 11).
+    void _reduce(uint16_t mss)
+    {
+        if (cwnd < w_max)
+            w_max = (uint64_t) cwnd * (1024 + BETA) / 2048;
+        else
+            w_max = cwnd;
+
+        ssthresh = max((uint64_t) cwnd * BETA / 1024, (uint64_t) 2 * mss);
+        in_epoch = false;
+    }
+
+    // Begins a new congestion avoidance epoch at the current window.
+    void _start_epoch(time_t now, uint16_t mss)
+    {
+        in_epoch    = true;
+        epoch_start = now;
+        w_est       = cwnd;
+
+        if (cwnd < w_max) {
+            // K = cbrt((w_max - cwnd) / C), in segments and seconds.
+            double segments = (double) (w_max - cwnd) / mss;
+            k       = (uint64_t) cbrt(
+                          segments * (1ULL << CUBE_SHIFT) / CUBE_SCALE
+                      );
+            origin  = w_max;
+        } else {
+            k       = 0;
+            origin  = cwnd;
+        }
+    }
+};
+
+//
+// BBR
+//
+
+// Model-based congestion control which estimates the bottleneck bandwidth and
+// the round-trip propagation time of the path, instead of reacting to losses
+// (BBR, draft-cardwell-iccrg-bbr-congestion-control).
+//
+// Implements the STARTUP, DRAIN, PROBE_BW and PROBE_RTT states of the first
+// version of the algorithm. The bandwidth is the maximum delivery rate of the
+// last 'BW_WINDOW' round trips, the propagation time the minimum RTT of the
+// last 'MIN_RTT_WINDOW'.
+//
+// The congestion window only bounds the data in flight to twice the estimated
+// bandwidth-delay product. BBR relies on the transmissions being paced at
+// 'pacing_rate()'.
+template <typename clock_t>
+struct tcp_bbr_cc_t {
+    typedef typename clock_t::time_t        time_t;
+    typedef typename clock_t::interval_t    interval_t;
+    typedef tcp_ack_sample_t<clock_t>       ack_sample_t;
+
+    //
+    // Parameters
+    //
+
+    // Gains are in 1/GAIN_UNIT.
+    static constexpr uint64_t   GAIN_UNIT       = 1024;
+
+    // 2 / ln(2), the smallest gain which doubles the delivery rate each round
+    // trip during STARTUP.
+    static constexpr uint64_t   HIGH_GAIN       = 2955;
+    static constexpr uint64_t   DRAIN_GAIN      = GAIN_UNIT * GAIN_UNIT / 2955;
+    static constexpr uint64_t   CWND_GAIN       = 2 * GAIN_UNIT;
+
+    // Pacing gains of the PROBE_BW cycle. Each phase lasts one minimal RTT.
+    static constexpr size_t     CYCLE_LENGTH    = 8;
+
+    // Number of round trips of the bandwidth filter.
+    static constexpr size_t     BW_WINDOW       = 10;
+
+    // The pipe is considered full if the bandwidth didn't grow by 25% during
+    // 3 round trips.
+    static constexpr uint64_t   FULL_BW_GROWTH  = GAIN_UNIT * 5 / 4;
+    static constexpr size_t     FULL_BW_ROUNDS  = 3;
+
+    // Minimal number of segments in flight.
+    static constexpr uint32_t   MIN_CWND_SEGS   = 4;
+
+    //
+    // Member types
+    //
+
+    enum mode_t {
+        STARTUP,
+        DRAIN,
+        PROBE_BW,
+        PROBE_RTT
+    };
+
+    //
+    // Fields
+    //
+
+    uint32_t    cwnd;
+
+    mode_t      mode        = STARTUP;
+
+    uint64_t    pacing_gain = HIGH_GAIN;
+    uint64_t    cwnd_gain   = HIGH_GAIN;
+
+    // Maximum delivery rates (in bytes per second) of the last round trips,
+    // indexed by 'round % BW_WINDOW'.
+    uint64_t    bw_samples[BW_WINDOW] = { 0 };
+
+    // Round trip counting. A round trip ends when a segment sent after the
+    // beginning of the round trip is acknowledged.
+    uint64_t    round               = 0;
+    uint64_t    next_round_delivered = 0;
+
+    // 'true' if the last ACK started a new round trip.
+    bool        round_start         = false;
+
+    // Full pipe detection of the STARTUP mode.
+    bool        filled_pipe     = false;
+    uint64_t    full_bw         = 0;
+    size_t      full_bw_count   = 0;
+
+    // Minimal RTT and when it was measured.
+    bool        has_min_rtt     = false;
+    interval_t  min_rtt;
+    time_t      min_rtt_stamp;
+
+    // Phase of the PROBE_BW cycle and when it started.
+    size_t      cycle_index     = 0;
+    time_t      cycle_stamp;
+
+    // End of the PROBE_RTT mode.
+    time_t      probe_rtt_done;
+
+    // Congestion window before PROBE_RTT or a retransmission timeout.
+    uint32_t    prior_cwnd      = 0;
+
+    //
+    // Methods
+    //
+
+    inline void init(uint16_t mss, time_t now)
+    {
+        cwnd            = tcp_initial_window(mss);
+        min_rtt_stamp   = now;
+    }
+
+    void on_ack(const ack_sample_t &sample, uint16_t mss)
+    {
+        _update_round(sample);
+        _update_bw(sample);
+        _update_min_rtt(sample);
+        _update_mode(sample, mss);
+        _update_cwnd(sample, mss);
+    }
+
+    // BBR doesn't interpret losses as a congestion signal.
+    inline void on_loss(size_t in_flight, uint16_t mss, time_t now)
+    {
+    }
+
+    // Restarts from a minimal window, and restores the previous window once
+    // the model gives a new one.
+    void on_timeout(size_t in_flight, uint16_t mss, time_t now)
+    {
+        prior_cwnd = max(prior_cwnd, cwnd);
+        cwnd       = MIN_CWND_SEGS * mss;
+    }
+
+    // The STARTUP mode is the equivalent of the slow start of the other
+    // algorithms.
+    inline bool in_slow_start(void) const
+    {
+        return mode == STARTUP;
+    }
+
+    // Returns the pacing rate, in bytes per second. Zero until the first
+    // delivery rate has been measured.
+    inline uint64_t pacing_rate(void) const
+    {
+        return bandwidth() * pacing_gain / GAIN_UNIT;
+    }
+
+    // Returns the estimated bottleneck bandwidth, in bytes per second.
+    inline uint64_t bandwidth(void) const
+    {
+        uint64_t bw = 0;
+        for (uint64_t sample : bw_samples)
+            bw = max(bw, sample);
+        return bw;
+    }
+
+    // Estimated bandwidth-delay product, in bytes.
+    inline uint64_t bdp(void) const
+    {
+        return bandwidth() * min_rtt.microsec() / 1000000;
+    }
+
+private:
+    static constexpr uint64_t _cycle_gain(size_t index)
+    {
+        return   index == 0 ? GAIN_UNIT * 5 / 4
+               : index == 1 ? GAIN_UNIT * 3 / 4
+               :              GAIN_UNIT;
+    }
+
+    // Duration without a new minimal RTT after which PROBE_RTT is entered.
+    static inline interval_t _min_rtt_window(void)
+    {
+        return interval_t(10 * 1000000);    // 10 seconds
+    }
+
+    static inline interval_t _probe_rtt_duration(void)
+    {
+        return interval_t(200 * 1000);      // 200 ms
+    }
+
+    void _update_round(const ack_sample_t &sample)
+    {
+        round_start = sample.prior_delivered >= next_round_delivered;
+
+        if (round_start) {
+            next_round_delivered = sample.delivered;
+            ++round;
+            bw_samples[round % BW_WINDOW] = 0;
+        }
+    }
+
+    // App-limited samples are only used when they exceed the current
+    // estimate.
+    void _update_bw(const ack_sample_t &sample)
+    {
+        if (sample.is_app_limited && sample.delivery_rate < bandwidth())
+            return;
+
+        uint64_t *slot = &bw_samples[round % BW_WINDOW];
+        *slot = max(*slot, sample.delivery_rate);
+    }
+
+    void _update_min_rtt(const ack_sample_t &sample)
+    {
+        bool expired = min_rtt_stamp + _min_rtt_window() < sample.now;
+
+        if (
+               sample.has_rtt
+            && (!has_min_rtt || sample.rtt < min_rtt || expired)
+        ) {
+            min_rtt         = sample.rtt;
+            min_rtt_stamp   = sample.now;
+            has_min_rtt     = true;
+        }
+
+        if (expired && mode != PROBE_RTT && has_min_rtt) {
+            // Drains the queue to measure the propagation time again.
+            mode            = PROBE_RTT;
+            pacing_gain     = GAIN_UNIT;
+            cwnd_gain       = GAIN_UNIT;
+            prior_cwnd      = max(prior_cwnd, cwnd);
+            probe_rtt_done  = sample.now + _probe_rtt_duration();
+            min_rtt_stamp   = sample.now;
+        }
+    }
+
+    void _update_mode(const ack_sample_t &sample, uint16_t mss)
+    {
+        switch (mode) {
+        case STARTUP:
+            // The bandwidth growth is measured once per round trip, on samples
+            // which were not limited by the application.
+            if (round_start && !sample.is_app_limited)
+                _check_full_pipe();
+
+            if (filled_pipe) {
+                mode        = DRAIN;
+                pacing_gain = DRAIN_GAIN;
+                cwnd_gain   = HIGH_GAIN;
+            }
+            break;
+
+        case DRAIN:
+            if (sample.in_flight <= bdp())
+                _enter_probe_bw(sample.now);
+            break;
+
+        case PROBE_BW:
+            if (has_min_rtt && cycle_stamp + min_rtt < sample.now) {
+                cycle_index = (cycle_index + 1) % CYCLE_LENGTH;
+                cycle_stamp = sample.now;
+                pacing_gain = _cycle_gain(cycle_index);
+            }
+            break;
+
+        case PROBE_RTT:
+            if (probe_rtt_done < sample.now) {
+                cwnd        = max(cwnd, prior_cwnd);
+                prior_cwnd  = 0;
+
+                if (filled_pipe)
+                    _enter_probe_bw(sample.now);
+                else {
+                    mode        = STARTUP;
+                    pacing_gain = HIGH_GAIN;
+                    cwnd_gain   = HIGH_GAIN;
+                }
+            }
+            break;
+        };
+    }
+
+    // Detects the end of STARTUP, once the bandwidth stops growing.
+    void _check_full_pipe(void)
+    {
+        uint64_t bw = bandwidth();
+
+        if (bw * GAIN_UNIT >= full_bw * FULL_BW_GROWTH) {
+            full_bw         = bw;
+            full_bw_count   = 0;
+        } else if (++full_bw_count >= FULL_BW_ROUNDS)
+            filled_pipe = true;
+    }
+
+    void _enter_probe_bw(time_t now)
+    {
+        mode        = PROBE_BW;
+        cwnd_gain   = CWND_GAIN;
+        // Starts in a random phase which doesn't drain the queue.
+        cycle_index = 2 + round % (CYCLE_LENGTH - 2);
+        cycle_stamp = now;
+        pacing_gain = _cycle_gain(cycle_index);
+    }
+
+    void _update_cwnd(const ack_sample_t &sample, uint16_t mss)
+    {
+        uint32_t min_cwnd = MIN_CWND_SEGS * mss;
+
+        if (mode == PROBE_RTT) {
+            cwnd = min_cwnd;
+            return;
+        }
+
+        if (prior_cwnd > 0 && cwnd < prior_cwnd) {
+            // Restores the window after a retransmission timeout.
+            cwnd        = prior_cwnd;
+            prior_cwnd  = 0;
+        }
+
+        uint64_t target = bdp() * cwnd_gain / GAIN_UNIT;
+
+        if (filled_pipe)
+            cwnd = min((uint64_t) cwnd + sample.bytes_acked, target);
+        else if (cwnd < target || bandwidth() == 0)
+            cwnd += sample.bytes_acked;
+
+        cwnd = max(cwnd, min_cwnd);
+    }
+};
+
+//
+// Default algorithm
+//
+
+// Selected with the TCP_CC_CUBIC and TCP_CC_BBR flags. Reno is used if none is
+// defined.
+#if defined(TCP_CC_BBR)
+    template <typename clock_t>
+    using tcp_default_cc_t = tcp_bbr_cc_t<clock_t>;
+#elif defined(TCP_CC_CUBIC)
+    template <typename clock_t>
+    using tcp_default_cc_t = tcp_cubic_cc_t<clock_t>;
+#else
+    template <typename clock_t>
+    using tcp_default_cc_t = tcp_reno_cc_t<clock_t>;
+#endif
+
+} } /* namespace rusty::net */
+
+#endif /* __RUSTY_NET_TCP_CC_HPP__ */
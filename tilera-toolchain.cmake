@@ -1,5 +1,6 @@
 SET(CMAKE_SYSTEM_NAME    Linux)
 SET(CMAKE_SYSTEM_VERSION 1)
+SET(CMAKE_SYSTEM_PROCESSOR tilegx)
 
 SET(CMAKE_C_COMPILER     $ENV{TILERA_ROOT}/bin/tile-gcc48)
 SET(CMAKE_CXX_COMPILER 	 $ENV{TILERA_ROOT}/bin/tile-g++48)
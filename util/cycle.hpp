@@ -0,0 +1,55 @@
+//
+// Provides 'get_cycle_count()' on every supported architecture.
+//
+// On the TILE-Gx, the function is the one of the Tilera's architecture headers.
+// On other CPUs, it reads the time-stamp counter, which is incremented at a
+// constant rate on modern x86 processors.
+//
+// Copyright 2015 Raphael Javaux <raphaeljavaux@gmail.com>
+// University of Liege.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __RUSTY_UTILS_CYCLE_HPP__
+#define __RUSTY_UTILS_CYCLE_HPP__
+
+#ifdef __tilegx__
+    #include <arch/cycle.h>     // get_cycle_count()
+#else
+    #include <cstdint>
+
+    #if defined(__x86_64__) || defined(__i386__)
+        #include <x86intrin.h>  // __rdtsc()
+    #else
+        #include <ctime>        // clock_gettime()
+    #endif
+
+    // Returns the current value of the time-stamp counter.
+    //
+    // Falls back to a nanoseconds monotonic clock on other architectures, in
+    // which case 'CYCLES_PER_SECOND' is 10^9 (see 'driver/cpu.hpp').
+    static inline uint64_t get_cycle_count(void)
+    {
+        #if defined(__x86_64__) || defined(__i386__)
+            return __rdtsc();
+        #else
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            return (uint64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+        #endif
+    }
+#endif /* __tilegx__ */
+
+#endif /* __RUSTY_UTILS_CYCLE_HPP__ */
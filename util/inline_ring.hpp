@@ -0,0 +1,343 @@
+//
+// Double-ended queue which stores its first elements inline.
+//
+// Copyright 2015 Raphael Javaux <raphaeljavaux@gmail.com>
+// University of Liege.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __RUSTY_UTILS_INLINE_RING_HPP__
+#define __RUSTY_UTILS_INLINE_RING_HPP__
+
+#include <cassert>
+#include <cstddef>
+#include <iterator>         // random_access_iterator_tag
+#include <memory>           // allocator
+#include <new>              // placement new
+#include <type_traits>      // aligned_storage
+#include <utility>          // move()
+
+#include "util/macros.hpp"  // UNLIKELY()
+
+using namespace std;
+
+namespace rusty {
+namespace util {
+
+// Circular buffer which provides the subset of the 'deque' interface used by
+// the network stack (FIFO operations and iteration).
+//
+// The first 'N' elements are stored inside the object itself. The buffer only
+// allocates memory with 'alloc_t' when more than 'N' elements are stored at
+// the same time. It then doubles its capacity each time it is full.
+//
+// 'N' must be a power of two.
+template <typename T, size_t N, typename alloc_var_t = allocator<T>>
+struct inline_ring_t {
+    static_assert((N & (N - 1)) == 0, "N must be a power of two");
+
+    //
+    // Member types
+    //
+
+    typedef T                                                   value_type;
+    typedef typename alloc_var_t::template rebind<T>::other     alloc_t;
+
+    template <typename ring_t, typename value_t>
+    struct base_iterator_t {
+        typedef random_access_iterator_tag  iterator_category;
+        typedef value_t                     value_type;
+        typedef ptrdiff_t                   difference_type;
+        typedef value_t                     *pointer;
+        typedef value_t                     &reference;
+
+        ring_t  *ring;
+        size_t  index;              // Index relative to the first element.
+
+        inline reference operator*(void) const
+        {
+            return ring->at(index);
+        }
+
+        inline pointer operator->(void) const
+        {
+            return &ring->at(index);
+        }
+
+        inline base_iterator_t &operator++(void)
+        {
+            index++;
+            return *this;
+        }
+
+        inline base_iterator_t operator++(int)
+        {
+            base_iterator_t prev = *this;
+            index++;
+            return prev;
+        }
+
+        inline base_iterator_t &operator--(void)
+        {
+            index--;
+            return *this;
+        }
+
+        inline base_iterator_t operator+(difference_type n) const
+        {
+            return { ring, index + n };
+        }
+
+        inline base_iterator_t operator-(difference_type n) const
+        {
+            return { ring, index - n };
+        }
+
+        inline difference_type operator-(const base_iterator_t &other) const
+        {
+            return (difference_type) index - (difference_type) other.index;
+        }
+
+        inline bool operator==(const base_iterator_t &other) const
+        {
+            return index == other.index;
+        }
+
+        inline bool operator!=(const base_iterator_t &other) const
+        {
+            return index != other.index;
+        }
+
+        inline bool operator<(const base_iterator_t &other) const
+        {
+            return index < other.index;
+        }
+    };
+
+    typedef base_iterator_t<inline_ring_t, T>               iterator;
+    typedef base_iterator_t<const inline_ring_t, const T>   const_iterator;
+
+    //
+    // Fields
+    //
+
+    alloc_t     alloc;
+
+    // Points to 'inline_buffer' or to memory allocated with 'alloc'.
+    T           *buffer;
+    size_t      capacity;
+
+    size_t      head;               // Index of the first element in 'buffer'.
+    size_t      count;
+
+    typename aligned_storage<sizeof (T), alignof (T)>::type inline_buffer[N];
+
+    //
+    // Methods
+    //
+
+    inline_ring_t(alloc_t _alloc = alloc_t())
+        : alloc(_alloc), buffer((T *) inline_buffer), capacity(N), head(0),
+          count(0)
+    {
+    }
+
+    inline_ring_t(const inline_ring_t &other)
+        : inline_ring_t(other.alloc)
+    {
+        for (const T &value : other)
+            push_back(value);
+    }
+
+    inline_ring_t(inline_ring_t &&other)
+        : inline_ring_t(other.alloc)
+    {
+        if (other._is_inline()) {
+            for (T &value : other)
+                push_back(move(value));
+            other.clear();
+        } else {
+            // Steals the allocated buffer.
+            buffer      = other.buffer;
+            capacity    = other.capacity;
+            head        = other.head;
+            count       = other.count;
+
+            other.buffer    = (T *) other.inline_buffer;
+            other.capacity  = N;
+            other.head      = 0;
+            other.count     = 0;
+        }
+    }
+
+    ~inline_ring_t(void)
+    {
+        clear();
+
+        if (!_is_inline())
+            alloc.deallocate(buffer, capacity);
+    }
+
+    inline_ring_t &operator=(const inline_ring_t &other) = delete;
+
+    inline bool empty(void) const
+    {
+        return count == 0;
+    }
+
+    inline size_t size(void) const
+    {
+        return count;
+    }
+
+    // Returns the i-th element of the queue.
+    inline T &at(size_t i)
+    {
+        assert(i < count);
+        return buffer[(head + i) & (capacity - 1)];
+    }
+
+    inline const T &at(size_t i) const
+    {
+        assert(i < count);
+        return buffer[(head + i) & (capacity - 1)];
+    }
+
+    inline T &operator[](size_t i)
+    {
+        return at(i);
+    }
+
+    inline const T &operator[](size_t i) const
+    {
+        return at(i);
+    }
+
+    inline T &front(void)
+    {
+        return at(0);
+    }
+
+    inline const T &front(void) const
+    {
+        return at(0);
+    }
+
+    inline T &back(void)
+    {
+        return at(count - 1);
+    }
+
+    inline const T &back(void) const
+    {
+        return at(count - 1);
+    }
+
+    inline iterator begin(void)
+    {
+        return { this, 0 };
+    }
+
+    inline iterator end(void)
+    {
+        return { this, count };
+    }
+
+    inline const_iterator begin(void) const
+    {
+        return { this, 0 };
+    }
+
+    inline const_iterator end(void) const
+    {
+        return { this, count };
+    }
+
+    template <typename ... Args>
+    inline void emplace_back(Args&&... args)
+    {
+        if (UNLIKELY(count == capacity))
+            _grow();
+
+        new (&buffer[(head + count) & (capacity - 1)])
+            T(forward<Args>(args) ...);
+        count++;
+    }
+
+    inline void push_back(const T &value)
+    {
+        emplace_back(value);
+    }
+
+    inline void push_back(T &&value)
+    {
+        emplace_back(move(value));
+    }
+
+    inline void pop_front(void)
+    {
+        assert(!empty());
+
+        buffer[head].~T();
+        head = (head + 1) & (capacity - 1);
+        count--;
+    }
+
+    inline void pop_back(void)
+    {
+        assert(!empty());
+
+        back().~T();
+        count--;
+    }
+
+    inline void clear(void)
+    {
+        while (!empty())
+            pop_front();
+
+        head = 0;
+    }
+
+private:
+    inline bool _is_inline(void) const
+    {
+        return buffer == (const T *) inline_buffer;
+    }
+
+    // Doubles the capacity of the buffer.
+    void _grow(void)
+    {
+        size_t new_capacity = capacity * 2;
+        T *new_buffer = alloc.allocate(new_capacity);
+
+        for (size_t i = 0; i < count; i++) {
+            T *value = &at(i);
+            new (&new_buffer[i]) T(move(*value));
+            value->~T();
+        }
+
+        if (!_is_inline())
+            alloc.deallocate(buffer, capacity);
+
+        buffer      = new_buffer;
+        capacity    = new_capacity;
+        head        = 0;
+    }
+};
+
+} } /* namespace rusty::util */
+
+#endif /* __RUSTY_UTILS_INLINE_RING_HPP__ */
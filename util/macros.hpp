@@ -21,6 +21,9 @@
 #ifndef __RUSTY_UTILS_MACROS_HPP__
 #define __RUSTY_UTILS_MACROS_HPP__
 
+#include <cstdio>           // fprintf(), stderr
+#include <cstdlib>          // exit(), EXIT_FAILURE
+
 //
 // Branch prediction hints.
 //
@@ -59,7 +62,8 @@
 //   operations, such as events. These messages will only be displayed when
 //   NDEBUG is not defined.
 // * 'RUSTY_ERROR()' should be used for unexpected but recoverable events,
-//   such as the reception of an invalid packet.
+//   such as the reception of an invalid packet. These messages will not be
+//   displayed when NERRORMSG is defined.
 // * 'RUSTY_DIE()' should be used for unexpected and unrecoverable events,
 //   such as a failled memory allocation. The macro immediately stops the
 //   application after displaying the message by calling 'exit()' with
@@ -89,16 +93,20 @@
         } while (0)
 #endif
 
-#define RUSTY_ERROR(MODULE, COLOR, MSG, ...)                                   \
-    do {                                                                       \
-        fprintf(                                                               \
-            stderr, "%-20s%-20s" COLOR_BOLD MSG,                               \
-            "[" COLOR_YEL "ERROR" COLOR_RESET "]",                             \
-            "[" COLOR MODULE COLOR_RESET "]",                                  \
-            ##__VA_ARGS__                                                      \
-        );                                                                     \
-        fprintf(stderr, " (" __FILE__ ":%d)" COLOR_RESET "\n", __LINE__);      \
-    } while (0)
+#ifdef NERRORMSG
+    #define RUSTY_ERROR(MODULE, COLOR, MSG, ...)
+#else
+    #define RUSTY_ERROR(MODULE, COLOR, MSG, ...)                               \
+        do {                                                                   \
+            fprintf(                                                           \
+                stderr, "%-20s%-20s" COLOR_BOLD MSG,                           \
+                "[" COLOR_YEL "ERROR" COLOR_RESET "]",                         \
+                "[" COLOR MODULE COLOR_RESET "]",                              \
+                ##__VA_ARGS__                                                  \
+            );                                                                 \
+            fprintf(stderr, " (" __FILE__ ":%d)" COLOR_RESET "\n", __LINE__);  \
+        } while (0)
+#endif
 
 #define RUSTY_DIE(MODULE, COLOR, MSG, ...)                                     \
     do {                                                                       \
@@ -0,0 +1,207 @@
+//
+// Bounded lock-free queue used to send messages to a worker thread.
+//
+// Copyright 2015 Raphael Javaux <raphaeljavaux@gmail.com>
+// University of Liege.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __RUSTY_UTILS_MPSC_RING_HPP__
+#define __RUSTY_UTILS_MPSC_RING_HPP__
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>          // intptr_t
+#include <new>              // placement new
+#include <type_traits>      // aligned_storage
+#include <utility>          // forward(), move()
+
+#include "util/macros.hpp"  // LIKELY(), UNLIKELY()
+
+using namespace std;
+
+namespace rusty {
+namespace util {
+
+// Size of a cache line. Fields written by different threads are stored on
+// different cache lines.
+static constexpr size_t CACHE_LINE_SIZE = 64;
+
+// Fixed-size circular buffer which can be filled by any number of threads and
+// which is emptied by a single thread.
+//
+// The queue is lock-free. Each slot has a sequence number which tells if the
+// slot is free for the producer of a given position, or if it contains the
+// value of a given position for the consumer [1]. Producers reserve positions
+// with a compare-and-swap on a shared counter. The consumer never writes to a
+// shared counter, and only touches the slots it reads.
+//
+// Checking an empty queue only requires reading the sequence number of the
+// next slot, which stays in the cache of the consumer as long as no message
+// is pushed.
+//
+// 'N' must be a power of two.
+//
+// [1] http://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+template <typename T, size_t N>
+struct mpsc_ring_t {
+    static_assert((N & (N - 1)) == 0, "N must be a power of two");
+
+    //
+    // Member types
+    //
+
+    typedef T                                       value_type;
+
+    struct alignas(CACHE_LINE_SIZE) slot_t {
+        atomic<size_t>                              seq;
+        typename aligned_storage<
+            sizeof (T), alignof (T)
+        >::type                                     value;
+    };
+
+    //
+    // Fields
+    //
+
+    slot_t                                          slots[N];
+
+    // Next position to be reserved by a producer.
+    alignas(CACHE_LINE_SIZE) atomic<size_t>         push_pos;
+
+    // Next position to be read by the consumer. Only accessed by the consumer.
+    alignas(CACHE_LINE_SIZE) size_t                 pop_pos;
+
+    //
+    // Methods
+    //
+
+    mpsc_ring_t(void) : push_pos(0), pop_pos(0)
+    {
+        for (size_t i = 0; i < N; i++)
+            slots[i].seq.store(i, memory_order_relaxed);
+    }
+
+    mpsc_ring_t(const mpsc_ring_t &other) = delete;
+
+    ~mpsc_ring_t(void)
+    {
+        T value;
+        while (pop(&value))
+            ;
+    }
+
+    // Constructs a new value at the end of the queue.
+    //
+    // Returns 'false' if the queue is full. Can be called concurrently by any
+    // number of threads.
+    template <typename ... Args>
+    bool emplace(Args&&... args)
+    {
+        size_t pos = push_pos.load(memory_order_relaxed);
+        slot_t *slot;
+
+        for (;;) {
+            slot = &slots[pos & (N - 1)];
+
+            size_t seq = slot->seq.load(memory_order_acquire);
+            intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+
+            if (diff == 0) {
+                // The slot is free. Tries to reserve its position.
+                if (
+                    push_pos.compare_exchange_weak(
+                        pos, pos + 1, memory_order_relaxed
+                    )
+                )
+                    break;
+            } else if (diff < 0) {
+                // The slot still contains the value it had one round before.
+                return false;
+            } else
+                pos = push_pos.load(memory_order_relaxed);
+        }
+
+        new (&slot->value) T(forward<Args>(args) ...);
+
+        // Publishes the value to the consumer.
+        slot->seq.store(pos + 1, memory_order_release);
+
+        return true;
+    }
+
+    // Equivalent to 'emplace(value)'.
+    inline bool push(const T &value)
+    {
+        return emplace(value);
+    }
+
+    // Returns 'true' if there is no value to pop.
+    //
+    // Must only be called by the consumer.
+    inline bool empty(void) const
+    {
+        const slot_t *slot = &slots[pop_pos & (N - 1)];
+        return slot->seq.load(memory_order_acquire) != pop_pos + 1;
+    }
+
+    // Moves the first value of the queue into 'value'.
+    //
+    // Returns 'false' if the queue is empty. Must only be called by the
+    // consumer.
+    inline bool pop(T *value)
+    {
+        slot_t *slot = &slots[pop_pos & (N - 1)];
+
+        if (slot->seq.load(memory_order_acquire) != pop_pos + 1)
+            return false;
+
+        T *slot_value = (T *) &slot->value;
+        *value = move(*slot_value);
+        slot_value->~T();
+
+        // Gives the slot back to the producers of the next round.
+        slot->seq.store(pop_pos + N, memory_order_release);
+        pop_pos++;
+
+        return true;
+    }
+
+    // Pops and calls the function with every value of the queue, including
+    // values which are pushed while the function is executed.
+    //
+    // Returns the number of popped values. Must only be called by the
+    // consumer.
+    template <typename F>
+    inline size_t drain(F f)
+    {
+        if (LIKELY(empty()))
+            return 0;
+
+        size_t n = 0;
+        T value;
+        while (pop(&value)) {
+            f(move(value));
+            n++;
+        }
+
+        return n;
+    }
+};
+
+} } /* namespace rusty::util */
+
+#endif /* __RUSTY_UTILS_MPSC_RING_HPP__ */
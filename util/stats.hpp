@@ -0,0 +1,77 @@
+//
+// Statistics counters, written by a single worker and read by any thread.
+//
+// Copyright 2015 Raphael Javaux <raphaeljavaux@gmail.com>
+// University of Liege.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#ifndef __RUSTY_UTILS_STATS_HPP__
+#define __RUSTY_UTILS_STATS_HPP__
+
+#include <atomic>
+#include <cstdint>
+
+#include "util/mpsc_ring.hpp"  // CACHE_LINE_SIZE
+
+using namespace std;
+
+namespace rusty {
+namespace util {
+
+// Counter which is only modified by the thread which owns it, and which can be
+// read by any other thread without locking.
+//
+// As there is a single writer, an increment doesn't need an atomic
+// read-modify-write instruction. Relaxed loads and stores of an aligned 64 bits
+// integer are plain memory accesses.
+//
+// Counters of a layer should be grouped in a structure aligned on a cache
+// line (see 'CACHE_LINE_SIZE'), so that the counters of different workers never
+// share a cache line.
+struct counter_t {
+    atomic<uint64_t>    value;
+
+    inline counter_t(void) : value(0)
+    {
+    }
+
+    counter_t(const counter_t &other) = delete;
+
+    // Must only be called by the owner of the counter.
+    inline void inc(uint64_t n = 1)
+    {
+        value.store(value.load(memory_order_relaxed) + n, memory_order_relaxed);
+    }
+
+    // Replaces the value of the counter, for counters which give the current
+    // size of something (gauges).
+    //
+    // Must only be called by the owner of the counter.
+    inline void set(uint64_t new_value)
+    {
+        value.store(new_value, memory_order_relaxed);
+    }
+
+    // Can be called by any thread.
+    inline uint64_t get(void) const
+    {
+        return value.load(memory_order_relaxed);
+    }
+};
+
+} } /* namespace rusty::util */
+
+#endif /* __RUSTY_UTILS_STATS_HPP__ */
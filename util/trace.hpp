@@ -0,0 +1,311 @@
+//
+// Per-worker latency histograms and trace events of the packet processing
+// stages.
+//
+// Copyright 2015 Raphael Javaux <raphaeljavaux@gmail.com>
+// University of Liege.
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+// Tracing is only compiled when USE_TRACING is defined. Otherwise, the
+// 'TRACE_*()' macros expand to nothing.
+//
+// When compiled, each worker has its own 'tracer_t', which is disabled until
+// 'tracer_t::enabled' is set. A disabled tracer costs a thread-local load and a
+// predicted branch per traced stage.
+//
+
+#ifndef __RUSTY_UTILS_TRACE_HPP__
+#define __RUSTY_UTILS_TRACE_HPP__
+
+#include <algorithm>            // min()
+#include <atomic>
+#include <cinttypes>            // PRIu64
+#include <cstdint>
+#include <cstdio>               // FILE, fprintf()
+
+#include "util/cycle.hpp"       // get_cycle_count()
+#include "util/macros.hpp"      // UNLIKELY()
+#include "util/stats.hpp"       // counter_t, CACHE_LINE_SIZE
+
+using namespace std;
+
+namespace rusty {
+namespace util {
+
+// Traced stages of the processing of a packet.
+enum trace_stage_t {
+    // From the peek of a batch of ingress descriptors to the processing of
+    // each of its packets.
+    TRACE_RX_QUEUE = 0,
+
+    // Processing of a received frame, by all the layers of the network stack
+    // and by the application.
+    TRACE_RX_FRAME,
+
+    // Processing of a received TCP segment, including the application.
+    TRACE_TCP,
+
+    // Execution of the 'new_data' handler of the application.
+    TRACE_APP,
+
+    // Allocation and writing of an egress packet ('send_packet()').
+    TRACE_SEND,
+
+    // Posting of a batch of egress descriptors.
+    TRACE_TX_FLUSH,
+
+    N_TRACE_STAGES
+};
+
+static const char * const TRACE_STAGE_NAMES[N_TRACE_STAGES] = {
+    "rx_queue", "rx_frame", "tcp", "app", "send", "tx_flush"
+};
+
+// Histogram of durations in CPU cycles, with a relative error of at most
+// 1 / SUB_BUCKETS (HDR histogram).
+//
+// Durations smaller than SUB_BUCKETS cycles have their own bucket. Each
+// following power of two is divided in SUB_BUCKETS buckets of the same width.
+// Durations of 2^32 cycles and more are recorded in the last bucket.
+//
+// Buckets are only incremented by the worker which owns the histogram and can
+// be read by any thread.
+struct histogram_t {
+    static constexpr unsigned int  SUB_BUCKET_BITS    = 4;
+    static constexpr unsigned int  SUB_BUCKETS        = 1 << SUB_BUCKET_BITS;
+    static constexpr unsigned int  MAX_BITS           = 32;
+    static constexpr size_t        N_BUCKETS          =
+        (MAX_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+    counter_t       buckets[N_BUCKETS];
+
+    // Number of recorded durations.
+    counter_t       count;
+
+    counter_t       max;
+
+    inline void record(uint64_t cycles)
+    {
+        buckets[bucket(cycles)].inc();
+        count.inc();
+
+        if (cycles > max.get())
+            max.set(cycles);
+    }
+
+    // Returns a lower bound of the duration below which 'percent' percents of
+    // the recorded durations are.
+    uint64_t percentile(double percent) const
+    {
+        uint64_t threshold = (uint64_t) (count.get() * percent / 100.0);
+        uint64_t seen      = 0;
+
+        for (size_t i = 0; i < N_BUCKETS; i++) {
+            seen += buckets[i].get();
+
+            if (seen > threshold)
+                return lower_bound(i);
+        }
+
+        return max.get();
+    }
+
+    // Returns the index of the bucket of the duration.
+    static inline size_t bucket(uint64_t cycles)
+    {
+        if (cycles < SUB_BUCKETS)
+            return cycles;
+
+        if (UNLIKELY(cycles >= (uint64_t) 1 << MAX_BITS))
+            return N_BUCKETS - 1;
+
+        // Index of the most significant bit.
+        unsigned int msb = 63 - __builtin_clzll(cycles);
+
+        size_t sub = (cycles >> (msb - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1);
+
+        return (msb - SUB_BUCKET_BITS + 1) * SUB_BUCKETS + sub;
+    }
+
+    // Returns the smallest duration recorded in the bucket.
+    static inline uint64_t lower_bound(size_t bucket)
+    {
+        if (bucket < SUB_BUCKETS)
+            return bucket;
+
+        unsigned int msb = bucket / SUB_BUCKETS + SUB_BUCKET_BITS - 1;
+        uint64_t     sub = bucket % SUB_BUCKETS;
+
+        return (SUB_BUCKETS + sub) << (msb - SUB_BUCKET_BITS);
+    }
+};
+
+// Traced stage execution.
+struct trace_event_t {
+    // Cycle counter when the stage started.
+    uint64_t        begin;
+
+    uint32_t        cycles;
+    uint32_t        stage;
+};
+
+// Latency histograms and last trace events of a worker.
+struct alignas(CACHE_LINE_SIZE) tracer_t {
+    // Number of retained trace events. Must be a power of two.
+    static constexpr size_t     N_EVENTS = 4096;
+
+    static_assert(
+        (N_EVENTS & (N_EVENTS - 1)) == 0, "N_EVENTS must be a power of two"
+    );
+
+    // Stages are only traced when 'true'. Can be set by any thread.
+    atomic<bool>                enabled;
+
+    histogram_t                 histograms[N_TRACE_STAGES];
+
+    // Circular buffer of the last N_EVENTS events. The next event is written
+    // at 'n_events % N_EVENTS'.
+    trace_event_t               events[N_EVENTS];
+    atomic<uint64_t>            n_events;
+
+    tracer_t(void) : enabled(false), n_events(0)
+    {
+    }
+
+    tracer_t(const tracer_t &other) = delete;
+
+    // Records the execution of a stage.
+    //
+    // Must only be called by the owner of the tracer.
+    inline void record(trace_stage_t stage, uint64_t begin, uint64_t end)
+    {
+        uint64_t cycles = end - begin;
+
+        histograms[stage].record(cycles);
+
+        uint64_t n = n_events.load(memory_order_relaxed);
+
+        trace_event_t *event = &events[n & (N_EVENTS - 1)];
+        event->begin    = begin;
+        event->cycles   = (uint32_t) min(cycles, (uint64_t) UINT32_MAX);
+        event->stage    = stage;
+
+        n_events.store(n + 1, memory_order_release);
+    }
+
+    // Writes the histograms and the trace events to the file.
+    //
+    // Can be called by any thread. Events which are written while being dumped
+    // could be inconsistent.
+    void dump(FILE *file) const
+    {
+        fprintf(file, "# stage count p50 p90 p99 p99.9 max (cycles)\n");
+
+        for (size_t i = 0; i < N_TRACE_STAGES; i++) {
+            const histogram_t &histogram = histograms[i];
+
+            fprintf(
+                file,
+                "%s %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64 " %" PRIu64
+                " %" PRIu64 "\n",
+                TRACE_STAGE_NAMES[i], histogram.count.get(),
+                histogram.percentile(50), histogram.percentile(90),
+                histogram.percentile(99), histogram.percentile(99.9),
+                histogram.max.get()
+            );
+        }
+
+        fprintf(file, "# begin stage cycles\n");
+
+        uint64_t n     = n_events.load(memory_order_acquire),
+                 first = n > N_EVENTS ? n - N_EVENTS : 0;
+
+        for (uint64_t i = first; i < n; i++) {
+            const trace_event_t &event = events[i & (N_EVENTS - 1)];
+
+            fprintf(
+                file, "%" PRIu64 " %s %" PRIu32 "\n", event.begin,
+                TRACE_STAGE_NAMES[event.stage], event.cycles
+            );
+        }
+    }
+};
+
+// Tracer of the worker which executes the current thread, or 'nullptr'.
+inline tracer_t *&current_tracer(void)
+{
+    static thread_local tracer_t *tracer = nullptr;
+    return tracer;
+}
+
+// Returns the current value of the cycle counter if the tracer of the thread
+// is enabled, or zero.
+inline uint64_t trace_begin(void)
+{
+    tracer_t *tracer = current_tracer();
+
+    if (UNLIKELY(
+        tracer != nullptr && tracer->enabled.load(memory_order_relaxed)
+    ))
+        return get_cycle_count();
+    else
+        return 0;
+}
+
+// Records the execution of the stage which started at 'begin', unless the
+// tracer was disabled when the stage started.
+inline void trace_end(trace_stage_t stage, uint64_t begin)
+{
+    if (UNLIKELY(begin != 0))
+        current_tracer()->record(stage, begin, get_cycle_count());
+}
+
+// Records the stage when the scope is left.
+struct trace_scope_t {
+    trace_stage_t   stage;
+    uint64_t        begin;
+
+    inline trace_scope_t(trace_stage_t _stage)
+        : stage(_stage), begin(trace_begin())
+    {
+    }
+
+    inline ~trace_scope_t(void)
+    {
+        trace_end(stage, begin);
+    }
+};
+
+} } /* namespace rusty::util */
+
+#ifdef USE_TRACING
+    // Declares 'NAME' as the beginning of a stage.
+    #define TRACE_BEGIN(NAME)                                                  \
+        uint64_t NAME = rusty::util::trace_begin()
+
+    // Records the stage which started at 'TRACE_BEGIN(NAME)'.
+    #define TRACE_END(STAGE, NAME)                                             \
+        rusty::util::trace_end(rusty::util::STAGE, NAME)
+
+    // Records the stage from this point to the end of the current scope.
+    #define TRACE_SCOPE(STAGE)                                                 \
+        rusty::util::trace_scope_t _trace_scope(rusty::util::STAGE)
+#else
+    #define TRACE_BEGIN(NAME)
+    #define TRACE_END(STAGE, NAME)
+    #define TRACE_SCOPE(STAGE)
+#endif /* USE_TRACING */
+
+#endif /* __RUSTY_UTILS_TRACE_HPP__ */